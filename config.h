@@ -3,5 +3,6 @@
 
 #define ENABLE_DEBUG
 // #define ENABLE_LOGGING
+// #define ENABLE_STATS
 
 #endif
@@ -0,0 +1,113 @@
+#ifndef MATH_EXPR_ASYNC_H
+#define MATH_EXPR_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math_expr/compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file async.h
+ * Evaluation jobs submitted without waiting for them to run.
+ *
+ * A queue owns a set of worker threads. math_expr_async_submit copies a job
+ * into a lock-free ring and returns at once; a worker evaluates it and then
+ * either calls the job's callback on the worker thread or posts a completion
+ * that the submitter collects with math_expr_async_poll. The completion file
+ * descriptor becomes readable whenever completions are waiting, so an event
+ * loop can watch it with poll, epoll or select next to its sockets.
+ *
+ * A queue holds at most its capacity of jobs between submission and the
+ * delivery of their completion; beyond that math_expr_async_submit fails
+ * instead of blocking. Jobs may run in any order and on any worker. Without
+ * thread support the library evaluates each job inside
+ * math_expr_async_submit.
+ */
+
+typedef struct math_expr_async_queue math_expr_async_queue;
+
+typedef struct math_expr_async_completion {
+    uint64_t id;      /**< Identifier math_expr_async_submit returned for the job. */
+    int status;       /**< 0 on success, non-zero if the job or any of its rows failed. */
+    void *user_data;  /**< The job's user_data. */
+} math_expr_async_completion;
+
+/** Called on a worker thread once a job has been evaluated. */
+typedef void (*math_expr_async_callback)(const math_expr_async_completion *completion);
+
+/**
+ * One evaluation. Everything the job points to must stay valid, and the
+ * program unchanged, until its completion is delivered.
+ */
+typedef struct math_expr_async_job {
+    const math_expr_program *program;   /**< Program evaluated over rows, or NULL to evaluate expression. */
+    const double *const *columns;       /**< One array of rows values per symbol slot of program. */
+    size_t rows;                        /**< Rows to evaluate with program. */
+    const char *expression;             /**< Source evaluated with math_expr_evaluate when program is NULL. */
+    double *results;                    /**< One result per row, or one for an expression. */
+    math_expr_async_callback callback;  /**< Called when done; NULL posts a completion to the queue instead. */
+    void *user_data;                    /**< Returned in the completion. */
+} math_expr_async_job;
+
+/**
+ * Create a queue and start its workers.
+ *
+ * @param worker_count Worker threads; zero selects the number of online processors.
+ * @param capacity Jobs in flight at most; rounded up to a power of two, zero selects 1024.
+ * @return New queue or NULL on failure.
+ */
+math_expr_async_queue *math_expr_async_create(size_t worker_count, size_t capacity);
+
+/**
+ * Run every submitted job, stop the workers and free the queue. Completions
+ * not collected by then are discarded. No thread may submit concurrently.
+ */
+void math_expr_async_destroy(math_expr_async_queue *queue);
+
+/**
+ * Submit a job without waiting for it. Safe to call from many threads at once.
+ *
+ * @param queue Queue.
+ * @param job Job to copy into the queue.
+ * @param out_id Optional output pointer that receives the job's identifier.
+ * @return 0 on success, non-zero if the job is invalid or the queue is full.
+ */
+int math_expr_async_submit(math_expr_async_queue *queue, const math_expr_async_job *job, uint64_t *out_id);
+
+/**
+ * Set the byte budget of each expression job, counted as for a call to
+ * math_expr_evaluate (see memory.h); 0 removes it. A job that would exceed
+ * it fails with a non-zero status. A worker keeps its token buffers between
+ * jobs, and their growth is charged to the job that grows them. Program
+ * jobs are not budgeted. Jobs that start after the call use the new limit.
+ */
+void math_expr_async_set_memory_limit(math_expr_async_queue *queue, size_t bytes);
+
+/**
+ * File descriptor that is readable while completions are waiting. It is an
+ * eventfd on Linux and the read end of a pipe elsewhere; the queue owns it
+ * and math_expr_async_poll resets it.
+ */
+int math_expr_async_completion_fd(const math_expr_async_queue *queue);
+
+/**
+ * Collect waiting completions without blocking. Call from one thread at a time.
+ *
+ * @param queue Queue.
+ * @param out_completions Array receiving up to max_count completions.
+ * @param max_count Size of out_completions.
+ * @return Number of completions stored.
+ */
+size_t math_expr_async_poll(math_expr_async_queue *queue,
+                            math_expr_async_completion *out_completions,
+                            size_t max_count);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_ASYNC_H
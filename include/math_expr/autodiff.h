@@ -0,0 +1,88 @@
+#ifndef MATH_EXPR_AUTODIFF_H
+#define MATH_EXPR_AUTODIFF_H
+
+#include <stddef.h>
+
+#include "math_expr/compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file autodiff.h
+ * Gradients of compiled programs with respect to their variables.
+ *
+ * Both modes return the value and the full gradient in one pass over the
+ * bytecode. Forward mode propagates a tangent vector per stack slot and costs
+ * O(instructions * variables); reverse mode records a tape and costs
+ * O(instructions) regardless of the number of variables. Derivatives of the
+ * degree-based trigonometric builtins include the pi/180 factor, and at
+ * points where a builtin is not differentiable (abs at 0, min/max on ties,
+ * % at discontinuities) the derivative of the selected branch is used. The
+ * min and max aggregates pass the derivative of the value they select.
+ * Likewise a conditional contributes the derivative of the branch it takes,
+ * and comparisons and logical operators have zero derivative.
+ */
+
+/**
+ * Reusable storage for reverse-mode evaluation of one program.
+ */
+typedef struct math_expr_tape {
+    double *values;    /**< Result of each instruction. */
+    double *adjoints;  /**< Adjoint of each instruction's result. */
+    double *partials;  /**< Local partial derivatives, two per instruction. */
+    size_t *operands;  /**< Operand instruction indices, two per instruction. */
+    size_t *spill;     /**< Operand instruction indices of aggregate reductions. */
+    size_t *stack;
+    size_t capacity;
+    size_t stack_capacity;
+} math_expr_tape;
+
+/**
+ * Forward-mode gradient.
+ *
+ * @param program Compiled program.
+ * @param variables One value per symbol slot.
+ * @param out_value Output pointer that receives the value on success.
+ * @param out_gradient Array of symbol_count partial derivatives, indexed by slot.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_gradient_forward(const math_expr_program *program,
+                                       const double *variables,
+                                       double *out_value,
+                                       double *out_gradient);
+
+void math_expr_tape_init(math_expr_tape *tape);
+void math_expr_tape_deinit(math_expr_tape *tape);
+
+/**
+ * Size a tape for a program so later reverse-mode calls do not allocate.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_tape_reserve(math_expr_tape *tape, const math_expr_program *program);
+
+/**
+ * Reverse-mode gradient.
+ *
+ * The tape grows on first use if it was not reserved for the program.
+ *
+ * @param program Compiled program.
+ * @param tape Tape reused across calls.
+ * @param variables One value per symbol slot.
+ * @param out_value Output pointer that receives the value on success.
+ * @param out_gradient Array of symbol_count partial derivatives, indexed by slot.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_gradient_reverse(const math_expr_program *program,
+                                       math_expr_tape *tape,
+                                       const double *variables,
+                                       double *out_value,
+                                       double *out_gradient);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_AUTODIFF_H
@@ -0,0 +1,85 @@
+#ifndef MATH_EXPR_BATCH_H
+#define MATH_EXPR_BATCH_H
+
+#include <stddef.h>
+
+#include "math_expr/compiler.h"
+#include "math_expr/interval.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file batch.h
+ * Column-oriented evaluation of one program over many rows.
+ *
+ * Rows are processed in fixed-size blocks, one instruction at a time across
+ * the whole block, so arithmetic runs in tight loops the compiler can
+ * vectorise. Every row's result is bit-for-bit identical to
+ * math_expr_program_evaluate on the same inputs, including programs whose
+ * precision is MATH_EXPR_PRECISION_F32.
+ */
+
+/**
+ * Evaluate a program for every row.
+ *
+ * @param program Compiled program.
+ * @param columns One array of row_count values per symbol slot.
+ * @param row_count Number of rows.
+ * @param out_results Array of row_count results.
+ * @return 0 on success, non-zero if any row fails (for example division by zero).
+ */
+int math_expr_program_evaluate_batch(const math_expr_program *program,
+                                     const double *const *columns,
+                                     size_t row_count,
+                                     double *out_results);
+
+/**
+ * Evaluate a program for every row in single precision.
+ *
+ * Arithmetic is carried out in float regardless of the program's precision,
+ * and each row matches math_expr_program_evaluate_f32 bit for bit.
+ *
+ * @param program Compiled program.
+ * @param columns One array of row_count values per symbol slot.
+ * @param row_count Number of rows.
+ * @param out_results Array of row_count results.
+ * @return 0 on success, non-zero if any row fails (for example division by zero).
+ */
+int math_expr_program_evaluate_batch_f32(const math_expr_program *program,
+                                         const float *const *columns,
+                                         size_t row_count,
+                                         float *out_results);
+
+/**
+ * Evaluate a program for every row, skipping blocks that cannot produce a
+ * value inside keep.
+ *
+ * For each block of block_rows rows, the range of every column is computed
+ * and the program is evaluated over intervals first. Blocks whose enclosure
+ * does not intersect keep are not evaluated and their results are set to
+ * NaN; every row whose value lies in keep is computed exactly.
+ *
+ * @param program Compiled program.
+ * @param columns One array of row_count values per symbol slot.
+ * @param row_count Number of rows.
+ * @param block_rows Rows per pruning block; zero selects a default.
+ * @param keep Range of results the caller is interested in.
+ * @param out_results Array of row_count results.
+ * @param out_skipped_blocks Optional output pointer that receives the number of skipped blocks.
+ * @return 0 on success, non-zero if an evaluated row fails.
+ */
+int math_expr_program_evaluate_batch_pruned(const math_expr_program *program,
+                                            const double *const *columns,
+                                            size_t row_count,
+                                            size_t block_rows,
+                                            math_expr_interval keep,
+                                            double *out_results,
+                                            size_t *out_skipped_blocks);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_BATCH_H
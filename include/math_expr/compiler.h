@@ -0,0 +1,236 @@
+#ifndef MATH_EXPR_COMPILER_H
+#define MATH_EXPR_COMPILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math_expr/lexer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file compiler.h
+ * Compilation of expressions into a compact stack-machine program that can be
+ * evaluated repeatedly without re-lexing or re-parsing.
+ *
+ * Identifiers that are neither builtin functions nor named constants become
+ * variables. Each distinct variable name is assigned a slot in the program's
+ * symbol table; callers supply one value per slot at evaluation time.
+ *
+ * if(), && and || compile to forward jumps, so an evaluation only executes
+ * the branch it takes. A value is true when it is non-zero; NaN is true.
+ *
+ * The aggregates sum, avg, min and max accept one or more arguments, each a
+ * scalar expression, an array literal such as [1, x, 2 * y] or an array
+ * registered in a context, and reduce all their values with one instruction.
+ * min and max with exactly two scalar arguments remain ordinary builtins.
+ */
+
+typedef enum math_expr_opcode {
+    MATH_EXPR_OP_CONST, /**< Push constants[operand]. */
+    MATH_EXPR_OP_LOAD,  /**< Push variables[operand]. */
+    MATH_EXPR_OP_NEG,
+    MATH_EXPR_OP_ADD,
+    MATH_EXPR_OP_SUB,
+    MATH_EXPR_OP_MUL,
+    MATH_EXPR_OP_DIV,
+    MATH_EXPR_OP_MOD,
+    MATH_EXPR_OP_POW,
+    MATH_EXPR_OP_CALL,  /**< Call builtin function number operand. */
+    MATH_EXPR_OP_CALL_EXTERNAL, /**< Call functions[operand]. */
+    MATH_EXPR_OP_LT,    /**< Comparisons push 1 if they hold and 0 otherwise. */
+    MATH_EXPR_OP_LE,
+    MATH_EXPR_OP_GT,
+    MATH_EXPR_OP_GE,
+    MATH_EXPR_OP_EQ,
+    MATH_EXPR_OP_NE,
+    MATH_EXPR_OP_NOT,   /**< Push 1 if the value is zero, 0 otherwise. */
+    MATH_EXPR_OP_BOOL,  /**< Push 0 if the value is zero, 1 otherwise. */
+    MATH_EXPR_OP_JUMP,  /**< Continue at code[operand]. */
+    MATH_EXPR_OP_JUMP_IF_FALSE, /**< Pop a value; continue at code[operand] if it is zero. */
+    MATH_EXPR_OP_REDUCE, /**< Pop operand >> 2 values, push their math_expr_aggregate operand & 3. */
+    /**
+     * Superinstructions. The compiler never emits them; math_expr_hot_program
+     * does, and only math_expr_program_evaluate runs them.
+     */
+    MATH_EXPR_OP_MUL_ADD, /**< Pop b, a and c; push c + a * b with the product rounded first. */
+    MATH_EXPR_OP_SQUARE   /**< Replace the value x with x * x. */
+} math_expr_opcode;
+
+/**
+ * Reductions performed by MATH_EXPR_OP_REDUCE.
+ *
+ * sum adds four interleaved partial sums once there are four or more values,
+ * so it may differ in the last bits from the same values written with +.
+ * avg is the sum divided by the count. Like the two-argument builtins, min
+ * and max return NaN only when the last value is NaN.
+ */
+typedef enum math_expr_aggregate {
+    MATH_EXPR_AGGREGATE_SUM,
+    MATH_EXPR_AGGREGATE_AVG,
+    MATH_EXPR_AGGREGATE_MIN,
+    MATH_EXPR_AGGREGATE_MAX
+} math_expr_aggregate;
+
+/** Largest number of values one MATH_EXPR_OP_REDUCE can combine. */
+#define MATH_EXPR_REDUCE_MAX_COUNT (UINT32_MAX >> 2)
+
+typedef struct math_expr_instruction {
+    uint32_t opcode;
+    uint32_t operand;
+} math_expr_instruction;
+
+/**
+ * Arithmetic precision used when evaluating a program.
+ *
+ * In MATH_EXPR_PRECISION_F32 every operation is carried out in IEEE single
+ * precision. Each arithmetic operator and sqrt is correctly rounded (relative
+ * error at most 2^-24, about 6e-8, per operation). With a C library such as
+ * glibc, exp, ln, log and pow are within 1 ulp of the float result, though
+ * pow's error relative to the exact value grows with |y * ln(x)|. The
+ * degree-based sin, cos and tan reduce the argument exactly in degrees and
+ * scale only the remainder, at most 45 degrees, by pi/180 in single
+ * precision, which adds a relative error of about 1e-7 in the angle before
+ * the 1 ulp library error; tan loses further accuracy near its poles.
+ * abs, min, max and % are exact.
+ */
+typedef enum math_expr_precision {
+    MATH_EXPR_PRECISION_F64,
+    MATH_EXPR_PRECISION_F32
+} math_expr_precision;
+
+/** Largest arity of a function registered in a math_expr_context. */
+#define MATH_EXPR_FUNCTION_MAX_ARITY 8U
+
+/**
+ * Function supplied by the application.
+ *
+ * @param user_data Pointer given at registration.
+ * @param args The function's arguments.
+ * @param out_result Output pointer that receives the result.
+ * @return 0 on success, non-zero to fail the evaluation.
+ */
+typedef int (*math_expr_function)(void *user_data, const double *args, double *out_result);
+
+/**
+ * Registered function bound into a program when it was compiled.
+ */
+typedef struct math_expr_program_function {
+    math_expr_function func;
+    void *user_data;
+    size_t arity;
+} math_expr_program_function;
+
+/**
+ * Program flag: code, constants and symbol strings point into memory owned by
+ * the caller (for example a mapped image) and are not freed by
+ * math_expr_program_deinit.
+ */
+#define MATH_EXPR_PROGRAM_BORROWED 0x1U
+
+typedef struct math_expr_program {
+    math_expr_instruction *code;
+    size_t code_size;
+    size_t code_capacity;
+    double *constants;
+    size_t constant_count;
+    size_t constant_capacity;
+    char **symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+    math_expr_program_function *functions;
+    size_t function_count;
+    size_t function_capacity;
+    size_t max_stack;
+    unsigned int flags;
+    math_expr_precision precision;
+} math_expr_program;
+
+void math_expr_program_init(math_expr_program *program);
+void math_expr_program_deinit(math_expr_program *program);
+
+/**
+ * Compile the given expression string.
+ *
+ * @param expression Null-terminated UTF-8 expression string.
+ * @param out_program Initialised program that receives the compiled code.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_compile(const char *expression, math_expr_program *out_program);
+
+/**
+ * Compile a pre-tokenised expression.
+ *
+ * @param tokens Token array produced by the lexer.
+ * @param out_program Initialised program that receives the compiled code.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_compile_tokens(const math_expr_token_array *tokens, math_expr_program *out_program);
+
+/**
+ * Compile an expression lexed into the packed token layout.
+ *
+ * @param tokens Packed token array produced by math_expr_lex_packed.
+ * @param out_program Initialised program that receives the compiled code.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_compile_packed(const math_expr_packed_token_array *tokens, math_expr_program *out_program);
+
+/**
+ * Look up the slot assigned to a variable.
+ *
+ * @param program Compiled program.
+ * @param name Variable name (case-sensitive).
+ * @param out_slot Output pointer that receives the slot index on success.
+ * @return 0 on success, non-zero if the program does not reference the name.
+ */
+int math_expr_program_find_symbol(const math_expr_program *program, const char *name, size_t *out_slot);
+
+/**
+ * Check that every instruction is well formed, that jumps go forward and
+ * reach every branch join with the same stack depth, and that the depth
+ * never exceeds max_stack. Programs from untrusted sources must pass this
+ * check before evaluation.
+ *
+ * @param program Program to check.
+ * @return 0 if the program is valid, non-zero otherwise.
+ */
+int math_expr_program_validate(const math_expr_program *program);
+
+/**
+ * Evaluate a compiled program.
+ *
+ * Results are bit-for-bit identical to math_expr_evaluate for the same input.
+ *
+ * @param program Compiled program.
+ * @param variables One value per symbol slot; may be NULL if the program has no symbols.
+ * @param out_result Output pointer that receives the computed value on success.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_evaluate(const math_expr_program *program, const double *variables, double *out_result);
+
+/**
+ * Select the precision math_expr_program_evaluate uses for this program.
+ * Programs default to MATH_EXPR_PRECISION_F64.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_set_precision(math_expr_program *program, math_expr_precision precision);
+
+/**
+ * Evaluate a compiled program in single precision.
+ *
+ * @param program Compiled program.
+ * @param variables One value per symbol slot; may be NULL if the program has no symbols.
+ * @param out_result Output pointer that receives the computed value on success.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_evaluate_f32(const math_expr_program *program, const float *variables, float *out_result);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_COMPILER_H
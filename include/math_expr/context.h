@@ -0,0 +1,120 @@
+#ifndef MATH_EXPR_CONTEXT_H
+#define MATH_EXPR_CONTEXT_H
+
+#include <stddef.h>
+
+#include "math_expr/compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file context.h
+ * Evaluation contexts holding application-registered functions, constants
+ * and arrays.
+ *
+ * A context may be shared by any number of evaluating threads while other
+ * threads register or remove entries. Each evaluation works on an immutable
+ * snapshot of the registry taken when it starts, and lookups never lock.
+ * Updates copy the registry, publish the copy atomically, and free the old
+ * snapshot once no evaluation is still using it. Updates are meant to be rare.
+ *
+ * Registered names follow identifier rules, are matched case-insensitively
+ * like builtins, and may not shadow a builtin function or constant.
+ */
+
+typedef struct math_expr_context math_expr_context;
+
+math_expr_context *math_expr_context_create(void);
+
+/**
+ * Destroy a context. No evaluation or update may be using it.
+ */
+void math_expr_context_destroy(math_expr_context *context);
+
+/**
+ * Register a named constant, or change the value of an existing one.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_context_set_constant(math_expr_context *context, const char *name, double value);
+
+/**
+ * Register a function, or replace an existing function of the same name.
+ *
+ * @param context Context to modify.
+ * @param name Function name.
+ * @param arity Number of arguments, at most MATH_EXPR_FUNCTION_MAX_ARITY.
+ * @param func Implementation; called concurrently if the context is shared.
+ * @param user_data Pointer passed to every call.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_context_set_function(math_expr_context *context,
+                                   const char *name,
+                                   size_t arity,
+                                   math_expr_function func,
+                                   void *user_data);
+
+/**
+ * Register an array, or replace an existing array of the same name.
+ *
+ * An array name can be passed on its own as an argument of sum, avg, min and
+ * max, which then reduce over its elements: "avg(samples) + max(samples, 0)".
+ *
+ * @param context Context to modify.
+ * @param name Array name.
+ * @param values Elements; they are copied.
+ * @param count Number of elements, at least one.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_context_set_array(math_expr_context *context, const char *name, const double *values, size_t count);
+
+/**
+ * Remove the constant, the function and the array registered under a name.
+ *
+ * @return 0 if anything was removed, non-zero otherwise.
+ */
+int math_expr_context_remove(math_expr_context *context, const char *name);
+
+/**
+ * Evaluate an expression that may use the context's functions, constants and arrays.
+ *
+ * @param context Context to read; may be NULL to use builtins only.
+ * @param expression Null-terminated expression string.
+ * @param out_result Output pointer that receives the computed value on success.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_evaluate_with_context(math_expr_context *context, const char *expression, double *out_result);
+
+/**
+ * Set the byte budget of each evaluation through the context; 0 removes it.
+ * Evaluations use the tighter of this and the calling thread's limit (see
+ * memory.h) and fail cleanly when lexing or evaluating would exceed it.
+ */
+void math_expr_context_set_memory_limit(math_expr_context *context, size_t bytes);
+
+/**
+ * Largest peak of the evaluations through the context so far, in bytes.
+ */
+size_t math_expr_context_memory_peak(const math_expr_context *context);
+
+/**
+ * Compile an expression that may use the context's functions, constants and arrays.
+ *
+ * Registered constants and array elements are folded into the program and
+ * registered functions are bound by pointer, so later changes to the
+ * context do not affect it.
+ *
+ * @param context Context to read; may be NULL to use builtins only.
+ * @param expression Null-terminated expression string.
+ * @param out_program Program that receives the compiled code.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_compile_with_context(math_expr_context *context, const char *expression, math_expr_program *out_program);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_CONTEXT_H
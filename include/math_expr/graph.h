@@ -0,0 +1,80 @@
+#ifndef MATH_EXPR_GRAPH_H
+#define MATH_EXPR_GRAPH_H
+
+#include <stddef.h>
+
+#include "math_expr/thread_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file graph.h
+ * Recalculation engine for sets of named, interdependent formulas.
+ *
+ * Each formula is compiled once. Identifiers referenced by a formula become
+ * edges to the nodes of the same name, which are either other formulas or
+ * input values. Changing an input only marks its downstream formulas dirty,
+ * and math_expr_graph_recalculate re-evaluates just those nodes in
+ * topological order.
+ */
+
+typedef struct math_expr_graph math_expr_graph;
+
+math_expr_graph *math_expr_graph_create(void);
+void math_expr_graph_destroy(math_expr_graph *graph);
+
+/**
+ * Define or replace a formula node.
+ *
+ * @param graph Graph to modify.
+ * @param name Node name referenced by other formulas.
+ * @param expression Formula source.
+ * @return 0 on success, non-zero if the formula fails to compile or memory
+ *         runs out; the node then keeps its previous definition.
+ */
+int math_expr_graph_set_formula(math_expr_graph *graph, const char *name, const char *expression);
+
+/**
+ * Set an input value, replacing any formula previously bound to the name.
+ *
+ * @param graph Graph to modify.
+ * @param name Node name.
+ * @param value New value.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_graph_set_value(math_expr_graph *graph, const char *name, double value);
+
+/**
+ * Re-evaluate every dirty formula.
+ *
+ * Independent formulas on the same topological level are spread across the
+ * pool when one is given.
+ *
+ * @param graph Graph to recalculate.
+ * @param pool Optional worker pool; NULL evaluates on the calling thread.
+ * @return 0 on success, non-zero if the graph has a cycle or a formula failed.
+ */
+int math_expr_graph_recalculate(math_expr_graph *graph, math_expr_thread_pool *pool);
+
+/**
+ * Read the current value of a node.
+ *
+ * @param graph Graph to query.
+ * @param name Node name.
+ * @param out_value Output pointer that receives the value on success.
+ * @return 0 on success, non-zero if the node is unknown, dirty or failed.
+ */
+int math_expr_graph_get_value(const math_expr_graph *graph, const char *name, double *out_value);
+
+/**
+ * Number of formulas evaluated by the last call to math_expr_graph_recalculate.
+ */
+size_t math_expr_graph_last_evaluated(const math_expr_graph *graph);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_GRAPH_H
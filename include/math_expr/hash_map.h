@@ -0,0 +1,117 @@
+#ifndef MATH_EXPR_HASH_MAP_H
+#define MATH_EXPR_HASH_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file hash_map.h
+ * Open-addressing hash map with Robin Hood probing.
+ *
+ * A map holds either string keys or 64-bit integer keys, chosen when it is
+ * initialised, and an inline eight-byte value per key. String keys are
+ * copied into one arena owned by the map, so inserting a key performs no
+ * allocation of its own. The table doubles when it is 80% full; lookups
+ * stop as soon as they reach a slot closer to its home than the key would
+ * be, so misses are as cheap as hits. Removal shifts the following run back
+ * instead of leaving tombstones.
+ *
+ * Value pointers returned by the map stay valid until the next insert,
+ * remove, clear or deinit on the same map. A map is not thread-safe.
+ */
+
+/** Map flag: keys are uint64_t values instead of strings. */
+#define MATH_EXPR_MAP_INTEGER_KEYS 0x1U
+/** Map flag: string keys compare and hash ignoring ASCII case. */
+#define MATH_EXPR_MAP_IGNORE_CASE 0x2U
+
+typedef union math_expr_map_value {
+    double number;
+    uint64_t integer;
+    size_t index;
+    void *pointer;
+} math_expr_map_value;
+
+typedef struct math_expr_map_slot {
+    uint64_t hash;
+    uint64_t key;              /**< Integer key, or offset of the string key in the key arena. */
+    size_t length;             /**< String key length in bytes. */
+    math_expr_map_value value;
+    size_t distance;           /**< 1 + distance from the home slot; 0 marks an empty slot. */
+} math_expr_map_slot;
+
+/** Fields are private; use the functions below. */
+typedef struct math_expr_map {
+    math_expr_map_slot *slots;
+    size_t capacity;
+    size_t count;
+    char *keys;
+    size_t keys_size;
+    size_t keys_capacity;
+    size_t keys_garbage;
+    unsigned int flags;
+} math_expr_map;
+
+/**
+ * Initialise an empty map. No memory is allocated until the first insert.
+ *
+ * @param map Map to initialise.
+ * @param flags Bitwise OR of MATH_EXPR_MAP_* flags.
+ */
+void math_expr_map_init(math_expr_map *map, unsigned int flags);
+void math_expr_map_deinit(math_expr_map *map);
+
+/** Remove every key, keeping the allocated storage. */
+void math_expr_map_clear(math_expr_map *map);
+
+/**
+ * Make room for count keys without further growth.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_map_reserve(math_expr_map *map, size_t count);
+
+size_t math_expr_map_size(const math_expr_map *map);
+
+/**
+ * Look up a string key.
+ *
+ * @param map Map with string keys.
+ * @param key Key bytes; need not be null-terminated.
+ * @param length Key length in bytes.
+ * @return Pointer to the value, or NULL if the key is absent.
+ */
+math_expr_map_value *math_expr_map_find(const math_expr_map *map, const char *key, size_t length);
+
+/**
+ * Insert a string key, or find it if it is already present.
+ *
+ * @param map Map with string keys.
+ * @param key Key bytes; copied into the map.
+ * @param length Key length in bytes.
+ * @param out_inserted Optional; set to 1 if the key was added, 0 if it existed.
+ * @return Pointer to the value, zeroed for a new key, or NULL on allocation failure.
+ */
+math_expr_map_value *math_expr_map_insert(math_expr_map *map, const char *key, size_t length, int *out_inserted);
+
+/**
+ * Remove a string key.
+ *
+ * @return 0 if the key was removed, non-zero if it was absent.
+ */
+int math_expr_map_remove(math_expr_map *map, const char *key, size_t length);
+
+/** Integer-key counterparts of math_expr_map_find, _insert and _remove. */
+math_expr_map_value *math_expr_map_find_int(const math_expr_map *map, uint64_t key);
+math_expr_map_value *math_expr_map_insert_int(math_expr_map *map, uint64_t key, int *out_inserted);
+int math_expr_map_remove_int(math_expr_map *map, uint64_t key);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_HASH_MAP_H
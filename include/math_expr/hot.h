@@ -0,0 +1,99 @@
+#ifndef MATH_EXPR_HOT_H
+#define MATH_EXPR_HOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "math_expr/compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file hot.h
+ * Programs that re-optimise themselves once they are evaluated often.
+ *
+ * A hot program wraps a copy of a compiled program and counts its
+ * evaluations. Until the count reaches the threshold it also records, for
+ * every variable slot, whether all evaluations passed the same value. At the
+ * threshold the program is queued for a background thread shared by all hot
+ * programs (or, without thread support, the evaluating thread) which builds
+ * two new versions of the code:
+ *
+ * - a generic version where a multiplication followed by an addition becomes
+ *   one MATH_EXPR_OP_MUL_ADD and x * x becomes MATH_EXPR_OP_SQUARE;
+ * - a specialised version where the slots that stayed constant are replaced
+ *   by their values, constant subexpressions are folded, branches with a
+ *   constant condition are resolved, and the result is fused the same way.
+ *
+ * The new versions are published atomically. Evaluations already running
+ * finish on the code they started with, and the old code is freed once no
+ * evaluation uses it. An evaluation runs the specialised version only when
+ * every specialised slot holds exactly the recorded value (compared bit for
+ * bit) and the generic version otherwise, so results are always bit-for-bit
+ * identical to math_expr_program_evaluate on the original program.
+ */
+
+/** Default number of evaluations before a hot program is optimised. */
+#define MATH_EXPR_HOT_DEFAULT_THRESHOLD 1000U
+
+typedef struct math_expr_hot_program math_expr_hot_program;
+
+typedef struct math_expr_hot_stats {
+    uint64_t evaluations;       /**< Calls to math_expr_hot_program_evaluate. */
+    uint64_t specialized_runs;  /**< Evaluations that ran the specialised version. */
+    uint64_t guard_misses;      /**< Evaluations whose inputs did not match the specialisation. */
+    size_t generation;          /**< Number of optimised versions published so far. */
+    size_t specialized_slots;   /**< Variable slots the specialised version assumes. */
+    size_t original_size;       /**< Instructions in the original program. */
+    size_t generic_size;        /**< Instructions in the current generic version. */
+    size_t specialized_size;    /**< Instructions in the specialised version; 0 if there is none. */
+} math_expr_hot_stats;
+
+/**
+ * Wrap a program.
+ *
+ * @param program Valid compiled program; it is copied, so it may be freed afterwards.
+ * @param threshold Evaluations before optimising; zero selects MATH_EXPR_HOT_DEFAULT_THRESHOLD.
+ * @return New hot program or NULL on failure.
+ */
+math_expr_hot_program *math_expr_hot_program_create(const math_expr_program *program, size_t threshold);
+
+/**
+ * Destroy a hot program. A queued background optimisation is cancelled and
+ * one already running is waited for. No evaluation may be using it.
+ */
+void math_expr_hot_program_destroy(math_expr_hot_program *hot);
+
+/**
+ * Evaluate the current version. Safe to call from many threads at once.
+ *
+ * @param hot Hot program.
+ * @param variables One value per symbol slot of the original program; may be NULL if it has none.
+ * @param out_result Output pointer that receives the computed value on success.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_hot_program_evaluate(math_expr_hot_program *hot, const double *variables, double *out_result);
+
+/**
+ * Optimise now from the profile recorded so far, unless that has already
+ * happened. Returns once an optimised version is active, waiting for a
+ * background optimisation in progress.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_hot_program_optimize(math_expr_hot_program *hot);
+
+/**
+ * Read the counters of a hot program.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_hot_program_get_stats(math_expr_hot_program *hot, math_expr_hot_stats *out_stats);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_HOT_H
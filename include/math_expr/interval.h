@@ -0,0 +1,44 @@
+#ifndef MATH_EXPR_INTERVAL_H
+#define MATH_EXPR_INTERVAL_H
+
+#include "math_expr/compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file interval.h
+ * Range analysis of compiled programs.
+ *
+ * Interval evaluation runs a program over closed ranges instead of numbers
+ * and returns an enclosure of every non-NaN result the program can produce
+ * when each variable lies in its range. Endpoints are rounded outwards, so
+ * the enclosure is conservative. Inputs for which the scalar evaluator would
+ * fail (division by zero, logarithm of a negative number, ...) contribute
+ * nothing; an empty result (lo > hi) means no input in range yields a number.
+ * A conditional whose condition can go either way encloses both branches.
+ */
+
+typedef struct math_expr_interval {
+    double lo;
+    double hi;
+} math_expr_interval;
+
+/**
+ * Evaluate a program over variable ranges.
+ *
+ * @param program Compiled program.
+ * @param variables One range per symbol slot; may be NULL if the program has no symbols.
+ * @param out_result Output pointer that receives the enclosure on success.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_evaluate_interval(const math_expr_program *program,
+                                        const math_expr_interval *variables,
+                                        math_expr_interval *out_result);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_INTERVAL_H
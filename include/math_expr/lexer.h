@@ -2,6 +2,7 @@
 #define MATH_EXPR_LEXER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,19 +26,112 @@ typedef struct math_expr_token {
     double number;
 } math_expr_token;
 
+/**
+ * Tokens with their lexemes. Each lexeme is a null-terminated string stored
+ * in text, which the array owns, so lexemes stay valid until the array is
+ * cleared, lexed into again or deinitialised.
+ */
 typedef struct math_expr_token_array {
     math_expr_token *data;
     size_t size;
     size_t capacity;
+    char *text;
+    size_t text_size;
+    size_t text_capacity;
 } math_expr_token_array;
 
+/**
+ * Compact token layout: eight bytes per token, with number values kept in a
+ * side array and lexemes referenced by offset into the borrowed source
+ * string. The i-th NUMBER token's value is numbers[i].
+ */
+typedef struct math_expr_packed_token {
+    uint32_t offset; /**< Byte offset of the lexeme in the source string. */
+    uint16_t length; /**< Lexeme length in bytes. */
+    uint8_t type;    /**< math_expr_token_type value. */
+    uint8_t op;      /**< Operator character or MATH_EXPR_TOKEN_OP_* code for OPERATOR tokens, 0 otherwise. */
+} math_expr_packed_token;
+
+/**
+ * Op codes of the two-character operators. Single-character operators use
+ * the character itself, so these lie outside the ASCII range.
+ */
+#define MATH_EXPR_TOKEN_OP_LE 0x80U  /**< <= */
+#define MATH_EXPR_TOKEN_OP_GE 0x81U  /**< >= */
+#define MATH_EXPR_TOKEN_OP_EQ 0x82U  /**< == */
+#define MATH_EXPR_TOKEN_OP_NE 0x83U  /**< != */
+#define MATH_EXPR_TOKEN_OP_AND 0x84U /**< && */
+#define MATH_EXPR_TOKEN_OP_OR 0x85U  /**< || */
+
+typedef struct math_expr_packed_token_array {
+    const char *source; /**< Borrowed; must outlive the tokens. */
+    math_expr_packed_token *data;
+    size_t size;
+    size_t capacity;
+    double *numbers;
+    size_t number_count;
+    size_t number_capacity;
+} math_expr_packed_token_array;
+
+/** Lexer flag: do not emit MATH_EXPR_TOKEN_SPACE tokens. */
+#define MATH_EXPR_LEX_SKIP_SPACE 0x1U
+
 void math_expr_token_array_init(math_expr_token_array *array);
 void math_expr_token_array_clear(math_expr_token_array *array);
 void math_expr_token_array_deinit(math_expr_token_array *array);
 
+/**
+ * Make room for at least capacity tokens. Token arrays never shrink before
+ * math_expr_token_array_deinit, so an array lexed into repeatedly, for
+ * example one per worker thread, keeps reusing its largest buffers.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_token_array_reserve(math_expr_token_array *array, size_t capacity);
+
 int math_expr_lex_expression(const char *expression, math_expr_token_array *out_tokens);
+
+/**
+ * Lex an expression with MATH_EXPR_LEX_* flags.
+ *
+ * A quick scan of the expression first bounds its token count and lexeme
+ * text, and the array grows to both in one allocation each before lexing;
+ * buffers that are already large enough are reused as they are. On failure
+ * the array is left empty with its buffers kept.
+ *
+ * @param expression Null-terminated UTF-8 expression string.
+ * @param out_tokens Token array that receives the tokens.
+ * @param flags Bitwise OR of MATH_EXPR_LEX_* flags.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_lex_expression_ex(const char *expression, math_expr_token_array *out_tokens, unsigned int flags);
+
+void math_expr_packed_token_array_init(math_expr_packed_token_array *array);
+void math_expr_packed_token_array_clear(math_expr_packed_token_array *array);
+void math_expr_packed_token_array_deinit(math_expr_packed_token_array *array);
+
+/**
+ * Lex an expression into the packed token layout.
+ *
+ * Lexemes are limited to 65535 bytes and the source to 4 GiB. Buffers are
+ * sized and reused as for math_expr_lex_expression_ex.
+ *
+ * @param expression Null-terminated UTF-8 expression string; must outlive out_tokens.
+ * @param out_tokens Packed token array that receives the tokens.
+ * @param flags Bitwise OR of MATH_EXPR_LEX_* flags.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_lex_packed(const char *expression, math_expr_packed_token_array *out_tokens, unsigned int flags);
 const char *math_expr_token_type_to_string(math_expr_token_type type);
 
+/**
+ * Op code of an operator lexeme, as stored in math_expr_packed_token::op.
+ *
+ * @return The character for one-character operators, a MATH_EXPR_TOKEN_OP_*
+ *         code for two-character operators, 0 for anything else.
+ */
+uint8_t math_expr_operator_code(const char *lexeme, size_t length);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
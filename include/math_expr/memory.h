@@ -0,0 +1,74 @@
+#ifndef MATH_EXPR_MEMORY_H
+#define MATH_EXPR_MEMORY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file memory.h
+ * Memory accounting and byte budgets for lexing and evaluation.
+ *
+ * Every call to a lexer or evaluator entry point counts the heap bytes it
+ * allocates: token buffers, lexemes and argument lists. The count is the
+ * net of allocations and frees since the call began, and its peak is what
+ * the call needed at most. A call that would go over its budget stops,
+ * frees what it built and fails with a "memory limit" message on stderr;
+ * the budget is checked before each allocation, so the peak never exceeds
+ * it.
+ *
+ * The budget of a call is the calling thread's limit, tightened by the
+ * context's limit when evaluating through a context. Calls made inside
+ * another call (the lexing inside math_expr_evaluate) share its budget.
+ *
+ * Only the lexers and the interpreter behind math_expr_evaluate and
+ * math_expr_evaluate_with_context are budgeted. The compiled engine is not:
+ * compiling counts the lexing of its source but not the program it builds,
+ * and evaluating a program allocates outside any budget. That covers the
+ * heap stack of programs deeper than the local one, batch workspaces,
+ * parallel evaluation buffers, intervals and derivative tapes. Their sizes
+ * follow from the program, so bound untrusted input by budgeting its
+ * compilation and checking the program's code_size and max_stack before
+ * evaluating it.
+ */
+
+typedef struct math_expr_memory_usage {
+    size_t peak_bytes;  /**< Most bytes in use at once. */
+    size_t limit_bytes; /**< Budget the call ran with; 0 for none. */
+    int limit_exceeded; /**< Non-zero if the call failed for lack of budget. */
+} math_expr_memory_usage;
+
+/**
+ * Set the byte budget of each lexing or evaluation call made by the calling
+ * thread; 0 removes it. The limit is per thread and starts at 0.
+ */
+void math_expr_memory_set_limit(size_t bytes);
+
+/** Byte budget of the calling thread. */
+size_t math_expr_memory_get_limit(void);
+
+/**
+ * Usage of the last completed outermost lexing or evaluation call on the
+ * calling thread.
+ *
+ * @param out_usage Output pointer; zeroed if the thread has made no call.
+ */
+void math_expr_memory_last_usage(math_expr_memory_usage *out_usage);
+
+/**
+ * Evaluate an expression and report the peak bytes lexing and evaluating it
+ * took, for sizing budgets and worker memory.
+ *
+ * @param expression Null-terminated expression string.
+ * @param out_peak_bytes Output pointer that receives the peak, also when evaluation fails.
+ * @return Status of math_expr_evaluate.
+ */
+int math_expr_memory_peak(const char *expression, size_t *out_peak_bytes);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_MEMORY_H
@@ -0,0 +1,87 @@
+#ifndef MATH_EXPR_PARALLEL_H
+#define MATH_EXPR_PARALLEL_H
+
+#include <stddef.h>
+
+#include "math_expr/compiler.h"
+#include "math_expr/thread_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file parallel.h
+ * Evaluation of one large program across the threads of a pool.
+ *
+ * A plan splits a program into the operands of its outermost chain of + and
+ * - operators, so "t1 + t2 - t3 + ..." becomes the terms t1, t2, t3, ...
+ * Each term is evaluated on its own stack by some worker, and the caller then
+ * adds the term values up one by one from left to right, exactly as the
+ * sequential program does. Results are therefore bit-for-bit identical to
+ * math_expr_program_evaluate, whatever the number of threads.
+ *
+ * Forking work out costs a few microseconds, so programs whose estimated
+ * cost is below the plan's threshold run on the calling thread. The cost is
+ * a weighted instruction count in which a builtin call or ^ weighs as much
+ * as a few dozen additions. Terms may run in any order and concurrently, so
+ * registered functions called by the program must be thread-safe, and when
+ * a term fails other terms may still have been evaluated.
+ */
+
+/** Default plan threshold, in instruction-cost units. */
+#define MATH_EXPR_PARALLEL_DEFAULT_THRESHOLD 20000U
+
+typedef struct math_expr_parallel_term {
+    size_t begin;  /**< First instruction of the term. */
+    size_t end;    /**< One past its last instruction. */
+    size_t cost;   /**< Estimated cost of the term. */
+    int subtract;  /**< Non-zero if the term is subtracted from the running sum. */
+} math_expr_parallel_term;
+
+typedef struct math_expr_parallel_plan {
+    math_expr_parallel_term *terms; /**< Terms in source order. */
+    size_t term_count;
+    size_t cost;       /**< Estimated cost of the whole program. */
+    size_t threshold;  /**< Programs cheaper than this run on the calling thread. */
+    size_t code_size;  /**< Size of the program the plan was built for. */
+} math_expr_parallel_plan;
+
+void math_expr_parallel_plan_init(math_expr_parallel_plan *plan);
+void math_expr_parallel_plan_deinit(math_expr_parallel_plan *plan);
+
+/**
+ * Split a program into terms.
+ *
+ * Programs that are not a sum or difference at the top level get a plan
+ * with a single term and always run on the calling thread.
+ *
+ * @param plan Initialised plan; any previous contents are replaced.
+ * @param program Compiled program; it must pass math_expr_program_validate.
+ * @param threshold Smallest program cost worth spreading over threads; zero
+ *        selects MATH_EXPR_PARALLEL_DEFAULT_THRESHOLD.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_parallel_plan_build(math_expr_parallel_plan *plan, const math_expr_program *program, size_t threshold);
+
+/**
+ * Evaluate a program using the threads of a pool.
+ *
+ * @param program Compiled program the plan was built for.
+ * @param plan Plan for the program; it is only read and can be shared.
+ * @param variables One value per symbol slot; may be NULL if the program has no symbols.
+ * @param pool Pool to run on; NULL evaluates on the calling thread.
+ * @param out_result Output pointer that receives the computed value on success.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_evaluate_parallel(const math_expr_program *program,
+                                        const math_expr_parallel_plan *plan,
+                                        const double *variables,
+                                        math_expr_thread_pool *pool,
+                                        double *out_result);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_PARALLEL_H
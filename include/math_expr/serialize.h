@@ -0,0 +1,112 @@
+#ifndef MATH_EXPR_SERIALIZE_H
+#define MATH_EXPR_SERIALIZE_H
+
+#include <stddef.h>
+
+#include "math_expr/compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file serialize.h
+ * Versioned binary images of compiled programs.
+ *
+ * An image is a 48-byte header followed by the constant pool, the bytecode,
+ * the symbol offset table and the symbol string blob. The header records the
+ * program's precision, so a single-precision program loads as one. All
+ * fields are little-endian and every section is 8-byte aligned, so on
+ * little-endian hosts a loaded program points straight into the image and
+ * only the symbol pointer table is allocated. Images are padded to a multiple of 8 bytes and record
+ * their own size, so several can be concatenated into one file. Programs that
+ * call functions registered in a math_expr_context hold function pointers and
+ * cannot be serialised.
+ */
+
+#define MATH_EXPR_IMAGE_VERSION 3U
+#define MATH_EXPR_IMAGE_HEADER_SIZE 48U
+
+typedef struct math_expr_mapped_file {
+    void *data;
+    size_t size;
+    int mapped;
+} math_expr_mapped_file;
+
+/**
+ * Number of bytes math_expr_program_write_image needs for the program.
+ */
+size_t math_expr_program_image_size(const math_expr_program *program);
+
+/**
+ * Serialise a program into a caller-provided buffer.
+ *
+ * @param program Program to serialise.
+ * @param buffer Destination buffer.
+ * @param buffer_size Size of the destination buffer in bytes.
+ * @param out_size Optional output pointer that receives the image size.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_write_image(const math_expr_program *program,
+                                  void *buffer,
+                                  size_t buffer_size,
+                                  size_t *out_size);
+
+/**
+ * Serialise a program to a file.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_save(const math_expr_program *program, const char *path);
+
+/**
+ * Size of the image starting at the given address, as recorded in its header.
+ *
+ * @return Image size in bytes, or 0 if the bytes do not start a valid image header.
+ */
+size_t math_expr_image_size(const void *image, size_t available);
+
+/**
+ * Load a program from an image.
+ *
+ * The checksum, which covers the header as well as the sections, the
+ * version and every instruction are verified. When the host is
+ * little-endian and the image is 8-byte aligned the program borrows the image
+ * memory, which must then outlive the program.
+ *
+ * @param image Image bytes.
+ * @param size Number of readable bytes at image.
+ * @param out_program Initialised program that receives the result.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_load_image(const void *image, size_t size, math_expr_program *out_program);
+
+/**
+ * Load a program from an image, recompiling from source when the image is
+ * missing, corrupt or written by a different format version.
+ *
+ * @param image Image bytes; may be NULL.
+ * @param size Number of readable bytes at image.
+ * @param source Expression to compile as a fallback.
+ * @param out_program Initialised program that receives the result.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_program_load_or_compile(const void *image,
+                                      size_t size,
+                                      const char *source,
+                                      math_expr_program *out_program);
+
+/**
+ * Map a file read-only into memory, falling back to reading it into a heap
+ * buffer where mmap is unavailable.
+ *
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_map_file(const char *path, math_expr_mapped_file *out_file);
+void math_expr_unmap_file(math_expr_mapped_file *file);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_SERIALIZE_H
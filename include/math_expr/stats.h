@@ -0,0 +1,86 @@
+#ifndef MATH_EXPR_STATS_H
+#define MATH_EXPR_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file stats.h
+ * Per-thread instrumentation counters and phase hooks.
+ *
+ * Counters are only collected when the library is built with ENABLE_STATS
+ * defined, in config.h or through the MATH_EXPR_STATS CMake option.
+ * Otherwise the instrumentation compiles away and the functions below
+ * report failure.
+ */
+
+#define MATH_EXPR_STATS_TOKEN_TYPES 4U
+#define MATH_EXPR_STATS_BUILTIN_SLOTS 32U
+
+typedef enum math_expr_phase {
+    MATH_EXPR_PHASE_LEX,
+    MATH_EXPR_PHASE_PARSE,
+    MATH_EXPR_PHASE_EVAL,
+    MATH_EXPR_PHASE_COUNT
+} math_expr_phase;
+
+typedef struct math_expr_stats {
+    uint64_t phase_calls[MATH_EXPR_PHASE_COUNT];
+    uint64_t phase_ns[MATH_EXPR_PHASE_COUNT];
+    uint64_t allocations;
+    uint64_t bytes_allocated;
+    uint64_t tokens[MATH_EXPR_STATS_TOKEN_TYPES]; /**< Indexed by math_expr_token_type. */
+    uint64_t builtin_calls[MATH_EXPR_STATS_BUILTIN_SLOTS];
+    uint64_t errors;
+} math_expr_stats;
+
+/**
+ * Hook invoked at phase boundaries on the thread running the phase.
+ *
+ * @param user Pointer registered with math_expr_stats_set_hook.
+ * @param phase Phase that starts or ends.
+ * @param end Zero at the start of the phase, non-zero at its end.
+ * @param elapsed_ns Duration of the phase; zero at the start.
+ */
+typedef void (*math_expr_phase_hook)(void *user, math_expr_phase phase, int end, uint64_t elapsed_ns);
+
+/**
+ * Report whether the library was built with statistics support.
+ */
+int math_expr_stats_enabled(void);
+
+/**
+ * Copy the calling thread's counters.
+ *
+ * @param out_stats Output pointer; zeroed when statistics are disabled.
+ * @return 0 on success, non-zero when statistics are disabled.
+ */
+int math_expr_stats_get(math_expr_stats *out_stats);
+
+void math_expr_stats_reset(void);
+
+/**
+ * Name of the builtin counted in builtin_calls[index], or NULL for an unused slot.
+ */
+const char *math_expr_stats_builtin_name(size_t index);
+
+/**
+ * Install a process-wide phase hook; NULL removes it.
+ *
+ * Safe to call while other threads lex or evaluate. The hook and user are
+ * replaced together, so every call receives the user registered with its
+ * hook; a phase already under way may still report to the previous hook.
+ *
+ * @return 0 on success, non-zero when statistics are disabled.
+ */
+int math_expr_stats_set_hook(math_expr_phase_hook hook, void *user);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_STATS_H
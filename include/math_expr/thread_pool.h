@@ -0,0 +1,58 @@
+#ifndef MATH_EXPR_THREAD_POOL_H
+#define MATH_EXPR_THREAD_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file thread_pool.h
+ * Fork-join worker pool used by the parallel evaluation paths.
+ *
+ * When the library is built without thread support the pool runs every task
+ * on the calling thread.
+ */
+
+typedef struct math_expr_thread_pool math_expr_thread_pool;
+
+/**
+ * Task callback invoked once per task index.
+ */
+typedef void (*math_expr_task_fn)(void *context, size_t index);
+
+/**
+ * Create a pool.
+ *
+ * @param thread_count Total number of threads taking part in a run, including
+ *        the caller. Zero selects the number of online processors.
+ * @return New pool or NULL on failure.
+ */
+math_expr_thread_pool *math_expr_thread_pool_create(size_t thread_count);
+void math_expr_thread_pool_destroy(math_expr_thread_pool *pool);
+
+size_t math_expr_thread_pool_size(const math_expr_thread_pool *pool);
+
+/**
+ * Run task_count tasks and wait for all of them to finish.
+ *
+ * The calling thread participates in the run. Concurrent calls on the same
+ * pool are serialised.
+ *
+ * @param pool Pool to run on; NULL runs the tasks on the calling thread.
+ * @param task_count Number of tasks.
+ * @param task Callback invoked with indices [0, task_count).
+ * @param context Opaque pointer forwarded to the callback.
+ * @return 0 on success, non-zero on failure.
+ */
+int math_expr_thread_pool_run(math_expr_thread_pool *pool,
+                              size_t task_count,
+                              math_expr_task_fn task,
+                              void *context);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_THREAD_POOL_H
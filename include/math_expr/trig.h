@@ -0,0 +1,56 @@
+#ifndef MATH_EXPR_TRIG_H
+#define MATH_EXPR_TRIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file trig.h
+ * How the degree-based sin, cos and tan builtins are computed.
+ *
+ * Arguments are reduced in degrees: x = 360 n + 90 q + t with |t| <= 45 is
+ * exact in floating point, so only t is converted to radians and large
+ * arguments lose no accuracy. Multiples of 90 degrees give exactly 0, 1 or
+ * -1, multiples of 30 and 45 degrees the correctly rounded values such as
+ * 0.5 and sqrt(2) / 2, and tan at an odd multiple of 90 degrees is +infinity.
+ *
+ * The mode is global and applies to every engine, which all call the same
+ * functions, so they keep agreeing bit for bit. Set it before compiling and
+ * evaluating; switching while other threads evaluate gives them a mix of
+ * both modes.
+ */
+
+/** Spacing of the sin and cos table, in degrees. */
+#define MATH_EXPR_TRIG_TABLE_STEP 0.25
+
+/** Largest absolute error of sin and cos in MATH_EXPR_TRIG_TABLE mode. */
+#define MATH_EXPR_TRIG_TABLE_MAX_ERROR 1e-12
+
+typedef enum math_expr_trig_mode {
+    /** Reduced argument passed to the C library; the default. */
+    MATH_EXPR_TRIG_LIBM,
+    /**
+     * sin and cos interpolated from a table of quarter degrees, with an
+     * absolute error below MATH_EXPR_TRIG_TABLE_MAX_ERROR; exact on the table
+     * points, which include every integral and half degree. tan is computed
+     * as in MATH_EXPR_TRIG_LIBM.
+     */
+    MATH_EXPR_TRIG_TABLE
+} math_expr_trig_mode;
+
+/**
+ * Select how sin, cos and tan are computed. The table is built on first use.
+ *
+ * @return 0 on success, non-zero for an unknown mode.
+ */
+int math_expr_trig_set_mode(math_expr_trig_mode mode);
+
+/** Current mode. */
+math_expr_trig_mode math_expr_trig_get_mode(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MATH_EXPR_TRIG_H
@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "math_expr/evaluator.h"
 #include "math_expr/lexer.h"
 
+#include "server.h"
+
 static void print_tokens(const math_expr_token_array *tokens)
 {
     for (size_t i = 0; tokens && i < tokens->size; ++i) {
@@ -30,6 +33,14 @@ int main(int argc, char **argv)
 {
     const char *expression = NULL;
 
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        return math_expr_serve_stdio() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc > 1 && strncmp(argv[1], "--serve=", 8) == 0) {
+        return math_expr_serve_socket(argv[1] + 8) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (argc > 1) {
         expression = argv[1];
     } else {
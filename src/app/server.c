@@ -0,0 +1,507 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+
+#include "math_expr/compiler.h"
+#include "math_expr/hash_map.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const size_t kReadChunk = 64U * 1024U;
+static const size_t kWriteChunk = 64U * 1024U;
+static const size_t kMaxLine = 1024U * 1024U;
+static const size_t kMaxCachedExpressions = 65536U;
+static const size_t kInitialBindingCapacity = 64U;
+
+typedef struct cache_entry {
+    math_expr_program program;
+    size_t *bindings; /* Binding index of each symbol slot. */
+    int valid;        /* Zero if the expression failed to compile. */
+} cache_entry;
+
+typedef struct binding {
+    double value;
+    int bound;
+} binding;
+
+typedef struct session {
+    math_expr_map expression_index;
+    cache_entry *expressions;
+    size_t expression_count;
+    math_expr_map binding_index;
+    binding *bindings;
+    size_t binding_count;
+    size_t binding_capacity;
+    double *arguments;
+    size_t argument_capacity;
+    char *output;
+    size_t output_size;
+    int output_fd;
+    int output_failed;
+} session;
+
+static void clear_expressions(session *s)
+{
+    for (size_t i = 0; i < s->expression_count; ++i) {
+        math_expr_program_deinit(&s->expressions[i].program);
+        free(s->expressions[i].bindings);
+    }
+    s->expression_count = 0U;
+    math_expr_map_clear(&s->expression_index);
+}
+
+static void session_deinit(session *s)
+{
+    clear_expressions(s);
+    math_expr_map_deinit(&s->expression_index);
+    math_expr_map_deinit(&s->binding_index);
+    free(s->expressions);
+    free(s->bindings);
+    free(s->arguments);
+    free(s->output);
+}
+
+/* Index of the binding for name, created unbound if it does not exist. */
+static int find_binding(session *s, const char *name, size_t length, size_t *out_index)
+{
+    const math_expr_map_value *found = math_expr_map_find(&s->binding_index, name, length);
+    if (found) {
+        *out_index = found->index;
+        return 0;
+    }
+
+    if (s->binding_count == s->binding_capacity) {
+        size_t capacity = s->binding_capacity == 0U ? kInitialBindingCapacity : s->binding_capacity * 2U;
+        binding *bindings = (binding *)realloc(s->bindings, capacity * sizeof(*bindings));
+        if (!bindings) {
+            perror("math_expr_server: realloc");
+            return -1;
+        }
+        s->bindings = bindings;
+        s->binding_capacity = capacity;
+    }
+
+    math_expr_map_value *slot = math_expr_map_insert(&s->binding_index, name, length, NULL);
+    if (!slot) {
+        return -1;
+    }
+    slot->index = s->binding_count;
+
+    s->bindings[s->binding_count].value = 0.0;
+    s->bindings[s->binding_count].bound = 0;
+    *out_index = s->binding_count++;
+    return 0;
+}
+
+static int compile_entry(session *s, const char *text, size_t length, cache_entry *entry)
+{
+    char *expression = (char *)malloc(length + 1U);
+    if (!expression) {
+        perror("math_expr_server: malloc");
+        return -1;
+    }
+    memcpy(expression, text, length);
+    expression[length] = '\0';
+
+    memset(entry, 0, sizeof(*entry));
+    math_expr_program_init(&entry->program);
+    entry->valid = math_expr_compile(expression, &entry->program) == 0;
+    free(expression);
+
+    if (!entry->valid || entry->program.symbol_count == 0U) {
+        return 0;
+    }
+
+    entry->bindings = (size_t *)malloc(entry->program.symbol_count * sizeof(*entry->bindings));
+    if (!entry->bindings) {
+        perror("math_expr_server: malloc");
+        math_expr_program_deinit(&entry->program);
+        return -1;
+    }
+
+    for (size_t i = 0; i < entry->program.symbol_count; ++i) {
+        const char *name = entry->program.symbols[i];
+        if (find_binding(s, name, strlen(name), &entry->bindings[i]) != 0) {
+            free(entry->bindings);
+            math_expr_program_deinit(&entry->program);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Cached program for an expression, compiled on first use. Failed
+ * compilations are cached too. The cache is emptied when it fills up.
+ */
+static const cache_entry *lookup_expression(session *s, const char *text, size_t length)
+{
+    const math_expr_map_value *found = math_expr_map_find(&s->expression_index, text, length);
+    if (found) {
+        return &s->expressions[found->index];
+    }
+
+    if (s->expression_count == kMaxCachedExpressions) {
+        clear_expressions(s);
+    }
+    if (!s->expressions) {
+        s->expressions = (cache_entry *)malloc(kMaxCachedExpressions * sizeof(*s->expressions));
+        if (!s->expressions) {
+            perror("math_expr_server: malloc");
+            return NULL;
+        }
+    }
+
+    cache_entry *entry = &s->expressions[s->expression_count];
+    if (compile_entry(s, text, length, entry) != 0) {
+        return NULL;
+    }
+    math_expr_map_value *slot = math_expr_map_insert(&s->expression_index, text, length, NULL);
+    if (!slot) {
+        math_expr_program_deinit(&entry->program);
+        free(entry->bindings);
+        return NULL;
+    }
+    slot->index = s->expression_count;
+
+    ++s->expression_count;
+    return entry;
+}
+
+static void flush_output(session *s)
+{
+    size_t written = 0U;
+    while (written < s->output_size && !s->output_failed) {
+        ssize_t result = write(s->output_fd, s->output + written, s->output_size - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            s->output_failed = 1;
+            break;
+        }
+        written += (size_t)result;
+    }
+    s->output_size = 0U;
+}
+
+static void write_output(session *s, const char *text, size_t length)
+{
+    if (s->output_size + length > kWriteChunk) {
+        flush_output(s);
+    }
+    memcpy(s->output + s->output_size, text, length);
+    s->output_size += length;
+}
+
+static void write_error(session *s, const char *message)
+{
+    char line[256];
+    int length = snprintf(line, sizeof(line), "error: %s\n", message);
+    write_output(s, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1U);
+}
+
+static void write_value(session *s, double value)
+{
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%.17g\n", value);
+    write_output(s, line, (size_t)length);
+}
+
+static int evaluate_entry(session *s, const cache_entry *entry, double *out_value)
+{
+    const math_expr_program *program = &entry->program;
+
+    if (program->symbol_count > s->argument_capacity) {
+        double *arguments = (double *)realloc(s->arguments, program->symbol_count * sizeof(*arguments));
+        if (!arguments) {
+            perror("math_expr_server: realloc");
+            write_error(s, "out of memory");
+            return -1;
+        }
+        s->arguments = arguments;
+        s->argument_capacity = program->symbol_count;
+    }
+
+    for (size_t i = 0; i < program->symbol_count; ++i) {
+        const binding *value = &s->bindings[entry->bindings[i]];
+        if (!value->bound) {
+            char message[128];
+            snprintf(message, sizeof(message), "unbound variable '%.64s'", program->symbols[i]);
+            write_error(s, message);
+            return -1;
+        }
+        s->arguments[i] = value->value;
+    }
+
+    if (math_expr_program_evaluate(program, s->arguments, out_value) != 0) {
+        write_error(s, "evaluation failed");
+        return -1;
+    }
+    return 0;
+}
+
+/* Length of "name =" at the start of line (not "=="), or 0 if it is not an assignment. */
+static size_t assignment_target(const char *line, size_t length, size_t *out_name_length)
+{
+    size_t i = 0U;
+    if (length == 0U || !(isalpha((unsigned char)line[0]) || line[0] == '_')) {
+        return 0U;
+    }
+    while (i < length && (isalnum((unsigned char)line[i]) || line[i] == '_')) {
+        ++i;
+    }
+    *out_name_length = i;
+
+    while (i < length && isspace((unsigned char)line[i])) {
+        ++i;
+    }
+    if (i < length && line[i] == '=' && (i + 1U == length || line[i + 1U] != '=')) {
+        return i + 1U;
+    }
+    return 0U;
+}
+
+static void handle_line(session *s, const char *line, size_t length)
+{
+    while (length > 0U && isspace((unsigned char)line[length - 1U])) {
+        --length;
+    }
+    while (length > 0U && isspace((unsigned char)*line)) {
+        ++line;
+        --length;
+    }
+    if (length == 0U) {
+        return;
+    }
+
+    size_t name_length = 0U;
+    size_t prefix = assignment_target(line, length, &name_length);
+    const char *text = line + prefix;
+    size_t text_length = length - prefix;
+    while (text_length > 0U && isspace((unsigned char)*text)) {
+        ++text;
+        --text_length;
+    }
+
+    const cache_entry *entry = lookup_expression(s, text, text_length);
+    if (!entry) {
+        write_error(s, "out of memory");
+        return;
+    }
+    if (!entry->valid) {
+        write_error(s, "invalid expression");
+        return;
+    }
+
+    double value = 0.0;
+    if (evaluate_entry(s, entry, &value) != 0) {
+        return;
+    }
+
+    if (prefix > 0U) {
+        /* Builtin names such as pi compile to constants and cannot be rebound. */
+        const cache_entry *target = lookup_expression(s, line, name_length);
+        if (!target || !target->valid || target->program.symbol_count != 1U) {
+            write_error(s, "cannot assign to a builtin name");
+            return;
+        }
+        binding *variable = &s->bindings[target->bindings[0]];
+        variable->value = value;
+        variable->bound = 1;
+    }
+
+    write_value(s, value);
+}
+
+static int session_init(session *s, int output_fd)
+{
+    memset(s, 0, sizeof(*s));
+    math_expr_map_init(&s->expression_index, 0U);
+    math_expr_map_init(&s->binding_index, 0U);
+    s->output_fd = output_fd;
+    s->output = (char *)malloc(kWriteChunk);
+    if (!s->output) {
+        perror("math_expr_server: malloc");
+        return -1;
+    }
+    return 0;
+}
+
+/* Serve one input stream; the buffer grows only for lines longer than a read chunk. */
+static int serve_fd(session *s, int input_fd, int output_fd)
+{
+    size_t capacity = kReadChunk;
+    size_t size = 0U;
+    int skipping = 0; /* Inside a line that exceeded kMaxLine. */
+    char *buffer = (char *)malloc(capacity);
+    if (!buffer) {
+        perror("math_expr_server: malloc");
+        return -1;
+    }
+
+    s->output_fd = output_fd;
+    s->output_failed = 0;
+
+    for (;;) {
+        if (size == capacity) {
+            if (capacity >= kMaxLine) {
+                if (!skipping) {
+                    write_error(s, "line too long");
+                }
+                skipping = 1;
+                size = 0U;
+            } else {
+                char *grown = (char *)realloc(buffer, capacity * 2U);
+                if (!grown) {
+                    perror("math_expr_server: realloc");
+                    free(buffer);
+                    return -1;
+                }
+                buffer = grown;
+                capacity *= 2U;
+            }
+        }
+
+        ssize_t result = read(input_fd, buffer + size, capacity - size);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            perror("math_expr_server: read");
+            break;
+        }
+        if (result == 0) {
+            if (size > 0U && !skipping) {
+                handle_line(s, buffer, size);
+            }
+            break;
+        }
+
+        size_t end = size + (size_t)result;
+        size_t start = 0U;
+        for (size_t i = size; i < end; ++i) {
+            if (buffer[i] != '\n') {
+                continue;
+            }
+            if (!skipping) {
+                handle_line(s, buffer + start, i - start);
+            }
+            skipping = 0;
+            start = i + 1U;
+        }
+
+        memmove(buffer, buffer + start, end - start);
+        size = end - start;
+        flush_output(s);
+        if (s->output_failed) {
+            break;
+        }
+    }
+
+    flush_output(s);
+    free(buffer);
+    return 0;
+}
+
+int math_expr_serve_stdio(void)
+{
+    session s;
+    if (session_init(&s, STDOUT_FILENO) != 0) {
+        return -1;
+    }
+
+    int status = serve_fd(&s, STDIN_FILENO, STDOUT_FILENO);
+    session_deinit(&s);
+    return status;
+}
+
+int math_expr_serve_socket(const char *path)
+{
+    struct sockaddr_un address;
+    if (!path || strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "math_expr_server: invalid socket path\n");
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, strlen(path) + 1U);
+
+    /* Replace a socket left over from an earlier run, but never another kind of file. */
+    struct stat info;
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("math_expr_server: socket");
+        return -1;
+    }
+    if (bind(listener, (const struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        perror("math_expr_server: bind");
+        close(listener);
+        return -1;
+    }
+
+    /* A client that disconnects early must not terminate the server. */
+    signal(SIGPIPE, SIG_IGN);
+
+    session s;
+    if (session_init(&s, -1) != 0) {
+        close(listener);
+        return -1;
+    }
+
+    int status = 0;
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("math_expr_server: accept");
+            status = -1;
+            break;
+        }
+
+        status = serve_fd(&s, connection, connection);
+        close(connection);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    session_deinit(&s);
+    close(listener);
+    unlink(path);
+    return status;
+}
+
+#else
+
+int math_expr_serve_stdio(void)
+{
+    fprintf(stderr, "math_expr_server: server mode is not supported on this platform\n");
+    return -1;
+}
+
+int math_expr_serve_socket(const char *path)
+{
+    (void)path;
+    return math_expr_serve_stdio();
+}
+
+#endif
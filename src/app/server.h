@@ -0,0 +1,26 @@
+#ifndef MATH_EXPR_APP_SERVER_H
+#define MATH_EXPR_APP_SERVER_H
+
+/*
+ * Long-running request loop for the command-line tool.
+ *
+ * Each input line is one request and gets exactly one output line:
+ *   expression        the value, printed with %.17g so it round-trips
+ *   name = expression binds name to the value and prints it
+ * Failures print "error: ..." instead. Blank lines are ignored. Compiled
+ * programs are cached by expression text and variable bindings persist for
+ * the life of the process, so repeated requests skip lexing and parsing.
+ * Input is read and output written in large chunks; responses to all the
+ * complete lines of a chunk are written together before the next read.
+ */
+
+/* Serve standard input to standard output until end of input. */
+int math_expr_serve_stdio(void);
+
+/*
+ * Listen on a UNIX domain socket and serve one connection at a time until
+ * the process is stopped. Connections share the cache and the bindings.
+ */
+int math_expr_serve_socket(const char *path);
+
+#endif // MATH_EXPR_APP_SERVER_H
@@ -0,0 +1,449 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/async.h"
+
+#include "math_expr/batch.h"
+#include "math_expr/evaluator.h"
+
+#include "memory_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#endif
+
+#define MATH_EXPR_ASYNC_DEFAULT_CAPACITY 1024U
+
+/*
+ * Bounded ring with a sequence number per slot (Vyukov). A slot is free for
+ * the producer at position p when its sequence is p and holds an item for the
+ * consumer at p when its sequence is p + 1, so producers and consumers claim
+ * positions with one compare-and-swap each and never take a lock. A claim
+ * whose item is still being written makes the ring look full or empty for a
+ * moment; callers that know an item exists retry.
+ */
+typedef struct async_ring {
+    atomic_size_t *sequences;
+    unsigned char *items;
+    size_t item_size;
+    size_t mask;
+    atomic_size_t head;
+    atomic_size_t tail;
+} async_ring;
+
+struct math_expr_async_queue {
+    size_t capacity;
+    async_ring jobs;
+    async_ring completions;
+    atomic_uint_fast64_t next_id;
+    /* Jobs submitted whose completion has not been delivered; bounds both rings. */
+    atomic_size_t in_flight;
+    atomic_size_t memory_limit; /* Byte budget of each expression job; 0 for none. */
+    int read_fd;
+    int write_fd;
+    atomic_int signalled;
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    pthread_t *threads;
+    size_t worker_count;
+    sem_t ready;
+    int ready_initialized;
+    atomic_int shutdown;
+#endif
+};
+
+typedef struct async_entry {
+    math_expr_async_job job;
+    uint64_t id;
+} async_entry;
+
+static size_t round_up_pow2(size_t value)
+{
+    size_t result = 2U;
+    while (result < value) {
+        result <<= 1U;
+    }
+    return result;
+}
+
+static int ring_init(async_ring *ring, size_t capacity, size_t item_size)
+{
+    ring->sequences = (atomic_size_t *)malloc(capacity * sizeof(*ring->sequences));
+    ring->items = (unsigned char *)malloc(capacity * item_size);
+    if (!ring->sequences || !ring->items) {
+        perror("math_expr_async: malloc");
+        return -1;
+    }
+
+    for (size_t i = 0; i < capacity; ++i) {
+        atomic_init(&ring->sequences[i], i);
+    }
+    ring->item_size = item_size;
+    ring->mask = capacity - 1U;
+    atomic_init(&ring->head, 0U);
+    atomic_init(&ring->tail, 0U);
+    return 0;
+}
+
+static void ring_free(async_ring *ring)
+{
+    free(ring->sequences);
+    free(ring->items);
+}
+
+static int ring_push(async_ring *ring, const void *item)
+{
+    size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        size_t index = position & ring->mask;
+        size_t sequence = atomic_load_explicit(&ring->sequences[index], memory_order_acquire);
+        ptrdiff_t distance = (ptrdiff_t)(sequence - position);
+        if (distance == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1U,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(ring->items + index * ring->item_size, item, ring->item_size);
+                atomic_store_explicit(&ring->sequences[index], position + 1U, memory_order_release);
+                return 0;
+            }
+        } else if (distance < 0) {
+            return -1;
+        } else {
+            position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static int ring_pop(async_ring *ring, void *out_item)
+{
+    size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        size_t index = position & ring->mask;
+        size_t sequence = atomic_load_explicit(&ring->sequences[index], memory_order_acquire);
+        ptrdiff_t distance = (ptrdiff_t)(sequence - (position + 1U));
+        if (distance == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1U,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(out_item, ring->items + index * ring->item_size, ring->item_size);
+                atomic_store_explicit(&ring->sequences[index], position + ring->mask + 1U,
+                                      memory_order_release);
+                return 0;
+            }
+        } else if (distance < 0) {
+            return -1;
+        } else {
+            position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+static void pause_briefly(void)
+{
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    sched_yield();
+#endif
+}
+
+static int open_completion_fd(math_expr_async_queue *queue)
+{
+#ifdef __linux__
+    int fd = eventfd(0U, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        perror("math_expr_async: eventfd");
+        return -1;
+    }
+    queue->read_fd = fd;
+    queue->write_fd = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("math_expr_async: pipe");
+        return -1;
+    }
+    for (int i = 0; i < 2; ++i) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    queue->read_fd = fds[0];
+    queue->write_fd = fds[1];
+#endif
+    return 0;
+}
+
+/* Make the descriptor readable unless an earlier completion already did. */
+static void signal_completions(math_expr_async_queue *queue)
+{
+    if (atomic_exchange(&queue->signalled, 1)) {
+        return;
+    }
+
+#ifdef __linux__
+    uint64_t one = 1U;
+    ssize_t written = write(queue->write_fd, &one, sizeof(one));
+#else
+    unsigned char one = 1U;
+    ssize_t written = write(queue->write_fd, &one, sizeof(one));
+#endif
+    (void)written; /* Only fails when the descriptor is already readable. */
+}
+
+/*
+ * Drain before clearing the flag: a completion that finds the flag clear
+ * writes after the drain and leaves the descriptor readable, and one that
+ * found it set was pushed before the clear and is popped by the caller.
+ */
+static void reset_completion_fd(math_expr_async_queue *queue)
+{
+    unsigned char buffer[64];
+    while (read(queue->read_fd, buffer, sizeof(buffer)) > 0) {
+    }
+    atomic_store(&queue->signalled, 0);
+}
+
+/* tokens, when given, is the worker's own array, lexed into again for every expression job. */
+static int run_job(math_expr_async_queue *queue, const math_expr_async_job *job, math_expr_token_array *tokens)
+{
+    if (job->program) {
+        return math_expr_program_evaluate_batch(job->program, job->columns, job->rows, job->results) == 0 ? 0 : -1;
+    }
+
+    math_expr_memory_scope scope;
+    math_expr_memory_scope_begin(&scope, atomic_load_explicit(&queue->memory_limit, memory_order_relaxed));
+    int status = 0;
+    if (!tokens) {
+        status = math_expr_evaluate(job->expression, job->results);
+    } else {
+        status = math_expr_lex_expression_ex(job->expression, tokens, MATH_EXPR_LEX_SKIP_SPACE);
+        if (status == 0) {
+            status = math_expr_evaluate_tokens(tokens, job->results);
+        }
+        math_expr_token_array_clear(tokens);
+    }
+    math_expr_memory_scope_end(&scope);
+    return status == 0 ? 0 : -1;
+}
+
+static void complete_entry(math_expr_async_queue *queue, const async_entry *entry, math_expr_token_array *tokens)
+{
+    math_expr_async_completion completion;
+    completion.id = entry->id;
+    completion.status = run_job(queue, &entry->job, tokens);
+    completion.user_data = entry->job.user_data;
+
+    if (entry->job.callback) {
+        entry->job.callback(&completion);
+        atomic_fetch_sub_explicit(&queue->in_flight, 1U, memory_order_acq_rel);
+        return;
+    }
+
+    /* in_flight keeps the ring from filling; a failed push is a consumer still copying out. */
+    while (ring_push(&queue->completions, &completion) != 0) {
+        pause_briefly();
+    }
+    signal_completions(queue);
+}
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+
+static void *worker_main(void *arg)
+{
+    math_expr_async_queue *queue = (math_expr_async_queue *)arg;
+    async_entry entry;
+    math_expr_token_array tokens;
+    math_expr_token_array_init(&tokens);
+
+    for (;;) {
+        while (sem_wait(&queue->ready) != 0 && errno == EINTR) {
+        }
+
+        /*
+         * Every post but the final ones from math_expr_async_destroy stands
+         * for a pushed job; a failed pop is another producer mid-push until
+         * shutdown, after which no push is in progress and the ring is empty.
+         */
+        while (ring_pop(&queue->jobs, &entry) != 0) {
+            if (atomic_load_explicit(&queue->shutdown, memory_order_acquire)) {
+                math_expr_token_array_deinit(&tokens);
+                return NULL;
+            }
+            pause_briefly();
+        }
+        complete_entry(queue, &entry, &tokens);
+    }
+}
+
+static size_t online_processors(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1U;
+}
+
+#endif
+
+math_expr_async_queue *math_expr_async_create(size_t worker_count, size_t capacity)
+{
+    math_expr_async_queue *queue = (math_expr_async_queue *)calloc(1U, sizeof(*queue));
+    if (!queue) {
+        perror("math_expr_async: calloc");
+        return NULL;
+    }
+
+    queue->read_fd = -1;
+    queue->write_fd = -1;
+    queue->capacity = round_up_pow2(capacity == 0U ? MATH_EXPR_ASYNC_DEFAULT_CAPACITY : capacity);
+    atomic_init(&queue->next_id, 1U);
+    atomic_init(&queue->in_flight, 0U);
+    atomic_init(&queue->memory_limit, 0U);
+    atomic_init(&queue->signalled, 0);
+
+    if (ring_init(&queue->jobs, queue->capacity, sizeof(async_entry)) != 0 ||
+        ring_init(&queue->completions, queue->capacity, sizeof(math_expr_async_completion)) != 0 ||
+        open_completion_fd(queue) != 0) {
+        math_expr_async_destroy(queue);
+        return NULL;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    atomic_init(&queue->shutdown, 0);
+    if (sem_init(&queue->ready, 0, 0U) != 0) {
+        perror("math_expr_async: sem_init");
+        math_expr_async_destroy(queue);
+        return NULL;
+    }
+    queue->ready_initialized = 1;
+
+    if (worker_count == 0U) {
+        worker_count = online_processors();
+    }
+    queue->threads = (pthread_t *)calloc(worker_count, sizeof(*queue->threads));
+    if (!queue->threads) {
+        perror("math_expr_async: calloc");
+        math_expr_async_destroy(queue);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < worker_count; ++i) {
+        if (pthread_create(&queue->threads[i], NULL, worker_main, queue) != 0) {
+            fprintf(stderr, "math_expr_async: failed to start worker thread\n");
+            math_expr_async_destroy(queue);
+            return NULL;
+        }
+        ++queue->worker_count;
+    }
+#else
+    (void)worker_count;
+#endif
+
+    return queue;
+}
+
+void math_expr_async_destroy(math_expr_async_queue *queue)
+{
+    if (!queue) {
+        return;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    if (queue->ready_initialized) {
+        atomic_store_explicit(&queue->shutdown, 1, memory_order_release);
+        for (size_t i = 0; i < queue->worker_count; ++i) {
+            sem_post(&queue->ready);
+        }
+        for (size_t i = 0; i < queue->worker_count; ++i) {
+            pthread_join(queue->threads[i], NULL);
+        }
+        sem_destroy(&queue->ready);
+    }
+    free(queue->threads);
+#endif
+
+    if (queue->read_fd >= 0) {
+        close(queue->read_fd);
+    }
+    if (queue->write_fd >= 0 && queue->write_fd != queue->read_fd) {
+        close(queue->write_fd);
+    }
+    ring_free(&queue->completions);
+    ring_free(&queue->jobs);
+    free(queue);
+}
+
+int math_expr_async_submit(math_expr_async_queue *queue, const math_expr_async_job *job, uint64_t *out_id)
+{
+    if (!queue || !job || !job->results || (!job->program && !job->expression)) {
+        return -1;
+    }
+    if (job->program && job->rows > 0U && !job->columns && job->program->symbol_count > 0U) {
+        return -1;
+    }
+
+    if (atomic_fetch_add_explicit(&queue->in_flight, 1U, memory_order_acq_rel) >= queue->capacity) {
+        atomic_fetch_sub_explicit(&queue->in_flight, 1U, memory_order_acq_rel);
+        return -1;
+    }
+
+    async_entry entry;
+    entry.job = *job;
+    entry.id = atomic_fetch_add_explicit(&queue->next_id, 1U, memory_order_relaxed);
+    if (out_id) {
+        *out_id = entry.id;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    if (queue->worker_count > 0U) {
+        while (ring_push(&queue->jobs, &entry) != 0) {
+            pause_briefly();
+        }
+        sem_post(&queue->ready);
+        return 0;
+    }
+#endif
+
+    complete_entry(queue, &entry, NULL);
+    return 0;
+}
+
+void math_expr_async_set_memory_limit(math_expr_async_queue *queue, size_t bytes)
+{
+    if (queue) {
+        atomic_store_explicit(&queue->memory_limit, bytes, memory_order_relaxed);
+    }
+}
+
+int math_expr_async_completion_fd(const math_expr_async_queue *queue)
+{
+    return queue ? queue->read_fd : -1;
+}
+
+size_t math_expr_async_poll(math_expr_async_queue *queue,
+                            math_expr_async_completion *out_completions,
+                            size_t max_count)
+{
+    if (!queue || !out_completions) {
+        return 0U;
+    }
+
+    reset_completion_fd(queue);
+
+    size_t count = 0U;
+    while (count < max_count && ring_pop(&queue->completions, &out_completions[count]) == 0) {
+        atomic_fetch_sub_explicit(&queue->in_flight, 1U, memory_order_acq_rel);
+        ++count;
+    }
+
+    if (count == max_count && count > 0U) {
+        signal_completions(queue);
+    }
+    return count;
+}
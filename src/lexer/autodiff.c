@@ -0,0 +1,658 @@
+#include "math_expr/autodiff.h"
+
+#include "builtins.h"
+#include "stats_internal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifndef M_LN10
+#define M_LN10 2.30258509299404568402
+#endif
+
+#define MATH_EXPR_AD_MAX_ARITY 2U
+#define MATH_EXPR_AD_LOCAL_DOUBLES 256U
+
+static const double kDegreesToRadians = M_PI / 180.0;
+
+static double call1(math_expr_builtin_id id, double value)
+{
+    return math_expr_builtin_get(id)->func(&value);
+}
+
+static void pow_partials(double base, double exponent, double value, double *partials)
+{
+    partials[0] = exponent == 0.0 ? 0.0 : exponent * pow(base, exponent - 1.0);
+    partials[1] = base > 0.0 ? value * log(base) : 0.0;
+}
+
+static int compare(math_expr_opcode opcode, double a, double b)
+{
+    switch (opcode) {
+    case MATH_EXPR_OP_LT:
+        return a < b;
+    case MATH_EXPR_OP_LE:
+        return a <= b;
+    case MATH_EXPR_OP_GT:
+        return a > b;
+    case MATH_EXPR_OP_GE:
+        return a >= b;
+    case MATH_EXPR_OP_EQ:
+        return a == b;
+    default:
+        return a != b;
+    }
+}
+
+static size_t operand_count(const math_expr_instruction *instruction)
+{
+    switch ((math_expr_opcode)instruction->opcode) {
+    case MATH_EXPR_OP_NEG:
+    case MATH_EXPR_OP_NOT:
+    case MATH_EXPR_OP_BOOL:
+        return 1U;
+    case MATH_EXPR_OP_CALL:
+        return math_expr_builtin_get(instruction->operand)->arity;
+    default:
+        return 2U;
+    }
+}
+
+/*
+ * Follow a jump: the derivative of a conditional is the derivative of the
+ * branch it takes. Returns 1 if the instruction was a jump.
+ */
+static int follow_jump(const math_expr_instruction *instruction, const double *condition, size_t *pc, size_t *top)
+{
+    if (instruction->opcode == MATH_EXPR_OP_JUMP) {
+        *pc = instruction->operand;
+        return 1;
+    }
+    if (instruction->opcode != MATH_EXPR_OP_JUMP_IF_FALSE) {
+        return 0;
+    }
+
+    --*top;
+    if (*condition == 0.0) {
+        *pc = instruction->operand;
+    }
+    return 1;
+}
+
+/*
+ * Compute the value of one non-leaf instruction from its operands and the
+ * local partial derivative with respect to each operand.
+ */
+static int apply(const math_expr_instruction *instruction,
+                 const double *args,
+                 size_t *out_arity,
+                 double *out_value,
+                 double *partials)
+{
+    double a = args[0];
+    double b = args[1];
+
+    partials[0] = 0.0;
+    partials[1] = 0.0;
+
+    switch ((math_expr_opcode)instruction->opcode) {
+    case MATH_EXPR_OP_NEG:
+        *out_arity = 1U;
+        *out_value = -a;
+        partials[0] = -1.0;
+        return 0;
+    case MATH_EXPR_OP_ADD:
+        *out_arity = 2U;
+        *out_value = a + b;
+        partials[0] = 1.0;
+        partials[1] = 1.0;
+        return 0;
+    case MATH_EXPR_OP_SUB:
+        *out_arity = 2U;
+        *out_value = a - b;
+        partials[0] = 1.0;
+        partials[1] = -1.0;
+        return 0;
+    case MATH_EXPR_OP_MUL:
+        *out_arity = 2U;
+        *out_value = a * b;
+        partials[0] = b;
+        partials[1] = a;
+        return 0;
+    case MATH_EXPR_OP_DIV:
+        if (b == 0.0) {
+            fprintf(stderr, "math_expr_autodiff: division by zero\n");
+            return -1;
+        }
+        *out_arity = 2U;
+        *out_value = a / b;
+        partials[0] = 1.0 / b;
+        partials[1] = -a / (b * b);
+        return 0;
+    case MATH_EXPR_OP_MOD:
+        if (b == 0.0) {
+            fprintf(stderr, "math_expr_autodiff: modulo by zero\n");
+            return -1;
+        }
+        *out_arity = 2U;
+        *out_value = fmod(a, b);
+        partials[0] = 1.0;
+        partials[1] = -trunc(a / b);
+        return 0;
+    case MATH_EXPR_OP_POW:
+        *out_arity = 2U;
+        *out_value = pow(a, b);
+        pow_partials(a, b, *out_value, partials);
+        return 0;
+    case MATH_EXPR_OP_LT:
+    case MATH_EXPR_OP_LE:
+    case MATH_EXPR_OP_GT:
+    case MATH_EXPR_OP_GE:
+    case MATH_EXPR_OP_EQ:
+    case MATH_EXPR_OP_NE:
+        /* Comparisons are piecewise constant; their derivative is zero. */
+        *out_arity = 2U;
+        *out_value = compare((math_expr_opcode)instruction->opcode, a, b) ? 1.0 : 0.0;
+        return 0;
+    case MATH_EXPR_OP_NOT:
+        *out_arity = 1U;
+        *out_value = a == 0.0 ? 1.0 : 0.0;
+        return 0;
+    case MATH_EXPR_OP_BOOL:
+        *out_arity = 1U;
+        *out_value = a != 0.0 ? 1.0 : 0.0;
+        return 0;
+    case MATH_EXPR_OP_CALL:
+        break;
+    default:
+        fprintf(stderr, "math_expr_autodiff: unsupported opcode %u\n", (unsigned)instruction->opcode);
+        return -1;
+    }
+
+    const math_expr_builtin *builtin = math_expr_builtin_get(instruction->operand);
+    if (builtin->arity > MATH_EXPR_AD_MAX_ARITY) {
+        return -1;
+    }
+
+    *out_arity = builtin->arity;
+    *out_value = builtin->func(args);
+    MATH_EXPR_STATS_BUILTIN(instruction->operand);
+
+    switch (builtin->canonical) {
+    case MATH_EXPR_BUILTIN_SIN:
+        partials[0] = call1(MATH_EXPR_BUILTIN_COS, a) * kDegreesToRadians;
+        break;
+    case MATH_EXPR_BUILTIN_COS:
+        partials[0] = -call1(MATH_EXPR_BUILTIN_SIN, a) * kDegreesToRadians;
+        break;
+    case MATH_EXPR_BUILTIN_TAN: {
+        double c = call1(MATH_EXPR_BUILTIN_COS, a);
+        partials[0] = kDegreesToRadians / (c * c);
+        break;
+    }
+    case MATH_EXPR_BUILTIN_SQRT:
+        partials[0] = 0.5 / *out_value;
+        break;
+    case MATH_EXPR_BUILTIN_ABS:
+        partials[0] = a < 0.0 ? -1.0 : 1.0;
+        break;
+    case MATH_EXPR_BUILTIN_LN:
+        partials[0] = 1.0 / a;
+        break;
+    case MATH_EXPR_BUILTIN_LOG:
+        partials[0] = 1.0 / (a * M_LN10);
+        break;
+    case MATH_EXPR_BUILTIN_EXP:
+        partials[0] = *out_value;
+        break;
+    case MATH_EXPR_BUILTIN_POW:
+        pow_partials(a, b, *out_value, partials);
+        break;
+    case MATH_EXPR_BUILTIN_MAX:
+        partials[0] = a > b ? 1.0 : 0.0;
+        partials[1] = 1.0 - partials[0];
+        break;
+    case MATH_EXPR_BUILTIN_MIN:
+        partials[0] = a < b ? 1.0 : 0.0;
+        partials[1] = 1.0 - partials[0];
+        break;
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Value and tangents of a REDUCE over the top count stack slots. */
+static int reduce_forward(const math_expr_instruction *instruction, double *values, double *tangents, size_t n, size_t *top)
+{
+    math_expr_aggregate kind = (math_expr_aggregate)(instruction->operand & 3U);
+    size_t count = instruction->operand >> 2;
+    if (count == 0U || count > *top) {
+        return -1;
+    }
+
+    size_t base = *top - count;
+    double *result = tangents + base * n;
+    if (kind == MATH_EXPR_AGGREGATE_MIN || kind == MATH_EXPR_AGGREGATE_MAX) {
+        size_t selected = math_expr_aggregate_select(kind, &values[base], count);
+        if (selected > 0U) {
+            memcpy(result, tangents + (base + selected) * n, n * sizeof(*result));
+        }
+    } else {
+        double weight = kind == MATH_EXPR_AGGREGATE_AVG ? 1.0 / (double)count : 1.0;
+        for (size_t k = 1; k < count; ++k) {
+            const double *tangent = tangents + (base + k) * n;
+            for (size_t j = 0; j < n; ++j) {
+                result[j] += tangent[j];
+            }
+        }
+        for (size_t j = 0; j < n; ++j) {
+            result[j] *= weight;
+        }
+    }
+
+    values[base] = math_expr_aggregate_reduce(kind, &values[base], count);
+    *top = base + 1U;
+    return 0;
+}
+
+static int check_arguments(const math_expr_program *program,
+                           const double *variables,
+                           const double *out_value,
+                           const double *out_gradient)
+{
+    if (!program || !out_value || program->code_size == 0U) {
+        return -1;
+    }
+
+    if (program->symbol_count > 0U && (!variables || !out_gradient)) {
+        return -1;
+    }
+
+    if (program->function_count > 0U) {
+        fprintf(stderr, "math_expr_autodiff: registered functions cannot be differentiated\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int run_forward(const math_expr_program *program,
+                       const double *variables,
+                       double *values,
+                       double *tangents,
+                       double *out_value,
+                       double *out_gradient)
+{
+    size_t n = program->symbol_count;
+    size_t top = 0U;
+    size_t pc = 0U;
+
+    while (pc < program->code_size) {
+        const math_expr_instruction *instruction = &program->code[pc++];
+
+        if (instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE && top == 0U) {
+            return -1;
+        }
+        if (follow_jump(instruction, top > 0U ? &values[top - 1U] : NULL, &pc, &top)) {
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_CONST || instruction->opcode == MATH_EXPR_OP_LOAD) {
+            double *tangent = tangents + top * n;
+            memset(tangent, 0, n * sizeof(*tangent));
+            if (instruction->opcode == MATH_EXPR_OP_CONST) {
+                values[top] = program->constants[instruction->operand];
+            } else {
+                values[top] = variables[instruction->operand];
+                tangent[instruction->operand] = 1.0;
+            }
+            ++top;
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_REDUCE) {
+            if (reduce_forward(instruction, values, tangents, n, &top) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        size_t arity = operand_count(instruction);
+        if (arity > MATH_EXPR_AD_MAX_ARITY || arity > top) {
+            return -1;
+        }
+
+        size_t base = top - arity;
+        double args[MATH_EXPR_AD_MAX_ARITY] = {0.0, 0.0};
+        memcpy(args, &values[base], arity * sizeof(*args));
+
+        double partials[MATH_EXPR_AD_MAX_ARITY];
+        double value = 0.0;
+        if (apply(instruction, args, &arity, &value, partials) != 0) {
+            return -1;
+        }
+
+        double *result = tangents + base * n;
+        for (size_t j = 0; j < n; ++j) {
+            double sum = partials[0] * result[j];
+            if (arity > 1U) {
+                sum += partials[1] * tangents[(base + 1U) * n + j];
+            }
+            result[j] = sum;
+        }
+
+        values[base] = value;
+        top = base + 1U;
+    }
+
+    if (top != 1U) {
+        fprintf(stderr, "math_expr_autodiff: malformed program\n");
+        return -1;
+    }
+
+    *out_value = values[0];
+    if (n > 0U) {
+        memcpy(out_gradient, tangents, n * sizeof(*out_gradient));
+    }
+    return 0;
+}
+
+int math_expr_program_gradient_forward(const math_expr_program *program,
+                                       const double *variables,
+                                       double *out_value,
+                                       double *out_gradient)
+{
+    if (check_arguments(program, variables, out_value, out_gradient) != 0) {
+        return -1;
+    }
+
+    size_t needed = program->max_stack * (1U + program->symbol_count);
+    double local[MATH_EXPR_AD_LOCAL_DOUBLES];
+    double *storage = local;
+
+    if (needed > MATH_EXPR_AD_LOCAL_DOUBLES) {
+        storage = (double *)malloc(needed * sizeof(*storage));
+        if (!storage) {
+            perror("math_expr_autodiff: malloc");
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC(needed * sizeof(*storage));
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = run_forward(program,
+                             variables,
+                             storage,
+                             storage + program->max_stack,
+                             out_value,
+                             out_gradient);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+
+    if (storage != local) {
+        free(storage);
+    }
+    return status;
+}
+
+void math_expr_tape_init(math_expr_tape *tape)
+{
+    if (!tape) {
+        return;
+    }
+
+    memset(tape, 0, sizeof(*tape));
+}
+
+void math_expr_tape_deinit(math_expr_tape *tape)
+{
+    if (!tape) {
+        return;
+    }
+
+    free(tape->values);
+    free(tape->adjoints);
+    free(tape->partials);
+    free(tape->operands);
+    free(tape->spill);
+    free(tape->stack);
+    math_expr_tape_init(tape);
+}
+
+int math_expr_tape_reserve(math_expr_tape *tape, const math_expr_program *program)
+{
+    if (!tape || !program) {
+        return -1;
+    }
+
+    if (tape->capacity < program->code_size) {
+        size_t count = program->code_size;
+        double *values = (double *)realloc(tape->values, count * sizeof(*values));
+        if (values) {
+            tape->values = values;
+        }
+        double *adjoints = (double *)realloc(tape->adjoints, count * sizeof(*adjoints));
+        if (adjoints) {
+            tape->adjoints = adjoints;
+        }
+        double *partials = (double *)realloc(tape->partials, count * MATH_EXPR_AD_MAX_ARITY * sizeof(*partials));
+        if (partials) {
+            tape->partials = partials;
+        }
+        size_t *operands = (size_t *)realloc(tape->operands, count * MATH_EXPR_AD_MAX_ARITY * sizeof(*operands));
+        if (operands) {
+            tape->operands = operands;
+        }
+        size_t *spill = (size_t *)realloc(tape->spill, count * sizeof(*spill));
+        if (spill) {
+            tape->spill = spill;
+        }
+
+        if (!values || !adjoints || !partials || !operands || !spill) {
+            perror("math_expr_autodiff: realloc");
+            return -1;
+        }
+
+        MATH_EXPR_STATS_ALLOC(count * (3U + 2U * MATH_EXPR_AD_MAX_ARITY) * sizeof(double));
+        tape->capacity = count;
+    }
+
+    if (tape->stack_capacity < program->max_stack) {
+        size_t *stack = (size_t *)realloc(tape->stack, program->max_stack * sizeof(*stack));
+        if (!stack) {
+            perror("math_expr_autodiff: realloc");
+            return -1;
+        }
+
+        MATH_EXPR_STATS_ALLOC(program->max_stack * sizeof(*stack));
+        tape->stack = stack;
+        tape->stack_capacity = program->max_stack;
+    }
+
+    return 0;
+}
+
+/*
+ * Record a REDUCE: operands[0] is where its inputs start in the spill buffer,
+ * operands[1] how many there are, and partials[0] the derivative with respect
+ * to each. min and max record only the input they select. Every value is
+ * consumed once, so the spill buffer never holds more than code_size entries.
+ */
+static int reduce_reverse(math_expr_tape *tape,
+                          size_t index,
+                          const math_expr_instruction *instruction,
+                          size_t *top,
+                          size_t *spill_size)
+{
+    math_expr_aggregate kind = (math_expr_aggregate)(instruction->operand & 3U);
+    size_t count = instruction->operand >> 2;
+    if (count == 0U || count > *top || *spill_size + count > tape->capacity) {
+        return -1;
+    }
+
+    /* Adjoints are only needed once the forward sweep is over, so they hold the inputs meanwhile. */
+    size_t base = *top - count;
+    double *inputs = tape->adjoints;
+    for (size_t k = 0; k < count; ++k) {
+        inputs[k] = tape->values[tape->stack[base + k]];
+    }
+
+    size_t *operands = &tape->operands[index * MATH_EXPR_AD_MAX_ARITY];
+    double *partials = &tape->partials[index * MATH_EXPR_AD_MAX_ARITY];
+    operands[0] = *spill_size;
+    if (kind == MATH_EXPR_AGGREGATE_MIN || kind == MATH_EXPR_AGGREGATE_MAX) {
+        tape->spill[(*spill_size)++] = tape->stack[base + math_expr_aggregate_select(kind, inputs, count)];
+        operands[1] = 1U;
+        partials[0] = 1.0;
+    } else {
+        memcpy(&tape->spill[*spill_size], &tape->stack[base], count * sizeof(*tape->spill));
+        *spill_size += count;
+        operands[1] = count;
+        partials[0] = kind == MATH_EXPR_AGGREGATE_AVG ? 1.0 / (double)count : 1.0;
+    }
+
+    tape->values[index] = math_expr_aggregate_reduce(kind, inputs, count);
+    tape->stack[base] = index;
+    *top = base + 1U;
+    return 0;
+}
+
+static int run_reverse(const math_expr_program *program,
+                       math_expr_tape *tape,
+                       const double *variables,
+                       double *out_value,
+                       double *out_gradient)
+{
+    size_t top = 0U;
+    size_t pc = 0U;
+    size_t spill_size = 0U;
+
+    /* Tape entries are indexed by instruction; those on branches not taken are never referenced. */
+    while (pc < program->code_size) {
+        size_t index = pc++;
+        const math_expr_instruction *instruction = &program->code[index];
+        double *partials = &tape->partials[index * MATH_EXPR_AD_MAX_ARITY];
+        size_t *operands = &tape->operands[index * MATH_EXPR_AD_MAX_ARITY];
+
+        if (instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE && top == 0U) {
+            return -1;
+        }
+        if (follow_jump(instruction, top > 0U ? &tape->values[tape->stack[top - 1U]] : NULL, &pc, &top)) {
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_CONST || instruction->opcode == MATH_EXPR_OP_LOAD) {
+            tape->values[index] = instruction->opcode == MATH_EXPR_OP_CONST
+                                      ? program->constants[instruction->operand]
+                                      : variables[instruction->operand];
+            tape->stack[top++] = index;
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_REDUCE) {
+            if (reduce_reverse(tape, index, instruction, &top, &spill_size) != 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        size_t arity = operand_count(instruction);
+        if (arity > MATH_EXPR_AD_MAX_ARITY || arity > top) {
+            return -1;
+        }
+
+        size_t base = top - arity;
+        double args[MATH_EXPR_AD_MAX_ARITY] = {0.0, 0.0};
+        for (size_t k = 0; k < arity; ++k) {
+            operands[k] = tape->stack[base + k];
+            args[k] = tape->values[operands[k]];
+        }
+
+        if (apply(instruction, args, &arity, &tape->values[index], partials) != 0) {
+            return -1;
+        }
+
+        tape->stack[base] = index;
+        top = base + 1U;
+    }
+
+    if (top != 1U) {
+        fprintf(stderr, "math_expr_autodiff: malformed program\n");
+        return -1;
+    }
+
+    size_t last = tape->stack[0];
+    *out_value = tape->values[last];
+
+    memset(tape->adjoints, 0, program->code_size * sizeof(*tape->adjoints));
+    if (program->symbol_count > 0U) {
+        memset(out_gradient, 0, program->symbol_count * sizeof(*out_gradient));
+    }
+    tape->adjoints[last] = 1.0;
+
+    for (pc = last + 1U; pc-- > 0U;) {
+        const math_expr_instruction *instruction = &program->code[pc];
+        double adjoint = tape->adjoints[pc];
+
+        if (instruction->opcode == MATH_EXPR_OP_CONST || adjoint == 0.0) {
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_LOAD) {
+            out_gradient[instruction->operand] += adjoint;
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_REDUCE) {
+            const size_t *operands = &tape->operands[pc * MATH_EXPR_AD_MAX_ARITY];
+            double contribution = tape->partials[pc * MATH_EXPR_AD_MAX_ARITY] * adjoint;
+            for (size_t k = 0; k < operands[1]; ++k) {
+                tape->adjoints[tape->spill[operands[0] + k]] += contribution;
+            }
+            continue;
+        }
+
+        size_t arity = operand_count(instruction);
+        for (size_t k = 0; k < arity; ++k) {
+            tape->adjoints[tape->operands[pc * MATH_EXPR_AD_MAX_ARITY + k]] +=
+                tape->partials[pc * MATH_EXPR_AD_MAX_ARITY + k] * adjoint;
+        }
+    }
+
+    return 0;
+}
+
+int math_expr_program_gradient_reverse(const math_expr_program *program,
+                                       math_expr_tape *tape,
+                                       const double *variables,
+                                       double *out_value,
+                                       double *out_gradient)
+{
+    if (!tape || check_arguments(program, variables, out_value, out_gradient) != 0) {
+        return -1;
+    }
+
+    if (math_expr_tape_reserve(tape, program) != 0) {
+        return -1;
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = run_reverse(program, tape, variables, out_value, out_gradient);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
+}
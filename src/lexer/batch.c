@@ -0,0 +1,291 @@
+#include "math_expr/batch.h"
+
+#include "builtins.h"
+#include "stats_internal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MATH_EXPR_BATCH_BLOCK 256U
+#define MATH_EXPR_MAX_ARITY 8U
+
+static const size_t kDefaultPruneRows = 4096U;
+
+/* A conditional whose rows went both ways in the current block. */
+typedef struct batch_branch {
+    size_t else_pc;
+    size_t join;            /* Set when the then branch ends. */
+    size_t depth;           /* Stack depth before either branch. */
+    int in_else;
+    unsigned char *then_mask;
+    unsigned char *else_mask;
+    void *then_values;      /* MATH_EXPR_BATCH_BLOCK values of the then branch. */
+} batch_branch;
+
+/*
+ * Scratch memory for one evaluation. Jumps only go forward, so a block runs
+ * each JUMP_IF_FALSE at most once and one batch_branch per JUMP_IF_FALSE is
+ * enough for any nesting.
+ */
+typedef struct batch_workspace {
+    void *stack;            /* max_stack columns of MATH_EXPR_BATCH_BLOCK values. */
+    unsigned char *all_rows;
+    batch_branch *branches;
+    size_t branch_count;
+} batch_workspace;
+
+#define MATH_EXPR_REAL double
+#define MATH_EXPR_IO double
+#define MATH_EXPR_SUFFIX f64
+#define MATH_EXPR_FMOD fmod
+#define MATH_EXPR_POW pow
+#define MATH_EXPR_BUILTIN_FUNC func
+#include "batch_eval.h"
+
+#define MATH_EXPR_REAL float
+#define MATH_EXPR_IO float
+#define MATH_EXPR_SUFFIX f32
+#define MATH_EXPR_FMOD fmodf
+#define MATH_EXPR_POW powf
+#define MATH_EXPR_BUILTIN_FUNC func_f32
+#include "batch_eval.h"
+
+/* Single-precision arithmetic over double columns, for F32 programs called through the double API. */
+#define MATH_EXPR_REAL float
+#define MATH_EXPR_IO double
+#define MATH_EXPR_SUFFIX f32_io_f64
+#define MATH_EXPR_FMOD fmodf
+#define MATH_EXPR_POW powf
+#define MATH_EXPR_BUILTIN_FUNC func_f32
+#include "batch_eval.h"
+
+static int alloc_workspace(const math_expr_program *program, batch_workspace *workspace)
+{
+    size_t depth = program->max_stack > 0U ? program->max_stack : 1U;
+    size_t branch_count = 0U;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        branch_count += program->code[pc].opcode == MATH_EXPR_OP_JUMP_IF_FALSE;
+    }
+
+    /* Values first, then branch records, then the byte masks, so each part stays aligned. */
+    size_t values = (depth + branch_count) * MATH_EXPR_BATCH_BLOCK;
+    size_t bytes = values * sizeof(double) + branch_count * sizeof(batch_branch) +
+                   (1U + 2U * branch_count) * MATH_EXPR_BATCH_BLOCK;
+    char *memory = (char *)malloc(bytes);
+    if (!memory) {
+        perror("math_expr_batch: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(bytes);
+
+    double *branch_values = (double *)memory + depth * MATH_EXPR_BATCH_BLOCK;
+    batch_branch *branches = (batch_branch *)(memory + values * sizeof(double));
+    unsigned char *masks = (unsigned char *)(branches + branch_count);
+
+    workspace->stack = memory;
+    workspace->all_rows = masks;
+    workspace->branches = branches;
+    workspace->branch_count = branch_count;
+    memset(masks, 1, MATH_EXPR_BATCH_BLOCK);
+
+    for (size_t b = 0; b < branch_count; ++b) {
+        branches[b].then_values = branch_values + b * MATH_EXPR_BATCH_BLOCK;
+        branches[b].then_mask = masks + (1U + 2U * b) * MATH_EXPR_BATCH_BLOCK;
+        branches[b].else_mask = branches[b].then_mask + MATH_EXPR_BATCH_BLOCK;
+    }
+    return 0;
+}
+
+static void free_workspace(batch_workspace *workspace)
+{
+    free(workspace->stack);
+}
+
+static int run_rows(const math_expr_program *program,
+                    const double *const *columns,
+                    size_t first_row,
+                    size_t row_count,
+                    batch_workspace *workspace,
+                    double *out_results)
+{
+    if (program->precision == MATH_EXPR_PRECISION_F32) {
+        return run_rows_f32_io_f64(program, columns, first_row, row_count, workspace, out_results);
+    }
+
+    return run_rows_f64(program, columns, first_row, row_count, workspace, out_results);
+}
+
+static int check_arguments(const math_expr_program *program,
+                           const void *columns,
+                           const void *out_results)
+{
+    if (!program || !out_results || program->code_size == 0U) {
+        return -1;
+    }
+
+    if (program->symbol_count > 0U && !columns) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int math_expr_program_evaluate_batch(const math_expr_program *program,
+                                     const double *const *columns,
+                                     size_t row_count,
+                                     double *out_results)
+{
+    if (check_arguments(program, columns, out_results) != 0) {
+        return -1;
+    }
+
+    if (row_count == 0U) {
+        return 0;
+    }
+
+    batch_workspace workspace;
+    if (alloc_workspace(program, &workspace) != 0) {
+        return -1;
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = run_rows(program, columns, 0U, row_count, &workspace, out_results);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+
+    free_workspace(&workspace);
+    return status;
+}
+
+int math_expr_program_evaluate_batch_f32(const math_expr_program *program,
+                                         const float *const *columns,
+                                         size_t row_count,
+                                         float *out_results)
+{
+    if (check_arguments(program, columns, out_results) != 0) {
+        return -1;
+    }
+
+    if (row_count == 0U) {
+        return 0;
+    }
+
+    batch_workspace workspace;
+    if (alloc_workspace(program, &workspace) != 0) {
+        return -1;
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = run_rows_f32(program, columns, 0U, row_count, &workspace, out_results);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+
+    free_workspace(&workspace);
+    return status;
+}
+
+static int intersects(math_expr_interval a, math_expr_interval b)
+{
+    return a.lo <= a.hi && a.lo <= b.hi && b.lo <= a.hi;
+}
+
+static void column_range(const double *column, size_t count, math_expr_interval *out_range)
+{
+    double lo = column[0];
+    double hi = column[0];
+
+    for (size_t i = 1; i < count; ++i) {
+        lo = column[i] < lo ? column[i] : lo;
+        hi = column[i] > hi ? column[i] : hi;
+    }
+
+    if (isnan(lo) || isnan(hi)) {
+        lo = -INFINITY;
+        hi = INFINITY;
+    }
+
+    out_range->lo = lo;
+    out_range->hi = hi;
+}
+
+int math_expr_program_evaluate_batch_pruned(const math_expr_program *program,
+                                            const double *const *columns,
+                                            size_t row_count,
+                                            size_t block_rows,
+                                            math_expr_interval keep,
+                                            double *out_results,
+                                            size_t *out_skipped_blocks)
+{
+    if (check_arguments(program, columns, out_results) != 0) {
+        return -1;
+    }
+
+    if (out_skipped_blocks) {
+        *out_skipped_blocks = 0U;
+    }
+
+    if (row_count == 0U) {
+        return 0;
+    }
+
+    if (block_rows == 0U) {
+        block_rows = kDefaultPruneRows;
+    }
+
+    batch_workspace workspace;
+    if (alloc_workspace(program, &workspace) != 0) {
+        return -1;
+    }
+
+    math_expr_interval *ranges = NULL;
+    if (program->symbol_count > 0U) {
+        ranges = (math_expr_interval *)malloc(program->symbol_count * sizeof(*ranges));
+        if (!ranges) {
+            perror("math_expr_batch: malloc");
+            free_workspace(&workspace);
+            return -1;
+        }
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = 0;
+
+    for (size_t row = 0; row < row_count && status == 0; row += block_rows) {
+        size_t rows = row_count - row < block_rows ? row_count - row : block_rows;
+
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            column_range(columns[slot] + row, rows, &ranges[slot]);
+        }
+
+        math_expr_interval bounds;
+        if (math_expr_program_evaluate_interval(program, ranges, &bounds) == 0 && !intersects(bounds, keep)) {
+            for (size_t i = 0; i < rows; ++i) {
+                out_results[row + i] = NAN;
+            }
+            if (out_skipped_blocks) {
+                ++*out_skipped_blocks;
+            }
+            continue;
+        }
+
+        status = run_rows(program, columns, row, rows, &workspace, out_results);
+    }
+
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+
+    free(ranges);
+    free_workspace(&workspace);
+    return status;
+}
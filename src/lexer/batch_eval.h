@@ -0,0 +1,405 @@
+/*
+ * Block interpreter template, instantiated once per precision. Define
+ * before including:
+ *   MATH_EXPR_REAL          arithmetic type of the evaluation stack
+ *   MATH_EXPR_IO            element type of the input columns and results
+ *   MATH_EXPR_SUFFIX        suffix appended to the generated function names
+ *   MATH_EXPR_FMOD          fmod for MATH_EXPR_REAL
+ *   MATH_EXPR_POW           pow for MATH_EXPR_REAL
+ *   MATH_EXPR_BUILTIN_FUNC  math_expr_builtin member implementing MATH_EXPR_REAL
+ * All parameters are undefined again at the end of this file.
+ */
+
+#define MATH_EXPR_CAT_(name, suffix) name##_##suffix
+#define MATH_EXPR_CAT(name, suffix) MATH_EXPR_CAT_(name, suffix)
+
+/*
+ * Rows of a block may disagree on a condition. The block then runs the then
+ * branch with only its rows active, parks the result, runs the else branch
+ * for the remaining rows and blends the two at the join. Arithmetic still
+ * covers every row so it vectorizes; functions are only called for active
+ * rows and only active rows can raise errors. A condition the active rows
+ * agree on costs no more than a jump.
+ */
+static int MATH_EXPR_CAT(join_branches, MATH_EXPR_SUFFIX)(batch_workspace *workspace,
+                                                          size_t *open,
+                                                          size_t pc,
+                                                          MATH_EXPR_REAL *stack,
+                                                          size_t top,
+                                                          size_t rows,
+                                                          const unsigned char **mask)
+{
+    while (*open > 0U) {
+        batch_branch *branch = &workspace->branches[*open - 1U];
+        if (!branch->in_else ? pc < branch->else_pc : pc < branch->join) {
+            return 0;
+        }
+        if (!branch->in_else || pc != branch->join || top != branch->depth + 1U) {
+            return -1;
+        }
+
+        MATH_EXPR_REAL *dst = stack + (top - 1U) * MATH_EXPR_BATCH_BLOCK;
+        const MATH_EXPR_REAL *then_values = (const MATH_EXPR_REAL *)branch->then_values;
+        for (size_t i = 0; i < rows; ++i) {
+            dst[i] = branch->then_mask[i] ? then_values[i] : dst[i];
+        }
+
+        --*open;
+        if (*open == 0U) {
+            *mask = workspace->all_rows;
+        } else {
+            const batch_branch *parent = &workspace->branches[*open - 1U];
+            *mask = parent->in_else ? parent->else_mask : parent->then_mask;
+        }
+    }
+
+    return 0;
+}
+
+static int MATH_EXPR_CAT(run_block, MATH_EXPR_SUFFIX)(const math_expr_program *program,
+                                                      const MATH_EXPR_IO *const *columns,
+                                                      size_t first_row,
+                                                      size_t rows,
+                                                      batch_workspace *workspace,
+                                                      MATH_EXPR_IO *out_results)
+{
+    MATH_EXPR_REAL *stack = (MATH_EXPR_REAL *)workspace->stack;
+    const unsigned char *mask = workspace->all_rows;
+    size_t open = 0U;
+    size_t top = 0U;
+    size_t pc = 0U;
+
+    while (pc < program->code_size) {
+        if (open > 0U &&
+            MATH_EXPR_CAT(join_branches, MATH_EXPR_SUFFIX)(workspace,
+                                                           &open,
+                                                           pc,
+                                                           stack,
+                                                           top,
+                                                           rows,
+                                                           &mask) != 0) {
+            fprintf(stderr, "math_expr_batch: malformed program\n");
+            return -1;
+        }
+
+        const math_expr_instruction *instruction = &program->code[pc++];
+        MATH_EXPR_REAL *lhs = top >= 2U ? stack + (top - 2U) * MATH_EXPR_BATCH_BLOCK : NULL;
+        const MATH_EXPR_REAL *rhs = top >= 1U ? stack + (top - 1U) * MATH_EXPR_BATCH_BLOCK : NULL;
+        int zero = 0;
+
+        switch ((math_expr_opcode)instruction->opcode) {
+        case MATH_EXPR_OP_CONST: {
+            MATH_EXPR_REAL value = (MATH_EXPR_REAL)program->constants[instruction->operand];
+            MATH_EXPR_REAL *dst = stack + top * MATH_EXPR_BATCH_BLOCK;
+            for (size_t i = 0; i < rows; ++i) {
+                dst[i] = value;
+            }
+            ++top;
+            break;
+        }
+        case MATH_EXPR_OP_LOAD: {
+            const MATH_EXPR_IO *src = columns[instruction->operand] + first_row;
+            MATH_EXPR_REAL *dst = stack + top * MATH_EXPR_BATCH_BLOCK;
+            for (size_t i = 0; i < rows; ++i) {
+                dst[i] = (MATH_EXPR_REAL)src[i];
+            }
+            ++top;
+            break;
+        }
+        case MATH_EXPR_OP_NEG: {
+            MATH_EXPR_REAL *dst = stack + (top - 1U) * MATH_EXPR_BATCH_BLOCK;
+            for (size_t i = 0; i < rows; ++i) {
+                dst[i] = -dst[i];
+            }
+            break;
+        }
+        case MATH_EXPR_OP_ADD:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] += rhs[i];
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_SUB:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] -= rhs[i];
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_MUL:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] *= rhs[i];
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_DIV:
+            for (size_t i = 0; i < rows; ++i) {
+                zero |= (rhs[i] == 0) & mask[i];
+                lhs[i] /= rhs[i];
+            }
+            if (zero) {
+                fprintf(stderr, "math_expr_batch: division by zero\n");
+                return -1;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_MOD:
+            for (size_t i = 0; i < rows; ++i) {
+                zero |= (rhs[i] == 0) & mask[i];
+                lhs[i] = MATH_EXPR_FMOD(lhs[i], rhs[i]);
+            }
+            if (zero) {
+                fprintf(stderr, "math_expr_batch: modulo by zero\n");
+                return -1;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_POW:
+            for (size_t i = 0; i < rows; ++i) {
+                if (mask[i]) {
+                    lhs[i] = MATH_EXPR_POW(lhs[i], rhs[i]);
+                }
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_CALL: {
+            /* Column by column a paired sin or cos never sees its argument twice in a row. */
+            const math_expr_builtin *builtin =
+                math_expr_builtin_get(math_expr_builtin_get(instruction->operand)->canonical);
+            size_t arity = builtin->arity;
+            if (arity > MATH_EXPR_MAX_ARITY) {
+                return -1;
+            }
+
+            MATH_EXPR_REAL *base = stack + (top - arity) * MATH_EXPR_BATCH_BLOCK;
+            MATH_EXPR_REAL args[MATH_EXPR_MAX_ARITY];
+            for (size_t i = 0; i < rows; ++i) {
+                if (!mask[i]) {
+                    continue;
+                }
+                for (size_t k = 0; k < arity; ++k) {
+                    args[k] = base[k * MATH_EXPR_BATCH_BLOCK + i];
+                }
+                base[i] = builtin->MATH_EXPR_BUILTIN_FUNC(args);
+            }
+            MATH_EXPR_STATS_BUILTIN(instruction->operand);
+            top = top - arity + 1U;
+            break;
+        }
+        case MATH_EXPR_OP_CALL_EXTERNAL: {
+            const math_expr_program_function *function = &program->functions[instruction->operand];
+            size_t arity = function->arity;
+            MATH_EXPR_REAL *base = stack + (top - arity) * MATH_EXPR_BATCH_BLOCK;
+            double args[MATH_EXPR_FUNCTION_MAX_ARITY];
+            for (size_t i = 0; i < rows; ++i) {
+                double value = 0.0;
+                if (!mask[i]) {
+                    continue;
+                }
+                for (size_t k = 0; k < arity; ++k) {
+                    args[k] = (double)base[k * MATH_EXPR_BATCH_BLOCK + i];
+                }
+                if (function->func(function->user_data, args, &value) != 0) {
+                    fprintf(stderr, "math_expr_batch: registered function failed\n");
+                    return -1;
+                }
+                base[i] = (MATH_EXPR_REAL)value;
+            }
+            top = top - arity + 1U;
+            break;
+        }
+        case MATH_EXPR_OP_LT:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] = lhs[i] < rhs[i] ? 1 : 0;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_LE:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] = lhs[i] <= rhs[i] ? 1 : 0;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_GT:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] = lhs[i] > rhs[i] ? 1 : 0;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_GE:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] = lhs[i] >= rhs[i] ? 1 : 0;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_EQ:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] = lhs[i] == rhs[i] ? 1 : 0;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_NE:
+            for (size_t i = 0; i < rows; ++i) {
+                lhs[i] = lhs[i] != rhs[i] ? 1 : 0;
+            }
+            --top;
+            break;
+        case MATH_EXPR_OP_NOT:
+        case MATH_EXPR_OP_BOOL: {
+            MATH_EXPR_REAL *dst = stack + (top - 1U) * MATH_EXPR_BATCH_BLOCK;
+            MATH_EXPR_REAL if_zero = instruction->opcode == MATH_EXPR_OP_NOT ? 1 : 0;
+            for (size_t i = 0; i < rows; ++i) {
+                dst[i] = dst[i] == 0 ? if_zero : 1 - if_zero;
+            }
+            break;
+        }
+        case MATH_EXPR_OP_REDUCE: {
+            /* Column-wise, in the order math_expr_aggregate_reduce uses for each row. */
+            math_expr_aggregate kind = (math_expr_aggregate)(instruction->operand & 3U);
+            size_t count = instruction->operand >> 2;
+            MATH_EXPR_REAL *base = stack + (top - count) * MATH_EXPR_BATCH_BLOCK;
+            if (kind == MATH_EXPR_AGGREGATE_MIN || kind == MATH_EXPR_AGGREGATE_MAX) {
+                int is_min = kind == MATH_EXPR_AGGREGATE_MIN;
+                for (size_t k = 1; k < count; ++k) {
+                    const MATH_EXPR_REAL *src = base + k * MATH_EXPR_BATCH_BLOCK;
+                    for (size_t i = 0; i < rows; ++i) {
+                        int keep = is_min ? base[i] < src[i] : base[i] > src[i];
+                        base[i] = keep ? base[i] : src[i];
+                    }
+                }
+            } else if (count < 4U) {
+                for (size_t k = 1; k < count; ++k) {
+                    const MATH_EXPR_REAL *src = base + k * MATH_EXPR_BATCH_BLOCK;
+                    for (size_t i = 0; i < rows; ++i) {
+                        base[i] += src[i];
+                    }
+                }
+            } else {
+                /* The first four columns are the four partial sums. */
+                for (size_t k = 4; k < count; ++k) {
+                    MATH_EXPR_REAL *lane = base + (k % 4U) * MATH_EXPR_BATCH_BLOCK;
+                    const MATH_EXPR_REAL *src = base + k * MATH_EXPR_BATCH_BLOCK;
+                    for (size_t i = 0; i < rows; ++i) {
+                        lane[i] += src[i];
+                    }
+                }
+                MATH_EXPR_REAL *lane1 = base + MATH_EXPR_BATCH_BLOCK;
+                MATH_EXPR_REAL *lane2 = base + 2U * MATH_EXPR_BATCH_BLOCK;
+                MATH_EXPR_REAL *lane3 = base + 3U * MATH_EXPR_BATCH_BLOCK;
+                for (size_t i = 0; i < rows; ++i) {
+                    base[i] = (base[i] + lane1[i]) + (lane2[i] + lane3[i]);
+                }
+            }
+            if (kind == MATH_EXPR_AGGREGATE_AVG) {
+                MATH_EXPR_REAL divisor = (MATH_EXPR_REAL)count;
+                for (size_t i = 0; i < rows; ++i) {
+                    base[i] /= divisor;
+                }
+            }
+            top = top - count + 1U;
+            break;
+        }
+        case MATH_EXPR_OP_JUMP: {
+            batch_branch *branch = open > 0U ? &workspace->branches[open - 1U] : NULL;
+            if (branch && !branch->in_else && pc == branch->else_pc) {
+                /* End of a then branch some active rows skip: park it and run the else branch. */
+                if (top != branch->depth + 1U) {
+                    fprintf(stderr, "math_expr_batch: malformed program\n");
+                    return -1;
+                }
+                memcpy(branch->then_values, rhs, rows * sizeof(MATH_EXPR_REAL));
+                --top;
+                branch->join = instruction->operand;
+                branch->in_else = 1;
+                mask = branch->else_mask;
+                break;
+            }
+            pc = instruction->operand;
+            break;
+        }
+        case MATH_EXPR_OP_JUMP_IF_FALSE: {
+            size_t taken = 0U;
+            size_t skipped = 0U;
+            --top;
+            for (size_t i = 0; i < rows; ++i) {
+                taken += mask[i] & (rhs[i] != 0);
+                skipped += mask[i] & (rhs[i] == 0);
+            }
+
+            if (taken == 0U) {
+                pc = instruction->operand;
+            } else if (skipped > 0U) {
+                if (open == workspace->branch_count) {
+                    fprintf(stderr, "math_expr_batch: malformed program\n");
+                    return -1;
+                }
+                batch_branch *branch = &workspace->branches[open++];
+                for (size_t i = 0; i < rows; ++i) {
+                    branch->then_mask[i] = mask[i] & (rhs[i] != 0);
+                    branch->else_mask[i] = mask[i] & (rhs[i] == 0);
+                }
+                branch->else_pc = instruction->operand;
+                branch->depth = top;
+                branch->in_else = 0;
+                mask = branch->then_mask;
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "math_expr_batch: unsupported opcode %u\n", (unsigned)instruction->opcode);
+            return -1;
+        }
+    }
+
+    if (open > 0U &&
+        (MATH_EXPR_CAT(join_branches, MATH_EXPR_SUFFIX)(workspace,
+                                                        &open,
+                                                        pc,
+                                                        stack,
+                                                        top,
+                                                        rows,
+                                                        &mask) != 0 ||
+         open > 0U)) {
+        fprintf(stderr, "math_expr_batch: malformed program\n");
+        return -1;
+    }
+
+    if (top != 1U) {
+        fprintf(stderr, "math_expr_batch: malformed program\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < rows; ++i) {
+        out_results[i] = (MATH_EXPR_IO)stack[i];
+    }
+    return 0;
+}
+
+static int MATH_EXPR_CAT(run_rows, MATH_EXPR_SUFFIX)(const math_expr_program *program,
+                                                     const MATH_EXPR_IO *const *columns,
+                                                     size_t first_row,
+                                                     size_t row_count,
+                                                     batch_workspace *workspace,
+                                                     MATH_EXPR_IO *out_results)
+{
+    for (size_t row = first_row; row < first_row + row_count; row += MATH_EXPR_BATCH_BLOCK) {
+        size_t rows = first_row + row_count - row;
+        if (rows > MATH_EXPR_BATCH_BLOCK) {
+            rows = MATH_EXPR_BATCH_BLOCK;
+        }
+
+        if (MATH_EXPR_CAT(run_block, MATH_EXPR_SUFFIX)(program, columns, row, rows, workspace, out_results + row) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#undef MATH_EXPR_CAT
+#undef MATH_EXPR_CAT_
+#undef MATH_EXPR_REAL
+#undef MATH_EXPR_IO
+#undef MATH_EXPR_SUFFIX
+#undef MATH_EXPR_FMOD
+#undef MATH_EXPR_POW
+#undef MATH_EXPR_BUILTIN_FUNC
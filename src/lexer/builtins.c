@@ -0,0 +1,356 @@
+#include "builtins.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifndef M_E
+#define M_E 2.71828182845904523536
+#endif
+
+int math_expr_str_iequal(const char *lhs, size_t lhs_length, const char *rhs)
+{
+    if (!lhs || !rhs) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < lhs_length; ++i) {
+        if (rhs[i] == '\0' || tolower((unsigned char)lhs[i]) != tolower((unsigned char)rhs[i])) {
+            return 0;
+        }
+    }
+
+    return rhs[lhs_length] == '\0';
+}
+
+static double func_sin(const double *args)
+{
+    return math_expr_sin_degrees(args[0]);
+}
+
+static double func_cos(const double *args)
+{
+    return math_expr_cos_degrees(args[0]);
+}
+
+static double func_tan(const double *args)
+{
+    return math_expr_tan_degrees(args[0]);
+}
+
+static double func_sin_paired(const double *args)
+{
+    return math_expr_sin_degrees_paired(args[0]);
+}
+
+static double func_cos_paired(const double *args)
+{
+    return math_expr_cos_degrees_paired(args[0]);
+}
+
+static double func_sqrt(const double *args)
+{
+    return sqrt(args[0]);
+}
+
+static double func_abs(const double *args)
+{
+    return fabs(args[0]);
+}
+
+static double func_ln(const double *args)
+{
+    return log(args[0]);
+}
+
+static double func_log(const double *args)
+{
+    return log10(args[0]);
+}
+
+static double func_exp(const double *args)
+{
+    return exp(args[0]);
+}
+
+static double func_pow(const double *args)
+{
+    return pow(args[0], args[1]);
+}
+
+static double func_max(const double *args)
+{
+    return args[0] > args[1] ? args[0] : args[1];
+}
+
+static double func_min(const double *args)
+{
+    return args[0] < args[1] ? args[0] : args[1];
+}
+
+static float func_sin_f32(const float *args)
+{
+    return math_expr_sin_degrees_f32(args[0]);
+}
+
+static float func_cos_f32(const float *args)
+{
+    return math_expr_cos_degrees_f32(args[0]);
+}
+
+static float func_tan_f32(const float *args)
+{
+    return math_expr_tan_degrees_f32(args[0]);
+}
+
+static float func_sin_paired_f32(const float *args)
+{
+    return math_expr_sin_degrees_paired_f32(args[0]);
+}
+
+static float func_cos_paired_f32(const float *args)
+{
+    return math_expr_cos_degrees_paired_f32(args[0]);
+}
+
+static float func_sqrt_f32(const float *args)
+{
+    return sqrtf(args[0]);
+}
+
+static float func_abs_f32(const float *args)
+{
+    return fabsf(args[0]);
+}
+
+static float func_ln_f32(const float *args)
+{
+    return logf(args[0]);
+}
+
+static float func_log_f32(const float *args)
+{
+    return log10f(args[0]);
+}
+
+static float func_exp_f32(const float *args)
+{
+    return expf(args[0]);
+}
+
+static float func_pow_f32(const float *args)
+{
+    return powf(args[0], args[1]);
+}
+
+static float func_max_f32(const float *args)
+{
+    return args[0] > args[1] ? args[0] : args[1];
+}
+
+static float func_min_f32(const float *args)
+{
+    return args[0] < args[1] ? args[0] : args[1];
+}
+
+static const math_expr_builtin kBuiltins[MATH_EXPR_BUILTIN_COUNT] = {
+    [MATH_EXPR_BUILTIN_SIN] = {"sin", 1, MATH_EXPR_BUILTIN_SIN, func_sin, func_sin_f32},
+    [MATH_EXPR_BUILTIN_COS] = {"cos", 1, MATH_EXPR_BUILTIN_COS, func_cos, func_cos_f32},
+    [MATH_EXPR_BUILTIN_TAN] = {"tan", 1, MATH_EXPR_BUILTIN_TAN, func_tan, func_tan_f32},
+    [MATH_EXPR_BUILTIN_SQRT] = {"sqrt", 1, MATH_EXPR_BUILTIN_SQRT, func_sqrt, func_sqrt_f32},
+    [MATH_EXPR_BUILTIN_ABS] = {"abs", 1, MATH_EXPR_BUILTIN_ABS, func_abs, func_abs_f32},
+    [MATH_EXPR_BUILTIN_LN] = {"ln", 1, MATH_EXPR_BUILTIN_LN, func_ln, func_ln_f32},
+    [MATH_EXPR_BUILTIN_LOG] = {"log", 1, MATH_EXPR_BUILTIN_LOG, func_log, func_log_f32},
+    [MATH_EXPR_BUILTIN_EXP] = {"exp", 1, MATH_EXPR_BUILTIN_EXP, func_exp, func_exp_f32},
+    [MATH_EXPR_BUILTIN_POW] = {"pow", 2, MATH_EXPR_BUILTIN_POW, func_pow, func_pow_f32},
+    [MATH_EXPR_BUILTIN_MAX] = {"max", 2, MATH_EXPR_BUILTIN_MAX, func_max, func_max_f32},
+    [MATH_EXPR_BUILTIN_MIN] = {"min", 2, MATH_EXPR_BUILTIN_MIN, func_min, func_min_f32},
+    /* After the plain entries, so name lookups never return them. */
+    [MATH_EXPR_BUILTIN_SIN_PAIRED] = {"sin", 1, MATH_EXPR_BUILTIN_SIN, func_sin_paired, func_sin_paired_f32},
+    [MATH_EXPR_BUILTIN_COS_PAIRED] = {"cos", 1, MATH_EXPR_BUILTIN_COS, func_cos_paired, func_cos_paired_f32}
+};
+
+const math_expr_builtin *math_expr_builtin_get(size_t index)
+{
+    if (index >= MATH_EXPR_BUILTIN_COUNT) {
+        return NULL;
+    }
+
+    return &kBuiltins[index];
+}
+
+int math_expr_builtin_find(const char *name, size_t length, size_t *out_index)
+{
+    if (!name) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < MATH_EXPR_BUILTIN_COUNT; ++i) {
+        if (math_expr_str_iequal(name, length, kBuiltins[i].name)) {
+            if (out_index) {
+                *out_index = i;
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int math_expr_constant_lookup(const char *name, size_t length, double *out)
+{
+    if (!name || !out) {
+        return -1;
+    }
+
+    struct constant_entry {
+        const char *name;
+        double value;
+    };
+
+    static const struct constant_entry constants[] = {
+        {"pi", M_PI},
+        {"e", M_E}
+    };
+
+    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); ++i) {
+        if (math_expr_str_iequal(name, length, constants[i].name)) {
+            *out = constants[i].value;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int math_expr_aggregate_find(const char *name, size_t length, math_expr_aggregate *out_kind)
+{
+    static const char *const names[] = {
+        [MATH_EXPR_AGGREGATE_SUM] = "sum",
+        [MATH_EXPR_AGGREGATE_AVG] = "avg",
+        [MATH_EXPR_AGGREGATE_MIN] = "min",
+        [MATH_EXPR_AGGREGATE_MAX] = "max"
+    };
+
+    if (!name) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (math_expr_str_iequal(name, length, names[i])) {
+            if (out_kind) {
+                *out_kind = (math_expr_aggregate)i;
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* The block loop over four independent lanes vectorizes without reassociating. */
+static double sum_f64(const double *values, size_t count)
+{
+    if (count < 4U) {
+        double sum = values[0];
+        for (size_t i = 1; i < count; ++i) {
+            sum += values[i];
+        }
+        return sum;
+    }
+
+    double lanes[4] = {values[0], values[1], values[2], values[3]};
+    size_t i = 4U;
+    for (; i + 4U <= count; i += 4U) {
+        for (size_t k = 0; k < 4U; ++k) {
+            lanes[k] += values[i + k];
+        }
+    }
+    for (size_t k = 0; i + k < count; ++k) {
+        lanes[k] += values[i + k];
+    }
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static float sum_f32(const float *values, size_t count)
+{
+    if (count < 4U) {
+        float sum = values[0];
+        for (size_t i = 1; i < count; ++i) {
+            sum += values[i];
+        }
+        return sum;
+    }
+
+    float lanes[4] = {values[0], values[1], values[2], values[3]};
+    size_t i = 4U;
+    for (; i + 4U <= count; i += 4U) {
+        for (size_t k = 0; k < 4U; ++k) {
+            lanes[k] += values[i + k];
+        }
+    }
+    for (size_t k = 0; i + k < count; ++k) {
+        lanes[k] += values[i + k];
+    }
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+double math_expr_aggregate_reduce(math_expr_aggregate kind, const double *values, size_t count)
+{
+    double result = values[0];
+
+    switch (kind) {
+    case MATH_EXPR_AGGREGATE_SUM:
+        return sum_f64(values, count);
+    case MATH_EXPR_AGGREGATE_AVG:
+        return sum_f64(values, count) / (double)count;
+    case MATH_EXPR_AGGREGATE_MIN:
+        for (size_t i = 1; i < count; ++i) {
+            result = result < values[i] ? result : values[i];
+        }
+        return result;
+    default:
+        for (size_t i = 1; i < count; ++i) {
+            result = result > values[i] ? result : values[i];
+        }
+        return result;
+    }
+}
+
+float math_expr_aggregate_reduce_f32(math_expr_aggregate kind, const float *values, size_t count)
+{
+    float result = values[0];
+
+    switch (kind) {
+    case MATH_EXPR_AGGREGATE_SUM:
+        return sum_f32(values, count);
+    case MATH_EXPR_AGGREGATE_AVG:
+        return sum_f32(values, count) / (float)count;
+    case MATH_EXPR_AGGREGATE_MIN:
+        for (size_t i = 1; i < count; ++i) {
+            result = result < values[i] ? result : values[i];
+        }
+        return result;
+    default:
+        for (size_t i = 1; i < count; ++i) {
+            result = result > values[i] ? result : values[i];
+        }
+        return result;
+    }
+}
+
+size_t math_expr_aggregate_select(math_expr_aggregate kind, const double *values, size_t count)
+{
+    size_t selected = 0U;
+
+    for (size_t i = 1; i < count; ++i) {
+        int keep = kind == MATH_EXPR_AGGREGATE_MIN ? values[selected] < values[i] : values[selected] > values[i];
+        if (!keep) {
+            selected = i;
+        }
+    }
+    return selected;
+}
@@ -0,0 +1,82 @@
+#ifndef MATH_EXPR_BUILTINS_H
+#define MATH_EXPR_BUILTINS_H
+
+#include <stddef.h>
+
+#include "math_expr/compiler.h"
+
+/*
+ * Internal table of builtin functions and named constants shared by the
+ * reference evaluator and the bytecode compiler.
+ */
+
+typedef enum math_expr_builtin_id {
+    MATH_EXPR_BUILTIN_SIN,
+    MATH_EXPR_BUILTIN_COS,
+    MATH_EXPR_BUILTIN_TAN,
+    MATH_EXPR_BUILTIN_SQRT,
+    MATH_EXPR_BUILTIN_ABS,
+    MATH_EXPR_BUILTIN_LN,
+    MATH_EXPR_BUILTIN_LOG,
+    MATH_EXPR_BUILTIN_EXP,
+    MATH_EXPR_BUILTIN_POW,
+    MATH_EXPR_BUILTIN_MAX,
+    MATH_EXPR_BUILTIN_MIN,
+    /* sin and cos of an argument the program takes both of; found by the compiler only. */
+    MATH_EXPR_BUILTIN_SIN_PAIRED,
+    MATH_EXPR_BUILTIN_COS_PAIRED,
+    MATH_EXPR_BUILTIN_COUNT
+} math_expr_builtin_id;
+
+typedef struct math_expr_builtin {
+    const char *name;
+    size_t arity;
+    math_expr_builtin_id canonical; /* Function computed; differs from the index for paired entries. */
+    double (*func)(const double *args);
+    float (*func_f32)(const float *args);
+} math_expr_builtin;
+
+/* Names are passed with an explicit length so packed lexemes can be used in place. */
+int math_expr_str_iequal(const char *lhs, size_t lhs_length, const char *rhs);
+
+const math_expr_builtin *math_expr_builtin_get(size_t index);
+int math_expr_builtin_find(const char *name, size_t length, size_t *out_index);
+int math_expr_constant_lookup(const char *name, size_t length, double *out);
+
+/*
+ * Aggregates sum, avg, min and max take any number of arguments and arrays.
+ * Both precisions and every engine reduce through these functions, so the
+ * order of additions is the same everywhere: a left fold below four values,
+ * and four interleaved partial sums combined as (s0 + s1) + (s2 + s3) above.
+ */
+int math_expr_aggregate_find(const char *name, size_t length, math_expr_aggregate *out_kind);
+double math_expr_aggregate_reduce(math_expr_aggregate kind, const double *values, size_t count);
+float math_expr_aggregate_reduce_f32(math_expr_aggregate kind, const float *values, size_t count);
+
+/* Index of the value min or max selects; ties and NaN resolve as in the reduction. */
+size_t math_expr_aggregate_select(math_expr_aggregate kind, const double *values, size_t count);
+
+/*
+ * Degree-based trigonometry behind sin, cos and tan (trig.c). The paired
+ * variants compute sin and cos together and keep both for the next call on
+ * the same argument in the same thread; they return exactly what the plain
+ * functions return.
+ */
+double math_expr_sin_degrees(double degrees);
+double math_expr_cos_degrees(double degrees);
+double math_expr_tan_degrees(double degrees);
+float math_expr_sin_degrees_f32(float degrees);
+float math_expr_cos_degrees_f32(float degrees);
+float math_expr_tan_degrees_f32(float degrees);
+double math_expr_sin_degrees_paired(double degrees);
+double math_expr_cos_degrees_paired(double degrees);
+float math_expr_sin_degrees_paired_f32(float degrees);
+float math_expr_cos_degrees_paired_f32(float degrees);
+
+/* Absolute error of sin and cos in the current mode beyond the C library's. */
+double math_expr_trig_max_error(void);
+
+/* Name of the lazy conditional if(cond, then, else); reserved like the builtins. */
+#define MATH_EXPR_CONDITIONAL_NAME "if"
+
+#endif // MATH_EXPR_BUILTINS_H
@@ -0,0 +1,1021 @@
+#include "math_expr/compiler.h"
+
+#include "builtins.h"
+#include "context_internal.h"
+#include "program_internal.h"
+#include "stats_internal.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t kInitialCodeCapacity = 16U;
+
+typedef struct compiler_token {
+    math_expr_token_type type;
+    int op;
+    const char *text;
+    size_t length;
+    double number;
+} compiler_token;
+
+typedef struct compiler {
+    const math_expr_token_array *tokens;
+    const math_expr_packed_token_array *packed;
+    size_t index;
+    size_t number_index;
+    compiler_token current;
+    math_expr_program *program;
+    size_t depth;
+    const math_expr_registry *registry;
+} compiler;
+
+void math_expr_program_init(math_expr_program *program)
+{
+    if (!program) {
+        return;
+    }
+
+    memset(program, 0, sizeof(*program));
+}
+
+void math_expr_program_deinit(math_expr_program *program)
+{
+    if (!program) {
+        return;
+    }
+
+    if (!(program->flags & MATH_EXPR_PROGRAM_BORROWED)) {
+        for (size_t i = 0; i < program->symbol_count; ++i) {
+            free(program->symbols[i]);
+        }
+        free(program->constants);
+        free(program->code);
+    }
+
+    free(program->symbols);
+    free(program->functions);
+    math_expr_program_init(program);
+}
+
+static int grow_buffer(void **data, size_t *capacity, size_t required, size_t element_size)
+{
+    if (required <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity == 0U ? kInitialCodeCapacity : *capacity * 2U;
+    while (new_capacity < required) {
+        new_capacity *= 2U;
+    }
+
+    void *new_data = realloc(*data, new_capacity * element_size);
+    if (!new_data) {
+        perror("math_expr_compiler: realloc");
+        return -1;
+    }
+
+    MATH_EXPR_STATS_ALLOC(new_capacity * element_size);
+    *data = new_data;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int emit(compiler *c, math_expr_opcode opcode, uint32_t operand, size_t pops, size_t pushes)
+{
+    math_expr_program *program = c->program;
+    if (grow_buffer((void **)&program->code,
+                    &program->code_capacity,
+                    program->code_size + 1U,
+                    sizeof(*program->code)) != 0) {
+        return -1;
+    }
+
+    program->code[program->code_size].opcode = (uint32_t)opcode;
+    program->code[program->code_size].operand = operand;
+    ++program->code_size;
+
+    c->depth = c->depth - pops + pushes;
+    if (c->depth > program->max_stack) {
+        program->max_stack = c->depth;
+    }
+    return 0;
+}
+
+static int emit_constant(compiler *c, double value)
+{
+    math_expr_program *program = c->program;
+    if (grow_buffer((void **)&program->constants,
+                    &program->constant_capacity,
+                    program->constant_count + 1U,
+                    sizeof(*program->constants)) != 0) {
+        return -1;
+    }
+
+    program->constants[program->constant_count] = value;
+    return emit(c, MATH_EXPR_OP_CONST, (uint32_t)program->constant_count++, 0U, 1U);
+}
+
+static int find_symbol(const math_expr_program *program, const char *name, size_t length, size_t *out_slot)
+{
+    for (size_t i = 0; i < program->symbol_count; ++i) {
+        if (strncmp(program->symbols[i], name, length) == 0 && program->symbols[i][length] == '\0') {
+            *out_slot = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int emit_load(compiler *c, const char *name, size_t length)
+{
+    math_expr_program *program = c->program;
+    size_t slot = 0U;
+
+    if (find_symbol(program, name, length, &slot) != 0) {
+        if (grow_buffer((void **)&program->symbols,
+                        &program->symbol_capacity,
+                        program->symbol_count + 1U,
+                        sizeof(*program->symbols)) != 0) {
+            return -1;
+        }
+
+        char *copy = (char *)malloc(length + 1U);
+        if (!copy) {
+            perror("math_expr_compiler: malloc");
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC(length + 1U);
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+
+        slot = program->symbol_count;
+        program->symbols[program->symbol_count++] = copy;
+    }
+
+    return emit(c, MATH_EXPR_OP_LOAD, (uint32_t)slot, 0U, 1U);
+}
+
+static int emit_external_call(compiler *c, const char *name, size_t length, size_t arg_count)
+{
+    const math_expr_registry_entry *entry =
+        math_expr_registry_find(c->registry, MATH_EXPR_REGISTRY_FUNCTION, name, length);
+    if (!entry) {
+        fprintf(stderr, "math_expr_compiler: unknown function '%.*s'\n", (int)length, name);
+        return -1;
+    }
+
+    if (entry->function.arity != arg_count) {
+        fprintf(stderr,
+                "math_expr_compiler: function '%.*s' expects %zu argument(s)\n",
+                (int)length,
+                name,
+                entry->function.arity);
+        return -1;
+    }
+
+    math_expr_program *program = c->program;
+    size_t index = 0U;
+    while (index < program->function_count &&
+           (program->functions[index].func != entry->function.func ||
+            program->functions[index].user_data != entry->function.user_data ||
+            program->functions[index].arity != entry->function.arity)) {
+        ++index;
+    }
+
+    if (index == program->function_count) {
+        if (grow_buffer((void **)&program->functions,
+                        &program->function_capacity,
+                        program->function_count + 1U,
+                        sizeof(*program->functions)) != 0) {
+            return -1;
+        }
+        program->functions[program->function_count++] = entry->function;
+    }
+
+    return emit(c, MATH_EXPR_OP_CALL_EXTERNAL, (uint32_t)index, arg_count, 1U);
+}
+
+/* Emit a jump whose target is filled in by patch_jump once it is known. */
+static int emit_jump(compiler *c, math_expr_opcode opcode, size_t *out_index)
+{
+    *out_index = c->program->code_size;
+    return emit(c, opcode, 0U, opcode == MATH_EXPR_OP_JUMP_IF_FALSE ? 1U : 0U, 0U);
+}
+
+static void patch_jump(compiler *c, size_t index)
+{
+    c->program->code[index].operand = (uint32_t)c->program->code_size;
+}
+
+static const compiler_token *compiler_peek(compiler *c)
+{
+    compiler_token *current = &c->current;
+
+    if (c->packed) {
+        const math_expr_packed_token_array *packed = c->packed;
+        while (c->index < packed->size && packed->data[c->index].type == MATH_EXPR_TOKEN_SPACE) {
+            ++c->index;
+        }
+
+        if (c->index >= packed->size) {
+            return NULL;
+        }
+
+        const math_expr_packed_token *token = &packed->data[c->index];
+        current->type = (math_expr_token_type)token->type;
+        current->op = token->op;
+        current->text = packed->source + token->offset;
+        current->length = token->length;
+        current->number = token->type == MATH_EXPR_TOKEN_NUMBER ? packed->numbers[c->number_index] : 0.0;
+        return current;
+    }
+
+    while (c->index < c->tokens->size &&
+           c->tokens->data[c->index].type == MATH_EXPR_TOKEN_SPACE) {
+        ++c->index;
+    }
+
+    if (c->index >= c->tokens->size) {
+        return NULL;
+    }
+
+    const math_expr_token *token = &c->tokens->data[c->index];
+    current->type = token->type;
+    current->text = token->lexeme;
+    current->length = strlen(token->lexeme);
+    current->op = token->type == MATH_EXPR_TOKEN_OPERATOR ? math_expr_operator_code(token->lexeme, current->length) : 0;
+    current->number = token->number;
+    return current;
+}
+
+static void compiler_advance(compiler *c)
+{
+    if (c->packed && c->packed->data[c->index].type == MATH_EXPR_TOKEN_NUMBER) {
+        ++c->number_index;
+    }
+
+    ++c->index;
+}
+
+static int compiler_match_operator(compiler *c, int op)
+{
+    const compiler_token *token = compiler_peek(c);
+    if (!token || token->type != MATH_EXPR_TOKEN_OPERATOR) {
+        return 0;
+    }
+
+    if (token->op == op) {
+        compiler_advance(c);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int compiler_expect_operator(compiler *c, int op)
+{
+    if (compiler_match_operator(c, op)) {
+        return 0;
+    }
+
+    fprintf(stderr, "math_expr_compiler: expected '%c'\n", op);
+    return -1;
+}
+
+static int compile_expression(compiler *c);
+
+/*
+ * Compile cond, JUMP_IF_FALSE else, then, JUMP end, else: the taken branch
+ * is the only one executed. Each branch pushes one value, so the compiler's
+ * depth is rewound by one before the else branch.
+ */
+static int compile_branches(compiler *c, int (*compile_then)(compiler *), int (*compile_else)(compiler *))
+{
+    size_t else_jump = 0U;
+    size_t end_jump = 0U;
+
+    if (emit_jump(c, MATH_EXPR_OP_JUMP_IF_FALSE, &else_jump) != 0 || compile_then(c) != 0 ||
+        emit_jump(c, MATH_EXPR_OP_JUMP, &end_jump) != 0) {
+        return -1;
+    }
+
+    patch_jump(c, else_jump);
+    --c->depth;
+    if (compile_else(c) != 0) {
+        return -1;
+    }
+    patch_jump(c, end_jump);
+    return 0;
+}
+
+static int compile_conditional_then(compiler *c)
+{
+    return compile_expression(c) != 0 || compiler_expect_operator(c, ',') != 0 ? -1 : 0;
+}
+
+static int compile_conditional_else(compiler *c)
+{
+    return compile_expression(c) != 0 || compiler_expect_operator(c, ')') != 0 ? -1 : 0;
+}
+
+/* if(cond, then, else) after "if(". */
+static int compile_conditional(compiler *c)
+{
+    if (compile_expression(c) != 0 || compiler_expect_operator(c, ',') != 0) {
+        return -1;
+    }
+
+    return compile_branches(c, compile_conditional_then, compile_conditional_else);
+}
+
+static int compile_call(compiler *c, const char *name, size_t length)
+{
+    size_t arg_count = 0U;
+
+    if (!compiler_match_operator(c, ')')) {
+        for (;;) {
+            if (compile_expression(c) != 0) {
+                return -1;
+            }
+            ++arg_count;
+
+            if (!compiler_match_operator(c, ',')) {
+                break;
+            }
+        }
+
+        if (compiler_expect_operator(c, ')') != 0) {
+            return -1;
+        }
+    }
+
+    size_t index = 0U;
+    if (math_expr_builtin_find(name, length, &index) != 0) {
+        return emit_external_call(c, name, length, arg_count);
+    }
+
+    const math_expr_builtin *builtin = math_expr_builtin_get(index);
+    if (builtin->arity != arg_count) {
+        fprintf(stderr,
+                "math_expr_compiler: function '%.*s' expects %zu argument(s)\n",
+                (int)length,
+                name,
+                builtin->arity);
+        return -1;
+    }
+
+    return emit(c, MATH_EXPR_OP_CALL, (uint32_t)index, arg_count, 1U);
+}
+
+static int compiler_next_is_operator(compiler *c, int op)
+{
+    const compiler_token *token = compiler_peek(c);
+    return token && token->type == MATH_EXPR_TOKEN_OPERATOR && token->op == op;
+}
+
+/*
+ * One argument of an aggregate, as in the evaluator: an array literal, a
+ * registered array name standing on its own, or any expression. Each value
+ * is pushed separately; *count tracks how many.
+ */
+static int compile_aggregate_argument(compiler *c, size_t *count, int *out_has_array)
+{
+    if (compiler_match_operator(c, '[')) {
+        *out_has_array = 1;
+        if (compiler_match_operator(c, ']')) {
+            return 0;
+        }
+        do {
+            if (compile_aggregate_argument(c, count, out_has_array) != 0) {
+                return -1;
+            }
+        } while (compiler_match_operator(c, ','));
+        return compiler_expect_operator(c, ']');
+    }
+
+    const compiler_token *token = compiler_peek(c);
+    if (token && token->type == MATH_EXPR_TOKEN_IDENTIFIER) {
+        const math_expr_registry_entry *entry =
+            math_expr_registry_find(c->registry, MATH_EXPR_REGISTRY_ARRAY, token->text, token->length);
+        size_t saved_index = c->index;
+        size_t saved_number_index = c->number_index;
+        compiler_advance(c);
+        if (entry && (compiler_next_is_operator(c, ',') || compiler_next_is_operator(c, ')') ||
+                      compiler_next_is_operator(c, ']'))) {
+            *out_has_array = 1;
+            for (size_t i = 0; i < entry->value_count; ++i) {
+                if (emit_constant(c, entry->values[i]) != 0) {
+                    return -1;
+                }
+            }
+            *count += entry->value_count;
+            return 0;
+        }
+        c->index = saved_index;
+        c->number_index = saved_number_index;
+    }
+
+    if (compile_expression(c) != 0) {
+        return -1;
+    }
+    ++*count;
+    return 0;
+}
+
+/* sum, avg, min or max after "name(": the values, then one REDUCE. */
+static int compile_aggregate(compiler *c, const char *name, size_t length, math_expr_aggregate kind)
+{
+    size_t count = 0U;
+    int has_array = 0;
+
+    if (!compiler_next_is_operator(c, ')')) {
+        do {
+            if (compile_aggregate_argument(c, &count, &has_array) != 0) {
+                return -1;
+            }
+        } while (compiler_match_operator(c, ','));
+    }
+
+    if (compiler_expect_operator(c, ')') != 0) {
+        return -1;
+    }
+
+    if (count == 0U) {
+        fprintf(stderr, "math_expr_compiler: function '%.*s' expects at least one value\n", (int)length, name);
+        return -1;
+    }
+    if (count > MATH_EXPR_REDUCE_MAX_COUNT) {
+        fprintf(stderr, "math_expr_compiler: function '%.*s' has too many values (at most %lu)\n", (int)length, name,
+                (unsigned long)MATH_EXPR_REDUCE_MAX_COUNT);
+        return -1;
+    }
+
+    if ((kind == MATH_EXPR_AGGREGATE_MIN || kind == MATH_EXPR_AGGREGATE_MAX) && !has_array && count == 2U) {
+        size_t index = 0U;
+        math_expr_builtin_find(name, length, &index);
+        return emit(c, MATH_EXPR_OP_CALL, (uint32_t)index, 2U, 1U);
+    }
+
+    return emit(c, MATH_EXPR_OP_REDUCE, (uint32_t)(count << 2) | (uint32_t)kind, count, 1U);
+}
+
+static int compile_primary(compiler *c)
+{
+    const compiler_token *token = compiler_peek(c);
+    if (!token) {
+        fprintf(stderr, "math_expr_compiler: unexpected end of input\n");
+        return -1;
+    }
+
+    if (token->type == MATH_EXPR_TOKEN_NUMBER) {
+        double number = token->number;
+        compiler_advance(c);
+        return emit_constant(c, number);
+    }
+
+    if (token->type == MATH_EXPR_TOKEN_OPERATOR && token->op == '(') {
+        compiler_advance(c);
+        if (compile_expression(c) != 0) {
+            return -1;
+        }
+        return compiler_expect_operator(c, ')');
+    }
+
+    if (token->type == MATH_EXPR_TOKEN_IDENTIFIER) {
+        const char *identifier = token->text;
+        size_t length = token->length;
+        compiler_advance(c);
+
+        if (compiler_match_operator(c, '(')) {
+            if (math_expr_str_iequal(identifier, length, MATH_EXPR_CONDITIONAL_NAME)) {
+                return compile_conditional(c);
+            }
+            math_expr_aggregate kind;
+            if (math_expr_aggregate_find(identifier, length, &kind) == 0) {
+                return compile_aggregate(c, identifier, length, kind);
+            }
+            return compile_call(c, identifier, length);
+        }
+
+        double value = 0.0;
+        if (math_expr_constant_lookup(identifier, length, &value) == 0) {
+            return emit_constant(c, value);
+        }
+
+        const math_expr_registry_entry *entry =
+            math_expr_registry_find(c->registry, MATH_EXPR_REGISTRY_CONSTANT, identifier, length);
+        if (entry) {
+            return emit_constant(c, entry->value);
+        }
+
+        return emit_load(c, identifier, length);
+    }
+
+    fprintf(stderr, "math_expr_compiler: unexpected token '%.*s'\n", (int)token->length, token->text);
+    return -1;
+}
+
+static int compile_power(compiler *c)
+{
+    if (compile_primary(c) != 0) {
+        return -1;
+    }
+
+    if (compiler_match_operator(c, '^')) {
+        if (compile_power(c) != 0) {
+            return -1;
+        }
+        return emit(c, MATH_EXPR_OP_POW, 0U, 2U, 1U);
+    }
+
+    return 0;
+}
+
+static int compile_unary(compiler *c)
+{
+    if (compiler_match_operator(c, '+')) {
+        return compile_unary(c);
+    }
+
+    if (compiler_match_operator(c, '-')) {
+        if (compile_unary(c) != 0) {
+            return -1;
+        }
+        return emit(c, MATH_EXPR_OP_NEG, 0U, 1U, 1U);
+    }
+
+    if (compiler_match_operator(c, '!')) {
+        if (compile_unary(c) != 0) {
+            return -1;
+        }
+        return emit(c, MATH_EXPR_OP_NOT, 0U, 1U, 1U);
+    }
+
+    return compile_power(c);
+}
+
+static int compile_term(compiler *c)
+{
+    if (compile_unary(c) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        math_expr_opcode opcode;
+        if (compiler_match_operator(c, '*')) {
+            opcode = MATH_EXPR_OP_MUL;
+        } else if (compiler_match_operator(c, '/')) {
+            opcode = MATH_EXPR_OP_DIV;
+        } else if (compiler_match_operator(c, '%')) {
+            opcode = MATH_EXPR_OP_MOD;
+        } else {
+            break;
+        }
+
+        if (compile_unary(c) != 0 || emit(c, opcode, 0U, 2U, 1U) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int compile_sum(compiler *c)
+{
+    if (compile_term(c) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        math_expr_opcode opcode;
+        if (compiler_match_operator(c, '+')) {
+            opcode = MATH_EXPR_OP_ADD;
+        } else if (compiler_match_operator(c, '-')) {
+            opcode = MATH_EXPR_OP_SUB;
+        } else {
+            break;
+        }
+
+        if (compile_term(c) != 0 || emit(c, opcode, 0U, 2U, 1U) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int compile_relational(compiler *c)
+{
+    if (compile_sum(c) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        math_expr_opcode opcode;
+        if (compiler_match_operator(c, '<')) {
+            opcode = MATH_EXPR_OP_LT;
+        } else if (compiler_match_operator(c, MATH_EXPR_TOKEN_OP_LE)) {
+            opcode = MATH_EXPR_OP_LE;
+        } else if (compiler_match_operator(c, '>')) {
+            opcode = MATH_EXPR_OP_GT;
+        } else if (compiler_match_operator(c, MATH_EXPR_TOKEN_OP_GE)) {
+            opcode = MATH_EXPR_OP_GE;
+        } else {
+            break;
+        }
+
+        if (compile_sum(c) != 0 || emit(c, opcode, 0U, 2U, 1U) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int compile_equality(compiler *c)
+{
+    if (compile_relational(c) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        math_expr_opcode opcode;
+        if (compiler_match_operator(c, MATH_EXPR_TOKEN_OP_EQ)) {
+            opcode = MATH_EXPR_OP_EQ;
+        } else if (compiler_match_operator(c, MATH_EXPR_TOKEN_OP_NE)) {
+            opcode = MATH_EXPR_OP_NE;
+        } else {
+            break;
+        }
+
+        if (compile_relational(c) != 0 || emit(c, opcode, 0U, 2U, 1U) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int compile_truth_of_equality(compiler *c)
+{
+    return compile_equality(c) != 0 ? -1 : emit(c, MATH_EXPR_OP_BOOL, 0U, 1U, 1U);
+}
+
+static int compile_false(compiler *c)
+{
+    return emit_constant(c, 0.0);
+}
+
+static int compile_true(compiler *c)
+{
+    return emit_constant(c, 1.0);
+}
+
+/* a && b is if(a, b != 0, 0) and a || b is if(a, 1, b != 0). */
+static int compile_conjunction(compiler *c)
+{
+    if (compile_equality(c) != 0) {
+        return -1;
+    }
+
+    while (compiler_match_operator(c, MATH_EXPR_TOKEN_OP_AND)) {
+        if (compile_branches(c, compile_truth_of_equality, compile_false) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int compile_truth_of_conjunction(compiler *c)
+{
+    return compile_conjunction(c) != 0 ? -1 : emit(c, MATH_EXPR_OP_BOOL, 0U, 1U, 1U);
+}
+
+static int compile_expression(compiler *c)
+{
+    if (compile_conjunction(c) != 0) {
+        return -1;
+    }
+
+    while (compiler_match_operator(c, MATH_EXPR_TOKEN_OP_OR)) {
+        if (compile_branches(c, compile_true, compile_truth_of_conjunction) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int is_jump(const math_expr_instruction *instruction)
+{
+    return instruction->opcode == MATH_EXPR_OP_JUMP || instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE;
+}
+
+/* Key of an instruction: constants by value, the paired trig builtins as sin and cos. */
+static uint64_t instruction_key(const math_expr_program *program, const math_expr_instruction *instruction)
+{
+    uint64_t operand = instruction->operand;
+
+    if (instruction->opcode == MATH_EXPR_OP_CONST) {
+        memcpy(&operand, &program->constants[instruction->operand], sizeof(operand));
+    } else if (instruction->opcode == MATH_EXPR_OP_CALL) {
+        operand = (uint64_t)math_expr_builtin_get(instruction->operand)->canonical;
+    }
+    return operand * UINT64_C(0x9e3779b97f4a7c15) + instruction->opcode;
+}
+
+static int same_code(const math_expr_program *program, size_t lhs, size_t rhs, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        const math_expr_instruction *a = &program->code[lhs + i];
+        const math_expr_instruction *b = &program->code[rhs + i];
+        if (a->opcode != b->opcode || instruction_key(program, a) != instruction_key(program, b)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_trig_call(const math_expr_instruction *instruction)
+{
+    if (instruction->opcode != MATH_EXPR_OP_CALL) {
+        return 0;
+    }
+    math_expr_builtin_id canonical = math_expr_builtin_get(instruction->operand)->canonical;
+    return canonical == MATH_EXPR_BUILTIN_SIN || canonical == MATH_EXPR_BUILTIN_COS;
+}
+
+/*
+ * Start of the argument of each sin and cos call at pc, or code_size if the
+ * argument contains a jump or is jumped into, and so is not a plain run of
+ * code. The argument begins at the last instruction before pc that ran one
+ * level shallower; prefix counts of jumps and of jump targets then tell in
+ * constant time whether it is plain. Jumps only go forward.
+ */
+static void find_argument_starts(const math_expr_program *program, const size_t *depths, size_t *work, size_t *starts)
+{
+    size_t count = program->code_size + 1U;
+    size_t *last = work;            /* Last pc seen at each depth. */
+    size_t *jumps = work + count;   /* Jumps before pc. */
+    size_t *landed = jumps + count; /* Jumps that target pc or earlier. */
+
+    memset(landed, 0, count * sizeof(*landed));
+    jumps[0] = 0U;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        const math_expr_instruction *instruction = &program->code[pc];
+        jumps[pc + 1U] = jumps[pc] + (size_t)is_jump(instruction);
+        if (is_jump(instruction)) {
+            ++landed[instruction->operand];
+        }
+    }
+    for (size_t pc = 1; pc < count; ++pc) {
+        landed[pc] += landed[pc - 1U];
+    }
+
+    for (size_t depth = 0; depth < count; ++depth) {
+        last[depth] = program->code_size;
+    }
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        starts[pc] = program->code_size;
+        if (is_trig_call(&program->code[pc])) {
+            size_t begin = last[depths[pc] - 1U];
+            if (begin < pc && jumps[begin] == jumps[pc] && landed[begin] == landed[pc]) {
+                starts[pc] = begin;
+            }
+        }
+        last[depths[pc]] = pc;
+    }
+}
+
+/* Arguments of sin and cos calls with equal code, found by hash. */
+typedef struct trig_argument {
+    uint64_t hash;
+    size_t begin;
+    size_t length;
+    size_t next;       /* Next argument in the same bucket, or SIZE_MAX. */
+    unsigned int uses; /* 1 for a sin call, 2 for a cos call. */
+} trig_argument;
+
+/*
+ * Switch sin and cos calls whose arguments compile to the same code to the
+ * paired builtins, which compute both values at the first of the two calls.
+ * Values are unchanged, so this only ever skips work. Argument hashes come
+ * from prefix hashes of the code, so the pass is linear in the code size
+ * apart from comparing arguments whose hashes collide.
+ */
+static int pair_trig_calls(math_expr_program *program)
+{
+    size_t sines = 0U;
+    size_t cosines = 0U;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        if (program->code[pc].opcode == MATH_EXPR_OP_CALL) {
+            sines += program->code[pc].operand == MATH_EXPR_BUILTIN_SIN;
+            cosines += program->code[pc].operand == MATH_EXPR_BUILTIN_COS;
+        }
+    }
+    if (sines == 0U || cosines == 0U) {
+        return 0;
+    }
+
+    size_t count = program->code_size + 1U;
+    size_t calls = sines + cosines;
+    size_t bucket_count = 1U;
+    while (bucket_count < 2U * calls) {
+        bucket_count <<= 1U;
+    }
+
+    /* Depths, argument starts, then scratch for find_argument_starts reused as the buckets. */
+    size_t words = 5U * count + bucket_count;
+    size_t *depths = (size_t *)malloc(words * sizeof(*depths));
+    uint64_t *prefix = (uint64_t *)malloc(2U * count * sizeof(*prefix));
+    trig_argument *arguments = (trig_argument *)malloc(calls * sizeof(*arguments));
+    if (!depths || !prefix || !arguments) {
+        perror("math_expr_compiler: malloc");
+        free(depths);
+        free(prefix);
+        free(arguments);
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(words * sizeof(*depths) + 2U * count * sizeof(*prefix) + calls * sizeof(*arguments));
+
+    if (math_expr_program_depths(program, depths) != 0) {
+        free(depths);
+        free(prefix);
+        free(arguments);
+        return -1;
+    }
+
+    size_t *starts = depths + count;
+    size_t *buckets = starts + count;
+    find_argument_starts(program, depths, buckets, starts);
+    for (size_t i = 0; i < bucket_count; ++i) {
+        buckets[i] = SIZE_MAX;
+    }
+
+    /* hash(begin, end) = prefix[end] - prefix[begin] * powers[end - begin]. */
+    const uint64_t kBase = UINT64_C(0x100000001b3);
+    uint64_t *powers = prefix + count;
+    prefix[0] = 0U;
+    powers[0] = 1U;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        prefix[pc + 1U] = prefix[pc] * kBase + instruction_key(program, &program->code[pc]);
+        powers[pc + 1U] = powers[pc] * kBase;
+    }
+
+    /* Reuses the depths array: each call's argument, or SIZE_MAX. */
+    size_t *argument_of = depths;
+    size_t argument_count = 0U;
+    math_expr_instruction *code = program->code;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        argument_of[pc] = SIZE_MAX;
+        if (starts[pc] == program->code_size) {
+            continue;
+        }
+
+        size_t begin = starts[pc];
+        size_t length = pc - begin;
+        uint64_t hash = prefix[pc] - prefix[begin] * powers[length];
+        size_t *link = &buckets[(size_t)(hash ^ (hash >> 32)) & (bucket_count - 1U)];
+        while (*link != SIZE_MAX) {
+            const trig_argument *argument = &arguments[*link];
+            if (argument->hash == hash && argument->length == length &&
+                same_code(program, argument->begin, begin, length)) {
+                break;
+            }
+            link = &arguments[*link].next;
+        }
+        if (*link == SIZE_MAX) {
+            arguments[argument_count] = (trig_argument){hash, begin, length, SIZE_MAX, 0U};
+            *link = argument_count++;
+        }
+
+        argument_of[pc] = *link;
+        arguments[*link].uses |= math_expr_builtin_get(code[pc].operand)->canonical == MATH_EXPR_BUILTIN_SIN ? 1U : 2U;
+    }
+
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        if (argument_of[pc] != SIZE_MAX && arguments[argument_of[pc]].uses == 3U) {
+            code[pc].operand = math_expr_builtin_get(code[pc].operand)->canonical == MATH_EXPR_BUILTIN_SIN
+                                   ? MATH_EXPR_BUILTIN_SIN_PAIRED
+                                   : MATH_EXPR_BUILTIN_COS_PAIRED;
+        }
+    }
+
+    free(depths);
+    free(prefix);
+    free(arguments);
+    return 0;
+}
+
+static int compile_program(compiler *c)
+{
+    math_expr_program_deinit(c->program);
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_PARSE);
+    int status = compile_expression(c);
+
+    if (status == 0 && compiler_peek(c) != NULL) {
+        fprintf(stderr, "math_expr_compiler: unexpected trailing tokens\n");
+        status = -1;
+    }
+    if (status == 0) {
+        status = pair_trig_calls(c->program);
+    }
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_PARSE);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+        math_expr_program_deinit(c->program);
+    }
+    return status;
+}
+
+int math_expr_compile_tokens(const math_expr_token_array *tokens, math_expr_program *out_program)
+{
+    if (!tokens || !out_program) {
+        return -1;
+    }
+
+    compiler c = {0};
+    c.tokens = tokens;
+    c.program = out_program;
+    return compile_program(&c);
+}
+
+int math_expr_compile_packed(const math_expr_packed_token_array *tokens, math_expr_program *out_program)
+{
+    if (!tokens || !out_program) {
+        return -1;
+    }
+
+    compiler c = {0};
+    c.packed = tokens;
+    c.program = out_program;
+    return compile_program(&c);
+}
+
+int math_expr_compile_with_context(math_expr_context *context, const char *expression, math_expr_program *out_program)
+{
+    if (!expression || !out_program) {
+        return -1;
+    }
+
+    math_expr_packed_token_array tokens;
+    math_expr_packed_token_array_init(&tokens);
+
+    if (math_expr_lex_packed(expression, &tokens, MATH_EXPR_LEX_SKIP_SPACE) != 0) {
+        math_expr_packed_token_array_deinit(&tokens);
+        return -1;
+    }
+
+    math_expr_snapshot_ticket ticket = 0U;
+    compiler c = {0};
+    c.packed = &tokens;
+    c.program = out_program;
+    c.registry = math_expr_context_read_begin(context, &ticket);
+    int status = compile_program(&c);
+    math_expr_context_read_end(context, ticket);
+
+    math_expr_packed_token_array_deinit(&tokens);
+    return status;
+}
+
+int math_expr_compile(const char *expression, math_expr_program *out_program)
+{
+    if (!expression || !out_program) {
+        return -1;
+    }
+
+    math_expr_packed_token_array tokens;
+    math_expr_packed_token_array_init(&tokens);
+
+    if (math_expr_lex_packed(expression, &tokens, MATH_EXPR_LEX_SKIP_SPACE) != 0) {
+        math_expr_packed_token_array_deinit(&tokens);
+        return -1;
+    }
+
+    int status = math_expr_compile_packed(&tokens, out_program);
+    math_expr_packed_token_array_deinit(&tokens);
+    return status;
+}
+
+int math_expr_program_find_symbol(const math_expr_program *program, const char *name, size_t *out_slot)
+{
+    if (!program || !name) {
+        return -1;
+    }
+
+    size_t slot = 0U;
+    if (find_symbol(program, name, strlen(name), &slot) != 0) {
+        return -1;
+    }
+
+    if (out_slot) {
+        *out_slot = slot;
+    }
+    return 0;
+}
@@ -0,0 +1,397 @@
+#include "context_internal.h"
+
+#include "builtins.h"
+#include "snapshot.h"
+#include "stats_internal.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct math_expr_context {
+    math_expr_snapshot registry;
+    atomic_size_t memory_limit;
+    atomic_size_t memory_peak;
+};
+
+static int compare_key(const math_expr_registry_entry *entry,
+                       math_expr_registry_kind kind,
+                       const char *name,
+                       size_t length)
+{
+    if (entry->kind != kind) {
+        return entry->kind < kind ? -1 : 1;
+    }
+
+    size_t common = entry->length < length ? entry->length : length;
+    for (size_t i = 0; i < common; ++i) {
+        int lhs = (unsigned char)entry->name[i];
+        int rhs = tolower((unsigned char)name[i]);
+        if (lhs != rhs) {
+            return lhs < rhs ? -1 : 1;
+        }
+    }
+
+    if (entry->length != length) {
+        return entry->length < length ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Index of the entry with the key, or of the position where it would be inserted. */
+static size_t lower_bound(const math_expr_registry *registry,
+                          math_expr_registry_kind kind,
+                          const char *name,
+                          size_t length)
+{
+    size_t lo = 0U;
+    size_t hi = registry->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2U;
+        if (compare_key(&registry->entries[mid], kind, name, length) < 0) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+const math_expr_registry_entry *math_expr_registry_find(const math_expr_registry *registry,
+                                                        math_expr_registry_kind kind,
+                                                        const char *name,
+                                                        size_t length)
+{
+    if (!registry || !name) {
+        return NULL;
+    }
+
+    const math_expr_map_value *found = math_expr_map_find(&registry->index[kind], name, length);
+    return found ? &registry->entries[found->index] : NULL;
+}
+
+static void registry_destroy(void *value)
+{
+    math_expr_registry *registry = (math_expr_registry *)value;
+    if (!registry) {
+        return;
+    }
+
+    for (size_t i = 0; i < registry->count; ++i) {
+        free(registry->entries[i].name);
+        free(registry->entries[i].values);
+    }
+    for (int kind = 0; kind < MATH_EXPR_REGISTRY_KIND_COUNT; ++kind) {
+        math_expr_map_deinit(&registry->index[kind]);
+    }
+    free(registry->entries);
+    free(registry);
+}
+
+/* Empty registry with room for count entries. */
+static math_expr_registry *registry_alloc(size_t count)
+{
+    math_expr_registry *registry = (math_expr_registry *)calloc(1U, sizeof(*registry));
+    if (registry && count > 0U) {
+        registry->entries = (math_expr_registry_entry *)calloc(count, sizeof(*registry->entries));
+    }
+    if (!registry || (count > 0U && !registry->entries)) {
+        perror("math_expr_context: calloc");
+        free(registry);
+        return NULL;
+    }
+    MATH_EXPR_STATS_ALLOC(sizeof(*registry) + count * sizeof(*registry->entries));
+
+    for (int kind = 0; kind < MATH_EXPR_REGISTRY_KIND_COUNT; ++kind) {
+        math_expr_map_init(&registry->index[kind], MATH_EXPR_MAP_IGNORE_CASE);
+    }
+    return registry;
+}
+
+static int append_copy(math_expr_registry *registry, const math_expr_registry_entry *entry)
+{
+    math_expr_registry_entry *copy = &registry->entries[registry->count];
+    *copy = *entry;
+    copy->name = (char *)malloc(entry->length + 1U);
+    if (!copy->name) {
+        perror("math_expr_context: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(entry->length + 1U);
+    memcpy(copy->name, entry->name, entry->length + 1U);
+
+    if (entry->value_count > 0U) {
+        copy->values = (double *)malloc(entry->value_count * sizeof(*copy->values));
+        if (!copy->values) {
+            perror("math_expr_context: malloc");
+            free(copy->name);
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC(entry->value_count * sizeof(*copy->values));
+        memcpy(copy->values, entry->values, entry->value_count * sizeof(*copy->values));
+    }
+
+    math_expr_map_value *slot = math_expr_map_insert(&registry->index[entry->kind], copy->name, entry->length, NULL);
+    if (!slot) {
+        free(copy->values);
+        free(copy->name);
+        return -1;
+    }
+    slot->index = registry->count++;
+    return 0;
+}
+
+/*
+ * Copy of source with insert (if any) placed at index and, when skip is set,
+ * the source entry at index left out. Every snapshot owns its name strings.
+ */
+static math_expr_registry *registry_copy(const math_expr_registry *source,
+                                         size_t index,
+                                         int skip,
+                                         const math_expr_registry_entry *insert)
+{
+    size_t count = source->count - (skip ? 1U : 0U) + (insert ? 1U : 0U);
+    math_expr_registry *registry = registry_alloc(count);
+    if (!registry) {
+        return NULL;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i <= source->count && status == 0; ++i) {
+        if (i == index && insert) {
+            status = append_copy(registry, insert);
+        }
+        if (status == 0 && i < source->count && !(i == index && skip)) {
+            status = append_copy(registry, &source->entries[i]);
+        }
+    }
+
+    if (status != 0) {
+        registry_destroy(registry);
+        return NULL;
+    }
+    return registry;
+}
+
+static int valid_name(const char *name)
+{
+    if (!name || !(isalpha((unsigned char)name[0]) || name[0] == '_')) {
+        return 0;
+    }
+
+    for (const char *c = name + 1; *c; ++c) {
+        if (!(isalnum((unsigned char)*c) || *c == '_')) {
+            return 0;
+        }
+    }
+
+    size_t index = 0U;
+    double value = 0.0;
+    size_t length = strlen(name);
+    return math_expr_builtin_find(name, length, &index) != 0 && math_expr_constant_lookup(name, length, &value) != 0 &&
+           math_expr_aggregate_find(name, length, NULL) != 0 &&
+           !math_expr_str_iequal(name, length, MATH_EXPR_CONDITIONAL_NAME);
+}
+
+/* Publish a registry with entry inserted or replaced; the caller holds the writer lock. */
+static int publish_entry(math_expr_context *context, math_expr_registry_entry *entry)
+{
+    const math_expr_registry *current = (const math_expr_registry *)math_expr_snapshot_peek(&context->registry);
+    size_t index = lower_bound(current, entry->kind, entry->name, entry->length);
+    int replace = index < current->count &&
+                  compare_key(&current->entries[index], entry->kind, entry->name, entry->length) == 0;
+
+    math_expr_registry *next = registry_copy(current, index, replace, entry);
+    if (!next) {
+        return -1;
+    }
+
+    if (math_expr_snapshot_publish(&context->registry, next) != 0) {
+        registry_destroy(next);
+        return -1;
+    }
+    return 0;
+}
+
+static int set_entry(math_expr_context *context, const char *name, math_expr_registry_entry *entry)
+{
+    if (!context || !valid_name(name)) {
+        fprintf(stderr, "math_expr_context: invalid or reserved name\n");
+        return -1;
+    }
+
+    size_t length = strlen(name);
+    char *lowered = (char *)malloc(length + 1U);
+    if (!lowered) {
+        perror("math_expr_context: malloc");
+        return -1;
+    }
+    for (size_t i = 0; i <= length; ++i) {
+        lowered[i] = (char)tolower((unsigned char)name[i]);
+    }
+
+    entry->name = lowered;
+    entry->length = length;
+
+    math_expr_snapshot_write_lock(&context->registry);
+    int status = publish_entry(context, entry);
+    math_expr_snapshot_write_unlock(&context->registry);
+
+    free(lowered);
+    return status;
+}
+
+math_expr_context *math_expr_context_create(void)
+{
+    math_expr_context *context = (math_expr_context *)calloc(1U, sizeof(*context));
+    if (!context) {
+        perror("math_expr_context: calloc");
+        return NULL;
+    }
+    math_expr_registry *registry = registry_alloc(0U);
+    if (!registry) {
+        free(context);
+        return NULL;
+    }
+    MATH_EXPR_STATS_ALLOC(sizeof(*context));
+
+    atomic_init(&context->memory_limit, 0U);
+    atomic_init(&context->memory_peak, 0U);
+    math_expr_snapshot_init(&context->registry, registry, registry_destroy);
+    return context;
+}
+
+void math_expr_context_destroy(math_expr_context *context)
+{
+    if (!context) {
+        return;
+    }
+
+    math_expr_snapshot_deinit(&context->registry);
+    free(context);
+}
+
+int math_expr_context_set_constant(math_expr_context *context, const char *name, double value)
+{
+    math_expr_registry_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = MATH_EXPR_REGISTRY_CONSTANT;
+    entry.value = value;
+    return set_entry(context, name, &entry);
+}
+
+int math_expr_context_set_function(math_expr_context *context,
+                                   const char *name,
+                                   size_t arity,
+                                   math_expr_function func,
+                                   void *user_data)
+{
+    if (!func || arity > MATH_EXPR_FUNCTION_MAX_ARITY) {
+        return -1;
+    }
+
+    math_expr_registry_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = MATH_EXPR_REGISTRY_FUNCTION;
+    entry.function.func = func;
+    entry.function.user_data = user_data;
+    entry.function.arity = arity;
+    return set_entry(context, name, &entry);
+}
+
+int math_expr_context_set_array(math_expr_context *context, const char *name, const double *values, size_t count)
+{
+    if (!values || count == 0U || count > MATH_EXPR_REDUCE_MAX_COUNT) {
+        return -1;
+    }
+
+    /* set_entry copies the registry, and with it a private copy of the values. */
+    math_expr_registry_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = MATH_EXPR_REGISTRY_ARRAY;
+    entry.values = (double *)values;
+    entry.value_count = count;
+    return set_entry(context, name, &entry);
+}
+
+int math_expr_context_remove(math_expr_context *context, const char *name)
+{
+    if (!context || !name) {
+        return -1;
+    }
+
+    size_t length = strlen(name);
+    int removed = 0;
+    int status = 0;
+
+    math_expr_snapshot_write_lock(&context->registry);
+    for (int kind = 0; kind < MATH_EXPR_REGISTRY_KIND_COUNT && status == 0; ++kind) {
+        const math_expr_registry *current = (const math_expr_registry *)math_expr_snapshot_peek(&context->registry);
+        size_t index = lower_bound(current, (math_expr_registry_kind)kind, name, length);
+        if (index >= current->count ||
+            compare_key(&current->entries[index], (math_expr_registry_kind)kind, name, length) != 0) {
+            continue;
+        }
+
+        math_expr_registry *next = registry_copy(current, index, 1, NULL);
+        if (!next || math_expr_snapshot_publish(&context->registry, next) != 0) {
+            registry_destroy(next);
+            status = -1;
+            break;
+        }
+        removed = 1;
+    }
+    math_expr_snapshot_write_unlock(&context->registry);
+
+    return status == 0 && removed ? 0 : -1;
+}
+
+const math_expr_registry *math_expr_context_read_begin(math_expr_context *context, math_expr_snapshot_ticket *out_ticket)
+{
+    if (!context) {
+        return NULL;
+    }
+
+    return (const math_expr_registry *)math_expr_snapshot_read_begin(&context->registry, out_ticket);
+}
+
+void math_expr_context_read_end(math_expr_context *context, math_expr_snapshot_ticket ticket)
+{
+    if (context) {
+        math_expr_snapshot_read_end(&context->registry, ticket);
+    }
+}
+
+void math_expr_context_set_memory_limit(math_expr_context *context, size_t bytes)
+{
+    if (context) {
+        atomic_store_explicit(&context->memory_limit, bytes, memory_order_relaxed);
+    }
+}
+
+size_t math_expr_context_memory_peak(const math_expr_context *context)
+{
+    return context ? atomic_load_explicit(&context->memory_peak, memory_order_relaxed) : 0U;
+}
+
+size_t math_expr_context_memory_limit(const math_expr_context *context)
+{
+    return context ? atomic_load_explicit(&context->memory_limit, memory_order_relaxed) : 0U;
+}
+
+void math_expr_context_record_memory_peak(math_expr_context *context, size_t peak_bytes)
+{
+    if (!context) {
+        return;
+    }
+
+    size_t seen = atomic_load_explicit(&context->memory_peak, memory_order_relaxed);
+    while (seen < peak_bytes &&
+           !atomic_compare_exchange_weak_explicit(&context->memory_peak, &seen, peak_bytes,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
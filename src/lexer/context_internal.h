@@ -0,0 +1,54 @@
+#ifndef MATH_EXPR_CONTEXT_INTERNAL_H
+#define MATH_EXPR_CONTEXT_INTERNAL_H
+
+#include "math_expr/context.h"
+#include "math_expr/hash_map.h"
+
+#include "snapshot.h"
+
+#include <stddef.h>
+
+/*
+ * Immutable registry snapshot published by a context. Entries are sorted by
+ * kind and lower-cased name; each kind also has a case-insensitive hash map
+ * from name to entry index, built with the snapshot, so lookups from the
+ * compiler and evaluators are a single probe.
+ */
+
+typedef enum math_expr_registry_kind {
+    MATH_EXPR_REGISTRY_CONSTANT,
+    MATH_EXPR_REGISTRY_FUNCTION,
+    MATH_EXPR_REGISTRY_ARRAY,
+    MATH_EXPR_REGISTRY_KIND_COUNT
+} math_expr_registry_kind;
+
+typedef struct math_expr_registry_entry {
+    char *name;
+    size_t length;
+    math_expr_registry_kind kind;
+    double value;
+    math_expr_program_function function;
+    double *values; /* Elements of an array, owned by the entry. */
+    size_t value_count;
+} math_expr_registry_entry;
+
+typedef struct math_expr_registry {
+    math_expr_registry_entry *entries;
+    size_t count;
+    math_expr_map index[MATH_EXPR_REGISTRY_KIND_COUNT]; /* Indexed by math_expr_registry_kind. */
+} math_expr_registry;
+
+const math_expr_registry_entry *math_expr_registry_find(const math_expr_registry *registry,
+                                                        math_expr_registry_kind kind,
+                                                        const char *name,
+                                                        size_t length);
+
+/* Pin the current registry for one evaluation; a NULL context yields NULL. */
+const math_expr_registry *math_expr_context_read_begin(math_expr_context *context, math_expr_snapshot_ticket *out_ticket);
+void math_expr_context_read_end(math_expr_context *context, math_expr_snapshot_ticket ticket);
+
+/* Byte budget of evaluations through the context, and the high-water mark they reach; NULL is unlimited. */
+size_t math_expr_context_memory_limit(const math_expr_context *context);
+void math_expr_context_record_memory_peak(math_expr_context *context, size_t peak_bytes);
+
+#endif // MATH_EXPR_CONTEXT_INTERNAL_H
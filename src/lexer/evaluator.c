@@ -1,22 +1,20 @@
 #include "math_expr/evaluator.h"
 
-#include <ctype.h>
+#include "builtins.h"
+#include "context_internal.h"
+#include "memory_internal.h"
+#include "stats_internal.h"
+
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-#ifndef M_E
-#define M_E 2.71828182845904523536
-#endif
-
 typedef struct parser {
     const math_expr_token_array *tokens;
     size_t index;
+    const math_expr_registry *registry;
+    int skipping; /* Non-zero while parsing a branch that is not taken. */
 } parser;
 
 static void parser_skip_spaces(parser *p)
@@ -86,156 +84,229 @@ static int parser_expect_operator(parser *p, const char *lexeme)
     return -1;
 }
 
-static int str_iequal(const char *lhs, const char *rhs)
+static int evaluate_registered(const parser *p,
+                               const char *name,
+                               const double *args,
+                               size_t arg_count,
+                               double *out)
 {
-    if (!lhs || !rhs) {
-        return 0;
+    const math_expr_registry_entry *entry =
+        math_expr_registry_find(p->registry, MATH_EXPR_REGISTRY_FUNCTION, name, strlen(name));
+    if (!entry) {
+        fprintf(stderr, "math_expr_evaluator: unknown function '%s'\n", name);
+        return -1;
     }
 
-    while (*lhs && *rhs) {
-        if (tolower((unsigned char)*lhs) != tolower((unsigned char)*rhs)) {
-            return 0;
-        }
-        ++lhs;
-        ++rhs;
+    if (entry->function.arity != arg_count) {
+        fprintf(stderr,
+                "math_expr_evaluator: function '%s' expects %zu argument(s)\n",
+                name,
+                entry->function.arity);
+        return -1;
     }
 
-    return *lhs == '\0' && *rhs == '\0';
-}
+    if (p->skipping) {
+        *out = 0.0;
+        return 0;
+    }
 
-static double to_radians(double degrees)
-{
-    return degrees * (M_PI / 180.0);
+    if (entry->function.func(entry->function.user_data, args, out) != 0) {
+        fprintf(stderr, "math_expr_evaluator: function '%s' failed\n", name);
+        return -1;
+    }
+    return 0;
 }
 
-static double func_sin(const double *args)
+static int evaluate_function(parser *p, const char *name, const double *args, size_t arg_count, double *out)
 {
-    return sin(to_radians(args[0]));
-}
+    if (!name || !out) {
+        return -1;
+    }
 
-static double func_cos(const double *args)
-{
-    return cos(to_radians(args[0]));
-}
+    size_t index = 0U;
+    if (math_expr_builtin_find(name, strlen(name), &index) != 0) {
+        return evaluate_registered(p, name, args, arg_count, out);
+    }
 
-static double func_tan(const double *args)
-{
-    return tan(to_radians(args[0]));
-}
+    const math_expr_builtin *builtin = math_expr_builtin_get(index);
+    if (builtin->arity != arg_count) {
+        fprintf(stderr,
+                "math_expr_evaluator: function '%s' expects %zu argument(s)\n",
+                name,
+                builtin->arity);
+        return -1;
+    }
 
-static double func_sqrt(const double *args)
-{
-    return sqrt(args[0]);
-}
+    if (p->skipping) {
+        *out = 0.0;
+        return 0;
+    }
 
-static double func_abs(const double *args)
-{
-    return fabs(args[0]);
+    MATH_EXPR_STATS_BUILTIN(index);
+    *out = builtin->func(args);
+    return 0;
 }
 
-static double func_ln(const double *args)
-{
-    return log(args[0]);
-}
+static int parse_expression(parser *p, double *out);
 
-static double func_log(const double *args)
+/*
+ * Parse one branch of a conditional. A branch that is not taken is still
+ * checked for syntax, unknown names and arity, but no function is called and
+ * no division or modulo by zero is reported.
+ */
+static int parse_branch(parser *p, int taken, int (*parse)(parser *, double *), double *out)
 {
-    return log10(args[0]);
+    if (!taken) {
+        ++p->skipping;
+    }
+    int status = parse(p, out);
+    if (!taken) {
+        --p->skipping;
+    }
+    return status;
 }
 
-static double func_exp(const double *args)
+/* if(cond, then, else) after "if(": only the selected branch is evaluated. */
+static int parse_conditional(parser *p, double *out)
 {
-    return exp(args[0]);
+    double condition = 0.0;
+    double then_value = 0.0;
+    double else_value = 0.0;
+
+    if (parse_expression(p, &condition) != 0 || parser_expect_operator(p, ",") != 0) {
+        return -1;
+    }
+
+    int taken = condition != 0.0;
+    if (parse_branch(p, taken, parse_expression, &then_value) != 0 || parser_expect_operator(p, ",") != 0 ||
+        parse_branch(p, !taken, parse_expression, &else_value) != 0 || parser_expect_operator(p, ")") != 0) {
+        return -1;
+    }
+
+    *out = taken ? then_value : else_value;
+    return 0;
 }
 
-static double func_pow(const double *args)
+typedef struct argument_list {
+    double *values;
+    size_t count;
+    size_t capacity;
+} argument_list;
+
+static int append_arguments(argument_list *args, const double *values, size_t count)
 {
-    return pow(args[0], args[1]);
+    if (args->count + count > args->capacity) {
+        size_t new_capacity = args->capacity == 0U ? 4U : args->capacity * 2U;
+        while (new_capacity < args->count + count) {
+            new_capacity *= 2U;
+        }
+        size_t added = (new_capacity - args->capacity) * sizeof(*args->values);
+        if (math_expr_memory_charge(added, "math_expr_evaluator") != 0) {
+            return -1;
+        }
+        double *new_values = (double *)realloc(args->values, new_capacity * sizeof(*new_values));
+        if (!new_values) {
+            perror("math_expr_evaluator: realloc");
+            math_expr_memory_release(added);
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC(new_capacity * sizeof(*new_values));
+        args->values = new_values;
+        args->capacity = new_capacity;
+    }
+
+    memcpy(args->values + args->count, values, count * sizeof(*values));
+    args->count += count;
+    return 0;
 }
 
-static double func_max(const double *args)
+static void free_arguments(argument_list *args)
 {
-    return args[0] > args[1] ? args[0] : args[1];
+    math_expr_memory_release(args->capacity * sizeof(*args->values));
+    free(args->values);
 }
 
-static double func_min(const double *args)
+static int parser_next_is_operator(parser *p, const char *lexeme)
 {
-    return args[0] < args[1] ? args[0] : args[1];
+    const math_expr_token *token = parser_peek(p);
+    return token && token->type == MATH_EXPR_TOKEN_OPERATOR && strcmp(token->lexeme, lexeme) == 0;
 }
 
-static int evaluate_function(const char *name, const double *args, size_t arg_count, double *out)
+/*
+ * One argument of an aggregate: an array literal, whose elements may be
+ * arguments of the same kind, a registered array name standing on its own,
+ * or any expression. Arrays are flattened into args.
+ */
+static int parse_aggregate_argument(parser *p, argument_list *args, int *out_has_array)
 {
-    if (!name || !out) {
-        return -1;
-    }
-
-    struct function_entry {
-        const char *name;
-        size_t arity;
-        double (*func)(const double *args);
-    };
-
-    static const struct function_entry functions[] = {
-        {"sin", 1, func_sin},
-        {"cos", 1, func_cos},
-        {"tan", 1, func_tan},
-        {"sqrt", 1, func_sqrt},
-        {"abs", 1, func_abs},
-        {"ln", 1, func_ln},
-        {"log", 1, func_log},
-        {"exp", 1, func_exp},
-        {"pow", 2, func_pow},
-        {"max", 2, func_max},
-        {"min", 2, func_min}
-    };
-
-    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i) {
-        if (str_iequal(name, functions[i].name)) {
-            if (functions[i].arity != arg_count) {
-                fprintf(stderr,
-                        "math_expr_evaluator: function '%s' expects %zu argument(s)\n",
-                        name,
-                        functions[i].arity);
+    if (parser_match_operator(p, "[")) {
+        *out_has_array = 1;
+        if (parser_match_operator(p, "]")) {
+            return 0;
+        }
+        do {
+            if (parse_aggregate_argument(p, args, out_has_array) != 0) {
                 return -1;
             }
+        } while (parser_match_operator(p, ","));
+        return parser_expect_operator(p, "]");
+    }
 
-            *out = functions[i].func(args);
-            return 0;
+    const math_expr_token *token = parser_peek(p);
+    if (token && token->type == MATH_EXPR_TOKEN_IDENTIFIER) {
+        const math_expr_registry_entry *entry =
+            math_expr_registry_find(p->registry, MATH_EXPR_REGISTRY_ARRAY, token->lexeme, strlen(token->lexeme));
+        size_t saved = p->index;
+        parser_consume(p);
+        if (entry && (parser_next_is_operator(p, ",") || parser_next_is_operator(p, ")") ||
+                      parser_next_is_operator(p, "]"))) {
+            *out_has_array = 1;
+            return append_arguments(args, entry->values, entry->value_count);
         }
+        p->index = saved;
     }
 
-    fprintf(stderr, "math_expr_evaluator: unknown function '%s'\n", name);
-    return -1;
+    double value = 0.0;
+    if (parse_expression(p, &value) != 0) {
+        return -1;
+    }
+    return append_arguments(args, &value, 1U);
 }
 
-static int lookup_constant(const char *name, double *out)
+/* sum, avg, min or max after "name(". Two scalar arguments to min or max call the builtin. */
+static int parse_aggregate(parser *p, const char *name, math_expr_aggregate kind, double *out)
 {
-    if (!name || !out) {
-        return -1;
+    argument_list args = {NULL, 0U, 0U};
+    int has_array = 0;
+    int status = 0;
+
+    if (!parser_next_is_operator(p, ")")) {
+        do {
+            status = parse_aggregate_argument(p, &args, &has_array);
+        } while (status == 0 && parser_match_operator(p, ","));
     }
 
-    struct constant_entry {
-        const char *name;
-        double value;
-    };
+    if (status == 0) {
+        status = parser_expect_operator(p, ")");
+    }
 
-    static const struct constant_entry constants[] = {
-        {"pi", M_PI},
-        {"e", M_E}
-    };
+    if (status == 0 && args.count == 0U) {
+        fprintf(stderr, "math_expr_evaluator: function '%s' expects at least one value\n", name);
+        status = -1;
+    }
 
-    for (size_t i = 0; i < sizeof(constants) / sizeof(constants[0]); ++i) {
-        if (str_iequal(name, constants[i].name)) {
-            *out = constants[i].value;
-            return 0;
+    if (status == 0) {
+        if ((kind == MATH_EXPR_AGGREGATE_MIN || kind == MATH_EXPR_AGGREGATE_MAX) && !has_array && args.count == 2U) {
+            status = evaluate_function(p, name, args.values, args.count, out);
+        } else {
+            *out = p->skipping ? 0.0 : math_expr_aggregate_reduce(kind, args.values, args.count);
         }
     }
 
-    return -1;
+    free_arguments(&args);
+    return status;
 }
 
-static int parse_expression(parser *p, double *out);
-
 static int parse_primary(parser *p, double *out)
 {
     const math_expr_token *token = parser_peek(p);
@@ -269,34 +340,27 @@ static int parse_primary(parser *p, double *out)
         parser_consume(p);
 
         if (parser_match_operator(p, "(")) {
-            double *args = NULL;
-            size_t arg_count = 0U;
-            size_t capacity = 0U;
+            if (math_expr_str_iequal(identifier, strlen(identifier), MATH_EXPR_CONDITIONAL_NAME)) {
+                return parse_conditional(p, out);
+            }
+
+            math_expr_aggregate kind;
+            if (math_expr_aggregate_find(identifier, strlen(identifier), &kind) == 0) {
+                return parse_aggregate(p, identifier, kind, out);
+            }
+
+            argument_list args = {NULL, 0U, 0U};
             int status = 0;
 
             const math_expr_token *next = parser_peek(p);
             if (next && !(next->type == MATH_EXPR_TOKEN_OPERATOR && strcmp(next->lexeme, ")") == 0)) {
                 for (;;) {
                     double value = 0.0;
-                    if (parse_expression(p, &value) != 0) {
+                    if (parse_expression(p, &value) != 0 || append_arguments(&args, &value, 1U) != 0) {
                         status = -1;
                         break;
                     }
 
-                    if (arg_count == capacity) {
-                        size_t new_capacity = capacity == 0 ? 4U : capacity * 2U;
-                        double *new_args = (double *)realloc(args, new_capacity * sizeof(*new_args));
-                        if (!new_args) {
-                            perror("math_expr_evaluator: realloc");
-                            status = -1;
-                            break;
-                        }
-                        args = new_args;
-                        capacity = new_capacity;
-                    }
-
-                    args[arg_count++] = value;
-
                     if (!parser_match_operator(p, ",")) {
                         break;
                     }
@@ -308,14 +372,21 @@ static int parse_primary(parser *p, double *out)
             }
 
             if (status == 0) {
-                status = evaluate_function(identifier, args, arg_count, out);
+                status = evaluate_function(p, identifier, args.values, args.count, out);
             }
 
-            free(args);
+            free_arguments(&args);
             return status;
         }
 
-        if (lookup_constant(identifier, out) == 0) {
+        if (math_expr_constant_lookup(identifier, strlen(identifier), out) == 0) {
+            return 0;
+        }
+
+        const math_expr_registry_entry *entry =
+            math_expr_registry_find(p->registry, MATH_EXPR_REGISTRY_CONSTANT, identifier, strlen(identifier));
+        if (entry) {
+            *out = entry->value;
             return 0;
         }
 
@@ -363,6 +434,15 @@ static int parse_unary(parser *p, double *out)
             *out = -*out;
             return 0;
         }
+
+        if (strcmp(token->lexeme, "!") == 0) {
+            parser_consume(p);
+            if (parse_unary(p, out) != 0) {
+                return -1;
+            }
+            *out = *out == 0.0 ? 1.0 : 0.0;
+            return 0;
+        }
     }
 
     return parse_power(p, out);
@@ -396,7 +476,7 @@ static int parse_term(parser *p, double *out)
             if (parse_unary(p, &rhs) != 0) {
                 return -1;
             }
-            if (rhs == 0.0) {
+            if (rhs == 0.0 && !p->skipping) {
                 fprintf(stderr, "math_expr_evaluator: division by zero\n");
                 return -1;
             }
@@ -410,7 +490,7 @@ static int parse_term(parser *p, double *out)
             if (parse_unary(p, &rhs) != 0) {
                 return -1;
             }
-            if (rhs == 0.0) {
+            if (rhs == 0.0 && !p->skipping) {
                 fprintf(stderr, "math_expr_evaluator: modulo by zero\n");
                 return -1;
             }
@@ -424,7 +504,7 @@ static int parse_term(parser *p, double *out)
     return 0;
 }
 
-static int parse_expression(parser *p, double *out)
+static int parse_sum(parser *p, double *out)
 {
     if (parse_term(p, out) != 0) {
         return -1;
@@ -462,13 +542,111 @@ static int parse_expression(parser *p, double *out)
     return 0;
 }
 
-int math_expr_evaluate_tokens(const math_expr_token_array *tokens, double *out_result)
+static int parse_relational(parser *p, double *out)
 {
-    if (!tokens || !out_result) {
+    if (parse_sum(p, out) != 0) {
         return -1;
     }
 
-    parser p = {tokens, 0U};
+    while (1) {
+        const math_expr_token *token = parser_peek(p);
+        if (!token || token->type != MATH_EXPR_TOKEN_OPERATOR) {
+            break;
+        }
+
+        const char *op = token->lexeme;
+        if (strcmp(op, "<") != 0 && strcmp(op, "<=") != 0 && strcmp(op, ">") != 0 && strcmp(op, ">=") != 0) {
+            break;
+        }
+
+        parser_consume(p);
+        double rhs = 0.0;
+        if (parse_sum(p, &rhs) != 0) {
+            return -1;
+        }
+
+        int result;
+        if (op[0] == '<') {
+            result = op[1] == '=' ? *out <= rhs : *out < rhs;
+        } else {
+            result = op[1] == '=' ? *out >= rhs : *out > rhs;
+        }
+        *out = result ? 1.0 : 0.0;
+    }
+
+    return 0;
+}
+
+static int parse_equality(parser *p, double *out)
+{
+    if (parse_relational(p, out) != 0) {
+        return -1;
+    }
+
+    while (1) {
+        const math_expr_token *token = parser_peek(p);
+        if (!token || token->type != MATH_EXPR_TOKEN_OPERATOR) {
+            break;
+        }
+
+        int equal = strcmp(token->lexeme, "==") == 0;
+        if (!equal && strcmp(token->lexeme, "!=") != 0) {
+            break;
+        }
+
+        parser_consume(p);
+        double rhs = 0.0;
+        if (parse_relational(p, &rhs) != 0) {
+            return -1;
+        }
+        *out = (equal ? *out == rhs : *out != rhs) ? 1.0 : 0.0;
+    }
+
+    return 0;
+}
+
+/* The right operand of && and || is only evaluated when it decides the result. */
+static int parse_conjunction(parser *p, double *out)
+{
+    if (parse_equality(p, out) != 0) {
+        return -1;
+    }
+
+    while (parser_match_operator(p, "&&")) {
+        int taken = *out != 0.0;
+        double rhs = 0.0;
+        if (parse_branch(p, taken, parse_equality, &rhs) != 0) {
+            return -1;
+        }
+        *out = taken && rhs != 0.0 ? 1.0 : 0.0;
+    }
+
+    return 0;
+}
+
+static int parse_expression(parser *p, double *out)
+{
+    if (parse_conjunction(p, out) != 0) {
+        return -1;
+    }
+
+    while (parser_match_operator(p, "||")) {
+        int taken = *out == 0.0;
+        double rhs = 0.0;
+        if (parse_branch(p, taken, parse_conjunction, &rhs) != 0) {
+            return -1;
+        }
+        *out = !taken || rhs != 0.0 ? 1.0 : 0.0;
+    }
+
+    return 0;
+}
+
+static int evaluate_tokens(const math_expr_token_array *tokens,
+                           const math_expr_registry *registry,
+                           double *out_result)
+{
+    parser p = {tokens, 0U, registry, 0};
     double value = 0.0;
 
     if (parse_expression(&p, &value) != 0) {
@@ -485,21 +663,76 @@ int math_expr_evaluate_tokens(const math_expr_token_array *tokens, double *out_r
     return 0;
 }
 
+int math_expr_evaluate_tokens(const math_expr_token_array *tokens, double *out_result)
+{
+    if (!tokens || !out_result) {
+        return -1;
+    }
+
+    math_expr_memory_scope scope;
+    math_expr_memory_scope_begin(&scope, 0U);
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = evaluate_tokens(tokens, NULL, out_result);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+    math_expr_memory_scope_end(&scope);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
+}
+
 int math_expr_evaluate(const char *expression, double *out_result)
 {
     if (!expression || !out_result) {
         return -1;
     }
 
+    math_expr_memory_scope scope;
+    math_expr_memory_scope_begin(&scope, 0U);
+
     math_expr_token_array tokens;
     math_expr_token_array_init(&tokens);
 
-    if (math_expr_lex_expression(expression, &tokens) != 0) {
-        math_expr_token_array_deinit(&tokens);
+    int status = math_expr_lex_expression_ex(expression, &tokens, MATH_EXPR_LEX_SKIP_SPACE);
+    if (status == 0) {
+        status = math_expr_evaluate_tokens(&tokens, out_result);
+    }
+
+    math_expr_token_array_deinit(&tokens);
+    math_expr_memory_scope_end(&scope);
+    return status;
+}
+
+int math_expr_evaluate_with_context(math_expr_context *context, const char *expression, double *out_result)
+{
+    if (!expression || !out_result) {
         return -1;
     }
 
-    int status = math_expr_evaluate_tokens(&tokens, out_result);
+    math_expr_memory_scope scope;
+    math_expr_memory_scope_begin(&scope, math_expr_context_memory_limit(context));
+
+    math_expr_token_array tokens;
+    math_expr_token_array_init(&tokens);
+
+    int status = math_expr_lex_expression_ex(expression, &tokens, MATH_EXPR_LEX_SKIP_SPACE);
+    if (status == 0) {
+        math_expr_snapshot_ticket ticket = 0U;
+        const math_expr_registry *registry = math_expr_context_read_begin(context, &ticket);
+
+        MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+        status = evaluate_tokens(&tokens, registry, out_result);
+        MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+        math_expr_context_read_end(context, ticket);
+
+        if (status != 0) {
+            MATH_EXPR_STATS_ERROR();
+        }
+    }
+
     math_expr_token_array_deinit(&tokens);
+    math_expr_context_record_memory_peak(context, math_expr_memory_scope_end(&scope));
     return status;
 }
@@ -0,0 +1,483 @@
+#include "math_expr/graph.h"
+
+#include "math_expr/compiler.h"
+#include "math_expr/hash_map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MATH_EXPR_GRAPH_LOCAL_INPUTS 16U
+
+typedef struct graph_node {
+    char *name;
+    int is_formula;
+    int defined;
+    int dirty;
+    int failed;
+    double value;
+    math_expr_program program;
+    size_t *inputs;
+    size_t *dependents;
+    size_t dependent_count;
+    size_t dependent_capacity;
+} graph_node;
+
+struct math_expr_graph {
+    graph_node *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    math_expr_map node_index; /* Node name to index into nodes. */
+    size_t *order;
+    size_t *level_offsets;
+    size_t level_count;
+    int order_valid;
+    size_t *work;
+    size_t last_evaluated;
+};
+
+typedef struct level_job {
+    math_expr_graph *graph;
+    const size_t *nodes;
+} level_job;
+
+math_expr_graph *math_expr_graph_create(void)
+{
+    math_expr_graph *graph = (math_expr_graph *)calloc(1U, sizeof(*graph));
+    if (!graph) {
+        perror("math_expr_graph: calloc");
+        return NULL;
+    }
+
+    math_expr_map_init(&graph->node_index, 0U);
+    return graph;
+}
+
+static void release_order(math_expr_graph *graph)
+{
+    free(graph->order);
+    free(graph->level_offsets);
+    free(graph->work);
+    graph->order = NULL;
+    graph->level_offsets = NULL;
+    graph->work = NULL;
+    graph->level_count = 0U;
+    graph->order_valid = 0;
+}
+
+void math_expr_graph_destroy(math_expr_graph *graph)
+{
+    if (!graph) {
+        return;
+    }
+
+    for (size_t i = 0; i < graph->node_count; ++i) {
+        graph_node *node = &graph->nodes[i];
+        free(node->name);
+        free(node->inputs);
+        free(node->dependents);
+        math_expr_program_deinit(&node->program);
+    }
+
+    release_order(graph);
+    math_expr_map_deinit(&graph->node_index);
+    free(graph->nodes);
+    free(graph);
+}
+
+static int find_node(const math_expr_graph *graph, const char *name, size_t *out_index)
+{
+    const math_expr_map_value *found = math_expr_map_find(&graph->node_index, name, strlen(name));
+    if (!found) {
+        return -1;
+    }
+
+    *out_index = found->index;
+    return 0;
+}
+
+static int find_or_add_node(math_expr_graph *graph, const char *name, size_t *out_index)
+{
+    if (find_node(graph, name, out_index) == 0) {
+        return 0;
+    }
+
+    if (graph->node_count == graph->node_capacity) {
+        size_t new_capacity = graph->node_capacity == 0U ? 16U : graph->node_capacity * 2U;
+        graph_node *new_nodes = (graph_node *)realloc(graph->nodes, new_capacity * sizeof(*new_nodes));
+        if (!new_nodes) {
+            perror("math_expr_graph: realloc");
+            return -1;
+        }
+        graph->nodes = new_nodes;
+        graph->node_capacity = new_capacity;
+    }
+
+    size_t length = strlen(name);
+    char *copy = (char *)malloc(length + 1U);
+    if (!copy) {
+        perror("math_expr_graph: malloc");
+        return -1;
+    }
+    memcpy(copy, name, length + 1U);
+
+    math_expr_map_value *slot = math_expr_map_insert(&graph->node_index, name, length, NULL);
+    if (!slot) {
+        free(copy);
+        return -1;
+    }
+    slot->index = graph->node_count;
+
+    graph_node *node = &graph->nodes[graph->node_count];
+    memset(node, 0, sizeof(*node));
+    node->name = copy;
+    math_expr_program_init(&node->program);
+
+    *out_index = graph->node_count++;
+    graph->order_valid = 0;
+    return 0;
+}
+
+static int add_dependent(graph_node *node, size_t dependent)
+{
+    if (node->dependent_count == node->dependent_capacity) {
+        size_t new_capacity = node->dependent_capacity == 0U ? 4U : node->dependent_capacity * 2U;
+        size_t *new_dependents = (size_t *)realloc(node->dependents, new_capacity * sizeof(*new_dependents));
+        if (!new_dependents) {
+            perror("math_expr_graph: realloc");
+            return -1;
+        }
+        node->dependents = new_dependents;
+        node->dependent_capacity = new_capacity;
+    }
+
+    node->dependents[node->dependent_count++] = dependent;
+    return 0;
+}
+
+static void remove_dependent(graph_node *node, size_t dependent)
+{
+    for (size_t i = 0; i < node->dependent_count; ++i) {
+        if (node->dependents[i] == dependent) {
+            node->dependents[i] = node->dependents[--node->dependent_count];
+            return;
+        }
+    }
+}
+
+static void detach_formula(math_expr_graph *graph, size_t index)
+{
+    graph_node *node = &graph->nodes[index];
+
+    for (size_t i = 0; i < node->program.symbol_count; ++i) {
+        remove_dependent(&graph->nodes[node->inputs[i]], index);
+    }
+
+    free(node->inputs);
+    node->inputs = NULL;
+    math_expr_program_deinit(&node->program);
+    node->is_formula = 0;
+    graph->order_valid = 0;
+}
+
+/*
+ * Mark a node and everything downstream of it dirty. Without memory for the
+ * walk every formula is marked instead, which costs evaluations but never
+ * leaves a stale value behind a change that has already been made.
+ */
+static void mark_dirty(math_expr_graph *graph, size_t index)
+{
+    size_t *stack = (size_t *)malloc(graph->node_count * sizeof(*stack));
+    if (!stack) {
+        for (size_t i = 0; i < graph->node_count; ++i) {
+            graph->nodes[i].dirty |= graph->nodes[i].is_formula;
+        }
+        return;
+    }
+
+    size_t top = 0U;
+    graph->nodes[index].dirty = graph->nodes[index].is_formula;
+    stack[top++] = index;
+
+    while (top > 0U) {
+        const graph_node *node = &graph->nodes[stack[--top]];
+        for (size_t i = 0; i < node->dependent_count; ++i) {
+            graph_node *dependent = &graph->nodes[node->dependents[i]];
+            if (!dependent->dirty) {
+                dependent->dirty = 1;
+                stack[top++] = node->dependents[i];
+            }
+        }
+    }
+
+    free(stack);
+}
+
+int math_expr_graph_set_formula(math_expr_graph *graph, const char *name, const char *expression)
+{
+    if (!graph || !name || !expression) {
+        return -1;
+    }
+
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (math_expr_compile(expression, &program) != 0) {
+        fprintf(stderr, "math_expr_graph: failed to compile formula '%s'\n", name);
+        return -1;
+    }
+
+    size_t *inputs = NULL;
+    if (program.symbol_count > 0U) {
+        inputs = (size_t *)malloc(program.symbol_count * sizeof(*inputs));
+        if (!inputs) {
+            perror("math_expr_graph: malloc");
+            math_expr_program_deinit(&program);
+            return -1;
+        }
+    }
+
+    size_t index = 0U;
+    if (find_or_add_node(graph, name, &index) != 0) {
+        free(inputs);
+        math_expr_program_deinit(&program);
+        return -1;
+    }
+
+    for (size_t i = 0; i < program.symbol_count; ++i) {
+        if (find_or_add_node(graph, program.symbols[i], &inputs[i]) != 0) {
+            free(inputs);
+            math_expr_program_deinit(&program);
+            return -1;
+        }
+    }
+
+    /*
+     * Attach the new edges before dropping the old ones, so that running out
+     * of memory leaves the previous formula in place. An input of both keeps
+     * one edge, since detaching removes a single occurrence per input.
+     */
+    for (size_t i = 0; i < program.symbol_count; ++i) {
+        if (add_dependent(&graph->nodes[inputs[i]], index) != 0) {
+            while (i-- > 0U) {
+                remove_dependent(&graph->nodes[inputs[i]], index);
+            }
+            free(inputs);
+            math_expr_program_deinit(&program);
+            return -1;
+        }
+    }
+
+    if (graph->nodes[index].is_formula) {
+        detach_formula(graph, index);
+    }
+
+    graph_node *node = &graph->nodes[index];
+    node->program = program;
+    node->inputs = inputs;
+    node->is_formula = 1;
+    node->defined = 0;
+    node->failed = 0;
+    graph->order_valid = 0;
+
+    mark_dirty(graph, index);
+    return 0;
+}
+
+int math_expr_graph_set_value(math_expr_graph *graph, const char *name, double value)
+{
+    if (!graph || !name) {
+        return -1;
+    }
+
+    size_t index = 0U;
+    if (find_or_add_node(graph, name, &index) != 0) {
+        return -1;
+    }
+
+    if (graph->nodes[index].is_formula) {
+        detach_formula(graph, index);
+    }
+
+    graph_node *node = &graph->nodes[index];
+    node->value = value;
+    node->defined = 1;
+    node->failed = 0;
+
+    mark_dirty(graph, index);
+    return 0;
+}
+
+static int rebuild_order(math_expr_graph *graph)
+{
+    release_order(graph);
+
+    size_t count = graph->node_count;
+    size_t *pending = (size_t *)calloc(count + 1U, sizeof(*pending));
+    graph->order = (size_t *)malloc((count + 1U) * sizeof(*graph->order));
+    graph->level_offsets = (size_t *)malloc((count + 2U) * sizeof(*graph->level_offsets));
+    graph->work = (size_t *)malloc((count + 1U) * sizeof(*graph->work));
+    if (!pending || !graph->order || !graph->level_offsets || !graph->work) {
+        perror("math_expr_graph: malloc");
+        free(pending);
+        release_order(graph);
+        return -1;
+    }
+
+    size_t ordered = 0U;
+    for (size_t i = 0; i < count; ++i) {
+        const graph_node *node = &graph->nodes[i];
+        pending[i] = node->is_formula ? node->program.symbol_count : 0U;
+        if (pending[i] == 0U) {
+            graph->order[ordered++] = i;
+        }
+    }
+
+    size_t level_start = 0U;
+    while (level_start < ordered) {
+        size_t level_end = ordered;
+        graph->level_offsets[graph->level_count++] = level_start;
+
+        for (size_t i = level_start; i < level_end; ++i) {
+            const graph_node *node = &graph->nodes[graph->order[i]];
+            for (size_t j = 0; j < node->dependent_count; ++j) {
+                size_t dependent = node->dependents[j];
+                if (--pending[dependent] == 0U) {
+                    graph->order[ordered++] = dependent;
+                }
+            }
+        }
+
+        level_start = level_end;
+    }
+    graph->level_offsets[graph->level_count] = ordered;
+
+    if (ordered != count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (pending[i] != 0U) {
+                fprintf(stderr, "math_expr_graph: cycle detected involving '%s'\n", graph->nodes[i].name);
+                break;
+            }
+        }
+        free(pending);
+        release_order(graph);
+        return -1;
+    }
+
+    free(pending);
+    graph->order_valid = 1;
+    return 0;
+}
+
+static void evaluate_node(math_expr_graph *graph, size_t index)
+{
+    graph_node *node = &graph->nodes[index];
+    size_t input_count = node->program.symbol_count;
+    double local_values[MATH_EXPR_GRAPH_LOCAL_INPUTS];
+    double *values = local_values;
+
+    node->dirty = 0;
+    node->failed = 1;
+
+    if (input_count > MATH_EXPR_GRAPH_LOCAL_INPUTS) {
+        values = (double *)malloc(input_count * sizeof(*values));
+        if (!values) {
+            perror("math_expr_graph: malloc");
+            return;
+        }
+    }
+
+    int ready = 1;
+    for (size_t i = 0; i < input_count; ++i) {
+        const graph_node *input = &graph->nodes[node->inputs[i]];
+        if (input->failed || !input->defined) {
+            ready = 0;
+            break;
+        }
+        values[i] = input->value;
+    }
+
+    if (ready && math_expr_program_evaluate(&node->program, values, &node->value) == 0) {
+        node->failed = 0;
+        node->defined = 1;
+    } else {
+        node->defined = 0;
+    }
+
+    if (values != local_values) {
+        free(values);
+    }
+}
+
+static void evaluate_level_task(void *context, size_t index)
+{
+    level_job *job = (level_job *)context;
+    evaluate_node(job->graph, job->nodes[index]);
+}
+
+int math_expr_graph_recalculate(math_expr_graph *graph, math_expr_thread_pool *pool)
+{
+    if (!graph) {
+        return -1;
+    }
+
+    graph->last_evaluated = 0U;
+
+    if (!graph->order_valid && rebuild_order(graph) != 0) {
+        return -1;
+    }
+
+    int status = 0;
+
+    for (size_t level = 0; level < graph->level_count; ++level) {
+        size_t work_count = 0U;
+        for (size_t i = graph->level_offsets[level]; i < graph->level_offsets[level + 1U]; ++i) {
+            size_t index = graph->order[i];
+            if (graph->nodes[index].dirty) {
+                graph->work[work_count++] = index;
+            }
+        }
+
+        if (work_count == 0U) {
+            continue;
+        }
+
+        level_job job = {graph, graph->work};
+        if (math_expr_thread_pool_run(pool, work_count, evaluate_level_task, &job) != 0) {
+            return -1;
+        }
+
+        graph->last_evaluated += work_count;
+        for (size_t i = 0; i < work_count; ++i) {
+            if (graph->nodes[graph->work[i]].failed) {
+                status = -1;
+            }
+        }
+    }
+
+    return status;
+}
+
+int math_expr_graph_get_value(const math_expr_graph *graph, const char *name, double *out_value)
+{
+    if (!graph || !name || !out_value) {
+        return -1;
+    }
+
+    size_t index = 0U;
+    if (find_node(graph, name, &index) != 0) {
+        return -1;
+    }
+
+    const graph_node *node = &graph->nodes[index];
+    if (node->dirty || node->failed || !node->defined) {
+        return -1;
+    }
+
+    *out_value = node->value;
+    return 0;
+}
+
+size_t math_expr_graph_last_evaluated(const math_expr_graph *graph)
+{
+    return graph ? graph->last_evaluated : 0U;
+}
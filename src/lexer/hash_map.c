@@ -0,0 +1,427 @@
+#include "math_expr/hash_map.h"
+
+#include "stats_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t kInitialSlots = 16U;
+static const size_t kInitialKeyBytes = 256U;
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t fold_case(uint64_t word)
+{
+    /* Set bit 5 of every byte that holds 'A'..'Z'. */
+    uint64_t ones = 0x0101010101010101ULL;
+    uint64_t high = 0x8080808080808080ULL;
+    uint64_t above_z = (word & ~high) + ones * (0x7FU - 'Z');
+    uint64_t from_a = (word & ~high) + ones * (0x80U - 'A');
+    uint64_t upper = from_a & ~above_z & ~word & high;
+    return word | (upper >> 2);
+}
+
+/* 64-bit multiply-rotate hash over eight-byte words with a murmur3 finish. */
+static uint64_t hash_string(const char *key, size_t length, int ignore_case)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ (length * 0xc6a4a7935bd1e995ULL);
+    size_t i = 0U;
+
+    for (; i + 8U <= length; i += 8U) {
+        uint64_t word;
+        memcpy(&word, key + i, sizeof(word));
+        if (ignore_case) {
+            word = fold_case(word);
+        }
+        hash = (hash ^ (word * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+        hash = (hash << 31) | (hash >> 33);
+    }
+
+    if (i < length) {
+        uint64_t word = 0U;
+        memcpy(&word, key + i, length - i);
+        if (ignore_case) {
+            word = fold_case(word);
+        }
+        hash = (hash ^ (word * 0x87c37b91114253d5ULL)) * 0x4cf5ad432745937fULL;
+    }
+
+    return mix64(hash);
+}
+
+static int lower_ascii(int c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static int keys_equal(const math_expr_map *map, const math_expr_map_slot *slot, const char *key, size_t length)
+{
+    if (slot->length != length) {
+        return 0;
+    }
+
+    const char *stored = map->keys + slot->key;
+    if (!(map->flags & MATH_EXPR_MAP_IGNORE_CASE)) {
+        return memcmp(stored, key, length) == 0;
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        if (lower_ascii((unsigned char)stored[i]) != lower_ascii((unsigned char)key[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void math_expr_map_init(math_expr_map *map, unsigned int flags)
+{
+    if (!map) {
+        return;
+    }
+
+    memset(map, 0, sizeof(*map));
+    map->flags = flags;
+}
+
+void math_expr_map_deinit(math_expr_map *map)
+{
+    if (!map) {
+        return;
+    }
+
+    free(map->slots);
+    free(map->keys);
+    math_expr_map_init(map, map->flags);
+}
+
+void math_expr_map_clear(math_expr_map *map)
+{
+    if (!map) {
+        return;
+    }
+
+    for (size_t i = 0; i < map->capacity; ++i) {
+        map->slots[i].distance = 0U;
+    }
+    map->count = 0U;
+    map->keys_size = 0U;
+    map->keys_garbage = 0U;
+}
+
+size_t math_expr_map_size(const math_expr_map *map)
+{
+    return map ? map->count : 0U;
+}
+
+/* Place an entry known to be absent; returns its final slot. */
+static math_expr_map_slot *place(math_expr_map *map, math_expr_map_slot entry)
+{
+    size_t mask = map->capacity - 1U;
+    size_t index = (size_t)entry.hash & mask;
+    math_expr_map_slot *placed = NULL;
+
+    entry.distance = 1U;
+    for (;;) {
+        math_expr_map_slot *slot = &map->slots[index];
+        if (slot->distance == 0U) {
+            *slot = entry;
+            return placed ? placed : slot;
+        }
+
+        /* Robin Hood: the entry further from home keeps the slot. */
+        if (slot->distance < entry.distance) {
+            math_expr_map_slot displaced = *slot;
+            *slot = entry;
+            entry = displaced;
+            if (!placed) {
+                placed = slot;
+            }
+        }
+
+        index = (index + 1U) & mask;
+        ++entry.distance;
+    }
+}
+
+static int resize(math_expr_map *map, size_t capacity)
+{
+    math_expr_map_slot *slots = (math_expr_map_slot *)calloc(capacity, sizeof(*slots));
+    if (!slots) {
+        perror("math_expr_map: calloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(capacity * sizeof(*slots));
+
+    math_expr_map_slot *old = map->slots;
+    size_t old_capacity = map->capacity;
+    map->slots = slots;
+    map->capacity = capacity;
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old[i].distance != 0U) {
+            place(map, old[i]);
+        }
+    }
+
+    free(old);
+    return 0;
+}
+
+int math_expr_map_reserve(math_expr_map *map, size_t count)
+{
+    if (!map) {
+        return -1;
+    }
+
+    size_t capacity = map->capacity == 0U ? kInitialSlots : map->capacity;
+    while (count * 5U > capacity * 4U) {
+        capacity *= 2U;
+    }
+    return capacity > map->capacity ? resize(map, capacity) : 0;
+}
+
+static math_expr_map_slot *find_slot(const math_expr_map *map, const char *key, size_t length, uint64_t hash)
+{
+    if (map->capacity == 0U) {
+        return NULL;
+    }
+
+    size_t mask = map->capacity - 1U;
+    size_t index = (size_t)hash & mask;
+
+    for (size_t distance = 1U;; ++distance) {
+        math_expr_map_slot *slot = &map->slots[index];
+        if (slot->distance < distance) {
+            return NULL;
+        }
+        if (slot->hash == hash && keys_equal(map, slot, key, length)) {
+            return slot;
+        }
+        index = (index + 1U) & mask;
+    }
+}
+
+static math_expr_map_slot *find_int_slot(const math_expr_map *map, uint64_t key, uint64_t hash)
+{
+    if (map->capacity == 0U) {
+        return NULL;
+    }
+
+    size_t mask = map->capacity - 1U;
+    size_t index = (size_t)hash & mask;
+
+    for (size_t distance = 1U;; ++distance) {
+        math_expr_map_slot *slot = &map->slots[index];
+        if (slot->distance < distance) {
+            return NULL;
+        }
+        if (slot->key == key) {
+            return slot;
+        }
+        index = (index + 1U) & mask;
+    }
+}
+
+/* Move live keys to the front of the arena, dropping the bytes of removed ones. */
+static void compact_keys(math_expr_map *map)
+{
+    char *keys = (char *)malloc(map->keys_capacity);
+    if (!keys) {
+        return;
+    }
+
+    size_t size = 0U;
+    for (size_t i = 0; i < map->capacity; ++i) {
+        math_expr_map_slot *slot = &map->slots[i];
+        if (slot->distance == 0U) {
+            continue;
+        }
+        memcpy(keys + size, map->keys + slot->key, slot->length + 1U);
+        slot->key = size;
+        size += slot->length + 1U;
+    }
+
+    free(map->keys);
+    map->keys = keys;
+    map->keys_size = size;
+    map->keys_garbage = 0U;
+}
+
+static int store_key(math_expr_map *map, const char *key, size_t length, uint64_t *out_offset)
+{
+    size_t needed = map->keys_size + length + 1U;
+    if (needed > map->keys_capacity && map->keys_garbage >= length + 1U && map->keys_garbage * 2U >= map->keys_size) {
+        compact_keys(map);
+        needed = map->keys_size + length + 1U;
+    }
+
+    if (needed > map->keys_capacity) {
+        size_t capacity = map->keys_capacity == 0U ? kInitialKeyBytes : map->keys_capacity * 2U;
+        while (capacity < needed) {
+            capacity *= 2U;
+        }
+        char *keys = (char *)realloc(map->keys, capacity);
+        if (!keys) {
+            perror("math_expr_map: realloc");
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC(capacity);
+        map->keys = keys;
+        map->keys_capacity = capacity;
+    }
+
+    memcpy(map->keys + map->keys_size, key, length);
+    map->keys[map->keys_size + length] = '\0';
+    *out_offset = map->keys_size;
+    map->keys_size = needed;
+    return 0;
+}
+
+/* Grow the table if one more key would take it past 80% full. */
+static int make_room(math_expr_map *map)
+{
+    if ((map->count + 1U) * 5U > map->capacity * 4U) {
+        return resize(map, map->capacity == 0U ? kInitialSlots : map->capacity * 2U);
+    }
+    return 0;
+}
+
+static math_expr_map_value *insert(math_expr_map *map, const char *key, size_t length, uint64_t hash, int *out_inserted)
+{
+    math_expr_map_slot *slot = find_slot(map, key, length, hash);
+    if (out_inserted) {
+        *out_inserted = slot == NULL;
+    }
+    if (slot) {
+        return &slot->value;
+    }
+
+    if (make_room(map) != 0) {
+        return NULL;
+    }
+
+    math_expr_map_slot entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.hash = hash;
+    if (store_key(map, key, length, &entry.key) != 0) {
+        return NULL;
+    }
+    entry.length = length;
+
+    ++map->count;
+    return &place(map, entry)->value;
+}
+
+static math_expr_map_value *insert_int(math_expr_map *map, uint64_t key, uint64_t hash, int *out_inserted)
+{
+    math_expr_map_slot *slot = find_int_slot(map, key, hash);
+    if (out_inserted) {
+        *out_inserted = slot == NULL;
+    }
+    if (slot) {
+        return &slot->value;
+    }
+
+    if (make_room(map) != 0) {
+        return NULL;
+    }
+
+    math_expr_map_slot entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.hash = hash;
+    entry.key = key;
+
+    ++map->count;
+    return &place(map, entry)->value;
+}
+
+static int remove_slot(math_expr_map *map, math_expr_map_slot *slot)
+{
+    if (!slot) {
+        return -1;
+    }
+
+    if (!(map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        map->keys_garbage += slot->length + 1U;
+    }
+
+    /* Backward shift: pull the rest of the run one slot closer to home. */
+    size_t mask = map->capacity - 1U;
+    size_t index = (size_t)(slot - map->slots);
+    size_t next = (index + 1U) & mask;
+    while (map->slots[next].distance > 1U) {
+        map->slots[index] = map->slots[next];
+        --map->slots[index].distance;
+        index = next;
+        next = (next + 1U) & mask;
+    }
+    map->slots[index].distance = 0U;
+
+    --map->count;
+    return 0;
+}
+
+math_expr_map_value *math_expr_map_find(const math_expr_map *map, const char *key, size_t length)
+{
+    if (!map || !key || (map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        return NULL;
+    }
+
+    math_expr_map_slot *slot = find_slot(map, key, length, hash_string(key, length, map->flags & MATH_EXPR_MAP_IGNORE_CASE));
+    return slot ? &slot->value : NULL;
+}
+
+math_expr_map_value *math_expr_map_insert(math_expr_map *map, const char *key, size_t length, int *out_inserted)
+{
+    if (!map || !key || (map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        return NULL;
+    }
+
+    return insert(map, key, length, hash_string(key, length, map->flags & MATH_EXPR_MAP_IGNORE_CASE), out_inserted);
+}
+
+int math_expr_map_remove(math_expr_map *map, const char *key, size_t length)
+{
+    if (!map || !key || (map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        return -1;
+    }
+
+    return remove_slot(map, find_slot(map, key, length, hash_string(key, length, map->flags & MATH_EXPR_MAP_IGNORE_CASE)));
+}
+
+math_expr_map_value *math_expr_map_find_int(const math_expr_map *map, uint64_t key)
+{
+    if (!map || !(map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        return NULL;
+    }
+
+    math_expr_map_slot *slot = find_int_slot(map, key, mix64(key));
+    return slot ? &slot->value : NULL;
+}
+
+math_expr_map_value *math_expr_map_insert_int(math_expr_map *map, uint64_t key, int *out_inserted)
+{
+    if (!map || !(map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        return NULL;
+    }
+
+    return insert_int(map, key, mix64(key), out_inserted);
+}
+
+int math_expr_map_remove_int(math_expr_map *map, uint64_t key)
+{
+    if (!map || !(map->flags & MATH_EXPR_MAP_INTEGER_KEYS)) {
+        return -1;
+    }
+
+    return remove_slot(map, find_int_slot(map, key, mix64(key)));
+}
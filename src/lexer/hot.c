@@ -0,0 +1,1024 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/hot.h"
+
+#include "program_internal.h"
+#include "snapshot.h"
+#include "stats_internal.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+/* Folding can expose dead branches and the reverse; stop after this many rounds. */
+#define MATH_EXPR_HOT_MAX_ROUNDS 4U
+
+#define MATH_EXPR_HOT_NO_CONSTANT ((size_t)-1)
+
+enum {
+    SLOT_UNSEEN,
+    SLOT_CLAIMED, /* A thread is storing the first value. */
+    SLOT_CONSTANT,
+    SLOT_VARIES
+};
+
+/*
+ * Code of one optimised version. The programs own their code and constants
+ * but borrow the symbol and function tables of the hot program's copy of the
+ * original.
+ */
+typedef struct hot_version {
+    math_expr_program generic;
+    math_expr_program specialized; /* code_size is 0 when no slot is specialised. */
+    size_t *guard_slots;
+    uint64_t *guard_bits;
+    size_t guard_count;
+} hot_version;
+
+struct math_expr_hot_program {
+    math_expr_program original;
+    math_expr_snapshot versions;
+    size_t threshold;
+    atomic_uint_fast64_t evaluations;
+    atomic_uint_fast64_t specialized_runs;
+    atomic_uint_fast64_t guard_misses;
+    atomic_int optimized; /* Set once optimisation ran; ends profiling. */
+    atomic_size_t generation;
+    _Atomic uint64_t *observed; /* Bits of the first value seen in each slot. */
+    atomic_uchar *slot_states;
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    int job_state; /* Guarded by g_optimizer_lock. */
+    struct math_expr_hot_program *next_job;
+#endif
+};
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+enum {
+    JOB_NONE,
+    JOB_QUEUED,
+    JOB_RUNNING
+};
+
+/*
+ * Programs waiting for optimisation, served in order by a single detached
+ * worker that exits when the queue is empty, so however many programs turn
+ * hot at most one thread exists for them.
+ */
+static pthread_mutex_t g_optimizer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_optimizer_done = PTHREAD_COND_INITIALIZER;
+static struct math_expr_hot_program *g_queue_head;
+static struct math_expr_hot_program *g_queue_tail;
+static int g_optimizer_running;
+#endif
+
+static uint64_t double_bits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static int grow(void **data, size_t *capacity, size_t required, size_t element_size)
+{
+    if (required <= *capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = *capacity == 0U ? 16U : *capacity * 2U;
+    while (new_capacity < required) {
+        new_capacity *= 2U;
+    }
+
+    void *new_data = realloc(*data, new_capacity * element_size);
+    if (!new_data) {
+        perror("math_expr_hot: realloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(new_capacity * element_size);
+    *data = new_data;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int append_instruction(math_expr_program *program, math_expr_opcode opcode, uint32_t operand)
+{
+    if (grow((void **)&program->code, &program->code_capacity, program->code_size + 1U, sizeof(*program->code)) != 0) {
+        return -1;
+    }
+
+    program->code[program->code_size].opcode = (uint32_t)opcode;
+    program->code[program->code_size].operand = operand;
+    ++program->code_size;
+    return 0;
+}
+
+static int append_constant(math_expr_program *program, double value, size_t *out_index)
+{
+    if (grow((void **)&program->constants,
+             &program->constant_capacity,
+             program->constant_count + 1U,
+             sizeof(*program->constants)) != 0) {
+        return -1;
+    }
+
+    program->constants[program->constant_count] = value;
+    *out_index = program->constant_count++;
+    return 0;
+}
+
+static int append_const_instruction(math_expr_program *program, double value)
+{
+    size_t index = 0U;
+    return append_constant(program, value, &index) != 0
+               ? -1
+               : append_instruction(program, MATH_EXPR_OP_CONST, (uint32_t)index);
+}
+
+/* Free what a rewritten program owns; its symbol and function tables are borrowed. */
+static void release_rewritten(math_expr_program *program)
+{
+    free(program->code);
+    free(program->constants);
+    math_expr_program_init(program);
+}
+
+/* Empty program sharing the tables of source. */
+static void start_rewrite(const math_expr_program *source, math_expr_program *out)
+{
+    math_expr_program_init(out);
+    out->symbols = source->symbols;
+    out->symbol_count = source->symbol_count;
+    out->functions = source->functions;
+    out->function_count = source->function_count;
+    out->max_stack = source->max_stack;
+    out->precision = source->precision;
+}
+
+/* Rewritten copy of source with the same code. */
+static int clone_rewritten(const math_expr_program *source, math_expr_program *out)
+{
+    start_rewrite(source, out);
+    if (grow((void **)&out->code, &out->code_capacity, source->code_size, sizeof(*out->code)) != 0 ||
+        grow((void **)&out->constants,
+             &out->constant_capacity,
+             source->constant_count > 0U ? source->constant_count : 1U,
+             sizeof(*out->constants)) != 0) {
+        release_rewritten(out);
+        return -1;
+    }
+
+    memcpy(out->code, source->code, source->code_size * sizeof(*out->code));
+    if (source->constant_count > 0U) {
+        memcpy(out->constants, source->constants, source->constant_count * sizeof(*out->constants));
+    }
+    out->code_size = source->code_size;
+    out->constant_count = source->constant_count;
+    return 0;
+}
+
+/* Deep copy owned by the hot program. */
+static int copy_program(const math_expr_program *source, math_expr_program *out)
+{
+    if (clone_rewritten(source, out) != 0) {
+        return -1;
+    }
+
+    out->symbols = NULL;
+    out->functions = NULL;
+    out->symbol_count = 0U;
+    out->function_count = 0U;
+
+    if (source->symbol_count > 0U) {
+        out->symbols = (char **)calloc(source->symbol_count, sizeof(*out->symbols));
+        if (!out->symbols) {
+            perror("math_expr_hot: calloc");
+            math_expr_program_deinit(out);
+            return -1;
+        }
+        out->symbol_capacity = source->symbol_count;
+        for (size_t i = 0; i < source->symbol_count; ++i) {
+            size_t length = strlen(source->symbols[i]);
+            out->symbols[i] = (char *)malloc(length + 1U);
+            if (!out->symbols[i]) {
+                perror("math_expr_hot: malloc");
+                math_expr_program_deinit(out);
+                return -1;
+            }
+            memcpy(out->symbols[i], source->symbols[i], length + 1U);
+            ++out->symbol_count;
+        }
+    }
+
+    if (source->function_count > 0U) {
+        out->functions = (math_expr_program_function *)malloc(source->function_count * sizeof(*out->functions));
+        if (!out->functions) {
+            perror("math_expr_hot: malloc");
+            math_expr_program_deinit(out);
+            return -1;
+        }
+        memcpy(out->functions, source->functions, source->function_count * sizeof(*out->functions));
+        out->function_count = source->function_count;
+        out->function_capacity = source->function_count;
+    }
+
+    return 0;
+}
+
+static int is_jump(const math_expr_instruction *instruction)
+{
+    return instruction->opcode == MATH_EXPR_OP_JUMP || instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE;
+}
+
+/* Per-instruction scratch for one pass over program: depths, jump targets and the old-to-new map. */
+typedef struct pass_scratch {
+    size_t *depths;
+    size_t *map;
+    unsigned char *targets;
+} pass_scratch;
+
+static int scratch_init(pass_scratch *scratch, const math_expr_program *program)
+{
+    size_t count = program->code_size + 1U;
+    scratch->depths = (size_t *)malloc(2U * count * sizeof(size_t) + count);
+    if (!scratch->depths) {
+        perror("math_expr_hot: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(2U * count * sizeof(size_t) + count);
+
+    scratch->map = scratch->depths + count;
+    scratch->targets = (unsigned char *)(scratch->map + count);
+    memset(scratch->targets, 0, count);
+
+    if (math_expr_program_depths(program, scratch->depths) != 0) {
+        free(scratch->depths);
+        return -1;
+    }
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        if (is_jump(&program->code[pc])) {
+            scratch->targets[program->code[pc].operand] = 1U;
+        }
+    }
+    return 0;
+}
+
+/* Jump operands were copied unchanged; point them at the new positions of their targets. */
+static void patch_jumps(math_expr_program *out, const size_t *map)
+{
+    for (size_t pc = 0; pc < out->code_size; ++pc) {
+        if (is_jump(&out->code[pc])) {
+            out->code[pc].operand = (uint32_t)map[out->code[pc].operand];
+        }
+    }
+}
+
+static int is_true(const math_expr_program *program, double value)
+{
+    return program->precision == MATH_EXPR_PRECISION_F32 ? (float)value != 0.0f : value != 0.0;
+}
+
+typedef struct fold_entry {
+    int constant; /* The value is the single CONST instruction at out position at. */
+    size_t at;
+} fold_entry;
+
+/* Whether instruction, applied to the constant operands, can be computed once here. */
+static int can_fold(const math_expr_program *out, const math_expr_instruction *instruction, const fold_entry *operands, size_t pops)
+{
+    math_expr_opcode opcode = (math_expr_opcode)instruction->opcode;
+    if (pops == 0U || opcode == MATH_EXPR_OP_CALL_EXTERNAL || is_jump(instruction)) {
+        return 0;
+    }
+
+    for (size_t k = 0; k < pops; ++k) {
+        if (!operands[k].constant) {
+            return 0;
+        }
+    }
+
+    /* The operands must be exactly the pops instructions before this one. */
+    size_t first = operands[0].at;
+    if (first + pops != out->code_size) {
+        return 0;
+    }
+
+    /* Division and modulo by zero stay in the code so they still fail at run time. */
+    if (opcode == MATH_EXPR_OP_DIV || opcode == MATH_EXPR_OP_MOD) {
+        double divisor = out->constants[out->code[operands[1].at].operand];
+        return is_true(out, divisor);
+    }
+    return 1;
+}
+
+/*
+ * Copy program into out, computing every pure instruction whose operands are
+ * all constants and resolving conditional jumps on constants. Constants are
+ * only tracked along straight-line code: at a jump target the value on top of
+ * the stack may come from either branch and is treated as unknown.
+ */
+static int fold_constants(const math_expr_program *program, math_expr_program *out, int *out_changed)
+{
+    pass_scratch scratch;
+    if (scratch_init(&scratch, program) != 0) {
+        return -1;
+    }
+
+    fold_entry *stack = (fold_entry *)malloc((program->max_stack + 1U) * sizeof(*stack));
+    if (!stack) {
+        perror("math_expr_hot: malloc");
+        free(scratch.depths);
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC((program->max_stack + 1U) * sizeof(*stack));
+
+    start_rewrite(program, out);
+    size_t top = 0U;
+    int status = 0;
+
+    for (size_t pc = 0; pc < program->code_size && status == 0; ++pc) {
+        const math_expr_instruction *instruction = &program->code[pc];
+
+        if (scratch.targets[pc]) {
+            top = scratch.depths[pc];
+            if (top > 0U) {
+                stack[top - 1U].constant = 0;
+            }
+        }
+        scratch.map[pc] = out->code_size;
+
+        switch ((math_expr_opcode)instruction->opcode) {
+        case MATH_EXPR_OP_CONST:
+            stack[top].constant = 1;
+            stack[top++].at = out->code_size;
+            status = append_const_instruction(out, program->constants[instruction->operand]);
+            continue;
+        case MATH_EXPR_OP_JUMP:
+            status = append_instruction(out, MATH_EXPR_OP_JUMP, instruction->operand);
+            continue;
+        case MATH_EXPR_OP_JUMP_IF_FALSE: {
+            fold_entry condition = stack[--top];
+            if (!condition.constant || condition.at + 1U != out->code_size) {
+                status = append_instruction(out, MATH_EXPR_OP_JUMP_IF_FALSE, instruction->operand);
+                continue;
+            }
+            /* A constant condition: fall through, or jump unconditionally. */
+            double value = out->constants[out->code[condition.at].operand];
+            out->code_size = condition.at;
+            *out_changed = 1;
+            if (!is_true(out, value)) {
+                status = append_instruction(out, MATH_EXPR_OP_JUMP, instruction->operand);
+            }
+            continue;
+        }
+        default:
+            break;
+        }
+
+        size_t pops = math_expr_instruction_pops(program, instruction);
+        fold_entry *operands = &stack[top - pops];
+        int fold = can_fold(out, instruction, operands, pops);
+        size_t first = pops > 0U ? operands[0].at : out->code_size;
+
+        status = append_instruction(out, (math_expr_opcode)instruction->opcode, instruction->operand);
+        top -= pops;
+        stack[top].constant = 0;
+        stack[top].at = out->code_size - 1U;
+
+        double value = 0.0;
+        if (status == 0 && fold && math_expr_program_run_range(out, first, out->code_size, NULL, &value) == 0) {
+            out->code_size = first;
+            status = append_const_instruction(out, value);
+            stack[top].constant = 1;
+            stack[top].at = first;
+            *out_changed = 1;
+        }
+        ++top;
+    }
+
+    scratch.map[program->code_size] = out->code_size;
+    if (status == 0) {
+        patch_jumps(out, scratch.map);
+    }
+
+    free(stack);
+    free(scratch.depths);
+    return status;
+}
+
+/* Drop code no path reaches, and jumps that only skip such code. */
+static int remove_unreachable(const math_expr_program *program, math_expr_program *out, int *out_changed)
+{
+    size_t count = program->code_size + 1U;
+    unsigned char *reachable = (unsigned char *)calloc(count, 1U);
+    size_t *map = (size_t *)malloc(count * sizeof(*map));
+    if (!reachable || !map) {
+        perror("math_expr_hot: malloc");
+        free(reachable);
+        free(map);
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(count + count * sizeof(*map));
+
+    reachable[0] = 1U;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        const math_expr_instruction *instruction = &program->code[pc];
+        if (!reachable[pc]) {
+            continue;
+        }
+        if (is_jump(instruction)) {
+            reachable[instruction->operand] = 1U;
+        }
+        if (instruction->opcode != MATH_EXPR_OP_JUMP) {
+            reachable[pc + 1U] = 1U;
+        }
+    }
+
+    start_rewrite(program, out);
+    int status = 0;
+    for (size_t pc = 0; pc < program->code_size && status == 0; ++pc) {
+        const math_expr_instruction *instruction = &program->code[pc];
+        map[pc] = out->code_size;
+        if (!reachable[pc]) {
+            *out_changed = 1;
+            continue;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_JUMP) {
+            size_t next = pc + 1U;
+            while (next < instruction->operand && !reachable[next]) {
+                ++next;
+            }
+            if (next == instruction->operand) {
+                *out_changed = 1;
+                continue;
+            }
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_CONST) {
+            status = append_const_instruction(out, program->constants[instruction->operand]);
+        } else {
+            status = append_instruction(out, (math_expr_opcode)instruction->opcode, instruction->operand);
+        }
+    }
+
+    map[program->code_size] = out->code_size;
+    if (status == 0) {
+        patch_jumps(out, map);
+    }
+
+    free(reachable);
+    free(map);
+    return status;
+}
+
+static int is_push(const math_expr_instruction *instruction)
+{
+    return instruction->opcode == MATH_EXPR_OP_CONST || instruction->opcode == MATH_EXPR_OP_LOAD;
+}
+
+/*
+ * Start of the left operand of the binary instruction at pc, if the operands
+ * are straight-line code that nothing jumps into; otherwise code_size.
+ */
+static size_t left_operand_start(const math_expr_program *program, const pass_scratch *scratch, size_t pc)
+{
+    size_t base = scratch->depths[pc] - 2U;
+    size_t begin = pc;
+
+    while (begin > 0U) {
+        --begin;
+        if (is_jump(&program->code[begin])) {
+            return program->code_size;
+        }
+        if (scratch->depths[begin] == base) {
+            return begin;
+        }
+        if (scratch->targets[begin]) {
+            return program->code_size;
+        }
+    }
+    return program->code_size;
+}
+
+/*
+ * Replace MUL ADD with MUL_ADD, LOAD s LOAD s MUL with LOAD s SQUARE, and
+ * a * b + z with z a single push with z a * b MUL_ADD: addition commutes, so
+ * the value is unchanged.
+ */
+static int fuse_instructions(const math_expr_program *program, math_expr_program *out)
+{
+    pass_scratch scratch;
+    if (scratch_init(&scratch, program) != 0) {
+        return -1;
+    }
+
+    start_rewrite(program, out);
+    const math_expr_instruction *code = program->code;
+    size_t size = program->code_size;
+    int status = 0;
+
+    for (size_t pc = 0; pc < size && status == 0; ++pc) {
+        scratch.map[pc] = out->code_size;
+
+        if (pc + 2U < size && code[pc].opcode == MATH_EXPR_OP_LOAD && code[pc + 1U].opcode == MATH_EXPR_OP_LOAD &&
+            code[pc].operand == code[pc + 1U].operand && code[pc + 2U].opcode == MATH_EXPR_OP_MUL &&
+            !scratch.targets[pc + 1U] && !scratch.targets[pc + 2U]) {
+            status = append_instruction(out, MATH_EXPR_OP_LOAD, code[pc].operand);
+            if (status == 0) {
+                status = append_instruction(out, MATH_EXPR_OP_SQUARE, 0U);
+            }
+            scratch.map[pc + 1U] = scratch.map[pc + 2U] = out->code_size - 1U;
+            pc += 2U;
+            continue;
+        }
+
+        if (code[pc].opcode == MATH_EXPR_OP_MUL && pc + 1U < size && code[pc + 1U].opcode == MATH_EXPR_OP_ADD &&
+            !scratch.targets[pc + 1U]) {
+            status = append_instruction(out, MATH_EXPR_OP_MUL_ADD, 0U);
+            scratch.map[pc + 1U] = out->code_size - 1U;
+            ++pc;
+            continue;
+        }
+
+        if (code[pc].opcode == MATH_EXPR_OP_MUL && pc + 2U < size && is_push(&code[pc + 1U]) &&
+            code[pc + 2U].opcode == MATH_EXPR_OP_ADD && !scratch.targets[pc + 1U] && !scratch.targets[pc + 2U]) {
+            size_t begin = left_operand_start(program, &scratch, pc);
+            if (begin < size) {
+                /* Move the push in front of the operands; jumps to begin now land on it. */
+                size_t at = scratch.map[begin];
+                status = append_instruction(out, (math_expr_opcode)code[pc + 1U].opcode, code[pc + 1U].operand);
+                if (status == 0) {
+                    memmove(&out->code[at + 1U], &out->code[at], (out->code_size - 1U - at) * sizeof(*out->code));
+                    out->code[at] = code[pc + 1U];
+                }
+                if (status == 0 && code[pc + 1U].opcode == MATH_EXPR_OP_CONST) {
+                    size_t index = 0U;
+                    status = append_constant(out, program->constants[code[pc + 1U].operand], &index);
+                    out->code[at].operand = (uint32_t)index;
+                }
+                if (status == 0) {
+                    status = append_instruction(out, MATH_EXPR_OP_MUL_ADD, 0U);
+                }
+                for (size_t k = begin + 1U; k <= pc; ++k) {
+                    ++scratch.map[k];
+                }
+                scratch.map[pc + 1U] = scratch.map[pc + 2U] = out->code_size - 1U;
+                pc += 2U;
+                continue;
+            }
+        }
+
+        if (code[pc].opcode == MATH_EXPR_OP_CONST) {
+            status = append_const_instruction(out, program->constants[code[pc].operand]);
+        } else {
+            status = append_instruction(out, (math_expr_opcode)code[pc].opcode, code[pc].operand);
+        }
+    }
+
+    scratch.map[size] = out->code_size;
+    if (status == 0) {
+        patch_jumps(out, scratch.map);
+    }
+
+    free(scratch.depths);
+    return status;
+}
+
+/* Set max_stack to the deepest point of the rewritten code and check it. */
+static int finish_rewrite(math_expr_program *program)
+{
+    size_t *depths = (size_t *)malloc((program->code_size + 1U) * sizeof(*depths));
+    if (!depths) {
+        perror("math_expr_hot: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC((program->code_size + 1U) * sizeof(*depths));
+
+    program->max_stack = (size_t)-1;
+    int status = math_expr_program_depths(program, depths);
+    if (status == 0) {
+        program->max_stack = 1U;
+        for (size_t pc = 0; pc <= program->code_size; ++pc) {
+            if (depths[pc] > program->max_stack) {
+                program->max_stack = depths[pc];
+            }
+        }
+        /* An instruction's result is the depth before the next one, except before a jump target. */
+        for (size_t pc = 0; pc < program->code_size; ++pc) {
+            size_t after = depths[pc] - math_expr_instruction_pops(program, &program->code[pc]) + !is_jump(&program->code[pc]);
+            if (after > program->max_stack) {
+                program->max_stack = after;
+            }
+        }
+        status = math_expr_program_validate(program);
+    }
+
+    free(depths);
+    return status;
+}
+
+typedef int (*rewrite_pass)(const math_expr_program *program, math_expr_program *out, int *out_changed);
+
+/* Run a pass on *program, replacing it with the result. */
+static int apply_pass(math_expr_program *program, rewrite_pass pass, int *out_changed)
+{
+    math_expr_program next;
+    if (pass(program, &next, out_changed) != 0) {
+        release_rewritten(&next);
+        return -1;
+    }
+
+    next.max_stack = program->max_stack;
+    release_rewritten(program);
+    *program = next;
+    return 0;
+}
+
+static int fuse_pass(const math_expr_program *program, math_expr_program *out, int *out_changed)
+{
+    (void)out_changed;
+    return fuse_instructions(program, out);
+}
+
+/* Rewrite program in place: substitute the guarded slots, fold, prune and fuse. */
+static int optimize_code(math_expr_program *program, const size_t *guard_slots, const uint64_t *guard_bits, size_t guard_count)
+{
+    if (guard_count > 0U) {
+        size_t *slot_constants = (size_t *)malloc(program->symbol_count * sizeof(*slot_constants));
+        if (!slot_constants) {
+            perror("math_expr_hot: malloc");
+            return -1;
+        }
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            slot_constants[slot] = MATH_EXPR_HOT_NO_CONSTANT;
+        }
+
+        int status = 0;
+        for (size_t i = 0; i < guard_count && status == 0; ++i) {
+            status = append_constant(program, bits_double(guard_bits[i]), &slot_constants[guard_slots[i]]);
+        }
+        for (size_t pc = 0; pc < program->code_size && status == 0; ++pc) {
+            math_expr_instruction *instruction = &program->code[pc];
+            if (instruction->opcode == MATH_EXPR_OP_LOAD &&
+                slot_constants[instruction->operand] != MATH_EXPR_HOT_NO_CONSTANT) {
+                instruction->opcode = MATH_EXPR_OP_CONST;
+                instruction->operand = (uint32_t)slot_constants[instruction->operand];
+            }
+        }
+        free(slot_constants);
+        if (status != 0) {
+            return -1;
+        }
+
+        int changed = 1;
+        for (size_t round = 0; round < MATH_EXPR_HOT_MAX_ROUNDS && changed; ++round) {
+            changed = 0;
+            if (apply_pass(program, fold_constants, &changed) != 0 ||
+                apply_pass(program, remove_unreachable, &changed) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    int unused = 0;
+    if (apply_pass(program, fuse_pass, &unused) != 0) {
+        return -1;
+    }
+    return finish_rewrite(program);
+}
+
+static void version_destroy(void *value)
+{
+    hot_version *version = (hot_version *)value;
+    if (!version) {
+        return;
+    }
+
+    release_rewritten(&version->generic);
+    release_rewritten(&version->specialized);
+    free(version->guard_slots);
+    free(version->guard_bits);
+    free(version);
+}
+
+/* Slots loaded by the program that kept one value while profiling. */
+static size_t collect_guards(const math_expr_hot_program *hot, size_t *slots, uint64_t *bits)
+{
+    const math_expr_program *program = &hot->original;
+    size_t count = 0U;
+
+    for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+        if (atomic_load_explicit(&hot->slot_states[slot], memory_order_acquire) != SLOT_CONSTANT) {
+            continue;
+        }
+        for (size_t pc = 0; pc < program->code_size; ++pc) {
+            if (program->code[pc].opcode == MATH_EXPR_OP_LOAD && program->code[pc].operand == slot) {
+                slots[count] = slot;
+                bits[count++] = atomic_load_explicit(&hot->observed[slot], memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+static hot_version *build_version(const math_expr_hot_program *hot)
+{
+    hot_version *version = (hot_version *)calloc(1U, sizeof(*version));
+    size_t slots = hot->original.symbol_count > 0U ? hot->original.symbol_count : 1U;
+    if (version) {
+        version->guard_slots = (size_t *)malloc(slots * sizeof(*version->guard_slots));
+        version->guard_bits = (uint64_t *)malloc(slots * sizeof(*version->guard_bits));
+    }
+    if (!version || !version->guard_slots || !version->guard_bits) {
+        perror("math_expr_hot: malloc");
+        version_destroy(version);
+        return NULL;
+    }
+    MATH_EXPR_STATS_ALLOC(sizeof(*version) + slots * (sizeof(size_t) + sizeof(uint64_t)));
+
+    if (clone_rewritten(&hot->original, &version->generic) != 0 || optimize_code(&version->generic, NULL, NULL, 0U) != 0) {
+        version_destroy(version);
+        return NULL;
+    }
+
+    version->guard_count = collect_guards(hot, version->guard_slots, version->guard_bits);
+    if (version->guard_count > 0U &&
+        (clone_rewritten(&hot->original, &version->specialized) != 0 ||
+         optimize_code(&version->specialized, version->guard_slots, version->guard_bits, version->guard_count) != 0)) {
+        version_destroy(version);
+        return NULL;
+    }
+
+    return version;
+}
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+static void *optimizer_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_optimizer_lock);
+    while (g_queue_head) {
+        math_expr_hot_program *hot = g_queue_head;
+        g_queue_head = hot->next_job;
+        if (!g_queue_head) {
+            g_queue_tail = NULL;
+        }
+        hot->job_state = JOB_RUNNING;
+        pthread_mutex_unlock(&g_optimizer_lock);
+
+        math_expr_hot_program_optimize(hot);
+
+        pthread_mutex_lock(&g_optimizer_lock);
+        hot->job_state = JOB_NONE;
+        pthread_cond_broadcast(&g_optimizer_done);
+    }
+    g_optimizer_running = 0;
+    pthread_mutex_unlock(&g_optimizer_lock);
+    return NULL;
+}
+
+/* Take a queued program back off the queue; the caller holds g_optimizer_lock. */
+static void unqueue(math_expr_hot_program *hot)
+{
+    math_expr_hot_program **link = &g_queue_head;
+    math_expr_hot_program *previous = NULL;
+    while (*link != hot) {
+        previous = *link;
+        link = &(*link)->next_job;
+    }
+    *link = hot->next_job;
+    if (g_queue_tail == hot) {
+        g_queue_tail = previous;
+    }
+    hot->job_state = JOB_NONE;
+}
+#endif
+
+/* Called by the evaluation that reaches the threshold, and by no other. */
+static void start_optimization(math_expr_hot_program *hot)
+{
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    pthread_mutex_lock(&g_optimizer_lock);
+    hot->next_job = NULL;
+    hot->job_state = JOB_QUEUED;
+    if (g_queue_tail) {
+        g_queue_tail->next_job = hot;
+    } else {
+        g_queue_head = hot;
+    }
+    g_queue_tail = hot;
+
+    int queued = g_optimizer_running;
+    if (!queued) {
+        pthread_t worker;
+        pthread_attr_t attributes;
+        if (pthread_attr_init(&attributes) == 0) {
+            pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+            queued = pthread_create(&worker, &attributes, optimizer_main, NULL) == 0;
+            pthread_attr_destroy(&attributes);
+        }
+        g_optimizer_running = queued;
+    }
+    if (!queued) {
+        unqueue(hot);
+    }
+    pthread_mutex_unlock(&g_optimizer_lock);
+    if (queued) {
+        return;
+    }
+#endif
+    math_expr_hot_program_optimize(hot);
+}
+
+static void record_profile(math_expr_hot_program *hot, const double *variables)
+{
+    for (size_t slot = 0; slot < hot->original.symbol_count; ++slot) {
+        uint64_t bits = double_bits(variables[slot]);
+        unsigned char state = atomic_load_explicit(&hot->slot_states[slot], memory_order_acquire);
+
+        if (state == SLOT_UNSEEN) {
+            unsigned char expected = SLOT_UNSEEN;
+            if (atomic_compare_exchange_strong(&hot->slot_states[slot], &expected, SLOT_CLAIMED)) {
+                atomic_store_explicit(&hot->observed[slot], bits, memory_order_relaxed);
+                atomic_store_explicit(&hot->slot_states[slot], SLOT_CONSTANT, memory_order_release);
+            }
+        } else if (state == SLOT_CONSTANT && atomic_load_explicit(&hot->observed[slot], memory_order_relaxed) != bits) {
+            atomic_store_explicit(&hot->slot_states[slot], SLOT_VARIES, memory_order_relaxed);
+        }
+    }
+}
+
+math_expr_hot_program *math_expr_hot_program_create(const math_expr_program *program, size_t threshold)
+{
+    if (!program || math_expr_program_validate(program) != 0) {
+        return NULL;
+    }
+
+    math_expr_hot_program *hot = (math_expr_hot_program *)calloc(1U, sizeof(*hot));
+    if (!hot) {
+        perror("math_expr_hot: calloc");
+        return NULL;
+    }
+    MATH_EXPR_STATS_ALLOC(sizeof(*hot));
+
+    size_t slots = program->symbol_count > 0U ? program->symbol_count : 1U;
+    hot->observed = (_Atomic uint64_t *)calloc(slots, sizeof(*hot->observed));
+    hot->slot_states = (atomic_uchar *)calloc(slots, sizeof(*hot->slot_states));
+    hot_version *initial = (hot_version *)calloc(1U, sizeof(*initial));
+    if (!hot->observed || !hot->slot_states || !initial) {
+        perror("math_expr_hot: calloc");
+        free(hot->observed);
+        free((void *)hot->slot_states);
+        free(initial);
+        free(hot);
+        return NULL;
+    }
+    MATH_EXPR_STATS_ALLOC(slots * (sizeof(*hot->observed) + sizeof(*hot->slot_states)) + sizeof(*initial));
+
+    if (copy_program(program, &hot->original) != 0 || clone_rewritten(&hot->original, &initial->generic) != 0) {
+        math_expr_program_deinit(&hot->original);
+        free(hot->observed);
+        free((void *)hot->slot_states);
+        free(initial);
+        free(hot);
+        return NULL;
+    }
+
+    for (size_t slot = 0; slot < slots; ++slot) {
+        atomic_init(&hot->observed[slot], 0U);
+        atomic_init(&hot->slot_states[slot], SLOT_UNSEEN);
+    }
+    atomic_init(&hot->evaluations, 0U);
+    atomic_init(&hot->specialized_runs, 0U);
+    atomic_init(&hot->guard_misses, 0U);
+    atomic_init(&hot->optimized, 0);
+    atomic_init(&hot->generation, 0U);
+    hot->threshold = threshold == 0U ? MATH_EXPR_HOT_DEFAULT_THRESHOLD : threshold;
+    math_expr_snapshot_init(&hot->versions, initial, version_destroy);
+    return hot;
+}
+
+void math_expr_hot_program_destroy(math_expr_hot_program *hot)
+{
+    if (!hot) {
+        return;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    /* A queued optimisation is dropped; one already running is waited for. */
+    pthread_mutex_lock(&g_optimizer_lock);
+    if (hot->job_state == JOB_QUEUED) {
+        unqueue(hot);
+    }
+    while (hot->job_state == JOB_RUNNING) {
+        pthread_cond_wait(&g_optimizer_done, &g_optimizer_lock);
+    }
+    pthread_mutex_unlock(&g_optimizer_lock);
+#endif
+
+    math_expr_snapshot_deinit(&hot->versions);
+    math_expr_program_deinit(&hot->original);
+    free(hot->observed);
+    free((void *)hot->slot_states);
+    free(hot);
+}
+
+static int guards_hold(const hot_version *version, const double *variables)
+{
+    for (size_t i = 0; i < version->guard_count; ++i) {
+        if (double_bits(variables[version->guard_slots[i]]) != version->guard_bits[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int math_expr_hot_program_evaluate(math_expr_hot_program *hot, const double *variables, double *out_result)
+{
+    if (!hot || !out_result || (hot->original.symbol_count > 0U && !variables)) {
+        return -1;
+    }
+
+    uint64_t count = atomic_fetch_add_explicit(&hot->evaluations, 1U, memory_order_relaxed) + 1U;
+    if (!atomic_load_explicit(&hot->optimized, memory_order_acquire)) {
+        record_profile(hot, variables);
+        if (count == hot->threshold) {
+            start_optimization(hot);
+        }
+    }
+
+    math_expr_snapshot_ticket ticket = 0U;
+    const hot_version *version = (const hot_version *)math_expr_snapshot_read_begin(&hot->versions, &ticket);
+    const math_expr_program *program = &version->generic;
+    if (version->guard_count > 0U) {
+        if (guards_hold(version, variables)) {
+            program = &version->specialized;
+            atomic_fetch_add_explicit(&hot->specialized_runs, 1U, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&hot->guard_misses, 1U, memory_order_relaxed);
+        }
+    }
+
+    int status = math_expr_program_evaluate(program, variables, out_result);
+    math_expr_snapshot_read_end(&hot->versions, ticket);
+    return status;
+}
+
+int math_expr_hot_program_optimize(math_expr_hot_program *hot)
+{
+    if (!hot) {
+        return -1;
+    }
+
+    int status = 0;
+    math_expr_snapshot_write_lock(&hot->versions);
+    if (!atomic_load_explicit(&hot->optimized, memory_order_acquire)) {
+        hot_version *next = build_version(hot);
+        if (!next || math_expr_snapshot_publish(&hot->versions, next) != 0) {
+            fprintf(stderr, "math_expr_hot: optimisation failed; keeping the original program\n");
+            version_destroy(next);
+            status = -1;
+        } else {
+            atomic_fetch_add(&hot->generation, 1U);
+        }
+        /* Profiling ends either way, so a failure is not retried on every evaluation. */
+        atomic_store_explicit(&hot->optimized, 1, memory_order_release);
+    }
+    math_expr_snapshot_write_unlock(&hot->versions);
+    return status;
+}
+
+int math_expr_hot_program_get_stats(math_expr_hot_program *hot, math_expr_hot_stats *out_stats)
+{
+    if (!hot || !out_stats) {
+        return -1;
+    }
+
+    memset(out_stats, 0, sizeof(*out_stats));
+    out_stats->evaluations = atomic_load(&hot->evaluations);
+    out_stats->specialized_runs = atomic_load(&hot->specialized_runs);
+    out_stats->guard_misses = atomic_load(&hot->guard_misses);
+    out_stats->generation = atomic_load(&hot->generation);
+    out_stats->original_size = hot->original.code_size;
+
+    math_expr_snapshot_ticket ticket = 0U;
+    const hot_version *version = (const hot_version *)math_expr_snapshot_read_begin(&hot->versions, &ticket);
+    out_stats->specialized_slots = version->guard_count;
+    out_stats->generic_size = version->generic.code_size;
+    out_stats->specialized_size = version->specialized.code_size;
+    math_expr_snapshot_read_end(&hot->versions, ticket);
+    return 0;
+}
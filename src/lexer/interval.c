@@ -0,0 +1,706 @@
+#include "math_expr/interval.h"
+
+#include "builtins.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MATH_EXPR_LOCAL_STACK 32U
+#define MATH_EXPR_LOCAL_BRANCHES 16U
+
+/* Beyond this magnitude degree arguments are not reduced; trig results fall back to [-1, 1]. */
+static const double kMaxReducibleDegrees = 1e9;
+
+static math_expr_interval make_interval(double lo, double hi)
+{
+    math_expr_interval result = {lo, hi};
+    return result;
+}
+
+static math_expr_interval empty_interval(void)
+{
+    return make_interval(INFINITY, -INFINITY);
+}
+
+static math_expr_interval entire_interval(void)
+{
+    return make_interval(-INFINITY, INFINITY);
+}
+
+static int is_empty(math_expr_interval x)
+{
+    return !(x.lo <= x.hi);
+}
+
+static int contains_zero(math_expr_interval x)
+{
+    return x.lo <= 0.0 && x.hi >= 0.0;
+}
+
+static math_expr_interval widen(math_expr_interval x, int ulps)
+{
+    for (int i = 0; i < ulps; ++i) {
+        x.lo = nextafter(x.lo, -INFINITY);
+        x.hi = nextafter(x.hi, INFINITY);
+    }
+    return x;
+}
+
+static double call1(math_expr_builtin_id id, double value)
+{
+    return math_expr_builtin_get(id)->func(&value);
+}
+
+static math_expr_interval from_corners(const double *values, size_t count)
+{
+    double lo = INFINITY;
+    double hi = -INFINITY;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (isnan(values[i])) {
+            return entire_interval();
+        }
+        lo = fmin(lo, values[i]);
+        hi = fmax(hi, values[i]);
+    }
+
+    return widen(make_interval(lo, hi), 1);
+}
+
+static math_expr_interval interval_add(math_expr_interval a, math_expr_interval b)
+{
+    double lo = a.lo + b.lo;
+    double hi = a.hi + b.hi;
+    return widen(make_interval(isnan(lo) ? -INFINITY : lo, isnan(hi) ? INFINITY : hi), 1);
+}
+
+static math_expr_interval interval_neg(math_expr_interval a)
+{
+    return make_interval(-a.hi, -a.lo);
+}
+
+static double product(double x, double y)
+{
+    double value = x * y;
+    return isnan(value) ? 0.0 : value;
+}
+
+static math_expr_interval interval_mul(math_expr_interval a, math_expr_interval b)
+{
+    double corners[4] = {
+        product(a.lo, b.lo),
+        product(a.lo, b.hi),
+        product(a.hi, b.lo),
+        product(a.hi, b.hi)
+    };
+    return from_corners(corners, 4U);
+}
+
+static math_expr_interval interval_div(math_expr_interval a, math_expr_interval b)
+{
+    if (b.lo == 0.0 && b.hi == 0.0) {
+        return empty_interval();
+    }
+
+    if (contains_zero(b)) {
+        return entire_interval();
+    }
+
+    double corners[4] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+    return from_corners(corners, 4U);
+}
+
+static math_expr_interval interval_mod(math_expr_interval a, math_expr_interval b)
+{
+    if (b.lo == 0.0 && b.hi == 0.0) {
+        return empty_interval();
+    }
+
+    double bound = fmax(fabs(b.lo), fabs(b.hi));
+    double min_divisor = contains_zero(b) ? 0.0 : fmin(fabs(b.lo), fabs(b.hi));
+
+    if (a.lo >= 0.0 && a.hi < min_divisor) {
+        return a;
+    }
+    if (a.hi <= 0.0 && -a.lo < min_divisor) {
+        return a;
+    }
+
+    double lo = a.lo >= 0.0 ? 0.0 : fmax(a.lo, -bound);
+    double hi = a.hi <= 0.0 ? 0.0 : fmin(a.hi, bound);
+    return make_interval(lo, hi);
+}
+
+static int is_integer(double value)
+{
+    return isfinite(value) && floor(value) == value;
+}
+
+static math_expr_interval interval_pow(math_expr_interval a, math_expr_interval b)
+{
+    if (a.lo >= 0.0) {
+        /* Corners are taken at +0; pow(-0, y) is -inf for negative odd integers y. */
+        double lo = a.lo + 0.0;
+        double hi = a.hi + 0.0;
+        double corners[4] = {pow(lo, b.lo), pow(lo, b.hi), pow(hi, b.lo), pow(hi, b.hi)};
+        math_expr_interval result = widen(from_corners(corners, 4U), 1);
+        if (lo == 0.0 && b.lo < 0.0) {
+            result.lo = -INFINITY;
+        }
+        return result;
+    }
+
+    if (b.lo != b.hi || !is_integer(b.lo)) {
+        return entire_interval();
+    }
+
+    double n = b.lo;
+    int even = fmod(n, 2.0) == 0.0;
+
+    if (n == 0.0) {
+        return make_interval(1.0, 1.0);
+    }
+
+    if (even) {
+        double mag_lo = contains_zero(a) ? 0.0 : fmin(fabs(a.lo), fabs(a.hi));
+        double mag_hi = fmax(fabs(a.lo), fabs(a.hi));
+        double corners[2] = {pow(mag_lo, n), pow(mag_hi, n)};
+        return widen(from_corners(corners, 2U), 1);
+    }
+
+    if (n < 0.0 && contains_zero(a)) {
+        return entire_interval();
+    }
+
+    double corners[2] = {pow(a.lo, n), pow(a.hi, n)};
+    return widen(from_corners(corners, 2U), 1);
+}
+
+static int contains_angle(math_expr_interval x, double angle, double period)
+{
+    double k = ceil((x.lo - angle) / period);
+    return angle + period * k <= x.hi;
+}
+
+static math_expr_interval interval_trig(math_expr_builtin_id id, math_expr_interval x)
+{
+    if (!(fabs(x.lo) < kMaxReducibleDegrees && fabs(x.hi) < kMaxReducibleDegrees) ||
+        x.hi - x.lo >= 360.0) {
+        return make_interval(-1.0, 1.0);
+    }
+
+    double peak = id == MATH_EXPR_BUILTIN_SIN ? 90.0 : 0.0;
+    double trough = peak + 180.0;
+    double a = call1(id, x.lo);
+    double b = call1(id, x.hi);
+    math_expr_interval result = widen(make_interval(fmin(a, b), fmax(a, b)), 2);
+    /* The table interpolant may wander by its error bound between the endpoints. */
+    double error = math_expr_trig_max_error();
+    result.lo -= error;
+    result.hi += error;
+
+    if (contains_angle(x, peak, 360.0)) {
+        result.hi = 1.0;
+    }
+    if (contains_angle(x, trough, 360.0)) {
+        result.lo = -1.0;
+    }
+
+    result.lo = fmax(result.lo, -1.0);
+    result.hi = fmin(result.hi, 1.0);
+    return result;
+}
+
+static math_expr_interval interval_tan(math_expr_interval x)
+{
+    if (!(fabs(x.lo) < kMaxReducibleDegrees && fabs(x.hi) < kMaxReducibleDegrees) ||
+        x.hi - x.lo >= 180.0 ||
+        contains_angle(x, 90.0, 180.0)) {
+        return entire_interval();
+    }
+
+    return widen(make_interval(call1(MATH_EXPR_BUILTIN_TAN, x.lo), call1(MATH_EXPR_BUILTIN_TAN, x.hi)), 2);
+}
+
+static math_expr_interval interval_monotonic(math_expr_builtin_id id, math_expr_interval x, double domain_lo)
+{
+    if (x.hi < domain_lo) {
+        return empty_interval();
+    }
+
+    double lo = fmax(x.lo, domain_lo);
+    return widen(make_interval(call1(id, lo), call1(id, x.hi)), 2);
+}
+
+static math_expr_interval interval_abs(math_expr_interval x)
+{
+    if (x.lo >= 0.0) {
+        return x;
+    }
+    if (x.hi <= 0.0) {
+        return interval_neg(x);
+    }
+    return make_interval(0.0, fmax(-x.lo, x.hi));
+}
+
+static math_expr_interval interval_call(size_t id, const math_expr_interval *args)
+{
+    switch ((math_expr_builtin_id)id) {
+    case MATH_EXPR_BUILTIN_SIN:
+    case MATH_EXPR_BUILTIN_COS:
+        return interval_trig((math_expr_builtin_id)id, args[0]);
+    case MATH_EXPR_BUILTIN_TAN:
+        return interval_tan(args[0]);
+    case MATH_EXPR_BUILTIN_SQRT:
+        return interval_monotonic(MATH_EXPR_BUILTIN_SQRT, args[0], 0.0);
+    case MATH_EXPR_BUILTIN_ABS:
+        return interval_abs(args[0]);
+    case MATH_EXPR_BUILTIN_LN:
+    case MATH_EXPR_BUILTIN_LOG:
+        return interval_monotonic((math_expr_builtin_id)id, args[0], 0.0);
+    case MATH_EXPR_BUILTIN_EXP:
+        return interval_monotonic(MATH_EXPR_BUILTIN_EXP, args[0], -INFINITY);
+    case MATH_EXPR_BUILTIN_POW:
+        return interval_pow(args[0], args[1]);
+    case MATH_EXPR_BUILTIN_MAX:
+        return make_interval(fmax(args[0].lo, args[1].lo), fmax(args[0].hi, args[1].hi));
+    case MATH_EXPR_BUILTIN_MIN:
+        return make_interval(fmin(args[0].lo, args[1].lo), fmin(args[0].hi, args[1].hi));
+    default:
+        return entire_interval();
+    }
+}
+
+/*
+ * Enclosure of one stack slot. NaN results are never part of range, so
+ * may_be_nan records whether some inputs produce NaN; that matters to the
+ * operations that turn NaN back into numbers (min, max, and pow with a zero
+ * exponent or unit base). An empty range always has may_be_nan set.
+ */
+typedef struct tracked_interval {
+    math_expr_interval range;
+    int may_be_nan;
+} tracked_interval;
+
+static int has_infinity(math_expr_interval x)
+{
+    return isinf(x.lo) || isinf(x.hi);
+}
+
+static math_expr_interval hull(math_expr_interval a, math_expr_interval b)
+{
+    if (is_empty(a)) {
+        return b;
+    }
+    if (is_empty(b)) {
+        return a;
+    }
+    return make_interval(fmin(a.lo, b.lo), fmax(a.hi, b.hi));
+}
+
+static tracked_interval make_tracked(math_expr_interval range, int may_be_nan)
+{
+    tracked_interval result = {range, may_be_nan || is_empty(range)};
+    return result;
+}
+
+static tracked_interval tracked_pow(tracked_interval a, tracked_interval b)
+{
+    math_expr_interval range = is_empty(a.range) || is_empty(b.range) ? empty_interval() : interval_pow(a.range, b.range);
+    int may_be_nan = a.may_be_nan || b.may_be_nan || has_infinity(a.range) || has_infinity(b.range) ||
+                     (a.range.lo < 0.0 && !(b.range.lo == b.range.hi && is_integer(b.range.lo)));
+
+    /* pow(NaN, 0) and pow(1, NaN) are 1. */
+    if ((a.may_be_nan && contains_zero(b.range)) || (b.may_be_nan && a.range.lo <= 1.0 && a.range.hi >= 1.0)) {
+        range = hull(range, make_interval(1.0, 1.0));
+    }
+
+    return make_tracked(range, may_be_nan);
+}
+
+static tracked_interval tracked_binary(math_expr_opcode opcode, tracked_interval a, tracked_interval b)
+{
+    if (opcode == MATH_EXPR_OP_POW) {
+        return tracked_pow(a, b);
+    }
+
+    if (is_empty(a.range) || is_empty(b.range)) {
+        return make_tracked(empty_interval(), 1);
+    }
+
+    /* Infinite operands admit inf - inf, 0 * inf, inf / inf and fmod(inf, y). */
+    int may_be_nan = a.may_be_nan || b.may_be_nan || has_infinity(a.range) || has_infinity(b.range);
+    math_expr_interval range;
+
+    switch (opcode) {
+    case MATH_EXPR_OP_ADD:
+        range = interval_add(a.range, b.range);
+        break;
+    case MATH_EXPR_OP_SUB:
+        range = interval_add(a.range, interval_neg(b.range));
+        break;
+    case MATH_EXPR_OP_MUL:
+        range = interval_mul(a.range, b.range);
+        break;
+    case MATH_EXPR_OP_DIV:
+        range = interval_div(a.range, b.range);
+        break;
+    case MATH_EXPR_OP_MOD:
+        range = interval_mod(a.range, b.range);
+        break;
+    default:
+        range = entire_interval();
+        break;
+    }
+
+    return make_tracked(range, may_be_nan);
+}
+
+static tracked_interval tracked_call(size_t id, const tracked_interval *args, size_t arity)
+{
+    if (id == MATH_EXPR_BUILTIN_POW) {
+        return tracked_pow(args[0], args[1]);
+    }
+
+    math_expr_interval ranges[2];
+    int any_empty = 0;
+    int may_be_nan = 0;
+
+    for (size_t i = 0; i < arity; ++i) {
+        ranges[i] = args[i].range;
+        any_empty |= is_empty(args[i].range);
+        may_be_nan |= args[i].may_be_nan;
+    }
+
+    if (id == MATH_EXPR_BUILTIN_MIN || id == MATH_EXPR_BUILTIN_MAX) {
+        /* min and max return their second argument when the first is NaN. */
+        math_expr_interval range = any_empty ? empty_interval() : interval_call(id, ranges);
+        if (args[0].may_be_nan) {
+            range = hull(range, args[1].range);
+        }
+        return make_tracked(range, args[1].may_be_nan);
+    }
+
+    if (any_empty) {
+        return make_tracked(empty_interval(), 1);
+    }
+
+    switch ((math_expr_builtin_id)id) {
+    case MATH_EXPR_BUILTIN_SQRT:
+    case MATH_EXPR_BUILTIN_LN:
+    case MATH_EXPR_BUILTIN_LOG:
+        may_be_nan |= ranges[0].lo < 0.0;
+        break;
+    case MATH_EXPR_BUILTIN_SIN:
+    case MATH_EXPR_BUILTIN_COS:
+    case MATH_EXPR_BUILTIN_TAN:
+        may_be_nan |= has_infinity(ranges[0]);
+        break;
+    default:
+        break;
+    }
+
+    return make_tracked(interval_call(id, ranges), may_be_nan);
+}
+
+/*
+ * Enclose a reduction by repeating its steps on intervals: the same partial
+ * sums added in the same order, or the same chain of two-argument min/max.
+ * values is overwritten.
+ */
+static tracked_interval tracked_reduce(math_expr_aggregate kind, tracked_interval *values, size_t count)
+{
+    if (kind == MATH_EXPR_AGGREGATE_MIN || kind == MATH_EXPR_AGGREGATE_MAX) {
+        size_t id = kind == MATH_EXPR_AGGREGATE_MIN ? MATH_EXPR_BUILTIN_MIN : MATH_EXPR_BUILTIN_MAX;
+        for (size_t k = 1; k < count; ++k) {
+            tracked_interval args[2] = {values[0], values[k]};
+            values[0] = tracked_call(id, args, 2U);
+        }
+        return values[0];
+    }
+
+    if (count < 4U) {
+        for (size_t k = 1; k < count; ++k) {
+            values[0] = tracked_binary(MATH_EXPR_OP_ADD, values[0], values[k]);
+        }
+    } else {
+        for (size_t k = 4; k < count; ++k) {
+            values[k % 4U] = tracked_binary(MATH_EXPR_OP_ADD, values[k % 4U], values[k]);
+        }
+        values[0] = tracked_binary(MATH_EXPR_OP_ADD,
+                                   tracked_binary(MATH_EXPR_OP_ADD, values[0], values[1]),
+                                   tracked_binary(MATH_EXPR_OP_ADD, values[2], values[3]));
+    }
+
+    if (kind == MATH_EXPR_AGGREGATE_AVG) {
+        double divisor = (double)count;
+        values[0] = tracked_binary(MATH_EXPR_OP_DIV, values[0], make_tracked(make_interval(divisor, divisor), 0));
+    }
+    return values[0];
+}
+
+/* Whether some value in x is true (non-zero or NaN) and whether some is false (zero). */
+static int can_be_true(tracked_interval x)
+{
+    return x.may_be_nan || (!is_empty(x.range) && !(x.range.lo == 0.0 && x.range.hi == 0.0));
+}
+
+static int can_be_false(tracked_interval x)
+{
+    return !is_empty(x.range) && contains_zero(x.range);
+}
+
+static tracked_interval make_truth(int can_true, int can_false)
+{
+    return make_tracked(make_interval(can_false ? 0.0 : 1.0, can_true ? 1.0 : 0.0), 0);
+}
+
+static tracked_interval tracked_compare(math_expr_opcode opcode, tracked_interval a, tracked_interval b)
+{
+    /* Any comparison with NaN is false, except != which is true. */
+    int with_nan = a.may_be_nan || b.may_be_nan;
+    int can_true = 0;
+    int can_false = with_nan;
+
+    if (opcode == MATH_EXPR_OP_NE) {
+        can_true = with_nan;
+        can_false = 0;
+    }
+
+    if (is_empty(a.range) || is_empty(b.range)) {
+        return make_truth(can_true, can_false);
+    }
+
+    math_expr_interval x = a.range;
+    math_expr_interval y = b.range;
+    int single = x.lo == x.hi && y.lo == y.hi && x.lo == y.lo;
+    int overlap = x.lo <= y.hi && y.lo <= x.hi;
+
+    switch (opcode) {
+    case MATH_EXPR_OP_LT:
+        can_true |= x.lo < y.hi;
+        can_false |= x.hi >= y.lo;
+        break;
+    case MATH_EXPR_OP_LE:
+        can_true |= x.lo <= y.hi;
+        can_false |= x.hi > y.lo;
+        break;
+    case MATH_EXPR_OP_GT:
+        can_true |= x.hi > y.lo;
+        can_false |= x.lo <= y.hi;
+        break;
+    case MATH_EXPR_OP_GE:
+        can_true |= x.hi >= y.lo;
+        can_false |= x.lo < y.hi;
+        break;
+    case MATH_EXPR_OP_EQ:
+        can_true |= overlap;
+        can_false |= !single;
+        break;
+    default:
+        can_true |= !single;
+        can_false |= overlap;
+        break;
+    }
+
+    return make_truth(can_true, can_false);
+}
+
+/* A conditional whose condition may go either way; both branches are enclosed. */
+typedef struct interval_branch {
+    size_t else_pc;
+    size_t join;
+    size_t depth;
+    int in_else;
+    tracked_interval then_value;
+} interval_branch;
+
+/* Hull the branches that end at pc into the value on top of the stack. */
+static int join_branches(interval_branch *branches, size_t *open, size_t pc, tracked_interval *stack, size_t top)
+{
+    while (*open > 0U) {
+        interval_branch *branch = &branches[*open - 1U];
+        if (!branch->in_else ? pc < branch->else_pc : pc < branch->join) {
+            return 0;
+        }
+        if (!branch->in_else || pc != branch->join || top != branch->depth + 1U) {
+            return -1;
+        }
+
+        tracked_interval *value = &stack[top - 1U];
+        *value = make_tracked(hull(branch->then_value.range, value->range),
+                              branch->then_value.may_be_nan || value->may_be_nan);
+        --*open;
+    }
+
+    return 0;
+}
+
+static int run_interval(const math_expr_program *program,
+                        const math_expr_interval *variables,
+                        tracked_interval *stack,
+                        interval_branch *branches,
+                        size_t branch_count,
+                        math_expr_interval *out_result)
+{
+    size_t open = 0U;
+    size_t top = 0U;
+    size_t pc = 0U;
+
+    while (pc < program->code_size) {
+        if (open > 0U && join_branches(branches, &open, pc, stack, top) != 0) {
+            fprintf(stderr, "math_expr_interval: malformed program\n");
+            return -1;
+        }
+
+        const math_expr_instruction *instruction = &program->code[pc++];
+
+        switch ((math_expr_opcode)instruction->opcode) {
+        case MATH_EXPR_OP_CONST: {
+            double value = program->constants[instruction->operand];
+            stack[top++] = make_tracked(isnan(value) ? empty_interval() : make_interval(value, value), 0);
+            break;
+        }
+        case MATH_EXPR_OP_LOAD:
+            stack[top++] = make_tracked(variables[instruction->operand], 0);
+            break;
+        case MATH_EXPR_OP_NEG:
+            stack[top - 1U].range = interval_neg(stack[top - 1U].range);
+            break;
+        case MATH_EXPR_OP_ADD:
+        case MATH_EXPR_OP_SUB:
+        case MATH_EXPR_OP_MUL:
+        case MATH_EXPR_OP_DIV:
+        case MATH_EXPR_OP_MOD:
+        case MATH_EXPR_OP_POW:
+            --top;
+            stack[top - 1U] = tracked_binary((math_expr_opcode)instruction->opcode, stack[top - 1U], stack[top]);
+            break;
+        case MATH_EXPR_OP_CALL: {
+            const math_expr_builtin *builtin = math_expr_builtin_get(instruction->operand);
+            if (builtin->arity > 2U) {
+                fprintf(stderr, "math_expr_interval: unsupported arity %zu\n", builtin->arity);
+                return -1;
+            }
+            top -= builtin->arity;
+            stack[top] = tracked_call(builtin->canonical, &stack[top], builtin->arity);
+            ++top;
+            break;
+        }
+        case MATH_EXPR_OP_REDUCE: {
+            size_t count = instruction->operand >> 2;
+            top -= count;
+            stack[top] = tracked_reduce((math_expr_aggregate)(instruction->operand & 3U), &stack[top], count);
+            ++top;
+            break;
+        }
+        case MATH_EXPR_OP_CALL_EXTERNAL:
+            /* Nothing is known about registered functions. */
+            top -= program->functions[instruction->operand].arity;
+            stack[top++] = make_tracked(entire_interval(), 1);
+            break;
+        case MATH_EXPR_OP_LT:
+        case MATH_EXPR_OP_LE:
+        case MATH_EXPR_OP_GT:
+        case MATH_EXPR_OP_GE:
+        case MATH_EXPR_OP_EQ:
+        case MATH_EXPR_OP_NE:
+            --top;
+            stack[top - 1U] = tracked_compare((math_expr_opcode)instruction->opcode, stack[top - 1U], stack[top]);
+            break;
+        case MATH_EXPR_OP_NOT:
+            stack[top - 1U] = make_truth(can_be_false(stack[top - 1U]), can_be_true(stack[top - 1U]));
+            break;
+        case MATH_EXPR_OP_BOOL:
+            stack[top - 1U] = make_truth(can_be_true(stack[top - 1U]), can_be_false(stack[top - 1U]));
+            break;
+        case MATH_EXPR_OP_JUMP: {
+            interval_branch *branch = open > 0U ? &branches[open - 1U] : NULL;
+            if (branch && !branch->in_else && pc == branch->else_pc) {
+                if (top != branch->depth + 1U) {
+                    fprintf(stderr, "math_expr_interval: malformed program\n");
+                    return -1;
+                }
+                branch->then_value = stack[--top];
+                branch->join = instruction->operand;
+                branch->in_else = 1;
+                break;
+            }
+            pc = instruction->operand;
+            break;
+        }
+        case MATH_EXPR_OP_JUMP_IF_FALSE: {
+            tracked_interval condition = stack[--top];
+            if (!can_be_true(condition)) {
+                pc = instruction->operand;
+            } else if (can_be_false(condition)) {
+                if (open == branch_count) {
+                    fprintf(stderr, "math_expr_interval: malformed program\n");
+                    return -1;
+                }
+                interval_branch *branch = &branches[open++];
+                branch->else_pc = instruction->operand;
+                branch->depth = top;
+                branch->in_else = 0;
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "math_expr_interval: unsupported opcode %u\n", (unsigned)instruction->opcode);
+            return -1;
+        }
+    }
+
+    if (open > 0U && (join_branches(branches, &open, pc, stack, top) != 0 || open > 0U)) {
+        fprintf(stderr, "math_expr_interval: malformed program\n");
+        return -1;
+    }
+
+    if (top != 1U) {
+        fprintf(stderr, "math_expr_interval: malformed program\n");
+        return -1;
+    }
+
+    *out_result = stack[0].range;
+    return 0;
+}
+
+int math_expr_program_evaluate_interval(const math_expr_program *program,
+                                        const math_expr_interval *variables,
+                                        math_expr_interval *out_result)
+{
+    if (!program || !out_result || program->code_size == 0U) {
+        return -1;
+    }
+
+    if (program->symbol_count > 0U && !variables) {
+        return -1;
+    }
+
+    /* Jumps only go forward, so at most one branch is open per JUMP_IF_FALSE. */
+    size_t branch_count = 0U;
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        branch_count += program->code[pc].opcode == MATH_EXPR_OP_JUMP_IF_FALSE;
+    }
+
+    if (program->max_stack <= MATH_EXPR_LOCAL_STACK && branch_count <= MATH_EXPR_LOCAL_BRANCHES) {
+        tracked_interval stack[MATH_EXPR_LOCAL_STACK];
+        interval_branch branches[MATH_EXPR_LOCAL_BRANCHES];
+        return run_interval(program, variables, stack, branches, branch_count, out_result);
+    }
+
+    tracked_interval *stack = (tracked_interval *)malloc(program->max_stack * sizeof(*stack));
+    interval_branch *branches = (interval_branch *)malloc((branch_count > 0U ? branch_count : 1U) * sizeof(*branches));
+    if (!stack || !branches) {
+        perror("math_expr_interval: malloc");
+        free(stack);
+        free(branches);
+        return -1;
+    }
+
+    int status = run_interval(program, variables, stack, branches, branch_count, out_result);
+    free(branches);
+    free(stack);
+    return status;
+}
@@ -1,5 +1,8 @@
 #include "math_expr/lexer.h"
 
+#include "memory_internal.h"
+#include "stats_internal.h"
+
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
@@ -28,20 +31,180 @@ static int is_operator_char(int c)
     case '^':
     case '%':
     case '=':
+    case '<':
+    case '>':
+    case '!':
+    case '&':
+    case '|':
     case '(':
     case ')':
     case ',':
+    case '[':
+    case ']':
         return 1;
     default:
         return 0;
     }
 }
 
+static const struct {
+    char text[3];
+    uint8_t op;
+} kTwoCharOperators[] = {
+    {"<=", MATH_EXPR_TOKEN_OP_LE},
+    {">=", MATH_EXPR_TOKEN_OP_GE},
+    {"==", MATH_EXPR_TOKEN_OP_EQ},
+    {"!=", MATH_EXPR_TOKEN_OP_NE},
+    {"&&", MATH_EXPR_TOKEN_OP_AND},
+    {"||", MATH_EXPR_TOKEN_OP_OR},
+};
+
+/* Length of the operator at start: 2 for the two-character operators, 1 otherwise. */
+static size_t operator_length(const char *start)
+{
+    for (size_t i = 0; i < sizeof(kTwoCharOperators) / sizeof(kTwoCharOperators[0]); ++i) {
+        if (start[0] == kTwoCharOperators[i].text[0] && start[1] == kTwoCharOperators[i].text[1]) {
+            return 2U;
+        }
+    }
+    return 1U;
+}
+
+uint8_t math_expr_operator_code(const char *lexeme, size_t length)
+{
+    if (!lexeme || length == 0U) {
+        return 0U;
+    }
+    if (length == 1U) {
+        return (uint8_t)lexeme[0];
+    }
+
+    for (size_t i = 0; i < sizeof(kTwoCharOperators) / sizeof(kTwoCharOperators[0]); ++i) {
+        if (length == 2U && memcmp(lexeme, kTwoCharOperators[i].text, 2U) == 0) {
+            return kTwoCharOperators[i].op;
+        }
+    }
+    return 0U;
+}
+
 static int is_space_char(int c)
 {
     return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
 }
 
+typedef struct token_estimate {
+    size_t tokens;
+    size_t numbers;
+    size_t text; /* Bytes of lexeme text with terminators. */
+} token_estimate;
+
+enum {
+    CHAR_OTHER,
+    CHAR_SPACE,
+    CHAR_OPERATOR,
+    CHAR_LETTER, /* Letters and '_'. */
+    CHAR_DIGIT,
+    CHAR_DOT,
+    CHAR_CLASS_COUNT
+};
+
+/* ASCII classes as seen by scan_expression; bytes above 0x7F are CHAR_OTHER. */
+static const unsigned char kCharClass[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0, /* 0x00 */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x10 */
+    1, 2, 0, 0, 0, 2, 2, 0, 2, 2, 2, 2, 2, 2, 5, 2, /* 0x20  !"#$%&'()*+,-./ */
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 2, 2, 2, 0, /* 0x30 0-9:;<=>? */
+    0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, /* 0x40 @A-O */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 0, 2, 2, 3, /* 0x50 P-Z[\]^_ */
+    0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, /* 0x60 `a-o */
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 2, 0, 0, 0, /* 0x70 p-z{|}~ */
+};
+
+#define START_TOKEN 0x1U
+#define START_NUMBER 0x2U
+#define START_SPACE 0x4U
+
+/*
+ * What starts at a character of the class in the column after one of the
+ * class in the row. Operators and '.' always start a token; a letter starts
+ * one unless it continues an identifier, a digit unless it continues a word,
+ * and a space unless it continues a run of spaces.
+ */
+static const unsigned char kTokenStarts[CHAR_CLASS_COUNT][CHAR_CLASS_COUNT] = {
+    /* other, space, operator, letter, digit, dot */
+    {0U, START_SPACE, START_TOKEN, START_TOKEN, START_TOKEN | START_NUMBER, START_TOKEN | START_NUMBER},
+    {0U, 0U, START_TOKEN, START_TOKEN, START_TOKEN | START_NUMBER, START_TOKEN | START_NUMBER},
+    {0U, START_SPACE, START_TOKEN, START_TOKEN, START_TOKEN | START_NUMBER, START_TOKEN | START_NUMBER},
+    {0U, START_SPACE, START_TOKEN, 0U, 0U, START_TOKEN | START_NUMBER},
+    {0U, START_SPACE, START_TOKEN, START_TOKEN, 0U, START_TOKEN | START_NUMBER},
+    {0U, START_SPACE, START_TOKEN, START_TOKEN, 0U, START_TOKEN | START_NUMBER},
+};
+
+/*
+ * Upper bound on the tokens scan_expression emits, from one table-driven
+ * pass over the characters without converting numbers. Inside a run of
+ * letters, digits, '_' and '.', tokens start at the first character, at
+ * every '.' and at a letter after a digit or '.', which is where a number
+ * can end; a hexadecimal number counts its 'x' as well, covering a name
+ * that follows its last letter digit. In locales where isalpha accepts
+ * bytes above 0x7F, identifiers made of them are not counted, and the
+ * buffers still grow in that case.
+ */
+static token_estimate estimate_tokens(const char *expression, unsigned int flags)
+{
+    size_t tokens = 0U;
+    size_t numbers = 0U;
+    size_t spaces = 0U;
+    unsigned char previous = CHAR_OTHER;
+    const unsigned char *cursor = (const unsigned char *)expression;
+
+    for (; *cursor != '\0'; ++cursor) {
+        unsigned char current = kCharClass[*cursor];
+        unsigned char starts = kTokenStarts[previous][current];
+        tokens += starts & START_TOKEN;
+        numbers += (starts & START_NUMBER) >> 1;
+        spaces += (starts & START_SPACE) >> 2;
+        previous = current;
+    }
+
+    /* Lexemes are disjoint pieces of the source, so they fit in its length plus a terminator each. */
+    token_estimate estimate;
+    estimate.tokens = tokens + ((flags & MATH_EXPR_LEX_SKIP_SPACE) ? 0U : spaces);
+    estimate.numbers = numbers;
+    estimate.text = estimate.tokens > 0U
+        ? (size_t)(cursor - (const unsigned char *)expression) + estimate.tokens
+        : 0U;
+    return estimate;
+}
+
+/* Grow the array to hold at least capacity tokens; arrays never shrink. */
+static int token_array_grow(math_expr_token_array *array, size_t capacity)
+{
+    if (capacity <= array->capacity) {
+        return 0;
+    }
+    if (capacity > SIZE_MAX / sizeof(*array->data)) {
+        fprintf(stderr, "math_expr_lexer: token capacity overflow\n");
+        return -1;
+    }
+
+    size_t added = (capacity - array->capacity) * sizeof(*array->data);
+    if (math_expr_memory_charge(added, "math_expr_lexer") != 0) {
+        return -1;
+    }
+    math_expr_token *new_data = (math_expr_token *)realloc(array->data, capacity * sizeof(*array->data));
+    if (!new_data) {
+        perror("math_expr_lexer: realloc");
+        math_expr_memory_release(added);
+        return -1;
+    }
+
+    MATH_EXPR_STATS_ALLOC(capacity * sizeof(*array->data));
+    array->data = new_data;
+    array->capacity = capacity;
+    return 0;
+}
+
 static void token_array_reserve(math_expr_token_array *array)
 {
     if (!array) {
@@ -52,38 +215,75 @@ static void token_array_reserve(math_expr_token_array *array)
         return;
     }
 
-    size_t new_capacity = array->capacity == 0 ? kInitialTokenCapacity : array->capacity * 2U;
-    math_expr_token *new_data = (math_expr_token *)realloc(array->data, new_capacity * sizeof(*array->data));
-    if (!new_data) {
-        perror("math_expr_lexer: realloc");
-        return;
+    token_array_grow(array, array->capacity == 0 ? kInitialTokenCapacity : array->capacity * 2U);
+}
+
+/*
+ * Grow the lexeme text to at least capacity bytes. The text moves, so the
+ * lexemes already stored are pointed at the new copy before the old is freed.
+ */
+static int token_text_grow(math_expr_token_array *array, size_t capacity)
+{
+    if (capacity <= array->text_capacity) {
+        return 0;
     }
 
-    array->data = new_data;
-    array->capacity = new_capacity;
+    size_t added = capacity - array->text_capacity;
+    if (math_expr_memory_charge(added, "math_expr_lexer") != 0) {
+        return -1;
+    }
+    char *new_text = (char *)malloc(capacity);
+    if (!new_text) {
+        perror("math_expr_lexer: malloc");
+        math_expr_memory_release(added);
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(capacity);
+
+    if (array->text_size > 0U) {
+        memcpy(new_text, array->text, array->text_size);
+        for (size_t i = 0; i < array->size; ++i) {
+            array->data[i].lexeme = new_text + (array->data[i].lexeme - array->text);
+        }
+    }
+    free(array->text);
+    array->text = new_text;
+    array->text_capacity = capacity;
+    return 0;
 }
 
-static char *copy_range(const char *start, size_t length)
+static char *store_lexeme(math_expr_token_array *array, const char *start, size_t length)
 {
-    char *buffer = (char *)malloc(length + 1U);
-    if (!buffer) {
-        perror("math_expr_lexer: malloc");
-        return NULL;
+    if (length + 1U > array->text_capacity - array->text_size) {
+        size_t needed = array->text_size + length + 1U;
+        size_t doubled = array->text_capacity * 2U;
+        if (token_text_grow(array, doubled > needed ? doubled : needed) != 0) {
+            return NULL;
+        }
     }
 
+    char *lexeme = array->text + array->text_size;
     if (length > 0U) {
-        memcpy(buffer, start, length);
+        memcpy(lexeme, start, length);
     }
-    buffer[length] = '\0';
-    return buffer;
+    lexeme[length] = '\0';
+    array->text_size += length + 1U;
+    return lexeme;
 }
 
-static int token_array_append(math_expr_token_array *array,
-                             math_expr_token_type type,
-                             const char *start,
-                             size_t length,
-                             double value)
+typedef struct token_sink {
+    int (*append)(void *target, math_expr_token_type type, const char *start, size_t length, double value);
+    void *target;
+    unsigned int flags;
+} token_sink;
+
+static int token_array_append(void *target,
+                              math_expr_token_type type,
+                              const char *start,
+                              size_t length,
+                              double value)
 {
+    math_expr_token_array *array = (math_expr_token_array *)target;
     if (!array) {
         return -1;
     }
@@ -93,11 +293,12 @@ static int token_array_append(math_expr_token_array *array,
         return -1;
     }
 
-    char *lexeme = copy_range(start, length);
+    char *lexeme = store_lexeme(array, start, length);
     if (!lexeme) {
         return -1;
     }
 
+    MATH_EXPR_STATS_TOKEN(type);
     math_expr_token *token = &array->data[array->size++];
     token->type = type;
     token->lexeme = lexeme;
@@ -105,16 +306,95 @@ static int token_array_append(math_expr_token_array *array,
     return 0;
 }
 
-static int append_space(math_expr_token_array *tokens, const char *start, const char *cursor)
+static int packed_array_grow(void **data, size_t *capacity, size_t new_capacity, size_t element_size)
+{
+    if (new_capacity <= *capacity) {
+        return 0;
+    }
+    if (new_capacity > SIZE_MAX / element_size) {
+        fprintf(stderr, "math_expr_lexer: token capacity overflow\n");
+        return -1;
+    }
+
+    size_t added = (new_capacity - *capacity) * element_size;
+    if (math_expr_memory_charge(added, "math_expr_lexer") != 0) {
+        return -1;
+    }
+    void *new_data = realloc(*data, new_capacity * element_size);
+    if (!new_data) {
+        perror("math_expr_lexer: realloc");
+        math_expr_memory_release(added);
+        return -1;
+    }
+
+    MATH_EXPR_STATS_ALLOC(new_capacity * element_size);
+    *data = new_data;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static void packed_array_reserve(void **data, size_t *capacity, size_t size, size_t element_size)
 {
-    return token_array_append(tokens,
-                              MATH_EXPR_TOKEN_SPACE,
-                              start,
-                              (size_t)(cursor - start),
-                              0.0);
+    if (size < *capacity) {
+        return;
+    }
+
+    packed_array_grow(data, capacity, *capacity == 0 ? kInitialTokenCapacity : *capacity * 2U, element_size);
+}
+
+static int packed_array_append(void *target,
+                               math_expr_token_type type,
+                               const char *start,
+                               size_t length,
+                               double value)
+{
+    math_expr_packed_token_array *array = (math_expr_packed_token_array *)target;
+    size_t offset = (size_t)(start - array->source);
+
+    if (length > UINT16_MAX || offset > UINT32_MAX) {
+        fprintf(stderr, "math_expr_lexer: token exceeds packed token limits\n");
+        return -1;
+    }
+
+    packed_array_reserve((void **)&array->data, &array->capacity, array->size, sizeof(*array->data));
+    if (array->size >= array->capacity) {
+        return -1;
+    }
+
+    if (type == MATH_EXPR_TOKEN_NUMBER) {
+        packed_array_reserve((void **)&array->numbers,
+                             &array->number_capacity,
+                             array->number_count,
+                             sizeof(*array->numbers));
+        if (array->number_count >= array->number_capacity) {
+            return -1;
+        }
+        array->numbers[array->number_count++] = value;
+    }
+
+    MATH_EXPR_STATS_TOKEN(type);
+    math_expr_packed_token *token = &array->data[array->size++];
+    token->offset = (uint32_t)offset;
+    token->length = (uint16_t)length;
+    token->type = (uint8_t)type;
+    token->op = type == MATH_EXPR_TOKEN_OPERATOR ? math_expr_operator_code(start, length) : 0U;
+    return 0;
+}
+
+static int append_space(const token_sink *sink, const char *start, const char *cursor)
+{
+    if (sink->flags & MATH_EXPR_LEX_SKIP_SPACE) {
+        return 0;
+    }
+
+    return sink->append(sink->target,
+                        MATH_EXPR_TOKEN_SPACE,
+                        start,
+                        (size_t)(cursor - start),
+                        0.0);
 }
 
-static int append_number(math_expr_token_array *tokens, const char *start, char **endptr)
+static int append_number(const token_sink *sink, const char *start, char **endptr)
 {
     errno = 0;
     char *local_endptr = NULL;
@@ -132,33 +412,33 @@ static int append_number(math_expr_token_array *tokens, const char *start, char
         perror("math_expr_lexer: strtod");
     }
 
-    if (token_array_append(tokens,
-                           MATH_EXPR_TOKEN_NUMBER,
-                           start,
-                           (size_t)(local_endptr - start),
-                           value) != 0) {
+    if (sink->append(sink->target,
+                     MATH_EXPR_TOKEN_NUMBER,
+                     start,
+                     (size_t)(local_endptr - start),
+                     value) != 0) {
         return -1;
     }
 
     return 0;
 }
 
-static int append_identifier(math_expr_token_array *tokens, const char *start, const char *cursor)
+static int append_identifier(const token_sink *sink, const char *start, const char *cursor)
 {
-    return token_array_append(tokens,
-                              MATH_EXPR_TOKEN_IDENTIFIER,
-                              start,
-                              (size_t)(cursor - start),
-                              0.0);
+    return sink->append(sink->target,
+                        MATH_EXPR_TOKEN_IDENTIFIER,
+                        start,
+                        (size_t)(cursor - start),
+                        0.0);
 }
 
-static int append_operator(math_expr_token_array *tokens, const char *start)
+static int append_operator(const token_sink *sink, const char *start, size_t length)
 {
-    return token_array_append(tokens,
-                              MATH_EXPR_TOKEN_OPERATOR,
-                              start,
-                              1U,
-                              0.0);
+    return sink->append(sink->target,
+                        MATH_EXPR_TOKEN_OPERATOR,
+                        start,
+                        length,
+                        0.0);
 }
 
 void math_expr_token_array_init(math_expr_token_array *array)
@@ -170,6 +450,9 @@ void math_expr_token_array_init(math_expr_token_array *array)
     array->data = NULL;
     array->size = 0U;
     array->capacity = 0U;
+    array->text = NULL;
+    array->text_size = 0U;
+    array->text_capacity = 0U;
 }
 
 void math_expr_token_array_clear(math_expr_token_array *array)
@@ -178,12 +461,17 @@ void math_expr_token_array_clear(math_expr_token_array *array)
         return;
     }
 
-    for (size_t i = 0; i < array->size; ++i) {
-        free(array->data[i].lexeme);
-        array->data[i].lexeme = NULL;
+    array->size = 0U;
+    array->text_size = 0U;
+}
+
+int math_expr_token_array_reserve(math_expr_token_array *array, size_t capacity)
+{
+    if (!array) {
+        return -1;
     }
 
-    array->size = 0U;
+    return token_array_grow(array, capacity);
 }
 
 void math_expr_token_array_deinit(math_expr_token_array *array)
@@ -192,26 +480,14 @@ void math_expr_token_array_deinit(math_expr_token_array *array)
         return;
     }
 
-    math_expr_token_array_clear(array);
+    math_expr_memory_release(array->capacity * sizeof(*array->data) + array->text_capacity);
     free(array->data);
-    array->data = NULL;
-    array->capacity = 0U;
+    free(array->text);
+    math_expr_token_array_init(array);
 }
 
-int math_expr_lex_expression(const char *expression, math_expr_token_array *out_tokens)
+static int scan_expression(const char *expression, const token_sink *sink)
 {
-    if (!out_tokens) {
-        return -1;
-    }
-
-    if (out_tokens->data != NULL || out_tokens->size != 0U || out_tokens->capacity != 0U) {
-        math_expr_token_array_clear(out_tokens);
-    }
-
-    if (!expression) {
-        return 0;
-    }
-
     const char *cursor = expression;
 
     while (*cursor != '\0') {
@@ -222,8 +498,8 @@ int math_expr_lex_expression(const char *expression, math_expr_token_array *out_
             while (*cursor != '\0' && is_space_char((unsigned char)*cursor)) {
                 ++cursor;
             }
-            if (append_space(out_tokens, start, cursor) != 0) {
-                goto error;
+            if (append_space(sink, start, cursor) != 0) {
+                return -1;
             }
             continue;
         }
@@ -231,13 +507,13 @@ int math_expr_lex_expression(const char *expression, math_expr_token_array *out_
         if (isdigit(current) || (*cursor == '.' && isdigit((unsigned char)*(cursor + 1)))) {
             const char *start = cursor;
             char *endptr = NULL;
-            int result = append_number(out_tokens, start, &endptr);
+            int result = append_number(sink, start, &endptr);
             if (result == 1 || !endptr || endptr == start) {
                 ++cursor;
                 continue;
             }
             if (result != 0) {
-                goto error;
+                return -1;
             }
             cursor = endptr;
             continue;
@@ -248,17 +524,18 @@ int math_expr_lex_expression(const char *expression, math_expr_token_array *out_
             while (*cursor != '\0' && is_identifier_part((unsigned char)*cursor)) {
                 ++cursor;
             }
-            if (append_identifier(out_tokens, start, cursor) != 0) {
-                goto error;
+            if (append_identifier(sink, start, cursor) != 0) {
+                return -1;
             }
             continue;
         }
 
         if (is_operator_char(current)) {
-            if (append_operator(out_tokens, cursor) != 0) {
-                goto error;
+            size_t length = operator_length(cursor);
+            if (append_operator(sink, cursor, length) != 0) {
+                return -1;
             }
-            ++cursor;
+            cursor += length;
             continue;
         }
 
@@ -267,10 +544,130 @@ int math_expr_lex_expression(const char *expression, math_expr_token_array *out_
     }
 
     return 0;
+}
+
+static int lex_expression(const char *expression, math_expr_token_array *out_tokens, unsigned int flags)
+{
+    math_expr_token_array_clear(out_tokens);
+
+    if (!expression) {
+        return 0;
+    }
+
+    token_estimate estimate = estimate_tokens(expression, flags);
+    token_sink sink = {token_array_append, out_tokens, flags};
+    if (token_array_grow(out_tokens, estimate.tokens) != 0 || token_text_grow(out_tokens, estimate.text) != 0 ||
+        scan_expression(expression, &sink) != 0) {
+        math_expr_token_array_clear(out_tokens);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int lex_packed(const char *expression, math_expr_packed_token_array *out_tokens, unsigned int flags)
+{
+    math_expr_packed_token_array_clear(out_tokens);
+    out_tokens->source = expression;
+
+    if (!expression) {
+        return 0;
+    }
+
+    token_estimate estimate = estimate_tokens(expression, flags);
+    token_sink sink = {packed_array_append, out_tokens, flags};
+    if (packed_array_grow((void **)&out_tokens->data, &out_tokens->capacity, estimate.tokens,
+                          sizeof(*out_tokens->data)) != 0 ||
+        packed_array_grow((void **)&out_tokens->numbers, &out_tokens->number_capacity, estimate.numbers,
+                          sizeof(*out_tokens->numbers)) != 0 ||
+        scan_expression(expression, &sink) != 0) {
+        math_expr_packed_token_array_clear(out_tokens);
+        return -1;
+    }
+
+    return 0;
+}
 
-error:
-    math_expr_token_array_deinit(out_tokens);
-    return -1;
+int math_expr_lex_expression_ex(const char *expression, math_expr_token_array *out_tokens, unsigned int flags)
+{
+    if (!out_tokens) {
+        return -1;
+    }
+
+    math_expr_memory_scope scope;
+    math_expr_memory_scope_begin(&scope, 0U);
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_LEX);
+    int status = lex_expression(expression, out_tokens, flags);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_LEX);
+    math_expr_memory_scope_end(&scope);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
+}
+
+int math_expr_lex_expression(const char *expression, math_expr_token_array *out_tokens)
+{
+    return math_expr_lex_expression_ex(expression, out_tokens, 0U);
+}
+
+void math_expr_packed_token_array_init(math_expr_packed_token_array *array)
+{
+    if (!array) {
+        return;
+    }
+
+    array->source = NULL;
+    array->data = NULL;
+    array->size = 0U;
+    array->capacity = 0U;
+    array->numbers = NULL;
+    array->number_count = 0U;
+    array->number_capacity = 0U;
+}
+
+void math_expr_packed_token_array_clear(math_expr_packed_token_array *array)
+{
+    if (!array) {
+        return;
+    }
+
+    array->source = NULL;
+    array->size = 0U;
+    array->number_count = 0U;
+}
+
+void math_expr_packed_token_array_deinit(math_expr_packed_token_array *array)
+{
+    if (!array) {
+        return;
+    }
+
+    math_expr_memory_release(array->capacity * sizeof(*array->data) +
+                             array->number_capacity * sizeof(*array->numbers));
+    free(array->data);
+    free(array->numbers);
+    math_expr_packed_token_array_init(array);
+}
+
+int math_expr_lex_packed(const char *expression, math_expr_packed_token_array *out_tokens, unsigned int flags)
+{
+    if (!out_tokens) {
+        return -1;
+    }
+
+    math_expr_memory_scope scope;
+    math_expr_memory_scope_begin(&scope, 0U);
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_LEX);
+    int status = lex_packed(expression, out_tokens, flags);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_LEX);
+    math_expr_memory_scope_end(&scope);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
 }
 
 const char *math_expr_token_type_to_string(math_expr_token_type type)
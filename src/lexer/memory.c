@@ -0,0 +1,137 @@
+#include "memory_internal.h"
+
+#include "math_expr/evaluator.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct memory_account {
+    math_expr_memory_scope *scope; /* Innermost open scope. */
+    size_t in_use;
+    size_t peak;
+    size_t ceiling; /* Largest in_use the open scopes allow; 0 for none. */
+    size_t thread_limit;
+    int exceeded;
+    math_expr_memory_usage last;
+} memory_account;
+
+static _Thread_local memory_account tls_account;
+
+static void tighten(memory_account *account, size_t limit)
+{
+    if (limit == 0U || limit > SIZE_MAX - account->in_use) {
+        return;
+    }
+
+    size_t ceiling = account->in_use + limit;
+    if (account->ceiling == 0U || ceiling < account->ceiling) {
+        account->ceiling = ceiling;
+    }
+}
+
+void math_expr_memory_scope_begin(math_expr_memory_scope *scope, size_t limit)
+{
+    memory_account *account = &tls_account;
+
+    scope->outer = account->scope;
+    if (!scope->outer) {
+        account->in_use = 0U;
+        account->ceiling = 0U;
+        account->exceeded = 0;
+    }
+    scope->base = account->in_use;
+    scope->saved_peak = account->peak;
+    scope->saved_ceiling = account->ceiling;
+
+    account->peak = account->in_use;
+    tighten(account, account->thread_limit);
+    tighten(account, limit);
+    account->scope = scope;
+}
+
+size_t math_expr_memory_scope_end(math_expr_memory_scope *scope)
+{
+    memory_account *account = &tls_account;
+    size_t peak = account->peak > scope->base ? account->peak - scope->base : 0U;
+
+    account->scope = scope->outer;
+    if (!scope->outer) {
+        account->last.peak_bytes = peak;
+        account->last.limit_bytes = account->ceiling;
+        account->last.limit_exceeded = account->exceeded;
+        account->in_use = 0U;
+        account->peak = 0U;
+        account->ceiling = 0U;
+        return peak;
+    }
+
+    if (scope->saved_peak > account->peak) {
+        account->peak = scope->saved_peak;
+    }
+    account->ceiling = scope->saved_ceiling;
+    return peak;
+}
+
+int math_expr_memory_charge(size_t bytes, const char *who)
+{
+    memory_account *account = &tls_account;
+    if (!account->scope) {
+        return 0;
+    }
+
+    if (account->ceiling != 0U && bytes > account->ceiling - account->in_use) {
+        account->exceeded = 1;
+        fprintf(stderr, "%s: memory limit exceeded allocating %zu bytes\n", who, bytes);
+        return -1;
+    }
+
+    account->in_use += bytes;
+    if (account->in_use > account->peak) {
+        account->peak = account->in_use;
+    }
+    return 0;
+}
+
+void math_expr_memory_release(size_t bytes)
+{
+    memory_account *account = &tls_account;
+    if (!account->scope) {
+        return;
+    }
+
+    /* Memory allocated before the outermost scope was never charged to it. */
+    account->in_use = bytes < account->in_use ? account->in_use - bytes : 0U;
+}
+
+void math_expr_memory_set_limit(size_t bytes)
+{
+    tls_account.thread_limit = bytes;
+}
+
+size_t math_expr_memory_get_limit(void)
+{
+    return tls_account.thread_limit;
+}
+
+void math_expr_memory_last_usage(math_expr_memory_usage *out_usage)
+{
+    if (out_usage) {
+        *out_usage = tls_account.last;
+    }
+}
+
+int math_expr_memory_peak(const char *expression, size_t *out_peak_bytes)
+{
+    math_expr_memory_scope scope;
+    double value = 0.0;
+
+    math_expr_memory_scope_begin(&scope, 0U);
+    int status = math_expr_evaluate(expression, &value);
+    size_t peak = math_expr_memory_scope_end(&scope);
+
+    if (out_peak_bytes) {
+        *out_peak_bytes = peak;
+    }
+    return status;
+}
@@ -0,0 +1,35 @@
+#ifndef MATH_EXPR_MEMORY_INTERNAL_H
+#define MATH_EXPR_MEMORY_INTERNAL_H
+
+#include "math_expr/memory.h"
+
+#include <stddef.h>
+
+/*
+ * Accounting scopes. Each public lexing or evaluation entry point opens one
+ * on its own stack; a scope opened inside another shares its budget and may
+ * only tighten it. Allocation sites charge bytes before allocating and
+ * release them when freeing; outside any scope both are no-ops.
+ */
+
+typedef struct math_expr_memory_scope {
+    struct math_expr_memory_scope *outer;
+    size_t base;          /* Bytes in use when the scope began. */
+    size_t saved_peak;
+    size_t saved_ceiling;
+} math_expr_memory_scope;
+
+/* limit 0 applies only the thread's limit and any enclosing budget. */
+void math_expr_memory_scope_begin(math_expr_memory_scope *scope, size_t limit);
+
+/* Peak bytes in use during the scope. */
+size_t math_expr_memory_scope_end(math_expr_memory_scope *scope);
+
+/*
+ * Account for an allocation of bytes. Reports on stderr, with the caller's
+ * prefix, and returns non-zero if the budget does not allow it.
+ */
+int math_expr_memory_charge(size_t bytes, const char *who);
+void math_expr_memory_release(size_t bytes);
+
+#endif // MATH_EXPR_MEMORY_INTERNAL_H
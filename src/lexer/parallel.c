@@ -0,0 +1,282 @@
+#include "math_expr/parallel.h"
+
+#include "program_internal.h"
+#include "stats_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Tasks per pool thread, so uneven terms still spread across the threads. */
+#define MATH_EXPR_PARALLEL_TASKS_PER_THREAD 4U
+
+typedef struct parallel_job {
+    const math_expr_program *program;
+    const math_expr_parallel_term *terms;
+    const double *variables;
+    const size_t *task_offsets; /* Terms of task i are [task_offsets[i], task_offsets[i + 1]). */
+    double *values;
+    int *statuses;
+} parallel_job;
+
+/* Rough cost of an instruction, in units of one addition. */
+static size_t instruction_cost(const math_expr_instruction *instruction)
+{
+    switch ((math_expr_opcode)instruction->opcode) {
+    case MATH_EXPR_OP_DIV:
+    case MATH_EXPR_OP_MOD:
+        return 4U;
+    case MATH_EXPR_OP_POW:
+        return 40U;
+    case MATH_EXPR_OP_CALL:
+        return 30U;
+    case MATH_EXPR_OP_CALL_EXTERNAL:
+        return 50U;
+    case MATH_EXPR_OP_REDUCE:
+        return instruction->operand >> 2;
+    default:
+        return 1U;
+    }
+}
+
+/*
+ * A term that starts at depth base must never pop a value below base, so it
+ * computes the same value on a stack of its own.
+ */
+static int term_is_closed(const math_expr_program *program, const size_t *depths, size_t begin, size_t end, size_t base)
+{
+    for (size_t pc = begin; pc < end; ++pc) {
+        if (depths[pc] < base + math_expr_instruction_pops(program, &program->code[pc])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static size_t range_cost(const math_expr_program *program, size_t begin, size_t end)
+{
+    size_t cost = 0U;
+    for (size_t pc = begin; pc < end; ++pc) {
+        cost += instruction_cost(&program->code[pc]);
+    }
+    return cost;
+}
+
+void math_expr_parallel_plan_init(math_expr_parallel_plan *plan)
+{
+    if (!plan) {
+        return;
+    }
+
+    memset(plan, 0, sizeof(*plan));
+    plan->threshold = MATH_EXPR_PARALLEL_DEFAULT_THRESHOLD;
+}
+
+void math_expr_parallel_plan_deinit(math_expr_parallel_plan *plan)
+{
+    if (!plan) {
+        return;
+    }
+
+    free(plan->terms);
+    math_expr_parallel_plan_init(plan);
+}
+
+/*
+ * Walk the outermost + / - chain from the right. The right operand of an
+ * operator at depth 2 starts at the last earlier instruction that runs at
+ * depth 1 and that no jump passes over; instructions inside an if() branch
+ * are always passed over by the jump around them.
+ */
+static int split_terms(math_expr_parallel_plan *plan,
+                       const math_expr_program *program,
+                       const size_t *depths,
+                       const size_t *crossed)
+{
+    size_t end = program->code_size;
+
+    for (;;) {
+        const math_expr_instruction *op = &program->code[end - 1U];
+        if ((op->opcode != MATH_EXPR_OP_ADD && op->opcode != MATH_EXPR_OP_SUB) || depths[end - 1U] != 2U ||
+            crossed[end - 1U]) {
+            break;
+        }
+
+        size_t begin = end - 1U;
+        while (begin > 0U && (depths[begin] != 1U || crossed[begin])) {
+            --begin;
+        }
+        if (begin == 0U || !term_is_closed(program, depths, begin, end - 1U, 1U)) {
+            break;
+        }
+
+        math_expr_parallel_term *term = &plan->terms[plan->term_count++];
+        term->begin = begin;
+        term->end = end - 1U;
+        term->cost = range_cost(program, begin, end - 1U);
+        term->subtract = op->opcode == MATH_EXPR_OP_SUB;
+        end = begin;
+    }
+
+    math_expr_parallel_term *first = &plan->terms[plan->term_count++];
+    first->begin = 0U;
+    first->end = end;
+    first->cost = range_cost(program, 0U, end);
+    first->subtract = 0;
+
+    for (size_t i = 0; i < plan->term_count / 2U; ++i) {
+        math_expr_parallel_term swap = plan->terms[i];
+        plan->terms[i] = plan->terms[plan->term_count - 1U - i];
+        plan->terms[plan->term_count - 1U - i] = swap;
+    }
+
+    plan->cost = range_cost(program, 0U, program->code_size);
+    return 0;
+}
+
+int math_expr_parallel_plan_build(math_expr_parallel_plan *plan, const math_expr_program *program, size_t threshold)
+{
+    if (!plan || !program || program->code_size == 0U) {
+        return -1;
+    }
+
+    size_t count = program->code_size + 1U;
+    size_t *depths = (size_t *)malloc(2U * count * sizeof(*depths));
+    /* Each term ends in an operator, so there are at most code_size / 2 + 1 of them. */
+    math_expr_parallel_term *terms =
+        (math_expr_parallel_term *)malloc((program->code_size / 2U + 1U) * sizeof(*terms));
+    if (!depths || !terms) {
+        perror("math_expr_parallel: malloc");
+        free(depths);
+        free(terms);
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(2U * count * sizeof(*depths) + (program->code_size / 2U + 1U) * sizeof(*terms));
+
+    if (math_expr_program_depths(program, depths) != 0) {
+        fprintf(stderr, "math_expr_parallel: invalid program\n");
+        free(depths);
+        free(terms);
+        return -1;
+    }
+
+    /* crossed[pc] counts the jumps that pass over pc. */
+    size_t *crossed = depths + count;
+    memset(crossed, 0, count * sizeof(*crossed));
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        const math_expr_instruction *instruction = &program->code[pc];
+        if (instruction->opcode == MATH_EXPR_OP_JUMP || instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE) {
+            ++crossed[pc + 1U];
+            --crossed[instruction->operand];
+        }
+    }
+    for (size_t pc = 1; pc < count; ++pc) {
+        crossed[pc] += crossed[pc - 1U];
+    }
+
+    free(plan->terms);
+    math_expr_parallel_plan_init(plan);
+    plan->terms = terms;
+    plan->threshold = threshold == 0U ? MATH_EXPR_PARALLEL_DEFAULT_THRESHOLD : threshold;
+    plan->code_size = program->code_size;
+
+    int status = split_terms(plan, program, depths, crossed);
+    free(depths);
+    return status;
+}
+
+static void evaluate_terms_task(void *context, size_t index)
+{
+    parallel_job *job = (parallel_job *)context;
+
+    for (size_t i = job->task_offsets[index]; i < job->task_offsets[index + 1U]; ++i) {
+        const math_expr_parallel_term *term = &job->terms[i];
+        if (math_expr_program_run_range(job->program, term->begin, term->end, job->variables, &job->values[i]) != 0) {
+            job->statuses[index] = -1;
+            return;
+        }
+    }
+}
+
+/* Contiguous runs of terms of roughly equal cost, one per task. */
+static size_t assign_tasks(const math_expr_parallel_plan *plan, size_t task_limit, size_t *offsets)
+{
+    size_t task_count = 0U;
+    size_t accumulated = 0U;
+    size_t target = plan->cost / task_limit + 1U;
+
+    offsets[0] = 0U;
+    for (size_t i = 0; i < plan->term_count; ++i) {
+        accumulated += plan->terms[i].cost;
+        if (accumulated >= target * (task_count + 1U) || i + 1U == plan->term_count) {
+            offsets[++task_count] = i + 1U;
+        }
+    }
+    return task_count;
+}
+
+int math_expr_program_evaluate_parallel(const math_expr_program *program,
+                                        const math_expr_parallel_plan *plan,
+                                        const double *variables,
+                                        math_expr_thread_pool *pool,
+                                        double *out_result)
+{
+    if (!program || !plan || !out_result || plan->code_size != program->code_size) {
+        return -1;
+    }
+
+    size_t threads = pool ? math_expr_thread_pool_size(pool) : 1U;
+    if (plan->term_count < 2U || plan->cost < plan->threshold || threads < 2U) {
+        return math_expr_program_evaluate(program, variables, out_result);
+    }
+    if (program->symbol_count > 0U && !variables) {
+        return -1;
+    }
+
+    size_t task_limit = threads * MATH_EXPR_PARALLEL_TASKS_PER_THREAD;
+    if (task_limit > plan->term_count) {
+        task_limit = plan->term_count;
+    }
+
+    size_t bytes = plan->term_count * sizeof(double) + (task_limit + 1U) * sizeof(size_t) + task_limit * sizeof(int);
+    double *values = (double *)malloc(bytes);
+    if (!values) {
+        perror("math_expr_parallel: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(bytes);
+
+    size_t *offsets = (size_t *)(values + plan->term_count);
+    int *statuses = (int *)(offsets + task_limit + 1U);
+    size_t task_count = assign_tasks(plan, task_limit, offsets);
+    memset(statuses, 0, task_count * sizeof(*statuses));
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    parallel_job job = {program, plan->terms, variables, offsets, values, statuses};
+    int status = math_expr_thread_pool_run(pool, task_count, evaluate_terms_task, &job);
+    for (size_t i = 0; i < task_count && status == 0; ++i) {
+        status = statuses[i];
+    }
+
+    /* Fold the terms left to right, in the program's precision, as the sequential code does. */
+    if (status == 0 && program->precision == MATH_EXPR_PRECISION_F32) {
+        float sum = (float)values[0];
+        for (size_t i = 1; i < plan->term_count; ++i) {
+            sum = plan->terms[i].subtract ? sum - (float)values[i] : sum + (float)values[i];
+        }
+        *out_result = sum;
+    } else if (status == 0) {
+        double sum = values[0];
+        for (size_t i = 1; i < plan->term_count; ++i) {
+            sum = plan->terms[i].subtract ? sum - values[i] : sum + values[i];
+        }
+        *out_result = sum;
+    }
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    free(values);
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
+}
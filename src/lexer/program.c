@@ -0,0 +1,351 @@
+#include "math_expr/compiler.h"
+
+#include "builtins.h"
+#include "program_internal.h"
+#include "stats_internal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MATH_EXPR_LOCAL_STACK 32U
+
+#define MATH_EXPR_REAL double
+#define MATH_EXPR_INPUT double
+#define MATH_EXPR_SUFFIX f64
+#define MATH_EXPR_FMOD fmod
+#define MATH_EXPR_POW pow
+#define MATH_EXPR_BUILTIN_FUNC func
+#define MATH_EXPR_REDUCE math_expr_aggregate_reduce
+#include "program_eval.h"
+
+#define MATH_EXPR_REAL float
+#define MATH_EXPR_INPUT float
+#define MATH_EXPR_SUFFIX f32
+#define MATH_EXPR_FMOD fmodf
+#define MATH_EXPR_POW powf
+#define MATH_EXPR_BUILTIN_FUNC func_f32
+#define MATH_EXPR_REDUCE math_expr_aggregate_reduce_f32
+#include "program_eval.h"
+
+#define MATH_EXPR_REAL float
+#define MATH_EXPR_INPUT double
+#define MATH_EXPR_SUFFIX f32_from_f64
+#define MATH_EXPR_FMOD fmodf
+#define MATH_EXPR_POW powf
+#define MATH_EXPR_BUILTIN_FUNC func_f32
+#define MATH_EXPR_REDUCE math_expr_aggregate_reduce_f32
+#include "program_eval.h"
+
+#define MATH_EXPR_DEPTH_UNSET ((size_t)-1)
+
+/* Record the depth a jump brings to target; every way into it must agree. */
+static int merge_depth(size_t *depths, size_t target, size_t depth)
+{
+    if (depths[target] == MATH_EXPR_DEPTH_UNSET) {
+        depths[target] = depth;
+        return 0;
+    }
+    return depths[target] == depth ? 0 : -1;
+}
+
+/*
+ * Jumps only go forward, so one pass sees every jump into an instruction
+ * before the instruction itself. depths[pc] holds the stack depth jumps
+ * bring to pc until the pass reaches pc, and then the depth before pc runs;
+ * code that nothing reaches is rejected.
+ */
+static int validate_code(const math_expr_program *program, size_t *depths)
+{
+    size_t depth = 0U;
+    int reachable = 1;
+
+    for (size_t pc = 0; pc <= program->code_size; ++pc) {
+        depths[pc] = MATH_EXPR_DEPTH_UNSET;
+    }
+
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        const math_expr_instruction *instruction = &program->code[pc];
+        size_t pops = 0U;
+        size_t pushes = 1U;
+
+        if (depths[pc] != MATH_EXPR_DEPTH_UNSET) {
+            if (reachable && depth != depths[pc]) {
+                return -1;
+            }
+            depth = depths[pc];
+            reachable = 1;
+        }
+        if (!reachable) {
+            return -1;
+        }
+        depths[pc] = depth;
+
+        switch ((math_expr_opcode)instruction->opcode) {
+        case MATH_EXPR_OP_CONST:
+            if (instruction->operand >= program->constant_count) {
+                return -1;
+            }
+            break;
+        case MATH_EXPR_OP_LOAD:
+            if (instruction->operand >= program->symbol_count) {
+                return -1;
+            }
+            break;
+        case MATH_EXPR_OP_NEG:
+        case MATH_EXPR_OP_NOT:
+        case MATH_EXPR_OP_BOOL:
+        case MATH_EXPR_OP_SQUARE:
+            pops = 1U;
+            break;
+        case MATH_EXPR_OP_MUL_ADD:
+            pops = 3U;
+            break;
+        case MATH_EXPR_OP_ADD:
+        case MATH_EXPR_OP_SUB:
+        case MATH_EXPR_OP_MUL:
+        case MATH_EXPR_OP_DIV:
+        case MATH_EXPR_OP_MOD:
+        case MATH_EXPR_OP_POW:
+        case MATH_EXPR_OP_LT:
+        case MATH_EXPR_OP_LE:
+        case MATH_EXPR_OP_GT:
+        case MATH_EXPR_OP_GE:
+        case MATH_EXPR_OP_EQ:
+        case MATH_EXPR_OP_NE:
+            pops = 2U;
+            break;
+        case MATH_EXPR_OP_CALL: {
+            const math_expr_builtin *builtin = math_expr_builtin_get(instruction->operand);
+            if (!builtin) {
+                return -1;
+            }
+            pops = builtin->arity;
+            break;
+        }
+        case MATH_EXPR_OP_CALL_EXTERNAL:
+            if (instruction->operand >= program->function_count ||
+                !program->functions[instruction->operand].func ||
+                program->functions[instruction->operand].arity > MATH_EXPR_FUNCTION_MAX_ARITY) {
+                return -1;
+            }
+            pops = program->functions[instruction->operand].arity;
+            break;
+        case MATH_EXPR_OP_REDUCE:
+            pops = instruction->operand >> 2;
+            if (pops == 0U) {
+                return -1;
+            }
+            break;
+        case MATH_EXPR_OP_JUMP:
+        case MATH_EXPR_OP_JUMP_IF_FALSE:
+            pops = instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE ? 1U : 0U;
+            pushes = 0U;
+            if (instruction->operand <= pc || instruction->operand > program->code_size) {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+
+        if (depth < pops) {
+            return -1;
+        }
+        depth = depth - pops + pushes;
+        if (depth > program->max_stack) {
+            return -1;
+        }
+
+        if (instruction->opcode == MATH_EXPR_OP_JUMP || instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE) {
+            if (merge_depth(depths, instruction->operand, depth) != 0) {
+                return -1;
+            }
+            reachable = instruction->opcode == MATH_EXPR_OP_JUMP_IF_FALSE;
+        }
+    }
+
+    if (depths[program->code_size] != MATH_EXPR_DEPTH_UNSET) {
+        if (reachable && depth != depths[program->code_size]) {
+            return -1;
+        }
+        depth = depths[program->code_size];
+        reachable = 1;
+    }
+
+    depths[program->code_size] = depth;
+    return reachable && depth == 1U ? 0 : -1;
+}
+
+int math_expr_program_validate(const math_expr_program *program)
+{
+    if (!program || program->code_size == 0U || !program->code) {
+        return -1;
+    }
+
+    size_t local[MATH_EXPR_LOCAL_STACK];
+    size_t *depths = local;
+
+    if (program->code_size + 1U > MATH_EXPR_LOCAL_STACK) {
+        depths = (size_t *)malloc((program->code_size + 1U) * sizeof(*depths));
+        if (!depths) {
+            perror("math_expr_program: malloc");
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC((program->code_size + 1U) * sizeof(*depths));
+    }
+
+    int status = validate_code(program, depths);
+
+    if (depths != local) {
+        free(depths);
+    }
+    return status;
+}
+
+size_t math_expr_instruction_pops(const math_expr_program *program, const math_expr_instruction *instruction)
+{
+    switch ((math_expr_opcode)instruction->opcode) {
+    case MATH_EXPR_OP_CONST:
+    case MATH_EXPR_OP_LOAD:
+    case MATH_EXPR_OP_JUMP:
+        return 0U;
+    case MATH_EXPR_OP_NEG:
+    case MATH_EXPR_OP_NOT:
+    case MATH_EXPR_OP_BOOL:
+    case MATH_EXPR_OP_SQUARE:
+    case MATH_EXPR_OP_JUMP_IF_FALSE:
+        return 1U;
+    case MATH_EXPR_OP_MUL_ADD:
+        return 3U;
+    case MATH_EXPR_OP_CALL:
+        return math_expr_builtin_get(instruction->operand)->arity;
+    case MATH_EXPR_OP_CALL_EXTERNAL:
+        return program->functions[instruction->operand].arity;
+    case MATH_EXPR_OP_REDUCE:
+        return instruction->operand >> 2;
+    default:
+        return 2U;
+    }
+}
+
+int math_expr_program_depths(const math_expr_program *program, size_t *depths)
+{
+    if (!program || program->code_size == 0U || !program->code || !depths) {
+        return -1;
+    }
+
+    return validate_code(program, depths);
+}
+
+static int check_arguments(const math_expr_program *program, const void *variables, const void *out_result)
+{
+    if (!program || !out_result || program->code_size == 0U) {
+        return -1;
+    }
+
+    if (program->symbol_count > 0U && !variables) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int math_expr_program_set_precision(math_expr_program *program, math_expr_precision precision)
+{
+    if (!program || (precision != MATH_EXPR_PRECISION_F64 && precision != MATH_EXPR_PRECISION_F32)) {
+        return -1;
+    }
+
+    program->precision = precision;
+    return 0;
+}
+
+int math_expr_program_run_range(const math_expr_program *program,
+                                size_t begin,
+                                size_t end,
+                                const double *variables,
+                                double *out_result)
+{
+    int status = -1;
+
+    if (program->precision == MATH_EXPR_PRECISION_F32) {
+        float stack[MATH_EXPR_LOCAL_STACK];
+        float *heap = NULL;
+        float result = 0.0f;
+
+        if (program->max_stack > MATH_EXPR_LOCAL_STACK) {
+            heap = (float *)malloc(program->max_stack * sizeof(*heap));
+            if (heap) {
+                MATH_EXPR_STATS_ALLOC(program->max_stack * sizeof(*heap));
+            } else {
+                perror("math_expr_program: malloc");
+            }
+        }
+
+        if (program->max_stack <= MATH_EXPR_LOCAL_STACK || heap) {
+            status = run_program_f32_from_f64(program, begin, end, variables, heap ? heap : stack, &result);
+            *out_result = result;
+        }
+        free(heap);
+    } else if (program->max_stack <= MATH_EXPR_LOCAL_STACK) {
+        double stack[MATH_EXPR_LOCAL_STACK];
+        status = run_program_f64(program, begin, end, variables, stack, out_result);
+    } else {
+        double *stack = (double *)malloc(program->max_stack * sizeof(*stack));
+        if (stack) {
+            MATH_EXPR_STATS_ALLOC(program->max_stack * sizeof(*stack));
+            status = run_program_f64(program, begin, end, variables, stack, out_result);
+            free(stack);
+        } else {
+            perror("math_expr_program: malloc");
+        }
+    }
+    return status;
+}
+
+int math_expr_program_evaluate(const math_expr_program *program, const double *variables, double *out_result)
+{
+    if (check_arguments(program, variables, out_result) != 0) {
+        return -1;
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = math_expr_program_run_range(program, 0U, program->code_size, variables, out_result);
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
+}
+
+int math_expr_program_evaluate_f32(const math_expr_program *program, const float *variables, float *out_result)
+{
+    if (check_arguments(program, variables, out_result) != 0) {
+        return -1;
+    }
+
+    MATH_EXPR_STATS_PHASE_BEGIN(MATH_EXPR_PHASE_EVAL);
+    int status = -1;
+
+    if (program->max_stack <= MATH_EXPR_LOCAL_STACK) {
+        float stack[MATH_EXPR_LOCAL_STACK];
+        status = run_program_f32(program, 0U, program->code_size, variables, stack, out_result);
+    } else {
+        float *stack = (float *)malloc(program->max_stack * sizeof(*stack));
+        if (stack) {
+            MATH_EXPR_STATS_ALLOC(program->max_stack * sizeof(*stack));
+            status = run_program_f32(program, 0U, program->code_size, variables, stack, out_result);
+            free(stack);
+        } else {
+            perror("math_expr_program: malloc");
+        }
+    }
+    MATH_EXPR_STATS_PHASE_END(MATH_EXPR_PHASE_EVAL);
+
+    if (status != 0) {
+        MATH_EXPR_STATS_ERROR();
+    }
+    return status;
+}
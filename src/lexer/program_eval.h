@@ -0,0 +1,175 @@
+/*
+ * Scalar interpreter template, instantiated once per precision. Define
+ * before including:
+ *   MATH_EXPR_REAL          arithmetic type of the evaluation stack
+ *   MATH_EXPR_INPUT         element type of the variables array
+ *   MATH_EXPR_SUFFIX        suffix appended to the generated function name
+ *   MATH_EXPR_FMOD          fmod for MATH_EXPR_REAL
+ *   MATH_EXPR_POW           pow for MATH_EXPR_REAL
+ *   MATH_EXPR_BUILTIN_FUNC  math_expr_builtin member implementing MATH_EXPR_REAL
+ *   MATH_EXPR_REDUCE        aggregate reduction over MATH_EXPR_REAL values
+ * All parameters are undefined again at the end of this file.
+ */
+
+#define MATH_EXPR_CAT_(name, suffix) name##_##suffix
+#define MATH_EXPR_CAT(name, suffix) MATH_EXPR_CAT_(name, suffix)
+
+/* Run code[begin, end), which must leave exactly one value on an empty stack. */
+static int MATH_EXPR_CAT(run_program, MATH_EXPR_SUFFIX)(const math_expr_program *program,
+                                                        size_t begin,
+                                                        size_t end,
+                                                        const MATH_EXPR_INPUT *variables,
+                                                        MATH_EXPR_REAL *stack,
+                                                        MATH_EXPR_REAL *out_result)
+{
+    size_t top = 0U;
+
+    size_t pc = begin;
+
+    while (pc < end) {
+        const math_expr_instruction *instruction = &program->code[pc++];
+
+        switch ((math_expr_opcode)instruction->opcode) {
+        case MATH_EXPR_OP_CONST:
+            stack[top++] = (MATH_EXPR_REAL)program->constants[instruction->operand];
+            break;
+        case MATH_EXPR_OP_LOAD:
+            stack[top++] = (MATH_EXPR_REAL)variables[instruction->operand];
+            break;
+        case MATH_EXPR_OP_NEG:
+            stack[top - 1U] = -stack[top - 1U];
+            break;
+        case MATH_EXPR_OP_ADD:
+            --top;
+            stack[top - 1U] += stack[top];
+            break;
+        case MATH_EXPR_OP_SUB:
+            --top;
+            stack[top - 1U] -= stack[top];
+            break;
+        case MATH_EXPR_OP_MUL:
+            --top;
+            stack[top - 1U] *= stack[top];
+            break;
+        case MATH_EXPR_OP_DIV:
+            --top;
+            if (stack[top] == 0) {
+                fprintf(stderr, "math_expr_program: division by zero\n");
+                return -1;
+            }
+            stack[top - 1U] /= stack[top];
+            break;
+        case MATH_EXPR_OP_MOD:
+            --top;
+            if (stack[top] == 0) {
+                fprintf(stderr, "math_expr_program: modulo by zero\n");
+                return -1;
+            }
+            stack[top - 1U] = MATH_EXPR_FMOD(stack[top - 1U], stack[top]);
+            break;
+        case MATH_EXPR_OP_POW:
+            --top;
+            stack[top - 1U] = MATH_EXPR_POW(stack[top - 1U], stack[top]);
+            break;
+        case MATH_EXPR_OP_CALL: {
+            const math_expr_builtin *builtin = math_expr_builtin_get(instruction->operand);
+            MATH_EXPR_STATS_BUILTIN(instruction->operand);
+            top -= builtin->arity;
+            stack[top] = builtin->MATH_EXPR_BUILTIN_FUNC(&stack[top]);
+            ++top;
+            break;
+        }
+        case MATH_EXPR_OP_CALL_EXTERNAL: {
+            const math_expr_program_function *function = &program->functions[instruction->operand];
+            double args[MATH_EXPR_FUNCTION_MAX_ARITY];
+            double value = 0.0;
+            top -= function->arity;
+            for (size_t i = 0; i < function->arity; ++i) {
+                args[i] = (double)stack[top + i];
+            }
+            if (function->func(function->user_data, args, &value) != 0) {
+                fprintf(stderr, "math_expr_program: registered function failed\n");
+                return -1;
+            }
+            stack[top++] = (MATH_EXPR_REAL)value;
+            break;
+        }
+        case MATH_EXPR_OP_LT:
+            --top;
+            stack[top - 1U] = stack[top - 1U] < stack[top] ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_LE:
+            --top;
+            stack[top - 1U] = stack[top - 1U] <= stack[top] ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_GT:
+            --top;
+            stack[top - 1U] = stack[top - 1U] > stack[top] ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_GE:
+            --top;
+            stack[top - 1U] = stack[top - 1U] >= stack[top] ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_EQ:
+            --top;
+            stack[top - 1U] = stack[top - 1U] == stack[top] ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_NE:
+            --top;
+            stack[top - 1U] = stack[top - 1U] != stack[top] ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_NOT:
+            stack[top - 1U] = stack[top - 1U] == 0 ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_BOOL:
+            stack[top - 1U] = stack[top - 1U] != 0 ? 1 : 0;
+            break;
+        case MATH_EXPR_OP_JUMP:
+            pc = instruction->operand;
+            break;
+        case MATH_EXPR_OP_JUMP_IF_FALSE:
+            if (stack[--top] == 0) {
+                pc = instruction->operand;
+            }
+            break;
+        case MATH_EXPR_OP_MUL_ADD: {
+            /* Two roundings, like MUL then ADD; the library is built in ISO C mode, which does not contract. */
+            MATH_EXPR_REAL product = stack[top - 2U] * stack[top - 1U];
+            top -= 2U;
+            stack[top - 1U] += product;
+            break;
+        }
+        case MATH_EXPR_OP_SQUARE:
+            stack[top - 1U] *= stack[top - 1U];
+            break;
+        case MATH_EXPR_OP_REDUCE: {
+            size_t count = instruction->operand >> 2;
+            top -= count;
+            stack[top] = MATH_EXPR_REDUCE((math_expr_aggregate)(instruction->operand & 3U), &stack[top], count);
+            ++top;
+            break;
+        }
+        default:
+            fprintf(stderr, "math_expr_program: invalid opcode %u\n", (unsigned)instruction->opcode);
+            return -1;
+        }
+    }
+
+    if (top != 1U) {
+        fprintf(stderr, "math_expr_program: malformed program\n");
+        return -1;
+    }
+
+    *out_result = stack[0];
+    return 0;
+}
+
+#undef MATH_EXPR_CAT
+#undef MATH_EXPR_CAT_
+#undef MATH_EXPR_REAL
+#undef MATH_EXPR_INPUT
+#undef MATH_EXPR_SUFFIX
+#undef MATH_EXPR_FMOD
+#undef MATH_EXPR_POW
+#undef MATH_EXPR_BUILTIN_FUNC
+#undef MATH_EXPR_REDUCE
@@ -0,0 +1,29 @@
+#ifndef MATH_EXPR_PROGRAM_INTERNAL_H
+#define MATH_EXPR_PROGRAM_INTERNAL_H
+
+#include "math_expr/compiler.h"
+
+#include <stddef.h>
+
+/*
+ * Validate program and store the stack depth before each instruction in
+ * depths[0, code_size), and the final depth in depths[code_size].
+ * Returns 0 if the program is valid.
+ */
+int math_expr_program_depths(const math_expr_program *program, size_t *depths);
+
+/* Number of values instruction pops; the instruction must be valid in program. */
+size_t math_expr_instruction_pops(const math_expr_program *program, const math_expr_instruction *instruction);
+
+/*
+ * Evaluate code[begin, end) in the program's precision on a stack of its
+ * own. The range must start on an empty stack and leave one value, and every
+ * jump in it must land inside it or on end.
+ */
+int math_expr_program_run_range(const math_expr_program *program,
+                                size_t begin,
+                                size_t end,
+                                const double *variables,
+                                double *out_result);
+
+#endif // MATH_EXPR_PROGRAM_INTERNAL_H
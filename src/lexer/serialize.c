@@ -0,0 +1,557 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/serialize.h"
+
+#include "stats_internal.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MATH_EXPR_HAVE_MMAP 1
+#endif
+
+_Static_assert(sizeof(math_expr_instruction) == 8U, "instructions must match the image layout");
+
+static const unsigned char kImageMagic[4] = {'M', 'E', 'X', 'P'};
+
+enum {
+    kOffsetVersion = 4,
+    kOffsetHeaderSize = 6,
+    kOffsetTotalSize = 8,
+    kOffsetChecksum = 12,
+    kOffsetCodeCount = 16,
+    kOffsetConstantCount = 20,
+    kOffsetSymbolCount = 24,
+    kOffsetMaxStack = 28,
+    kOffsetStringsSize = 32,
+    kOffsetPrecision = 36
+};
+
+/* Precision byte of the header; stable however math_expr_precision is numbered. */
+enum {
+    kImagePrecisionF64 = 0,
+    kImagePrecisionF32 = 1
+};
+
+typedef struct image_layout {
+    uint64_t constants;
+    uint64_t code;
+    uint64_t symbol_offsets;
+    uint64_t strings;
+    uint64_t total;
+} image_layout;
+
+static uint64_t align8(uint64_t value)
+{
+    return (value + 7U) & ~(uint64_t)7U;
+}
+
+static int host_is_little_endian(void)
+{
+    const uint16_t probe = 1U;
+    unsigned char first = 0U;
+    memcpy(&first, &probe, 1U);
+    return first == 1U;
+}
+
+static void put_u16(unsigned char *out, uint16_t value)
+{
+    out[0] = (unsigned char)(value & 0xFFU);
+    out[1] = (unsigned char)(value >> 8);
+}
+
+static void put_u32(unsigned char *out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void put_u64(unsigned char *out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint16_t get_u16(const unsigned char *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get_u32(const unsigned char *in)
+{
+    uint32_t value = 0U;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static uint64_t get_u64(const unsigned char *in)
+{
+    uint64_t value = 0U;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static uint32_t checksum_update(uint32_t hash, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/* Checksum of the whole image, header included, with the checksum field read as zero. */
+static uint32_t checksum(const unsigned char *image, size_t total)
+{
+    static const unsigned char kZero[4] = {0U, 0U, 0U, 0U};
+    uint32_t hash = checksum_update(2166136261U, image, kOffsetChecksum);
+    hash = checksum_update(hash, kZero, sizeof(kZero));
+    return checksum_update(hash, image + kOffsetChecksum + sizeof(kZero), total - kOffsetChecksum - sizeof(kZero));
+}
+
+static image_layout compute_layout(uint64_t code_count,
+                                   uint64_t constant_count,
+                                   uint64_t symbol_count,
+                                   uint64_t strings_size)
+{
+    image_layout layout;
+    layout.constants = MATH_EXPR_IMAGE_HEADER_SIZE;
+    layout.code = layout.constants + constant_count * 8U;
+    layout.symbol_offsets = layout.code + code_count * 8U;
+    layout.strings = layout.symbol_offsets + align8(symbol_count * 4U);
+    layout.total = layout.strings + align8(strings_size);
+    return layout;
+}
+
+static size_t strings_size_of(const math_expr_program *program)
+{
+    size_t size = 0U;
+    for (size_t i = 0; i < program->symbol_count; ++i) {
+        size += strlen(program->symbols[i]) + 1U;
+    }
+    return size;
+}
+
+size_t math_expr_program_image_size(const math_expr_program *program)
+{
+    if (!program) {
+        return 0U;
+    }
+
+    image_layout layout = compute_layout(program->code_size,
+                                         program->constant_count,
+                                         program->symbol_count,
+                                         strings_size_of(program));
+    return (size_t)layout.total;
+}
+
+int math_expr_program_write_image(const math_expr_program *program,
+                                  void *buffer,
+                                  size_t buffer_size,
+                                  size_t *out_size)
+{
+    if (!program || !buffer || program->code_size == 0U) {
+        return -1;
+    }
+
+    size_t strings_size = strings_size_of(program);
+    image_layout layout = compute_layout(program->code_size,
+                                         program->constant_count,
+                                         program->symbol_count,
+                                         strings_size);
+
+    if (layout.total > UINT32_MAX || program->max_stack > UINT32_MAX) {
+        fprintf(stderr, "math_expr_serialize: program too large for image format\n");
+        return -1;
+    }
+
+    if (program->function_count > 0U) {
+        fprintf(stderr, "math_expr_serialize: programs calling registered functions cannot be serialised\n");
+        return -1;
+    }
+
+    if (buffer_size < layout.total) {
+        fprintf(stderr, "math_expr_serialize: buffer too small\n");
+        return -1;
+    }
+
+    unsigned char *out = (unsigned char *)buffer;
+    memset(out, 0, (size_t)layout.total);
+
+    memcpy(out, kImageMagic, sizeof(kImageMagic));
+    put_u16(out + kOffsetVersion, (uint16_t)MATH_EXPR_IMAGE_VERSION);
+    put_u16(out + kOffsetHeaderSize, (uint16_t)MATH_EXPR_IMAGE_HEADER_SIZE);
+    put_u32(out + kOffsetTotalSize, (uint32_t)layout.total);
+    put_u32(out + kOffsetCodeCount, (uint32_t)program->code_size);
+    put_u32(out + kOffsetConstantCount, (uint32_t)program->constant_count);
+    put_u32(out + kOffsetSymbolCount, (uint32_t)program->symbol_count);
+    put_u32(out + kOffsetMaxStack, (uint32_t)program->max_stack);
+    put_u32(out + kOffsetStringsSize, (uint32_t)strings_size);
+    out[kOffsetPrecision] = program->precision == MATH_EXPR_PRECISION_F32 ? kImagePrecisionF32 : kImagePrecisionF64;
+
+    for (size_t i = 0; i < program->constant_count; ++i) {
+        uint64_t bits = 0U;
+        memcpy(&bits, &program->constants[i], sizeof(bits));
+        put_u64(out + layout.constants + i * 8U, bits);
+    }
+
+    for (size_t i = 0; i < program->code_size; ++i) {
+        put_u32(out + layout.code + i * 8U, program->code[i].opcode);
+        put_u32(out + layout.code + i * 8U + 4U, program->code[i].operand);
+    }
+
+    size_t string_offset = 0U;
+    for (size_t i = 0; i < program->symbol_count; ++i) {
+        size_t length = strlen(program->symbols[i]) + 1U;
+        put_u32(out + layout.symbol_offsets + i * 4U, (uint32_t)string_offset);
+        memcpy(out + layout.strings + string_offset, program->symbols[i], length);
+        string_offset += length;
+    }
+
+    put_u32(out + kOffsetChecksum, checksum(out, (size_t)layout.total));
+
+    if (out_size) {
+        *out_size = (size_t)layout.total;
+    }
+    return 0;
+}
+
+int math_expr_program_save(const math_expr_program *program, const char *path)
+{
+    if (!program || !path) {
+        return -1;
+    }
+
+    size_t size = math_expr_program_image_size(program);
+    unsigned char *buffer = (unsigned char *)malloc(size);
+    if (!buffer) {
+        perror("math_expr_serialize: malloc");
+        return -1;
+    }
+
+    int status = math_expr_program_write_image(program, buffer, size, NULL);
+    if (status == 0) {
+        FILE *file = fopen(path, "wb");
+        if (!file) {
+            perror("math_expr_serialize: fopen");
+            status = -1;
+        } else {
+            if (fwrite(buffer, 1U, size, file) != size) {
+                perror("math_expr_serialize: fwrite");
+                status = -1;
+            }
+            if (fclose(file) != 0) {
+                status = -1;
+            }
+        }
+    }
+
+    free(buffer);
+    return status;
+}
+
+size_t math_expr_image_size(const void *image, size_t available)
+{
+    const unsigned char *in = (const unsigned char *)image;
+    if (!in || available < MATH_EXPR_IMAGE_HEADER_SIZE || memcmp(in, kImageMagic, sizeof(kImageMagic)) != 0) {
+        return 0U;
+    }
+
+    uint32_t total = get_u32(in + kOffsetTotalSize);
+    if (total < MATH_EXPR_IMAGE_HEADER_SIZE || total > available) {
+        return 0U;
+    }
+
+    return total;
+}
+
+static int load_symbols(const unsigned char *in,
+                        const image_layout *layout,
+                        size_t symbol_count,
+                        size_t strings_size,
+                        int borrow,
+                        math_expr_program *program)
+{
+    if (symbol_count == 0U) {
+        return 0;
+    }
+
+    program->symbols = (char **)calloc(symbol_count, sizeof(*program->symbols));
+    if (!program->symbols) {
+        perror("math_expr_serialize: calloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(symbol_count * sizeof(*program->symbols));
+    program->symbol_capacity = symbol_count;
+
+    const char *strings = (const char *)(in + layout->strings);
+    for (size_t i = 0; i < symbol_count; ++i) {
+        uint32_t offset = get_u32(in + layout->symbol_offsets + i * 4U);
+        const char *end = offset < strings_size
+                              ? (const char *)memchr(strings + offset, '\0', strings_size - offset)
+                              : NULL;
+        if (!end) {
+            fprintf(stderr, "math_expr_serialize: corrupt symbol table\n");
+            return -1;
+        }
+
+        if (borrow) {
+            program->symbols[i] = (char *)(strings + offset);
+        } else {
+            size_t length = (size_t)(end - (strings + offset)) + 1U;
+            program->symbols[i] = (char *)malloc(length);
+            if (!program->symbols[i]) {
+                perror("math_expr_serialize: malloc");
+                return -1;
+            }
+            MATH_EXPR_STATS_ALLOC(length);
+            memcpy(program->symbols[i], strings + offset, length);
+        }
+        program->symbol_count = i + 1U;
+    }
+
+    return 0;
+}
+
+static int copy_sections(const unsigned char *in,
+                         const image_layout *layout,
+                         size_t code_count,
+                         size_t constant_count,
+                         math_expr_program *program)
+{
+    program->code = (math_expr_instruction *)malloc(code_count * sizeof(*program->code));
+    if (!program->code) {
+        perror("math_expr_serialize: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(code_count * sizeof(*program->code));
+    program->code_capacity = code_count;
+
+    for (size_t i = 0; i < code_count; ++i) {
+        program->code[i].opcode = get_u32(in + layout->code + i * 8U);
+        program->code[i].operand = get_u32(in + layout->code + i * 8U + 4U);
+    }
+    program->code_size = code_count;
+
+    if (constant_count > 0U) {
+        program->constants = (double *)malloc(constant_count * sizeof(*program->constants));
+        if (!program->constants) {
+            perror("math_expr_serialize: malloc");
+            return -1;
+        }
+        MATH_EXPR_STATS_ALLOC(constant_count * sizeof(*program->constants));
+        program->constant_capacity = constant_count;
+
+        for (size_t i = 0; i < constant_count; ++i) {
+            uint64_t bits = get_u64(in + layout->constants + i * 8U);
+            memcpy(&program->constants[i], &bits, sizeof(bits));
+        }
+    }
+    program->constant_count = constant_count;
+    return 0;
+}
+
+int math_expr_program_load_image(const void *image, size_t size, math_expr_program *out_program)
+{
+    if (!image || !out_program) {
+        return -1;
+    }
+
+    math_expr_program_deinit(out_program);
+
+    const unsigned char *in = (const unsigned char *)image;
+    size_t total = math_expr_image_size(image, size);
+    if (total == 0U) {
+        fprintf(stderr, "math_expr_serialize: not a program image\n");
+        return -1;
+    }
+
+    uint16_t version = get_u16(in + kOffsetVersion);
+    if (version != MATH_EXPR_IMAGE_VERSION || get_u16(in + kOffsetHeaderSize) != MATH_EXPR_IMAGE_HEADER_SIZE) {
+        fprintf(stderr,
+                "math_expr_serialize: unsupported image version %u (expected %u)\n",
+                (unsigned)version,
+                (unsigned)MATH_EXPR_IMAGE_VERSION);
+        return -1;
+    }
+
+    if (get_u32(in + kOffsetChecksum) != checksum(in, total)) {
+        fprintf(stderr, "math_expr_serialize: image checksum mismatch\n");
+        return -1;
+    }
+
+    size_t code_count = get_u32(in + kOffsetCodeCount);
+    size_t constant_count = get_u32(in + kOffsetConstantCount);
+    size_t symbol_count = get_u32(in + kOffsetSymbolCount);
+    size_t strings_size = get_u32(in + kOffsetStringsSize);
+    image_layout layout = compute_layout(code_count, constant_count, symbol_count, strings_size);
+
+    /* Every instruction pushes at most one value, so a larger stack can only come from a bad header. */
+    size_t max_stack = get_u32(in + kOffsetMaxStack);
+    if (layout.total != total || code_count == 0U || max_stack > code_count) {
+        fprintf(stderr, "math_expr_serialize: corrupt image layout\n");
+        return -1;
+    }
+
+    unsigned char precision = in[kOffsetPrecision];
+    if (precision != kImagePrecisionF64 && precision != kImagePrecisionF32) {
+        fprintf(stderr, "math_expr_serialize: unknown precision %u in image\n", (unsigned)precision);
+        return -1;
+    }
+
+    int borrow = host_is_little_endian() && ((uintptr_t)image % 8U) == 0U;
+    math_expr_program *program = out_program;
+    program->max_stack = max_stack;
+    program->precision = precision == kImagePrecisionF32 ? MATH_EXPR_PRECISION_F32 : MATH_EXPR_PRECISION_F64;
+
+    if (borrow) {
+        program->flags = MATH_EXPR_PROGRAM_BORROWED;
+        program->code = (math_expr_instruction *)(in + layout.code);
+        program->code_size = code_count;
+        program->constants = constant_count > 0U ? (double *)(in + layout.constants) : NULL;
+        program->constant_count = constant_count;
+    } else if (copy_sections(in, &layout, code_count, constant_count, program) != 0) {
+        math_expr_program_deinit(program);
+        return -1;
+    }
+
+    if (load_symbols(in, &layout, symbol_count, strings_size, borrow, program) != 0 ||
+        math_expr_program_validate(program) != 0) {
+        fprintf(stderr, "math_expr_serialize: invalid program in image\n");
+        math_expr_program_deinit(program);
+        return -1;
+    }
+
+    return 0;
+}
+
+int math_expr_program_load_or_compile(const void *image,
+                                      size_t size,
+                                      const char *source,
+                                      math_expr_program *out_program)
+{
+    if (!out_program) {
+        return -1;
+    }
+
+    if (image && math_expr_program_load_image(image, size, out_program) == 0) {
+        return 0;
+    }
+
+    if (!source) {
+        return -1;
+    }
+
+    return math_expr_compile(source, out_program);
+}
+
+#ifdef MATH_EXPR_HAVE_MMAP
+
+int math_expr_map_file(const char *path, math_expr_mapped_file *out_file)
+{
+    if (!path || !out_file) {
+        return -1;
+    }
+
+    memset(out_file, 0, sizeof(*out_file));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("math_expr_serialize: open");
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        fprintf(stderr, "math_expr_serialize: cannot map empty or unreadable file '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("math_expr_serialize: mmap");
+        return -1;
+    }
+
+    out_file->data = data;
+    out_file->size = (size_t)info.st_size;
+    out_file->mapped = 1;
+    return 0;
+}
+
+#else
+
+int math_expr_map_file(const char *path, math_expr_mapped_file *out_file)
+{
+    if (!path || !out_file) {
+        return -1;
+    }
+
+    memset(out_file, 0, sizeof(*out_file));
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("math_expr_serialize: fopen");
+        return -1;
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return -1;
+    }
+    long length = ftell(file);
+    rewind(file);
+    if (length <= 0) {
+        fclose(file);
+        return -1;
+    }
+
+    void *data = malloc((size_t)length);
+    if (!data || fread(data, 1U, (size_t)length, file) != (size_t)length) {
+        fprintf(stderr, "math_expr_serialize: failed to read '%s'\n", path);
+        free(data);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+    out_file->data = data;
+    out_file->size = (size_t)length;
+    return 0;
+}
+
+#endif
+
+void math_expr_unmap_file(math_expr_mapped_file *file)
+{
+    if (!file || !file->data) {
+        return;
+    }
+
+#ifdef MATH_EXPR_HAVE_MMAP
+    if (file->mapped) {
+        munmap(file->data, file->size);
+    } else {
+        free(file->data);
+    }
+#else
+    free(file->data);
+#endif
+
+    memset(file, 0, sizeof(*file));
+}
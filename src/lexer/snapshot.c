@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+
+#include "stats_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+#include <sched.h>
+#endif
+
+/*
+ * Readers count themselves under the parity of the epoch they saw, then load
+ * the pointer; writers swap the pointer before reading the counters. Values
+ * retired during parity p are destroyed once the epoch has moved on from p
+ * and the readers of p have drained: the move itself waited for the readers
+ * of the other parity, so no reader of either parity can still hold them.
+ * With sequentially consistent operations a reader counted after a check
+ * saw its counter at zero loads a newer value than anything retired before
+ * the check.
+ *
+ * Only a reader of the previous parity can be what holds reclamation back,
+ * so the last of them to leave its stripe asks for a reclaim, running it if
+ * the writer lock is free and otherwise leaving it to the holder on unlock.
+ */
+
+static _Thread_local unsigned int tls_stripe = MATH_EXPR_SNAPSHOT_STRIPES;
+static atomic_uint g_next_stripe;
+
+static unsigned int reader_stripe(void)
+{
+    if (tls_stripe == MATH_EXPR_SNAPSHOT_STRIPES) {
+        tls_stripe = atomic_fetch_add_explicit(&g_next_stripe, 1U, memory_order_relaxed) % MATH_EXPR_SNAPSHOT_STRIPES;
+    }
+    return tls_stripe;
+}
+
+static int drained(math_expr_snapshot *snapshot, unsigned int parity)
+{
+    for (size_t i = 0; i < MATH_EXPR_SNAPSHOT_STRIPES; ++i) {
+        if (atomic_load(&snapshot->stripes[i].readers[parity]) != 0U) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void destroy_list(math_expr_snapshot *snapshot, math_expr_snapshot_retired *node)
+{
+    while (node) {
+        math_expr_snapshot_retired *next = node->next;
+        snapshot->destroy(node->value);
+        free(node);
+        node = next;
+    }
+}
+
+/* Requires the writer lock. */
+static void reclaim(math_expr_snapshot *snapshot)
+{
+    for (int round = 0; round < 2; ++round) {
+        unsigned int parity = atomic_load(&snapshot->epoch) & 1U;
+        if (!drained(snapshot, parity ^ 1U)) {
+            break;
+        }
+
+        destroy_list(snapshot, snapshot->retired[parity ^ 1U]);
+        snapshot->retired[parity ^ 1U] = NULL;
+        if (!snapshot->retired[parity]) {
+            break;
+        }
+        atomic_fetch_add(&snapshot->epoch, 1U);
+    }
+
+    atomic_store(&snapshot->pending, snapshot->retired[0] != NULL || snapshot->retired[1] != NULL);
+}
+
+static int try_lock(math_expr_snapshot *snapshot)
+{
+    return !atomic_flag_test_and_set(&snapshot->writer);
+}
+
+/* Run the reclaims readers asked for, unless the lock holder will on unlock. */
+static void collect(math_expr_snapshot *snapshot)
+{
+    while (atomic_load(&snapshot->collect) && try_lock(snapshot)) {
+        atomic_store(&snapshot->collect, 0);
+        reclaim(snapshot);
+        atomic_flag_clear(&snapshot->writer);
+    }
+}
+
+void math_expr_snapshot_init(math_expr_snapshot *snapshot, void *initial, void (*destroy)(void *value))
+{
+    atomic_init(&snapshot->current, initial);
+    atomic_init(&snapshot->epoch, 0U);
+    atomic_init(&snapshot->pending, 0);
+    atomic_init(&snapshot->collect, 0);
+    atomic_flag_clear(&snapshot->writer);
+    snapshot->retired[0] = NULL;
+    snapshot->retired[1] = NULL;
+    snapshot->destroy = destroy;
+    for (size_t i = 0; i < MATH_EXPR_SNAPSHOT_STRIPES; ++i) {
+        atomic_init(&snapshot->stripes[i].readers[0], 0U);
+        atomic_init(&snapshot->stripes[i].readers[1], 0U);
+    }
+}
+
+void math_expr_snapshot_deinit(math_expr_snapshot *snapshot)
+{
+    destroy_list(snapshot, snapshot->retired[0]);
+    destroy_list(snapshot, snapshot->retired[1]);
+    snapshot->retired[0] = NULL;
+    snapshot->retired[1] = NULL;
+    snapshot->destroy(atomic_load(&snapshot->current));
+    atomic_store(&snapshot->current, NULL);
+}
+
+const void *math_expr_snapshot_read_begin(math_expr_snapshot *snapshot, math_expr_snapshot_ticket *out_ticket)
+{
+    unsigned int stripe = reader_stripe();
+    unsigned int parity = atomic_load(&snapshot->epoch) & 1U;
+
+    atomic_fetch_add(&snapshot->stripes[stripe].readers[parity], 1U);
+    *out_ticket = stripe << 1U | parity;
+    return atomic_load(&snapshot->current);
+}
+
+void math_expr_snapshot_read_end(math_expr_snapshot *snapshot, math_expr_snapshot_ticket ticket)
+{
+    unsigned int parity = ticket & 1U;
+
+    if (atomic_fetch_sub(&snapshot->stripes[ticket >> 1U].readers[parity], 1U) != 1U ||
+        (atomic_load(&snapshot->epoch) & 1U) == parity || !atomic_load(&snapshot->pending)) {
+        return;
+    }
+
+    atomic_store(&snapshot->collect, 1);
+    collect(snapshot);
+}
+
+void math_expr_snapshot_write_lock(math_expr_snapshot *snapshot)
+{
+    while (!try_lock(snapshot)) {
+#ifdef MATH_EXPR_HAVE_PTHREADS
+        sched_yield();
+#endif
+    }
+}
+
+void math_expr_snapshot_write_unlock(math_expr_snapshot *snapshot)
+{
+    atomic_flag_clear(&snapshot->writer);
+    collect(snapshot);
+}
+
+const void *math_expr_snapshot_peek(math_expr_snapshot *snapshot)
+{
+    return atomic_load_explicit(&snapshot->current, memory_order_relaxed);
+}
+
+int math_expr_snapshot_publish(math_expr_snapshot *snapshot, void *next)
+{
+    math_expr_snapshot_retired *node = (math_expr_snapshot_retired *)malloc(sizeof(*node));
+    if (!node) {
+        perror("math_expr_snapshot: malloc");
+        return -1;
+    }
+    MATH_EXPR_STATS_ALLOC(sizeof(*node));
+
+    unsigned int parity = atomic_load(&snapshot->epoch) & 1U;
+    node->value = atomic_exchange(&snapshot->current, next);
+    node->next = snapshot->retired[parity];
+    snapshot->retired[parity] = node;
+
+    reclaim(snapshot);
+    return 0;
+}
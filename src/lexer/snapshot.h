@@ -0,0 +1,67 @@
+#ifndef MATH_EXPR_SNAPSHOT_H
+#define MATH_EXPR_SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * Read-mostly shared pointer with RCU-style publication.
+ *
+ * Readers bracket their use of the current value with read_begin/read_end;
+ * both are a single atomic increment or decrement on a counter shared with
+ * few other threads, and never block. Writers take the writer lock, build a
+ * new immutable value, and publish it. The replaced value is retired and
+ * destroyed once every reader that could have loaded it has finished,
+ * either by a later writer or by the last of those readers, so in-flight
+ * readers keep using the value they started with and retired values do not
+ * pile up under a steady stream of readers.
+ */
+
+#define MATH_EXPR_SNAPSHOT_STRIPES 8U
+
+typedef struct math_expr_snapshot_retired {
+    struct math_expr_snapshot_retired *next;
+    void *value;
+} math_expr_snapshot_retired;
+
+/* Reader counts of one group of threads by epoch parity, padded so stripes share no cache line. */
+typedef struct math_expr_snapshot_stripe {
+    atomic_size_t readers[2];
+    char padding[64 - 2 * sizeof(atomic_size_t)];
+} math_expr_snapshot_stripe;
+
+typedef struct math_expr_snapshot {
+    _Atomic(void *) current;
+    atomic_uint epoch;
+    atomic_int pending;  /* Non-zero while a retired list is not empty. */
+    atomic_int collect;  /* A reader asked the lock holder to reclaim. */
+    atomic_flag writer;
+    math_expr_snapshot_retired *retired[2]; /* By the epoch parity they were retired in; guarded by writer. */
+    void (*destroy)(void *value);
+    math_expr_snapshot_stripe stripes[MATH_EXPR_SNAPSHOT_STRIPES];
+} math_expr_snapshot;
+
+/* Identifies the counter a reader was counted in; passed back to read_end. */
+typedef unsigned int math_expr_snapshot_ticket;
+
+void math_expr_snapshot_init(math_expr_snapshot *snapshot, void *initial, void (*destroy)(void *value));
+
+/* Destroys the current and all retired values; no reader or writer may be active. */
+void math_expr_snapshot_deinit(math_expr_snapshot *snapshot);
+
+const void *math_expr_snapshot_read_begin(math_expr_snapshot *snapshot, math_expr_snapshot_ticket *out_ticket);
+void math_expr_snapshot_read_end(math_expr_snapshot *snapshot, math_expr_snapshot_ticket ticket);
+
+void math_expr_snapshot_write_lock(math_expr_snapshot *snapshot);
+void math_expr_snapshot_write_unlock(math_expr_snapshot *snapshot);
+
+/* Current value as seen by the writer; requires the writer lock. */
+const void *math_expr_snapshot_peek(math_expr_snapshot *snapshot);
+
+/*
+ * Replace the current value; requires the writer lock. On failure the
+ * snapshot is unchanged and next is still owned by the caller.
+ */
+int math_expr_snapshot_publish(math_expr_snapshot *snapshot, void *next);
+
+#endif // MATH_EXPR_SNAPSHOT_H
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats_internal.h"
+
+#include "builtins.h"
+
+#include <string.h>
+
+#ifdef ENABLE_STATS
+
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct hook_binding {
+    math_expr_phase_hook hook;
+    void *user;
+} hook_binding;
+
+static _Thread_local math_expr_stats tls_stats;
+
+/* The hook and its user pointer, published together so a call never sees a torn pair. */
+static math_expr_snapshot g_hook = {.destroy = free};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void call_hook(math_expr_phase phase, int end, uint64_t elapsed_ns)
+{
+    math_expr_snapshot_ticket ticket = 0U;
+    const hook_binding *binding = (const hook_binding *)math_expr_snapshot_read_begin(&g_hook, &ticket);
+    if (binding) {
+        binding->hook(binding->user, phase, end, elapsed_ns);
+    }
+    math_expr_snapshot_read_end(&g_hook, ticket);
+}
+
+uint64_t math_expr_stats_phase_begin(math_expr_phase phase)
+{
+    call_hook(phase, 0, 0U);
+    return now_ns();
+}
+
+void math_expr_stats_phase_end(math_expr_phase phase, uint64_t start_ns)
+{
+    uint64_t elapsed = now_ns() - start_ns;
+    ++tls_stats.phase_calls[phase];
+    tls_stats.phase_ns[phase] += elapsed;
+
+    call_hook(phase, 1, elapsed);
+}
+
+void math_expr_stats_count_token(int type)
+{
+    if (type >= 0 && (unsigned)type < MATH_EXPR_STATS_TOKEN_TYPES) {
+        ++tls_stats.tokens[type];
+    }
+}
+
+void math_expr_stats_count_alloc(size_t bytes)
+{
+    ++tls_stats.allocations;
+    tls_stats.bytes_allocated += bytes;
+}
+
+void math_expr_stats_count_builtin(size_t index)
+{
+    if (index < MATH_EXPR_STATS_BUILTIN_SLOTS) {
+        ++tls_stats.builtin_calls[index];
+    }
+}
+
+void math_expr_stats_count_error(void)
+{
+    ++tls_stats.errors;
+}
+
+int math_expr_stats_enabled(void)
+{
+    return 1;
+}
+
+int math_expr_stats_get(math_expr_stats *out_stats)
+{
+    if (!out_stats) {
+        return -1;
+    }
+
+    *out_stats = tls_stats;
+    return 0;
+}
+
+void math_expr_stats_reset(void)
+{
+    memset(&tls_stats, 0, sizeof(tls_stats));
+}
+
+int math_expr_stats_set_hook(math_expr_phase_hook hook, void *user)
+{
+    hook_binding *binding = NULL;
+    if (hook) {
+        binding = (hook_binding *)malloc(sizeof(*binding));
+        if (!binding) {
+            perror("math_expr_stats: malloc");
+            return -1;
+        }
+        binding->hook = hook;
+        binding->user = user;
+    }
+
+    math_expr_snapshot_write_lock(&g_hook);
+    int status = math_expr_snapshot_publish(&g_hook, binding);
+    math_expr_snapshot_write_unlock(&g_hook);
+
+    if (status != 0) {
+        free(binding);
+    }
+    return status;
+}
+
+#else
+
+int math_expr_stats_enabled(void)
+{
+    return 0;
+}
+
+int math_expr_stats_get(math_expr_stats *out_stats)
+{
+    if (out_stats) {
+        memset(out_stats, 0, sizeof(*out_stats));
+    }
+
+    return -1;
+}
+
+void math_expr_stats_reset(void)
+{
+}
+
+int math_expr_stats_set_hook(math_expr_phase_hook hook, void *user)
+{
+    (void)hook;
+    (void)user;
+    return -1;
+}
+
+#endif
+
+const char *math_expr_stats_builtin_name(size_t index)
+{
+    const math_expr_builtin *builtin = math_expr_builtin_get(index);
+    return builtin ? builtin->name : NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef MATH_EXPR_STATS_INTERNAL_H
+#define MATH_EXPR_STATS_INTERNAL_H
+
+#include "config.h"
+#include "math_expr/stats.h"
+
+/*
+ * Instrumentation macros. They expand to nothing unless ENABLE_STATS is
+ * defined in config.h, so disabled builds carry no overhead.
+ */
+
+#ifdef ENABLE_STATS
+
+uint64_t math_expr_stats_phase_begin(math_expr_phase phase);
+void math_expr_stats_phase_end(math_expr_phase phase, uint64_t start_ns);
+void math_expr_stats_count_token(int type);
+void math_expr_stats_count_alloc(size_t bytes);
+void math_expr_stats_count_builtin(size_t index);
+void math_expr_stats_count_error(void);
+
+#define MATH_EXPR_STATS_PHASE_BEGIN(phase) \
+    const uint64_t math_expr_stats_start_ = math_expr_stats_phase_begin(phase)
+#define MATH_EXPR_STATS_PHASE_END(phase) math_expr_stats_phase_end((phase), math_expr_stats_start_)
+#define MATH_EXPR_STATS_TOKEN(type) math_expr_stats_count_token((int)(type))
+#define MATH_EXPR_STATS_ALLOC(bytes) math_expr_stats_count_alloc(bytes)
+#define MATH_EXPR_STATS_BUILTIN(index) math_expr_stats_count_builtin(index)
+#define MATH_EXPR_STATS_ERROR() math_expr_stats_count_error()
+
+#else
+
+#define MATH_EXPR_STATS_PHASE_BEGIN(phase) ((void)0)
+#define MATH_EXPR_STATS_PHASE_END(phase) ((void)0)
+#define MATH_EXPR_STATS_TOKEN(type) ((void)0)
+#define MATH_EXPR_STATS_ALLOC(bytes) ((void)0)
+#define MATH_EXPR_STATS_BUILTIN(index) ((void)0)
+#define MATH_EXPR_STATS_ERROR() ((void)0)
+
+#endif
+
+#endif // MATH_EXPR_STATS_INTERNAL_H
@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+
+struct math_expr_thread_pool {
+    size_t size;
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    pthread_t *threads;
+    size_t worker_count;
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t start_cv;
+    pthread_cond_t done_cv;
+    unsigned long generation;
+    int shutdown;
+    math_expr_task_fn task;
+    void *context;
+    size_t task_count;
+    atomic_size_t next_task;
+    size_t active_workers;
+#endif
+};
+
+static void run_inline(size_t task_count, math_expr_task_fn task, void *context)
+{
+    for (size_t i = 0; i < task_count; ++i) {
+        task(context, i);
+    }
+}
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+
+static void drain_tasks(math_expr_thread_pool *pool, math_expr_task_fn task, void *context, size_t task_count)
+{
+    for (;;) {
+        size_t index = atomic_fetch_add_explicit(&pool->next_task, 1U, memory_order_relaxed);
+        if (index >= task_count) {
+            break;
+        }
+        task(context, index);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    math_expr_thread_pool *pool = (math_expr_thread_pool *)arg;
+    unsigned long seen = 0UL;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait(&pool->start_cv, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        seen = pool->generation;
+        math_expr_task_fn task = pool->task;
+        void *context = pool->context;
+        size_t task_count = pool->task_count;
+        pthread_mutex_unlock(&pool->lock);
+
+        drain_tasks(pool, task, context, task_count);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active_workers == 0U) {
+            pthread_cond_signal(&pool->done_cv);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+static size_t online_processors(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1U;
+}
+
+#endif
+
+math_expr_thread_pool *math_expr_thread_pool_create(size_t thread_count)
+{
+    math_expr_thread_pool *pool = (math_expr_thread_pool *)calloc(1U, sizeof(*pool));
+    if (!pool) {
+        perror("math_expr_thread_pool: calloc");
+        return NULL;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    if (thread_count == 0U) {
+        thread_count = online_processors();
+    }
+
+    pool->size = thread_count;
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+    atomic_init(&pool->next_task, 0U);
+
+    if (thread_count > 1U) {
+        pool->threads = (pthread_t *)calloc(thread_count - 1U, sizeof(*pool->threads));
+        if (!pool->threads) {
+            perror("math_expr_thread_pool: calloc");
+            math_expr_thread_pool_destroy(pool);
+            return NULL;
+        }
+
+        for (size_t i = 0; i + 1U < thread_count; ++i) {
+            if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+                fprintf(stderr, "math_expr_thread_pool: failed to start worker thread\n");
+                math_expr_thread_pool_destroy(pool);
+                return NULL;
+            }
+            ++pool->worker_count;
+        }
+    }
+#else
+    (void)thread_count;
+    pool->size = 1U;
+#endif
+
+    return pool;
+}
+
+void math_expr_thread_pool_destroy(math_expr_thread_pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->worker_count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    free(pool->threads);
+    pthread_cond_destroy(&pool->done_cv);
+    pthread_cond_destroy(&pool->start_cv);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+#endif
+
+    free(pool);
+}
+
+size_t math_expr_thread_pool_size(const math_expr_thread_pool *pool)
+{
+    return pool ? pool->size : 1U;
+}
+
+int math_expr_thread_pool_run(math_expr_thread_pool *pool,
+                              size_t task_count,
+                              math_expr_task_fn task,
+                              void *context)
+{
+    if (!task) {
+        return -1;
+    }
+
+#ifdef MATH_EXPR_HAVE_PTHREADS
+    if (!pool || pool->worker_count == 0U || task_count < 2U) {
+        run_inline(task_count, task, context);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->run_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->task_count = task_count;
+    atomic_store_explicit(&pool->next_task, 0U, memory_order_relaxed);
+    pool->active_workers = pool->worker_count;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    drain_tasks(pool, task, context, task_count);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active_workers > 0U) {
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->run_lock);
+#else
+    (void)pool;
+    run_inline(task_count, task, context);
+#endif
+
+    return 0;
+}
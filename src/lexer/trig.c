@@ -0,0 +1,498 @@
+#include "math_expr/trig.h"
+
+#include "builtins.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Table points from 0 to 45 degrees inclusive. */
+#define MATH_EXPR_TRIG_TABLE_SIZE 181U
+
+static const double kRadiansPerDegree = M_PI / 180.0;
+static const float kRadiansPerDegreeF32 = (float)(M_PI / 180.0);
+
+static const double kSqrtHalf = 0.70710678118654752440;
+static const double kSqrt3Half = 0.86602540378443864676;
+static const double kTan30 = 0.57735026918962576451;
+static const double kSqrt3 = 1.73205080756887729353;
+
+static const float kSqrtHalfF32 = 0.70710678118654752440f;
+static const float kSqrt3HalfF32 = 0.86602540378443864676f;
+static const float kTan30F32 = 0.57735026918962576451f;
+static const float kSqrt3F32 = 1.73205080756887729353f;
+
+static atomic_int trig_mode = MATH_EXPR_TRIG_LIBM;
+static atomic_int tables_ready;
+static atomic_flag tables_lock = ATOMIC_FLAG_INIT;
+static double sin_table[MATH_EXPR_TRIG_TABLE_SIZE];
+static double cos_table[MATH_EXPR_TRIG_TABLE_SIZE];
+
+/*
+ * Values computed once per argument by the paired sin and cos, which the
+ * compiler selects when a program takes both of the same argument.
+ */
+typedef struct trig_pair {
+    uint64_t bits;
+    int mode;
+    int valid;
+    double sin;
+    double cos;
+} trig_pair;
+
+typedef struct trig_pair_f32 {
+    uint32_t bits;
+    int mode;
+    int valid;
+    float sin;
+    float cos;
+} trig_pair_f32;
+
+static _Thread_local trig_pair tls_pair;
+static _Thread_local trig_pair_f32 tls_pair_f32;
+
+/* sin and cos of |t| <= 45 degrees through the C library, exact at 30 and 45. */
+static double sin_libm(double t)
+{
+    double a = fabs(t);
+    if (a == 30.0) {
+        return copysign(0.5, t);
+    }
+    if (a == 45.0) {
+        return copysign(kSqrtHalf, t);
+    }
+    return sin(t * kRadiansPerDegree);
+}
+
+static double cos_libm(double t)
+{
+    double a = fabs(t);
+    if (a == 30.0) {
+        return kSqrt3Half;
+    }
+    if (a == 45.0) {
+        return kSqrtHalf;
+    }
+    return cos(t * kRadiansPerDegree);
+}
+
+static double tan_libm(double t)
+{
+    double a = fabs(t);
+    if (a == 30.0) {
+        return copysign(kTan30, t);
+    }
+    if (a == 45.0) {
+        return copysign(1.0, t);
+    }
+    return tan(t * kRadiansPerDegree);
+}
+
+static float sin_libm_f32(float t)
+{
+    float a = fabsf(t);
+    if (a == 30.0f) {
+        return copysignf(0.5f, t);
+    }
+    if (a == 45.0f) {
+        return copysignf(kSqrtHalfF32, t);
+    }
+    return sinf(t * kRadiansPerDegreeF32);
+}
+
+static float cos_libm_f32(float t)
+{
+    float a = fabsf(t);
+    if (a == 30.0f) {
+        return kSqrt3HalfF32;
+    }
+    if (a == 45.0f) {
+        return kSqrtHalfF32;
+    }
+    return cosf(t * kRadiansPerDegreeF32);
+}
+
+static float tan_libm_f32(float t)
+{
+    float a = fabsf(t);
+    if (a == 30.0f) {
+        return copysignf(kTan30F32, t);
+    }
+    if (a == 45.0f) {
+        return copysignf(1.0f, t);
+    }
+    return tanf(t * kRadiansPerDegreeF32);
+}
+
+static void fill_tables(void)
+{
+    if (atomic_load_explicit(&tables_ready, memory_order_acquire)) {
+        return;
+    }
+
+    while (atomic_flag_test_and_set_explicit(&tables_lock, memory_order_acquire)) {
+    }
+    if (!atomic_load_explicit(&tables_ready, memory_order_relaxed)) {
+        for (size_t k = 0; k < MATH_EXPR_TRIG_TABLE_SIZE; ++k) {
+            double t = (double)k * MATH_EXPR_TRIG_TABLE_STEP;
+            sin_table[k] = sin_libm(t);
+            cos_table[k] = cos_libm(t);
+        }
+        atomic_store_explicit(&tables_ready, 1, memory_order_release);
+    }
+    atomic_flag_clear_explicit(&tables_lock, memory_order_release);
+}
+
+/*
+ * Cubic Hermite interpolation between the table points around |t|, using
+ * the derivatives cos and -sin, which the tables also hold. The error is at
+ * most h^4 / 384 for a step of h radians, below 1e-12 for a quarter degree;
+ * on a table point the weights are exactly 1 and 0.
+ */
+typedef struct table_weights {
+    size_t k;
+    double h00, h10, h01, h11;
+} table_weights;
+
+static table_weights table_position(double t)
+{
+    static const double kStepRadians = MATH_EXPR_TRIG_TABLE_STEP * (M_PI / 180.0);
+
+    table_weights w;
+    double u = fabs(t) / MATH_EXPR_TRIG_TABLE_STEP;
+    w.k = (size_t)u;
+    if (w.k > MATH_EXPR_TRIG_TABLE_SIZE - 2U) {
+        w.k = MATH_EXPR_TRIG_TABLE_SIZE - 2U;
+    }
+
+    double f = u - (double)w.k;
+    double g = 1.0 - f;
+    w.h00 = (1.0 + 2.0 * f) * g * g;
+    w.h10 = f * g * g * kStepRadians;
+    w.h01 = f * f * (3.0 - 2.0 * f);
+    w.h11 = -f * f * g * kStepRadians;
+    return w;
+}
+
+static double sin_table_lookup(double t)
+{
+    table_weights w = table_position(t);
+    double value = w.h00 * sin_table[w.k] + w.h10 * cos_table[w.k] + w.h01 * sin_table[w.k + 1U] +
+                   w.h11 * cos_table[w.k + 1U];
+    return t < 0.0 ? -value : value;
+}
+
+static double cos_table_lookup(double t)
+{
+    table_weights w = table_position(t);
+    double value = w.h00 * cos_table[w.k] - w.h10 * sin_table[w.k] + w.h01 * cos_table[w.k + 1U] -
+                   w.h11 * sin_table[w.k + 1U];
+    /* Near 0 degrees the interpolant may overshoot by its error bound. */
+    return value > 1.0 ? 1.0 : value;
+}
+
+static int table_mode(void)
+{
+    return atomic_load_explicit(&trig_mode, memory_order_acquire) == MATH_EXPR_TRIG_TABLE;
+}
+
+static double sin_reduced(double t, int table)
+{
+    return table ? sin_table_lookup(t) : sin_libm(t);
+}
+
+static double cos_reduced(double t, int table)
+{
+    return table ? cos_table_lookup(t) : cos_libm(t);
+}
+
+static float sin_reduced_f32(float t, int table)
+{
+    return table ? (float)sin_table_lookup((double)t) : sin_libm_f32(t);
+}
+
+static float cos_reduced_f32(float t, int table)
+{
+    return table ? (float)cos_table_lookup((double)t) : cos_libm_f32(t);
+}
+
+/*
+ * degrees = 360 n + 90 q + t with |t| <= 45. fmod is exact, and so is the
+ * subtraction: t is a multiple of the last place of the remainder and smaller
+ * than it. Returns q modulo 4.
+ */
+static unsigned reduce_degrees(double degrees, double *out_t)
+{
+    double r = fmod(degrees, 360.0);
+    double q = nearbyint(r / 90.0);
+    *out_t = r - 90.0 * q;
+    return (unsigned)(int)q & 3U;
+}
+
+static unsigned reduce_degrees_f32(float degrees, float *out_t)
+{
+    float r = fmodf(degrees, 360.0f);
+    float q = nearbyintf(r / 90.0f);
+    *out_t = r - 90.0f * q;
+    return (unsigned)(int)q & 3U;
+}
+
+/* sin and cos of 90 q + t from those of t; zeros are returned unsigned. */
+static double sin_quadrant(unsigned q, double t, double sin_t, double cos_t)
+{
+    if (t == 0.0) {
+        return q == 1U ? 1.0 : q == 3U ? -1.0 : 0.0;
+    }
+    switch (q) {
+    case 0U:
+        return sin_t;
+    case 1U:
+        return cos_t;
+    case 2U:
+        return -sin_t;
+    default:
+        return -cos_t;
+    }
+}
+
+static double cos_quadrant(unsigned q, double t, double sin_t, double cos_t)
+{
+    return sin_quadrant((q + 1U) & 3U, t, sin_t, cos_t);
+}
+
+static float sin_quadrant_f32(unsigned q, float t, float sin_t, float cos_t)
+{
+    if (t == 0.0f) {
+        return q == 1U ? 1.0f : q == 3U ? -1.0f : 0.0f;
+    }
+    switch (q) {
+    case 0U:
+        return sin_t;
+    case 1U:
+        return cos_t;
+    case 2U:
+        return -sin_t;
+    default:
+        return -cos_t;
+    }
+}
+
+static float cos_quadrant_f32(unsigned q, float t, float sin_t, float cos_t)
+{
+    return sin_quadrant_f32((q + 1U) & 3U, t, sin_t, cos_t);
+}
+
+double math_expr_sin_degrees(double degrees)
+{
+    if (!isfinite(degrees)) {
+        return degrees - degrees;
+    }
+
+    double t = 0.0;
+    unsigned q = reduce_degrees(degrees, &t);
+    int table = table_mode();
+    if (t == 0.0) {
+        return sin_quadrant(q, t, 0.0, 0.0);
+    }
+    return q & 1U ? sin_quadrant(q, t, 0.0, cos_reduced(t, table)) : sin_quadrant(q, t, sin_reduced(t, table), 0.0);
+}
+
+double math_expr_cos_degrees(double degrees)
+{
+    if (!isfinite(degrees)) {
+        return degrees - degrees;
+    }
+
+    double t = 0.0;
+    unsigned q = reduce_degrees(degrees, &t);
+    int table = table_mode();
+    if (t == 0.0) {
+        return cos_quadrant(q, t, 0.0, 0.0);
+    }
+    return q & 1U ? cos_quadrant(q, t, sin_reduced(t, table), 0.0) : cos_quadrant(q, t, 0.0, cos_reduced(t, table));
+}
+
+double math_expr_tan_degrees(double degrees)
+{
+    if (!isfinite(degrees)) {
+        return degrees - degrees;
+    }
+
+    double t = 0.0;
+    unsigned q = reduce_degrees(degrees, &t);
+    if (t == 0.0) {
+        return q & 1U ? INFINITY : 0.0;
+    }
+    if (!(q & 1U)) {
+        return tan_libm(t);
+    }
+
+    /* tan(90 + t) = -1 / tan(t); 60 and 120 degrees are exact. */
+    if (fabs(t) == 30.0) {
+        return copysign(kSqrt3, -t);
+    }
+    return -1.0 / tan_libm(t);
+}
+
+float math_expr_sin_degrees_f32(float degrees)
+{
+    if (!isfinite(degrees)) {
+        return degrees - degrees;
+    }
+
+    float t = 0.0f;
+    unsigned q = reduce_degrees_f32(degrees, &t);
+    int table = table_mode();
+    if (t == 0.0f) {
+        return sin_quadrant_f32(q, t, 0.0f, 0.0f);
+    }
+    return q & 1U ? sin_quadrant_f32(q, t, 0.0f, cos_reduced_f32(t, table))
+                  : sin_quadrant_f32(q, t, sin_reduced_f32(t, table), 0.0f);
+}
+
+float math_expr_cos_degrees_f32(float degrees)
+{
+    if (!isfinite(degrees)) {
+        return degrees - degrees;
+    }
+
+    float t = 0.0f;
+    unsigned q = reduce_degrees_f32(degrees, &t);
+    int table = table_mode();
+    if (t == 0.0f) {
+        return cos_quadrant_f32(q, t, 0.0f, 0.0f);
+    }
+    return q & 1U ? cos_quadrant_f32(q, t, sin_reduced_f32(t, table), 0.0f)
+                  : cos_quadrant_f32(q, t, 0.0f, cos_reduced_f32(t, table));
+}
+
+float math_expr_tan_degrees_f32(float degrees)
+{
+    if (!isfinite(degrees)) {
+        return degrees - degrees;
+    }
+
+    float t = 0.0f;
+    unsigned q = reduce_degrees_f32(degrees, &t);
+    if (t == 0.0f) {
+        return q & 1U ? INFINITY : 0.0f;
+    }
+    if (!(q & 1U)) {
+        return tan_libm_f32(t);
+    }
+    if (fabsf(t) == 30.0f) {
+        return copysignf(kSqrt3F32, -t);
+    }
+    return -1.0f / tan_libm_f32(t);
+}
+
+/* Both values from one reduction, equal to math_expr_sin_degrees and math_expr_cos_degrees. */
+static const trig_pair *pair_for(double degrees)
+{
+    uint64_t bits = 0U;
+    memcpy(&bits, &degrees, sizeof(bits));
+    int table = table_mode();
+    trig_pair *pair = &tls_pair;
+    if (pair->valid && pair->bits == bits && pair->mode == table) {
+        return pair;
+    }
+
+    pair->bits = bits;
+    pair->mode = table;
+    pair->valid = 1;
+    if (!isfinite(degrees)) {
+        pair->sin = pair->cos = degrees - degrees;
+        return pair;
+    }
+
+    double t = 0.0;
+    unsigned q = reduce_degrees(degrees, &t);
+    double sin_t = 0.0;
+    double cos_t = 0.0;
+    if (t != 0.0) {
+        sin_t = sin_reduced(t, table);
+        cos_t = cos_reduced(t, table);
+    }
+    pair->sin = sin_quadrant(q, t, sin_t, cos_t);
+    pair->cos = cos_quadrant(q, t, sin_t, cos_t);
+    return pair;
+}
+
+static const trig_pair_f32 *pair_for_f32(float degrees)
+{
+    uint32_t bits = 0U;
+    memcpy(&bits, &degrees, sizeof(bits));
+    int table = table_mode();
+    trig_pair_f32 *pair = &tls_pair_f32;
+    if (pair->valid && pair->bits == bits && pair->mode == table) {
+        return pair;
+    }
+
+    pair->bits = bits;
+    pair->mode = table;
+    pair->valid = 1;
+    if (!isfinite(degrees)) {
+        pair->sin = pair->cos = degrees - degrees;
+        return pair;
+    }
+
+    float t = 0.0f;
+    unsigned q = reduce_degrees_f32(degrees, &t);
+    float sin_t = 0.0f;
+    float cos_t = 0.0f;
+    if (t != 0.0f) {
+        sin_t = sin_reduced_f32(t, table);
+        cos_t = cos_reduced_f32(t, table);
+    }
+    pair->sin = sin_quadrant_f32(q, t, sin_t, cos_t);
+    pair->cos = cos_quadrant_f32(q, t, sin_t, cos_t);
+    return pair;
+}
+
+double math_expr_sin_degrees_paired(double degrees)
+{
+    return pair_for(degrees)->sin;
+}
+
+double math_expr_cos_degrees_paired(double degrees)
+{
+    return pair_for(degrees)->cos;
+}
+
+float math_expr_sin_degrees_paired_f32(float degrees)
+{
+    return pair_for_f32(degrees)->sin;
+}
+
+float math_expr_cos_degrees_paired_f32(float degrees)
+{
+    return pair_for_f32(degrees)->cos;
+}
+
+double math_expr_trig_max_error(void)
+{
+    return table_mode() ? MATH_EXPR_TRIG_TABLE_MAX_ERROR : 0.0;
+}
+
+int math_expr_trig_set_mode(math_expr_trig_mode mode)
+{
+    if (mode != MATH_EXPR_TRIG_LIBM && mode != MATH_EXPR_TRIG_TABLE) {
+        return -1;
+    }
+
+    if (mode == MATH_EXPR_TRIG_TABLE) {
+        fill_tables();
+    }
+    atomic_store_explicit(&trig_mode, (int)mode, memory_order_release);
+    return 0;
+}
+
+math_expr_trig_mode math_expr_trig_get_mode(void)
+{
+    return (math_expr_trig_mode)atomic_load_explicit(&trig_mode, memory_order_acquire);
+}
@@ -0,0 +1,1656 @@
+/*
+ * Differential test and throughput gate for the evaluation engines.
+ *
+ * Random expression trees over the variables x, y and z, including
+ * comparisons, && and || and if(), and aggregates over array literals, are
+ * rendered twice: with variable names for the compiled paths, and with each
+ * row's values substituted as literals for the reference recursive-descent
+ * evaluator.
+ * Every compiled path must reproduce the reference bit for bit, including
+ * which rows fail, and interval evaluation must enclose every reference
+ * value. Hot programs are profiled with one variable held fixed and must
+ * match math_expr_program_evaluate whether or not their guard holds. Rows
+ * submitted one job each to an asynchronous queue, smaller than the row
+ * count so submission backs off, must match as they complete. With
+ * --trig=table, sin and cos interpolate from the table, which is first
+ * checked against the C library. With --perf or --report, evaluations per
+ * second are then measured for each path; only --perf fails the run when the
+ * compiled paths fall below the configured speedups, so timing noise cannot
+ * fail a correctness run.
+ *
+ * Usage: math_expr_differential [--seed=S] [--expressions=N] [--rows=R]
+ *                               [--perf] [--min-program-speedup=X] [--min-batch-speedup=Y]
+ *                               [--report=path] [--trig=libm|table]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/async.h"
+#include "math_expr/autodiff.h"
+#include "math_expr/batch.h"
+#include "math_expr/compiler.h"
+#include "math_expr/context.h"
+#include "math_expr/evaluator.h"
+#include "math_expr/hot.h"
+#include "math_expr/interval.h"
+#include "math_expr/memory.h"
+#include "math_expr/parallel.h"
+#include "math_expr/serialize.h"
+#include "math_expr/trig.h"
+
+#include <math.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VARIABLE_COUNT 3U
+#define MAX_EXPRESSION 4096U
+#define MAX_DEPTH 6
+#define CONTEXT_ROWS 4U
+
+typedef struct harness_options {
+    uint64_t seed;
+    size_t expressions;
+    size_t rows;
+    int perf;
+    double min_program_speedup;
+    double min_batch_speedup;
+    const char *report_path;
+    math_expr_trig_mode trig_mode;
+} harness_options;
+
+typedef struct builder {
+    char *data;
+    size_t size;
+    int overflow;
+} builder;
+
+static const char *const kVariableNames[VARIABLE_COUNT] = {"x", "y", "z"};
+
+static const struct {
+    const char *name;
+    unsigned arity;
+} kFunctions[] = {
+    {"sin", 1U}, {"cos", 1U}, {"tan", 1U}, {"sqrt", 1U}, {"abs", 1U}, {"ln", 1U},
+    {"log", 1U}, {"exp", 1U}, {"pow", 2U}, {"max", 2U}, {"min", 2U}
+};
+
+static const char *const kAggregates[] = {"sum", "avg", "min", "max"};
+
+static const char *const kLiterals[] = {"0", "1", "2", "3", "0.5", "10", "100", "1e-3", "7.25", "30", "45", "pi", "e"};
+static const char kBinaryOperators[] = "+-*/%^";
+static const char *const kLogicalOperators[] = {"<", "<=", ">", ">=", "==", "!=", "&&", "||"};
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static size_t random_below(uint64_t *state, size_t bound)
+{
+    return (size_t)(next_random(state) % bound);
+}
+
+static void append(builder *b, const char *text)
+{
+    size_t length = strlen(text);
+    if (b->size + length >= MAX_EXPRESSION) {
+        b->overflow = 1;
+        return;
+    }
+    memcpy(b->data + b->size, text, length + 1U);
+    b->size += length;
+}
+
+/*
+ * Emits one random expression. The random stream is consumed identically
+ * whether or not values are given, so both renderings share the same tree.
+ */
+static void generate(uint64_t *state, int depth, const double *values, builder *out)
+{
+    size_t kind = depth >= MAX_DEPTH ? random_below(state, 2U) : random_below(state, 11U);
+
+    switch (kind) {
+    case 0: {
+        append(out, kLiterals[random_below(state, sizeof(kLiterals) / sizeof(kLiterals[0]))]);
+        break;
+    }
+    case 1: {
+        size_t slot = random_below(state, VARIABLE_COUNT);
+        if (values) {
+            char literal[64];
+            snprintf(literal, sizeof(literal), "(%.17g)", values[slot]);
+            append(out, literal);
+        } else {
+            append(out, kVariableNames[slot]);
+        }
+        break;
+    }
+    case 2:
+        append(out, "-");
+        generate(state, depth + 1, values, out);
+        break;
+    case 3:
+    case 4:
+    case 5:
+    case 6: {
+        char op[3] = {kBinaryOperators[random_below(state, sizeof(kBinaryOperators) - 1U)], '\0', '\0'};
+        if (kind == 6U) {
+            strcpy(op, kLogicalOperators[random_below(state, sizeof(kLogicalOperators) / sizeof(kLogicalOperators[0]))]);
+        }
+        int parenthesise = random_below(state, 4U) != 0U;
+        if (parenthesise) {
+            append(out, "(");
+        }
+        generate(state, depth + 1, values, out);
+        append(out, op);
+        generate(state, depth + 1, values, out);
+        if (parenthesise) {
+            append(out, ")");
+        }
+        break;
+    }
+    case 7:
+        if (random_below(state, 4U) == 0U) {
+            append(out, "!");
+            generate(state, depth + 1, values, out);
+            break;
+        }
+        append(out, "if(");
+        generate(state, depth + 1, values, out);
+        append(out, ",");
+        generate(state, depth + 1, values, out);
+        append(out, ",");
+        generate(state, depth + 1, values, out);
+        append(out, ")");
+        break;
+    case 8: {
+        /* Aggregates over scalars and array literals, long enough to use every partial sum. */
+        size_t arguments = 1U + random_below(state, 6U);
+        append(out, kAggregates[random_below(state, sizeof(kAggregates) / sizeof(kAggregates[0]))]);
+        append(out, "(");
+        for (size_t i = 0; i < arguments; ++i) {
+            if (i > 0U) {
+                append(out, ",");
+            }
+            if (random_below(state, 3U) != 0U) {
+                generate(state, depth + 1, values, out);
+                continue;
+            }
+            size_t elements = 1U + random_below(state, 5U);
+            append(out, "[");
+            for (size_t k = 0; k < elements; ++k) {
+                if (k > 0U) {
+                    append(out, ",");
+                }
+                generate(state, depth + 2, values, out);
+            }
+            append(out, "]");
+        }
+        append(out, ")");
+        break;
+    }
+    default: {
+        size_t index = random_below(state, sizeof(kFunctions) / sizeof(kFunctions[0]));
+        append(out, kFunctions[index].name);
+        append(out, "(");
+        for (unsigned i = 0; i < kFunctions[index].arity; ++i) {
+            if (i > 0U) {
+                append(out, ",");
+            }
+            generate(state, depth + 1, values, out);
+        }
+        append(out, ")");
+        break;
+    }
+    }
+}
+
+static int render(uint64_t seed, const double *values, char *buffer)
+{
+    uint64_t state = seed;
+    builder b = {buffer, 0U, 0};
+    buffer[0] = '\0';
+    generate(&state, 0, values, &b);
+    return b.overflow ? -1 : 0;
+}
+
+static int same_result(double lhs, double rhs)
+{
+    return (isnan(lhs) && isnan(rhs)) || memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Maps the program's symbol slots onto the harness's x, y, z columns. */
+static void bind_slots(const math_expr_program *program, size_t *slot_variable)
+{
+    for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+        size_t slot = 0U;
+        if (math_expr_program_find_symbol(program, kVariableNames[v], &slot) == 0) {
+            slot_variable[slot] = v;
+        }
+    }
+}
+
+typedef struct case_data {
+    const char *source;
+    size_t rows;
+    double *inputs[VARIABLE_COUNT];
+    double *reference;
+    int *reference_ok;
+    double *results;
+    math_expr_thread_pool *pool;
+    math_expr_async_queue *async;
+    math_expr_context *context;
+} case_data;
+
+static int fail(const case_data *data, size_t row, const char *what)
+{
+    fprintf(stdout, "differential: %s\n  expression: %s\n", what, data->source);
+    if (row < data->rows) {
+        fprintf(stdout, "  row %zu: x=%.17g y=%.17g z=%.17g reference=%.17g (%s)\n",
+                row,
+                data->inputs[0][row],
+                data->inputs[1][row],
+                data->inputs[2][row],
+                data->reference[row],
+                data->reference_ok[row] ? "ok" : "error");
+    }
+    return -1;
+}
+
+static int check_scalar_paths(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    math_expr_tape tape;
+    math_expr_tape_init(&tape);
+    int status = 0;
+
+    for (size_t row = 0; row < data->rows && status == 0; ++row) {
+        double variables[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            variables[slot] = data->inputs[slot_variable[slot]][row];
+        }
+
+        double value = 0.0;
+        int ok = math_expr_program_evaluate(program, variables, &value) == 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(value, data->reference[row]))) {
+            status = fail(data, row, "math_expr_program_evaluate differs from the reference");
+            break;
+        }
+
+        double gradient[VARIABLE_COUNT];
+        ok = math_expr_program_gradient_forward(program, variables, &value, gradient) == 0;
+        if (ok && data->reference_ok[row] && !same_result(value, data->reference[row])) {
+            status = fail(data, row, "forward-mode value differs from the reference");
+            break;
+        }
+
+        ok = math_expr_program_gradient_reverse(program, &tape, variables, &value, gradient) == 0;
+        if (ok && data->reference_ok[row] && !same_result(value, data->reference[row])) {
+            status = fail(data, row, "reverse-mode value differs from the reference");
+            break;
+        }
+
+        math_expr_interval points[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            points[slot].lo = variables[slot];
+            points[slot].hi = variables[slot];
+        }
+
+        math_expr_interval bounds;
+        if (data->reference_ok[row] && !isnan(data->reference[row]) &&
+            math_expr_program_evaluate_interval(program, points, &bounds) == 0 &&
+            !(bounds.lo <= data->reference[row] && data->reference[row] <= bounds.hi)) {
+            status = fail(data, row, "interval enclosure excludes the reference value");
+        }
+    }
+
+    math_expr_tape_deinit(&tape);
+    return status;
+}
+
+/* Parallel evaluation with every top-level + / - operand split off, whatever its cost. */
+static int check_parallel_path(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    math_expr_parallel_plan plan;
+    math_expr_parallel_plan_init(&plan);
+    if (math_expr_parallel_plan_build(&plan, program, 1U) != 0) {
+        return fail(data, data->rows, "parallel plan could not be built");
+    }
+
+    int status = 0;
+    for (size_t row = 0; row < data->rows && status == 0; ++row) {
+        double variables[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            variables[slot] = data->inputs[slot_variable[slot]][row];
+        }
+
+        double value = 0.0;
+        int ok = math_expr_program_evaluate_parallel(program, &plan, variables, data->pool, &value) == 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(value, data->reference[row]))) {
+            status = fail(data, row, "parallel evaluation differs from the reference");
+        }
+    }
+
+    math_expr_parallel_plan_deinit(&plan);
+    return status;
+}
+
+/*
+ * Hot program profiled with the first slot pinned to its row-0 value, so
+ * the specialised version assumes it. Every row then runs once as is,
+ * mostly missing the guard, and once with the first slot pinned again.
+ */
+static int check_hot_path(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    const size_t threshold = 4U;
+    math_expr_hot_program *hot = math_expr_hot_program_create(program, threshold);
+    if (!hot) {
+        return fail(data, data->rows, "hot program could not be created");
+    }
+
+    int status = 0;
+    for (size_t pass = 0; pass < 3U && status == 0; ++pass) {
+        for (size_t row = 0; row < data->rows && status == 0; ++row) {
+            double variables[VARIABLE_COUNT];
+            for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+                variables[slot] = data->inputs[slot_variable[slot]][row];
+            }
+            if (pass != 1U && program->symbol_count > 0U) {
+                variables[0] = data->inputs[slot_variable[0]][0];
+            }
+            if (pass == 0U && row == threshold && math_expr_hot_program_optimize(hot) != 0) {
+                status = fail(data, row, "hot program could not be optimised");
+                break;
+            }
+
+            double expected = 0.0;
+            double value = 0.0;
+            int expected_ok = math_expr_program_evaluate(program, variables, &expected) == 0;
+            int ok = math_expr_hot_program_evaluate(hot, variables, &value) == 0;
+            if (ok != expected_ok || (ok && !same_result(value, expected))) {
+                status = fail(data, row, "hot program differs from math_expr_program_evaluate");
+            } else if (pass == 1U && (ok != data->reference_ok[row] || (ok && !same_result(value, data->reference[row])))) {
+                status = fail(data, row, "hot program differs from the reference");
+            }
+        }
+    }
+
+    math_expr_hot_program_destroy(hot);
+    return status;
+}
+
+static void note_async_batch(const math_expr_async_completion *completion)
+{
+    atomic_store((atomic_int *)completion->user_data, completion->status == 0 ? 1 : 2);
+}
+
+/*
+ * One job per row through the completion queue, plus the whole batch as a
+ * single job reporting through a callback. The queue holds fewer jobs than
+ * there are rows, so a full queue is drained before submitting again.
+ */
+static int check_async_path(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    const double **row_columns = (const double **)malloc(data->rows * VARIABLE_COUNT * sizeof(*row_columns));
+    double *row_results = (double *)malloc((data->rows + 1U) * sizeof(double));
+    int *row_ok = (int *)calloc(data->rows, sizeof(int));
+    const double *columns[VARIABLE_COUNT];
+    if (!row_columns || !row_results || !row_ok) {
+        free(row_columns);
+        free(row_results);
+        free(row_ok);
+        return fail(data, data->rows, "out of memory for the asynchronous check");
+    }
+    for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+        columns[slot] = data->inputs[slot_variable[slot]];
+    }
+
+    atomic_int batch_done;
+    atomic_init(&batch_done, 0);
+    math_expr_async_job batch_job;
+    memset(&batch_job, 0, sizeof(batch_job));
+    batch_job.program = program;
+    batch_job.columns = columns;
+    batch_job.rows = data->rows;
+    batch_job.results = data->results;
+    batch_job.callback = note_async_batch;
+    batch_job.user_data = &batch_done;
+    int batch_submitted = math_expr_async_submit(data->async, &batch_job, NULL) == 0;
+    int status = batch_submitted ? 0 : fail(data, data->rows, "asynchronous batch job was rejected");
+
+    size_t submitted = 0U;
+    size_t completed = 0U;
+    while (status == 0 && completed < data->rows) {
+        while (submitted < data->rows) {
+            const double **row_column = row_columns + submitted * VARIABLE_COUNT;
+            for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+                row_column[slot] = &data->inputs[slot_variable[slot]][submitted];
+            }
+            math_expr_async_job job;
+            memset(&job, 0, sizeof(job));
+            job.program = program;
+            job.columns = row_column;
+            job.rows = 1U;
+            job.results = &row_results[submitted];
+            job.user_data = &row_ok[submitted];
+            if (math_expr_async_submit(data->async, &job, NULL) != 0) {
+                break;
+            }
+            ++submitted;
+        }
+
+        struct pollfd ready = {math_expr_async_completion_fd(data->async), POLLIN, 0};
+        if (poll(&ready, 1U, 10000) <= 0) {
+            status = fail(data, completed, "asynchronous completions did not arrive");
+            break;
+        }
+
+        math_expr_async_completion completions[16];
+        size_t count = math_expr_async_poll(data->async, completions, 16U);
+        for (size_t i = 0; i < count; ++i) {
+            *(int *)completions[i].user_data = completions[i].status == 0 ? 1 : -1;
+        }
+        completed += count;
+    }
+
+    for (size_t row = 0; status == 0 && row < data->rows; ++row) {
+        int ok = row_ok[row] > 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(row_results[row], data->reference[row]))) {
+            status = fail(data, row, "asynchronous row differs from the reference");
+        }
+    }
+
+    /* Without variables the source itself goes through math_expr_evaluate. */
+    if (status == 0 && program->symbol_count == 0U) {
+        atomic_int expression_done;
+        atomic_init(&expression_done, 0);
+        math_expr_async_job job;
+        memset(&job, 0, sizeof(job));
+        job.expression = data->source;
+        job.results = &row_results[data->rows];
+        job.callback = note_async_batch;
+        job.user_data = &expression_done;
+        if (math_expr_async_submit(data->async, &job, NULL) != 0) {
+            status = fail(data, 0U, "asynchronous expression job was rejected");
+        }
+        while (status == 0 && atomic_load(&expression_done) == 0) {
+            sched_yield();
+        }
+        int ok = atomic_load(&expression_done) == 1;
+        if (status == 0 && (ok != data->reference_ok[0] ||
+                            (ok && !same_result(row_results[data->rows], data->reference[0])))) {
+            status = fail(data, 0U, "asynchronous expression differs from the reference");
+        }
+    }
+
+    /* The batch job reads columns and writes data->results, so wait for it either way. */
+    while (batch_submitted && atomic_load(&batch_done) == 0) {
+        sched_yield();
+    }
+    if (status == 0) {
+        int all_ok = 1;
+        for (size_t row = 0; row < data->rows; ++row) {
+            all_ok &= data->reference_ok[row];
+        }
+        int ok = atomic_load(&batch_done) == 1;
+        if (ok != all_ok) {
+            status = fail(data, data->rows, "asynchronous batch status differs from the reference");
+        }
+        for (size_t row = 0; ok && status == 0 && row < data->rows; ++row) {
+            if (!same_result(data->results[row], data->reference[row])) {
+                status = fail(data, row, "asynchronous batch result differs from the reference");
+            }
+        }
+    }
+
+    free(row_columns);
+    free(row_results);
+    free(row_ok);
+    return status;
+}
+
+static const double kTwo = 2.0;
+static const double kThree = 3.0;
+
+static int scale(void *user_data, const double *args, double *out_result)
+{
+    *out_result = args[0] * *(const double *)user_data;
+    return 0;
+}
+
+static int has_opcode(const math_expr_program *program, math_expr_opcode opcode)
+{
+    for (size_t pc = 0; pc < program->code_size; ++pc) {
+        if (program->code[pc].opcode == opcode) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * The first rows with x, y and z registered as context constants under
+ * upper-case names, evaluated as is and wrapped in a registered function
+ * that doubles its argument, both through the context and compiled against
+ * it. Doubling is exact, so the wrapped results must be twice the reference.
+ */
+static int check_context_path(const case_data *data)
+{
+    static const char *const kContextNames[VARIABLE_COUNT] = {"X", "Y", "Z"};
+    char wrapped[MAX_EXPRESSION + 16U];
+    snprintf(wrapped, sizeof(wrapped), "Scale(%s)", data->source);
+
+    for (size_t row = 0; row < data->rows && row < CONTEXT_ROWS; ++row) {
+        for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+            if (math_expr_context_set_constant(data->context, kContextNames[v], data->inputs[v][row]) != 0) {
+                return fail(data, row, "context rejected a constant");
+            }
+        }
+
+        double value = 0.0;
+        int ok = math_expr_evaluate_with_context(data->context, data->source, &value) == 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(value, data->reference[row]))) {
+            return fail(data, row, "math_expr_evaluate_with_context differs from the reference");
+        }
+
+        double doubled = data->reference[row] * 2.0;
+        ok = math_expr_evaluate_with_context(data->context, wrapped, &value) == 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(value, doubled))) {
+            return fail(data, row, "registered function differs from twice the reference");
+        }
+
+        math_expr_program program;
+        math_expr_program_init(&program);
+        if (math_expr_compile_with_context(data->context, wrapped, &program) != 0) {
+            return fail(data, row, "math_expr_compile_with_context rejected a compiled expression");
+        }
+        int status = 0;
+        if (program.symbol_count != 0U || !has_opcode(&program, MATH_EXPR_OP_CALL_EXTERNAL)) {
+            status = fail(data, row, "context names were not bound at compile time");
+        } else {
+            ok = math_expr_program_evaluate(&program, NULL, &value) == 0;
+            if (ok != data->reference_ok[row] || (ok && !same_result(value, doubled))) {
+                status = fail(data, row, "program compiled with a context differs from twice the reference");
+            }
+        }
+        math_expr_program_deinit(&program);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+static int check_batch_paths(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    const double *columns[VARIABLE_COUNT];
+    int all_ok = 1;
+    for (size_t row = 0; row < data->rows; ++row) {
+        all_ok &= data->reference_ok[row];
+    }
+    for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+        columns[slot] = data->inputs[slot_variable[slot]];
+    }
+
+    int ok = math_expr_program_evaluate_batch(program, columns, data->rows, data->results) == 0;
+    if (ok != all_ok) {
+        return fail(data, data->rows, "batch error status differs from the reference");
+    }
+    for (size_t row = 0; ok && row < data->rows; ++row) {
+        if (!same_result(data->results[row], data->reference[row])) {
+            return fail(data, row, "batch result differs from the reference");
+        }
+    }
+
+    /*
+     * Skipped blocks are not evaluated, so a failing row there goes unreported;
+     * an evaluated row must still fail exactly when the reference fails.
+     */
+    math_expr_interval everything = {-INFINITY, INFINITY};
+    ok = math_expr_program_evaluate_batch_pruned(program, columns, data->rows, 16U, everything, data->results, NULL) == 0;
+    if (!ok && all_ok) {
+        return fail(data, data->rows, "pruned batch failed although every reference row succeeds");
+    }
+    for (size_t row = 0; ok && row < data->rows; ++row) {
+        if (data->reference_ok[row] && !same_result(data->results[row], data->reference[row])) {
+            return fail(data, row, "pruned batch result differs from the reference");
+        }
+    }
+
+    math_expr_interval positive = {0.0, INFINITY};
+    ok = math_expr_program_evaluate_batch_pruned(program, columns, data->rows, 16U, positive, data->results, NULL) == 0;
+    if (!ok && all_ok) {
+        return fail(data, data->rows, "pruned batch failed although every reference row succeeds");
+    }
+    for (size_t row = 0; ok && row < data->rows; ++row) {
+        double expected = data->reference[row];
+        if (data->reference_ok[row] && expected >= 0.0 && !same_result(data->results[row], expected)) {
+            return fail(data, row, "pruned batch dropped a row inside the kept range");
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Round trip through an image, then again after switching the loaded program
+ * to single precision, which the second image must carry.
+ */
+static int check_image(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    size_t size = math_expr_program_image_size(program);
+    uint64_t *image = (uint64_t *)malloc(3U * size + sizeof(uint64_t));
+    if (!image) {
+        return fail(data, data->rows, "out of memory");
+    }
+
+    math_expr_program loaded;
+    math_expr_program loaded_f32;
+    math_expr_program copied;
+    math_expr_program_init(&loaded);
+    math_expr_program_init(&loaded_f32);
+    math_expr_program_init(&copied);
+    uint64_t *image_f32 = image + size / sizeof(uint64_t);
+    /* One byte off alignment, so the loader has to copy the sections. */
+    unsigned char *unaligned = (unsigned char *)(image_f32 + size / sizeof(uint64_t)) + 1;
+    int status = 0;
+
+    if (math_expr_program_write_image(program, image, size, NULL) != 0 ||
+        math_expr_program_load_image(image, size, &loaded) != 0) {
+        status = fail(data, data->rows, "image round trip failed");
+    } else if (math_expr_program_set_precision(&loaded, MATH_EXPR_PRECISION_F32) != 0 ||
+               math_expr_program_write_image(&loaded, image_f32, size, NULL) != 0 ||
+               math_expr_program_set_precision(&loaded, MATH_EXPR_PRECISION_F64) != 0 ||
+               math_expr_program_load_image(image_f32, size, &loaded_f32) != 0 ||
+               loaded_f32.precision != MATH_EXPR_PRECISION_F32) {
+        status = fail(data, data->rows, "single-precision image round trip failed");
+    } else {
+        memcpy(unaligned, image, size);
+        if (math_expr_program_load_image(unaligned, size, &copied) != 0 ||
+            (copied.flags & MATH_EXPR_PROGRAM_BORROWED) != 0) {
+            status = fail(data, data->rows, "unaligned image did not load into a copy");
+        }
+    }
+
+    for (size_t row = 0; status == 0 && row < data->rows; ++row) {
+        double variables[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            variables[slot] = data->inputs[slot_variable[slot]][row];
+        }
+
+        double value = 0.0;
+        int ok = math_expr_program_evaluate(&loaded, variables, &value) == 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(value, data->reference[row]))) {
+            status = fail(data, row, "program loaded from an image differs from the reference");
+            break;
+        }
+        ok = math_expr_program_evaluate(&copied, variables, &value) == 0;
+        if (ok != data->reference_ok[row] || (ok && !same_result(value, data->reference[row]))) {
+            status = fail(data, row, "program copied from an unaligned image differs from the reference");
+            break;
+        }
+
+        float variables_f32[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            variables_f32[slot] = (float)variables[slot];
+        }
+        float expected = 0.0f;
+        double loaded_value = 0.0;
+        int expected_ok = math_expr_program_evaluate_f32(program, variables_f32, &expected) == 0;
+        ok = math_expr_program_evaluate(&loaded_f32, variables, &loaded_value) == 0;
+        if (ok != expected_ok || (ok && !same_result(loaded_value, (double)expected))) {
+            status = fail(data, row, "single-precision program loaded from an image differs from evaluate_f32");
+        }
+    }
+
+    math_expr_program_deinit(&copied);
+    math_expr_program_deinit(&loaded_f32);
+    math_expr_program_deinit(&loaded);
+    free(image);
+    return status;
+}
+
+/*
+ * load_or_compile must recompile from source instead of loading an image of
+ * another version, with a corrupted section or header, or cut short. The
+ * image holds "x + 100" and the source is "x * 2", so the value at x = 1
+ * tells which one was used.
+ */
+static int check_image_fallback(void)
+{
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (math_expr_compile("x + 100", &program) != 0) {
+        fprintf(stdout, "differential: could not compile the image program\n");
+        return -1;
+    }
+
+    size_t size = math_expr_program_image_size(&program);
+    uint64_t *image = (uint64_t *)malloc(2U * size);
+    uint64_t *corrupt = image ? image + size / sizeof(uint64_t) : NULL;
+    int status = image && math_expr_program_write_image(&program, image, size, NULL) == 0 ? 0 : -1;
+    math_expr_program_deinit(&program);
+    if (status != 0) {
+        fprintf(stdout, "differential: could not write the image\n");
+        free(image);
+        return -1;
+    }
+
+    /* The constant pool holds the single constant, so the first instruction follows it. */
+    static const struct {
+        const char *what;
+        size_t offset;
+        unsigned char flip;
+        size_t cut;
+    } kCases[] = {
+        {"an intact image", 0U, 0x00U, 0U},
+        {"another version", 4U, 0x01U, 0U},
+        {"a corrupted constant", MATH_EXPR_IMAGE_HEADER_SIZE, 0x40U, 0U},
+        {"a corrupted instruction", MATH_EXPR_IMAGE_HEADER_SIZE + sizeof(double), 0x01U, 0U},
+        {"a corrupted max_stack", 28U, 0x80U, 0U},
+        {"a truncated image", 0U, 0x00U, 8U},
+    };
+    for (size_t i = 0; i < sizeof(kCases) / sizeof(kCases[0]) && status == 0; ++i) {
+        memcpy(corrupt, image, size);
+        ((unsigned char *)corrupt)[kCases[i].offset] ^= kCases[i].flip;
+
+        double x = 1.0;
+        double value = 0.0;
+        double expected = i == 0U ? 101.0 : 2.0;
+        math_expr_program_init(&program);
+        if (math_expr_program_load_or_compile(corrupt, size - kCases[i].cut, "x * 2", &program) != 0 ||
+            math_expr_program_evaluate(&program, &x, &value) != 0 || value != expected) {
+            fprintf(stdout, "differential: load_or_compile with %s gave %.17g, expected %.17g\n", kCases[i].what,
+                    value, expected);
+            status = -1;
+        }
+        math_expr_program_deinit(&program);
+    }
+
+    math_expr_program_init(&program);
+    if (status == 0 && math_expr_program_load_or_compile(NULL, 0U, NULL, &program) == 0) {
+        fprintf(stdout, "differential: load_or_compile without image or source succeeded\n");
+        status = -1;
+    }
+    math_expr_program_deinit(&program);
+
+    free(image);
+    return status;
+}
+
+/*
+ * Many programs turning hot at once share one background optimiser. Every
+ * other program is destroyed straight after crossing the threshold, usually
+ * while its optimisation is still queued, and the rest must agree afterwards.
+ */
+static int check_hot_many(void)
+{
+    enum { HOT_PROGRAMS = 256 };
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (math_expr_compile("x * x + 3", &program) != 0) {
+        fprintf(stdout, "differential: could not compile the hot program\n");
+        return -1;
+    }
+
+    math_expr_hot_program *hot[HOT_PROGRAMS] = {NULL};
+    int status = 0;
+    for (size_t i = 0; i < HOT_PROGRAMS && status == 0; ++i) {
+        double x = (double)i;
+        double value = 0.0;
+        hot[i] = math_expr_hot_program_create(&program, 1U);
+        if (!hot[i] || math_expr_hot_program_evaluate(hot[i], &x, &value) != 0) {
+            fprintf(stdout, "differential: hot program %zu could not be evaluated\n", i);
+            status = -1;
+        } else if (i % 2U == 1U) {
+            math_expr_hot_program_destroy(hot[i]);
+            hot[i] = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < HOT_PROGRAMS && status == 0; i += 2U) {
+        double x = (double)i;
+        double value = 0.0;
+        if (math_expr_hot_program_optimize(hot[i]) != 0 || math_expr_hot_program_evaluate(hot[i], &x, &value) != 0 ||
+            value != x * x + 3.0) {
+            fprintf(stdout, "differential: hot program %zu gave %.17g after optimising\n", i, value);
+            status = -1;
+        }
+    }
+
+    for (size_t i = 0; i < HOT_PROGRAMS; ++i) {
+        if (hot[i]) {
+            math_expr_hot_program_destroy(hot[i]);
+        }
+    }
+    math_expr_program_deinit(&program);
+    return status;
+}
+
+static int check_f32_paths(const case_data *data, const math_expr_program *program, const size_t *slot_variable)
+{
+    float *inputs = (float *)malloc(VARIABLE_COUNT * data->rows * sizeof(*inputs));
+    float *results = (float *)malloc(data->rows * sizeof(*results));
+    if (!inputs || !results) {
+        free(inputs);
+        free(results);
+        return fail(data, data->rows, "out of memory");
+    }
+
+    const float *columns[VARIABLE_COUNT];
+    for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+        float *column = inputs + slot * data->rows;
+        for (size_t row = 0; row < data->rows; ++row) {
+            column[row] = (float)data->inputs[slot_variable[slot]][row];
+        }
+        columns[slot] = column;
+    }
+
+    int status = 0;
+    int batch_ok = math_expr_program_evaluate_batch_f32(program, columns, data->rows, results) == 0;
+    int all_ok = 1;
+
+    for (size_t row = 0; row < data->rows; ++row) {
+        float variables[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program->symbol_count; ++slot) {
+            variables[slot] = columns[slot][row];
+        }
+
+        float value = 0.0f;
+        int ok = math_expr_program_evaluate_f32(program, variables, &value) == 0;
+        all_ok &= ok;
+        if (batch_ok && ok && !((isnan(value) && isnan(results[row])) || memcmp(&value, &results[row], sizeof(value)) == 0)) {
+            status = fail(data, row, "single-precision batch differs from single-precision scalar");
+            break;
+        }
+    }
+
+    if (status == 0 && batch_ok != all_ok) {
+        status = fail(data, data->rows, "single-precision batch error status differs from scalar");
+    }
+
+    free(inputs);
+    free(results);
+    return status;
+}
+
+/*
+ * Table-mode sin and cos against the library over two turns: within the
+ * documented error everywhere, and identical on the quarter-degree points.
+ */
+static int check_trig_table(void)
+{
+    static const char *const kSources[] = {"sin(x)", "cos(x)"};
+    int status = 0;
+
+    for (size_t f = 0; f < 2U && status == 0; ++f) {
+        math_expr_program program;
+        math_expr_program_init(&program);
+        if (math_expr_compile(kSources[f], &program) != 0) {
+            fprintf(stdout, "differential: could not compile %s\n", kSources[f]);
+            return -1;
+        }
+
+        for (long step = -72000; step <= 72000 && status == 0; ++step) {
+            double angle = (double)step * 0.01 + (step % 25 == 0 ? 0.0 : 0.001);
+            double table = 0.0;
+            double libm = 0.0;
+            math_expr_trig_set_mode(MATH_EXPR_TRIG_TABLE);
+            math_expr_program_evaluate(&program, &angle, &table);
+            math_expr_trig_set_mode(MATH_EXPR_TRIG_LIBM);
+            math_expr_program_evaluate(&program, &angle, &libm);
+
+            if (step % 25 == 0 ? table != libm : !(fabs(table - libm) <= MATH_EXPR_TRIG_TABLE_MAX_ERROR)) {
+                fprintf(stdout, "differential: table %s at %.17g is %.17g, library %.17g\n",
+                        kSources[f], angle, table, libm);
+                status = -1;
+            }
+        }
+        math_expr_program_deinit(&program);
+    }
+
+    return status;
+}
+
+/*
+ * Angles the degree reduction must get exactly right in both modes, through
+ * the interpreter and a compiled program: the correctly rounded values at
+ * multiples of 30 and 45 degrees, exact zeros and an infinite tangent at
+ * multiples of 90, and a huge argument reduced without losing accuracy.
+ */
+static int check_trig_exact(void)
+{
+    static const struct {
+        const char *expression;
+        const char *function;
+        double angle;
+        double expected;
+    } kCases[] = {
+        {"sin(30)", "sin(x)", 30.0, 0.5},
+        {"cos(60)", "cos(x)", 60.0, 0.5},
+        {"sin(150)", "sin(x)", 150.0, 0.5},
+        {"tan(45)", "tan(x)", 45.0, 1.0},
+        {"tan(135)", "tan(x)", 135.0, -1.0},
+        {"cos(90)", "cos(x)", 90.0, 0.0},
+        {"sin(-180)", "sin(x)", -180.0, 0.0},
+        {"tan(90)", "tan(x)", 90.0, INFINITY},
+    };
+    static const math_expr_trig_mode kModes[] = {MATH_EXPR_TRIG_LIBM, MATH_EXPR_TRIG_TABLE};
+    static const char *const kModeNames[] = {"library", "table"};
+    int status = 0;
+
+    for (size_t m = 0; m < 2U && status == 0; ++m) {
+        math_expr_trig_set_mode(kModes[m]);
+        for (size_t i = 0; i < sizeof(kCases) / sizeof(kCases[0]) && status == 0; ++i) {
+            double interpreted = NAN;
+            double compiled = NAN;
+            math_expr_program program;
+            math_expr_program_init(&program);
+            if (math_expr_evaluate(kCases[i].expression, &interpreted) != 0 ||
+                math_expr_compile(kCases[i].function, &program) != 0 ||
+                math_expr_program_evaluate(&program, &kCases[i].angle, &compiled) != 0 ||
+                interpreted != kCases[i].expected || compiled != kCases[i].expected) {
+                fprintf(stdout, "differential: %s %s is %.17g interpreted and %.17g compiled, expected %.17g\n",
+                        kModeNames[m], kCases[i].expression, interpreted, compiled, kCases[i].expected);
+                status = -1;
+            }
+            math_expr_program_deinit(&program);
+        }
+
+        /* 1e22 is 280 more than a multiple of 360. */
+        double huge = NAN;
+        double reduced = NAN;
+        if (status == 0 && (math_expr_evaluate("sin(1e22)", &huge) != 0 ||
+                            math_expr_evaluate("sin(280)", &reduced) != 0 || huge != reduced)) {
+            fprintf(stdout, "differential: %s sin(1e22) is %.17g, sin(280) %.17g\n", kModeNames[m], huge, reduced);
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+static int expect_value(math_expr_context *context, const char *expression, double expected)
+{
+    double value = 0.0;
+    if (math_expr_evaluate_with_context(context, expression, &value) != 0 || !same_result(value, expected)) {
+        fprintf(stdout, "differential: context evaluation of %s gave %.17g, expected %.17g\n", expression, value, expected);
+        return -1;
+    }
+    return 0;
+}
+
+static int expect_failure(math_expr_context *context, const char *expression)
+{
+    double value = 0.0;
+    if (math_expr_evaluate_with_context(context, expression, &value) == 0) {
+        fprintf(stdout, "differential: context evaluation of %s should fail\n", expression);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Registration, replacement and removal of constants and functions, names
+ * matched regardless of case, and names a context must refuse.
+ */
+static int check_context_registry(void)
+{
+    static const char *const kRefused[] = {"pi", "E", "sin", "SQRT", "sum", "Max", "if", "", "1x", "a-b", "a b"};
+    math_expr_context *context = math_expr_context_create();
+    if (!context) {
+        fprintf(stdout, "differential: could not create a context\n");
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < sizeof(kRefused) / sizeof(kRefused[0]) && status == 0; ++i) {
+        if (math_expr_context_set_constant(context, kRefused[i], 1.0) == 0 ||
+            math_expr_context_set_function(context, kRefused[i], 1U, scale, (void *)&kTwo) == 0) {
+            fprintf(stdout, "differential: context accepted the name '%s'\n", kRefused[i]);
+            status = -1;
+        }
+    }
+    if (status == 0 && math_expr_context_set_constant(context, NULL, 1.0) == 0) {
+        fprintf(stdout, "differential: context accepted a NULL name\n");
+        status = -1;
+    }
+
+    if (status == 0 && (math_expr_context_set_constant(context, "Rate", 0.25) != 0 ||
+                        math_expr_context_set_function(context, "scale", 1U, scale, (void *)&kTwo) != 0)) {
+        fprintf(stdout, "differential: context rejected a valid name\n");
+        status = -1;
+    }
+    if (status == 0) {
+        status = expect_value(context, "rate * 4", 1.0);
+    }
+    if (status == 0) {
+        status = expect_value(context, "RATE + SCALE(3)", 6.25);
+    }
+    if (status == 0) {
+        status = expect_failure(context, "scale(1, 2)");
+    }
+
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (status == 0 && math_expr_compile_with_context(context, "sCaLe(x) + rate", &program) != 0) {
+        fprintf(stdout, "differential: could not compile against a context\n");
+        status = -1;
+    }
+    double x = 5.0;
+    double value = 0.0;
+    if (status == 0 && (program.symbol_count != 1U || !has_opcode(&program, MATH_EXPR_OP_CALL_EXTERNAL))) {
+        fprintf(stdout, "differential: context function was not compiled to CALL_EXTERNAL\n");
+        status = -1;
+    }
+
+    /* Replacing entries changes later evaluations but not programs already compiled. */
+    if (status == 0 && (math_expr_context_set_function(context, "Scale", 1U, scale, (void *)&kThree) != 0 ||
+                        math_expr_context_set_constant(context, "rate", 0.5) != 0)) {
+        fprintf(stdout, "differential: context could not replace an entry\n");
+        status = -1;
+    }
+    if (status == 0) {
+        status = expect_value(context, "scale(3) + rate", 9.5);
+    }
+    if (status == 0 && (math_expr_program_evaluate(&program, &x, &value) != 0 || value != 10.25)) {
+        fprintf(stdout, "differential: compiled program followed a context update\n");
+        status = -1;
+    }
+    math_expr_program_deinit(&program);
+
+    if (status == 0 && (math_expr_context_remove(context, "SCALE") != 0 || math_expr_context_remove(context, "scale") == 0)) {
+        fprintf(stdout, "differential: context removal misreported\n");
+        status = -1;
+    }
+    if (status == 0) {
+        status = expect_failure(context, "scale(3)");
+    }
+    if (status == 0) {
+        status = expect_value(context, "rate", 0.5);
+    }
+    if (status == 0 && math_expr_context_remove(context, "Rate") != 0) {
+        fprintf(stdout, "differential: context could not remove a constant\n");
+        status = -1;
+    }
+    if (status == 0) {
+        status = expect_failure(context, "rate");
+    }
+
+    math_expr_context_destroy(context);
+    return status;
+}
+
+/*
+ * Arrays registered in a context flatten into sum, avg, min and max next to
+ * literals, bracketed lists and scalar constants, in both the evaluator and
+ * the compiler, and only inside those aggregates.
+ */
+static int check_context_arrays(void)
+{
+    static const double kValues[] = {3.0, -1.0, 4.0, 1.5};
+    static const double kSingle[] = {10.0};
+    static const double kReplaced[] = {1.0, 2.0};
+    math_expr_context *context = math_expr_context_create();
+    if (!context) {
+        fprintf(stdout, "differential: could not create a context\n");
+        return -1;
+    }
+
+    int status = 0;
+    if (math_expr_context_set_array(context, "Values", kValues, 4U) != 0 ||
+        math_expr_context_set_array(context, "single", kSingle, 1U) != 0 ||
+        math_expr_context_set_constant(context, "half", 0.5) != 0) {
+        fprintf(stdout, "differential: context rejected an array\n");
+        status = -1;
+    }
+    if (status == 0 && (math_expr_context_set_array(context, "empty", kValues, 0U) == 0 ||
+                        math_expr_context_set_array(context, "missing", NULL, 2U) == 0 ||
+                        math_expr_context_set_array(context, "max", kValues, 4U) == 0)) {
+        fprintf(stdout, "differential: context accepted an invalid array\n");
+        status = -1;
+    }
+
+    static const struct {
+        const char *expression;
+        double expected;
+    } kCases[] = {
+        {"sum(values)", 7.5},
+        {"avg(VALUES)", 1.875},
+        {"min(values)", -1.0},
+        {"max(values)", 4.0},
+        {"sum(values, 2, half)", 10.0},
+        {"avg(values, half)", 1.6},
+        {"max(values, single)", 10.0},
+        {"min(single, values, -7)", -7.0},
+        {"min(values, single)", -1.0},
+        {"sum([values, 1], single) * half", 9.25},
+        {"max(single)", 10.0},
+        {"sum(values) + half", 8.0},
+    };
+    for (size_t i = 0; i < sizeof(kCases) / sizeof(kCases[0]) && status == 0; ++i) {
+        status = expect_value(context, kCases[i].expression, kCases[i].expected);
+    }
+    if (status == 0) {
+        status = expect_failure(context, "values + 1");
+    }
+    if (status == 0) {
+        status = expect_failure(context, "sin(values)");
+    }
+
+    /* The compiler inlines the values, so only x remains a symbol and later updates are not seen. */
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (status == 0 && math_expr_compile_with_context(context, "sum(values, x) + max(single, values) * half", &program) != 0) {
+        fprintf(stdout, "differential: could not compile an array aggregate\n");
+        status = -1;
+    }
+    if (status == 0 && program.symbol_count != 1U) {
+        fprintf(stdout, "differential: array aggregate left %zu symbols\n", program.symbol_count);
+        status = -1;
+    }
+    if (status == 0 && math_expr_context_set_array(context, "values", kReplaced, 2U) != 0) {
+        fprintf(stdout, "differential: context could not replace an array\n");
+        status = -1;
+    }
+    double x = 2.0;
+    double value = 0.0;
+    if (status == 0 && (math_expr_program_evaluate(&program, &x, &value) != 0 || value != 14.5)) {
+        fprintf(stdout, "differential: compiled array aggregate gave %.17g, expected 14.5\n", value);
+        status = -1;
+    }
+    math_expr_program_deinit(&program);
+    if (status == 0) {
+        status = expect_value(context, "sum(values) + min(values, single)", 4.0);
+    }
+    if (status == 0 && (math_expr_context_remove(context, "values") != 0 || expect_failure(context, "sum(values)") != 0)) {
+        fprintf(stdout, "differential: removed array is still visible\n");
+        status = -1;
+    }
+
+    math_expr_context_destroy(context);
+    return status;
+}
+
+#define CONTEXT_UPDATES 2000U
+#define CONTEXT_READS 20000U
+
+typedef struct context_race {
+    math_expr_context *context;
+    atomic_int failed;
+} context_race;
+
+/*
+ * Task 0 raises level from 1 to CONTEXT_UPDATES, replacing the function and
+ * adding and removing an unrelated constant along the way; the other tasks
+ * read meanwhile. Each evaluation sees one registry, so it must return
+ * 3 * level for a single level, and a thread never sees level go down.
+ */
+static void context_race_task(void *context, size_t index)
+{
+    context_race *race = (context_race *)context;
+
+    if (index == 0U) {
+        for (unsigned int level = 1U; level <= CONTEXT_UPDATES; ++level) {
+            int status = math_expr_context_set_constant(race->context, "level", (double)level);
+            status |= math_expr_context_set_function(race->context, "scale", 1U, scale, (void *)&kTwo);
+            if (level % 16U == 0U) {
+                status |= math_expr_context_set_constant(race->context, "scratch", (double)level);
+                status |= math_expr_context_remove(race->context, "scratch");
+            }
+            if (status != 0) {
+                atomic_store(&race->failed, 1);
+                return;
+            }
+        }
+        return;
+    }
+
+    double last = 1.0;
+    for (unsigned int read = 0; read < CONTEXT_READS && !atomic_load(&race->failed); ++read) {
+        double value = 0.0;
+        if (math_expr_evaluate_with_context(race->context, "scale(LEVEL) + level", &value) != 0 ||
+            value != floor(value / 3.0) * 3.0 || value / 3.0 < last || value / 3.0 > (double)CONTEXT_UPDATES) {
+            atomic_store(&race->failed, 1);
+            return;
+        }
+        last = value / 3.0;
+
+        if (read % 64U == 0U) {
+            math_expr_program program;
+            math_expr_program_init(&program);
+            if (math_expr_compile_with_context(race->context, "scale(level)", &program) != 0 ||
+                math_expr_program_evaluate(&program, NULL, &value) != 0 || value / 2.0 < last) {
+                atomic_store(&race->failed, 1);
+            }
+            math_expr_program_deinit(&program);
+        }
+    }
+}
+
+static int check_context_threads(math_expr_thread_pool *pool)
+{
+    context_race race;
+    race.context = math_expr_context_create();
+    atomic_init(&race.failed, 0);
+    if (!race.context || math_expr_context_set_constant(race.context, "level", 1.0) != 0 ||
+        math_expr_context_set_function(race.context, "scale", 1U, scale, (void *)&kTwo) != 0) {
+        fprintf(stdout, "differential: could not set up a shared context\n");
+        math_expr_context_destroy(race.context);
+        return -1;
+    }
+
+    int status = math_expr_thread_pool_run(pool, math_expr_thread_pool_size(pool) + 1U, context_race_task, &race);
+    if (status != 0 || atomic_load(&race.failed)) {
+        fprintf(stdout, "differential: context reads during updates saw an inconsistent registry\n");
+        status = -1;
+    }
+
+    math_expr_context_destroy(race.context);
+    return status;
+}
+
+static int run_async_expression(math_expr_async_queue *queue, const char *expression, double *out_result)
+{
+    math_expr_async_job job;
+    memset(&job, 0, sizeof(job));
+    job.expression = expression;
+    job.results = out_result;
+
+    math_expr_async_completion completion;
+    if (math_expr_async_submit(queue, &job, NULL) != 0) {
+        return -1;
+    }
+    while (math_expr_async_poll(queue, &completion, 1U) == 0U) {
+        sched_yield();
+    }
+    return completion.status;
+}
+
+/*
+ * Expression jobs on a queue with a byte limit: a long sum fails under a
+ * budget far below its peak, then succeeds without one and again with a
+ * budget of exactly the peak it has on the submitting thread.
+ */
+static int check_async_budget(void)
+{
+    char expression[2 * 256];
+    for (size_t i = 0; i < 256U; ++i) {
+        expression[2 * i] = '1';
+        expression[2 * i + 1] = i + 1U < 256U ? '+' : '\0';
+    }
+
+    size_t peak = 0U;
+    math_expr_async_queue *queue = math_expr_async_create(1U, 4U);
+    if (!queue || math_expr_memory_peak(expression, &peak) != 0) {
+        fprintf(stdout, "differential: could not set up the asynchronous budget check\n");
+        math_expr_async_destroy(queue);
+        return -1;
+    }
+
+    int status = 0;
+    double value = 0.0;
+    math_expr_async_set_memory_limit(queue, 64U);
+    if (run_async_expression(queue, expression, &value) == 0) {
+        fprintf(stdout, "differential: asynchronous job ran beyond its queue's byte limit\n");
+        status = -1;
+    }
+
+    math_expr_async_set_memory_limit(queue, 0U);
+    if (status == 0 && (run_async_expression(queue, expression, &value) != 0 || value != 256.0)) {
+        fprintf(stdout, "differential: asynchronous job failed without a byte limit\n");
+        status = -1;
+    }
+
+    math_expr_async_set_memory_limit(queue, peak);
+    if (status == 0 && (run_async_expression(queue, expression, &value) != 0 || value != 256.0)) {
+        fprintf(stdout, "differential: asynchronous job failed within a byte limit of its peak\n");
+        status = -1;
+    }
+
+    math_expr_async_destroy(queue);
+    return status;
+}
+
+static int run_case(uint64_t seed, case_data *data, char *source, char *substituted)
+{
+    if (render(seed, NULL, source) != 0) {
+        return 0;
+    }
+    data->source = source;
+
+    for (size_t row = 0; row < data->rows; ++row) {
+        double values[VARIABLE_COUNT];
+        for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+            values[v] = data->inputs[v][row];
+        }
+        if (render(seed, values, substituted) != 0) {
+            return 0;
+        }
+        data->reference_ok[row] = math_expr_evaluate(substituted, &data->reference[row]) == 0;
+    }
+
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (math_expr_compile(source, &program) != 0) {
+        math_expr_program_deinit(&program);
+        for (size_t row = 0; row < data->rows; ++row) {
+            if (data->reference_ok[row]) {
+                return fail(data, row, "compiler rejected an expression the reference accepts");
+            }
+        }
+        return 0;
+    }
+
+    size_t slot_variable[VARIABLE_COUNT] = {0U, 0U, 0U};
+    bind_slots(&program, slot_variable);
+
+    int status = check_scalar_paths(data, &program, slot_variable);
+    if (status == 0) {
+        status = check_parallel_path(data, &program, slot_variable);
+    }
+    if (status == 0) {
+        status = check_hot_path(data, &program, slot_variable);
+    }
+    if (status == 0) {
+        status = check_async_path(data, &program, slot_variable);
+    }
+    if (status == 0) {
+        status = check_context_path(data);
+    }
+    if (status == 0) {
+        status = check_batch_paths(data, &program, slot_variable);
+    }
+    if (status == 0) {
+        status = check_image(data, &program, slot_variable);
+    }
+    if (status == 0) {
+        status = check_f32_paths(data, &program, slot_variable);
+    }
+
+    math_expr_program_deinit(&program);
+    return status;
+}
+
+typedef struct throughput {
+    double reference;
+    double program;
+    double batch;
+} throughput;
+
+/*
+ * Evaluations per second over the same expressions and rows. Expressions that
+ * fail on any row are skipped so every path does the same amount of work.
+ */
+static int measure(const harness_options *options, case_data *data, char *source, char *substituted, throughput *out)
+{
+    double reference_time = 0.0;
+    double program_time = 0.0;
+    double batch_time = 0.0;
+    size_t evaluations = 0U;
+    volatile double sink = 0.0;
+
+    for (size_t n = 0; n < options->expressions; ++n) {
+        uint64_t seed = options->seed + n * 0x9E3779B97F4A7C15ULL;
+        if (render(seed, NULL, source) != 0) {
+            continue;
+        }
+
+        math_expr_program program;
+        math_expr_program_init(&program);
+        if (math_expr_compile(source, &program) != 0) {
+            math_expr_program_deinit(&program);
+            continue;
+        }
+
+        size_t slot_variable[VARIABLE_COUNT] = {0U, 0U, 0U};
+        bind_slots(&program, slot_variable);
+        const double *columns[VARIABLE_COUNT];
+        for (size_t slot = 0; slot < program.symbol_count; ++slot) {
+            columns[slot] = data->inputs[slot_variable[slot]];
+        }
+
+        if (math_expr_program_evaluate_batch(&program, columns, data->rows, data->results) != 0) {
+            math_expr_program_deinit(&program);
+            continue;
+        }
+
+        for (size_t row = 0; row < data->rows; ++row) {
+            double values[VARIABLE_COUNT];
+            for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+                values[v] = data->inputs[v][row];
+            }
+            render(seed, values, substituted + row * MAX_EXPRESSION);
+        }
+
+        double start = now_seconds();
+        for (size_t row = 0; row < data->rows; ++row) {
+            double value = 0.0;
+            math_expr_evaluate(substituted + row * MAX_EXPRESSION, &value);
+            sink += value;
+        }
+        reference_time += now_seconds() - start;
+
+        start = now_seconds();
+        for (size_t row = 0; row < data->rows; ++row) {
+            double variables[VARIABLE_COUNT];
+            double value = 0.0;
+            for (size_t slot = 0; slot < program.symbol_count; ++slot) {
+                variables[slot] = columns[slot][row];
+            }
+            math_expr_program_evaluate(&program, variables, &value);
+            sink += value;
+        }
+        program_time += now_seconds() - start;
+
+        start = now_seconds();
+        math_expr_program_evaluate_batch(&program, columns, data->rows, data->results);
+        batch_time += now_seconds() - start;
+
+        evaluations += data->rows;
+        math_expr_program_deinit(&program);
+    }
+
+    (void)sink;
+
+    if (evaluations == 0U || reference_time <= 0.0 || program_time <= 0.0 || batch_time <= 0.0) {
+        fprintf(stdout, "differential: nothing to measure\n");
+        return -1;
+    }
+
+    out->reference = (double)evaluations / reference_time;
+    out->program = (double)evaluations / program_time;
+    out->batch = (double)evaluations / batch_time;
+    return 0;
+}
+
+static int write_report(const char *path, const throughput *rates)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("differential: fopen");
+        return -1;
+    }
+
+    fprintf(file, "path,evaluations_per_second\n");
+    fprintf(file, "reference,%.0f\n", rates->reference);
+    fprintf(file, "program,%.0f\n", rates->program);
+    fprintf(file, "batch,%.0f\n", rates->batch);
+    fclose(file);
+    return 0;
+}
+
+static int parse_options(int argc, char **argv, harness_options *options)
+{
+    options->seed = 0x2545F4914F6CDD1DULL;
+    options->expressions = 2000U;
+    options->rows = 64U;
+    options->perf = 0;
+    options->min_program_speedup = 5.0;
+    options->min_batch_speedup = 0.75;
+    options->report_path = NULL;
+    options->trig_mode = MATH_EXPR_TRIG_LIBM;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--seed=", 7) == 0) {
+            options->seed = strtoull(arg + 7, NULL, 10) * 2U + 1U;
+        } else if (strncmp(arg, "--expressions=", 14) == 0) {
+            options->expressions = (size_t)strtoull(arg + 14, NULL, 10);
+        } else if (strncmp(arg, "--rows=", 7) == 0) {
+            options->rows = (size_t)strtoull(arg + 7, NULL, 10);
+        } else if (strcmp(arg, "--perf") == 0) {
+            options->perf = 1;
+        } else if (strncmp(arg, "--min-program-speedup=", 22) == 0) {
+            options->min_program_speedup = strtod(arg + 22, NULL);
+        } else if (strncmp(arg, "--min-batch-speedup=", 20) == 0) {
+            options->min_batch_speedup = strtod(arg + 20, NULL);
+        } else if (strncmp(arg, "--report=", 9) == 0) {
+            options->report_path = arg + 9;
+        } else if (strcmp(arg, "--trig=libm") == 0 || strcmp(arg, "--trig=table") == 0) {
+            options->trig_mode = strcmp(arg + 7, "table") == 0 ? MATH_EXPR_TRIG_TABLE : MATH_EXPR_TRIG_LIBM;
+        } else {
+            fprintf(stdout, "differential: unknown option '%s'\n", arg);
+            return -1;
+        }
+    }
+
+    if (options->rows == 0U) {
+        fprintf(stdout, "differential: --rows must be positive\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    harness_options options;
+    if (parse_options(argc, argv, &options) != 0) {
+        return 2;
+    }
+
+    case_data data;
+    memset(&data, 0, sizeof(data));
+    data.rows = options.rows;
+    for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+        data.inputs[v] = (double *)malloc(options.rows * sizeof(double));
+    }
+    data.reference = (double *)malloc(options.rows * sizeof(double));
+    data.reference_ok = (int *)malloc(options.rows * sizeof(int));
+    data.results = (double *)malloc(options.rows * sizeof(double));
+    data.pool = math_expr_thread_pool_create(3U);
+    data.async = math_expr_async_create(3U, 16U);
+    data.context = math_expr_context_create();
+    char *source = (char *)malloc(MAX_EXPRESSION);
+    char *substituted = (char *)malloc(options.rows * MAX_EXPRESSION);
+
+    if (!data.inputs[0] || !data.inputs[1] || !data.inputs[2] || !data.reference || !data.reference_ok ||
+        !data.results || !data.pool || !data.async || !data.context || !source || !substituted ||
+        math_expr_context_set_function(data.context, "scale", 1U, scale, (void *)&kTwo) != 0) {
+        perror("differential: malloc");
+        return 2;
+    }
+
+    uint64_t state = options.seed;
+    for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+        for (size_t row = 0; row < options.rows; ++row) {
+            /* Mostly values in [-10, 10], with exact zeros to exercise division errors. */
+            data.inputs[v][row] = random_below(&state, 16U) == 0U
+                ? 0.0
+                : ((double)(next_random(&state) >> 11) / 9007199254740992.0) * 20.0 - 10.0;
+        }
+    }
+
+    /* Rejected rows are reported on stderr by every engine; only harness findings matter here. */
+    if (!freopen("/dev/null", "w", stderr)) {
+        perror("differential: freopen");
+    }
+
+    int status = check_trig_exact();
+    if (status == 0 && options.trig_mode == MATH_EXPR_TRIG_TABLE) {
+        status = check_trig_table();
+    }
+    if (status == 0) {
+        status = check_image_fallback();
+    }
+    if (status == 0) {
+        status = check_hot_many();
+    }
+    if (status == 0) {
+        status = check_context_registry();
+    }
+    if (status == 0) {
+        status = check_context_arrays();
+    }
+    if (status == 0) {
+        status = check_context_threads(data.pool);
+    }
+    if (status == 0) {
+        status = check_async_budget();
+    }
+    math_expr_trig_set_mode(options.trig_mode);
+
+    for (size_t n = 0; n < options.expressions && status == 0; ++n) {
+        status = run_case(options.seed + n * 0x9E3779B97F4A7C15ULL, &data, source, substituted);
+    }
+
+    if (status == 0) {
+        fprintf(stdout, "differential: %zu expressions x %zu rows agree\n", options.expressions, options.rows);
+    }
+
+    if (status == 0 && (options.perf || options.report_path)) {
+        throughput rates;
+        status = measure(&options, &data, source, substituted, &rates);
+        if (status == 0) {
+            fprintf(stdout, "differential: evaluations/sec reference %.0f, program %.0f, batch %.0f\n",
+                    rates.reference,
+                    rates.program,
+                    rates.batch);
+
+            if (options.report_path) {
+                status = write_report(options.report_path, &rates);
+            }
+
+            if (options.perf && rates.program < rates.reference * options.min_program_speedup) {
+                fprintf(stdout, "differential: program throughput below %.2fx the reference\n",
+                        options.min_program_speedup);
+                status = -1;
+            }
+            if (options.perf && rates.batch < rates.program * options.min_batch_speedup) {
+                fprintf(stdout, "differential: batch throughput below %.2fx the scalar program\n",
+                        options.min_batch_speedup);
+                status = -1;
+            }
+        }
+    }
+
+    for (size_t v = 0; v < VARIABLE_COUNT; ++v) {
+        free(data.inputs[v]);
+    }
+    free(data.reference);
+    free(data.reference_ok);
+    free(data.results);
+    math_expr_thread_pool_destroy(data.pool);
+    math_expr_async_destroy(data.async);
+    math_expr_context_destroy(data.context);
+    free(source);
+    free(substituted);
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/*
+ * Fuzz target for the lexer, the reference evaluator and the compiler.
+ * Each input is also evaluated under a memory budget of exactly its measured
+ * peak, which must succeed, and one byte less, which must fail cleanly.
+ *
+ * Built with MATH_EXPR_LIBFUZZER this is a plain libFuzzer target. Otherwise
+ * a small driver replays the files named on the command line, or generates
+ * -runs=N random inputs from -seed=S, so the target also runs under ctest.
+ */
+
+#include "math_expr/compiler.h"
+#include "math_expr/evaluator.h"
+#include "math_expr/lexer.h"
+#include "math_expr/memory.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INPUT 4096U
+
+static int same_result(double lhs, double rhs)
+{
+    return (isnan(lhs) && isnan(rhs)) || memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size > MAX_INPUT) {
+        return 0;
+    }
+
+    char expression[MAX_INPUT + 1U];
+    memcpy(expression, data, size);
+    expression[size] = '\0';
+
+    math_expr_token_array tokens;
+    math_expr_token_array_init(&tokens);
+    math_expr_lex_expression(expression, &tokens);
+    math_expr_token_array_deinit(&tokens);
+
+    math_expr_packed_token_array packed;
+    math_expr_packed_token_array_init(&packed);
+    math_expr_lex_packed(expression, &packed, MATH_EXPR_LEX_SKIP_SPACE);
+    math_expr_packed_token_array_deinit(&packed);
+
+    double reference = 0.0;
+    int reference_status = math_expr_evaluate(expression, &reference);
+
+    size_t peak = 0U;
+    if ((math_expr_memory_peak(expression, &peak) == 0) != (reference_status == 0)) {
+        fprintf(stdout, "fuzz: measuring memory changed the result for \"%s\"\n", expression);
+        abort();
+    }
+
+    double budgeted = 0.0;
+    math_expr_memory_usage usage;
+    math_expr_memory_set_limit(peak);
+    int budgeted_status = math_expr_evaluate(expression, &budgeted);
+    math_expr_memory_last_usage(&usage);
+    if ((budgeted_status == 0) != (reference_status == 0) || usage.limit_exceeded || usage.peak_bytes != peak ||
+        (budgeted_status == 0 && !same_result(budgeted, reference))) {
+        fprintf(stdout, "fuzz: \"%s\" differs under a budget of its own peak\n", expression);
+        abort();
+    }
+    if (peak > 1U) { /* A limit of 0 would mean none. */
+        math_expr_memory_set_limit(peak - 1U);
+        budgeted_status = math_expr_evaluate(expression, &budgeted);
+        math_expr_memory_last_usage(&usage);
+        if (budgeted_status == 0 || !usage.limit_exceeded || usage.peak_bytes >= peak) {
+            fprintf(stdout, "fuzz: \"%s\" fits a budget below its peak\n", expression);
+            abort();
+        }
+    }
+    math_expr_memory_set_limit(0U);
+
+    math_expr_program program;
+    math_expr_program_init(&program);
+    if (math_expr_compile(expression, &program) == 0) {
+        if (math_expr_program_validate(&program) != 0) {
+            fprintf(stdout, "fuzz: compiler produced an invalid program for \"%s\"\n", expression);
+            abort();
+        }
+
+        if (program.symbol_count == 0U) {
+            double compiled = 0.0;
+            int compiled_status = math_expr_program_evaluate(&program, NULL, &compiled);
+            if ((compiled_status == 0) != (reference_status == 0) ||
+                (compiled_status == 0 && !same_result(compiled, reference))) {
+                fprintf(stdout, "fuzz: compiled result differs from the evaluator for \"%s\"\n", expression);
+                abort();
+            }
+        }
+    } else if (reference_status == 0) {
+        fprintf(stdout, "fuzz: evaluator accepted \"%s\" but the compiler rejected it\n", expression);
+        abort();
+    }
+    math_expr_program_deinit(&program);
+
+    return 0;
+}
+
+#ifndef MATH_EXPR_LIBFUZZER
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* Biased towards expression characters so random inputs reach the parser. */
+static size_t generate_input(uint64_t *state, uint8_t *buffer, size_t capacity)
+{
+    static const char kAlphabet[] = "0123456789.+-*/%^(),[]<>=!&|  eEpisncoqrtabxlgmdfuv";
+    static const char *const kWords[] = {"sin(", "cos(", "tan(", "sqrt(", "abs(", "ln(", "log(",
+                                         "exp(", "pow(", "max(", "min(", "sum(", "avg(", "pi", "e", "x", "1e308"};
+    size_t length = (size_t)(next_random(state) % 64U);
+    size_t size = 0U;
+
+    while (size < length && size < capacity) {
+        uint64_t choice = next_random(state) % 10U;
+        if (choice == 0U) {
+            buffer[size++] = (uint8_t)next_random(state);
+        } else if (choice <= 2U) {
+            const char *word = kWords[next_random(state) % (sizeof(kWords) / sizeof(kWords[0]))];
+            for (; *word && size < capacity; ++word) {
+                buffer[size++] = (uint8_t)*word;
+            }
+        } else {
+            buffer[size++] = (uint8_t)kAlphabet[next_random(state) % (sizeof(kAlphabet) - 1U)];
+        }
+    }
+
+    return size;
+}
+
+static int run_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("fuzz: fopen");
+        return -1;
+    }
+
+    uint8_t buffer[MAX_INPUT];
+    size_t size = fread(buffer, 1U, sizeof(buffer), file);
+    fclose(file);
+
+    LLVMFuzzerTestOneInput(buffer, size);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long runs = 100000UL;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    int files = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = strtoul(argv[i] + 6, NULL, 10);
+        } else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            seed = strtoull(argv[i] + 6, NULL, 10) * 2U + 1U;
+        } else if (argv[i][0] != '-') {
+            if (run_file(argv[i]) != 0) {
+                return 1;
+            }
+            ++files;
+        }
+    }
+
+    if (files > 0) {
+        return 0;
+    }
+
+    /* The library reports every rejected input on stderr. */
+    if (!freopen("/dev/null", "w", stderr)) {
+        perror("fuzz: freopen");
+    }
+
+    uint64_t state = seed;
+    uint8_t buffer[MAX_INPUT];
+    for (unsigned long run = 0; run < runs; ++run) {
+        size_t size = generate_input(&state, buffer, sizeof(buffer));
+        LLVMFuzzerTestOneInput(buffer, size);
+    }
+
+    fprintf(stdout, "fuzz: %lu inputs, no failures\n", runs);
+    return 0;
+}
+
+#endif // MATH_EXPR_LIBFUZZER
@@ -0,0 +1,343 @@
+/*
+ * Scenario tests for math_expr_graph.
+ *
+ * Each scenario builds a small graph and checks the values it reads back and
+ * how many formulas every recalculation evaluated: changing an input
+ * re-evaluates exactly its downstream formulas, redefining a formula moves
+ * its edges, cycles are reported and the graph recovers once they are
+ * broken, and formulas that reference undefined names fail until the name is
+ * given a value. The scenarios run on the calling thread and on a pool, and
+ * a wide graph must give bit-identical values both ways.
+ *
+ * Usage: math_expr_graph [--threads=N]
+ */
+
+#include "math_expr/graph.h"
+#include "math_expr/thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDE_FORMULAS 256U
+#define NAME_BUFFER 32U
+
+static int expect_value(const math_expr_graph *graph, const char *name, double expected)
+{
+    double value = 0.0;
+    if (math_expr_graph_get_value(graph, name, &value) != 0 || value != expected) {
+        fprintf(stdout, "graph: '%s' is %.17g, expected %.17g\n", name, value, expected);
+        return -1;
+    }
+    return 0;
+}
+
+static int expect_unavailable(const math_expr_graph *graph, const char *name)
+{
+    double value = 0.0;
+    if (math_expr_graph_get_value(graph, name, &value) == 0) {
+        fprintf(stdout, "graph: '%s' should have no value but is %.17g\n", name, value);
+        return -1;
+    }
+    return 0;
+}
+
+/* Recalculate and check the status and the number of formulas evaluated. */
+static int expect_recalculate(math_expr_graph *graph, math_expr_thread_pool *pool, int ok, size_t evaluated)
+{
+    int status = math_expr_graph_recalculate(graph, pool);
+    if ((status == 0) != ok || math_expr_graph_last_evaluated(graph) != evaluated) {
+        fprintf(stdout, "graph: recalculation %s after %zu formulas, expected to %s after %zu\n",
+                status == 0 ? "succeeded" : "failed", math_expr_graph_last_evaluated(graph),
+                ok ? "succeed" : "fail", evaluated);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * x -> a -> b -> d and y -> c -> d: an input change dirties only what lies
+ * downstream of it, and untouched nodes stay readable in the meantime.
+ */
+static int check_propagation(math_expr_graph *graph, math_expr_thread_pool *pool)
+{
+    int status = math_expr_graph_set_value(graph, "x", 1.0) != 0 || math_expr_graph_set_value(graph, "y", 2.0) != 0 ||
+                         math_expr_graph_set_formula(graph, "a", "x + 1") != 0 ||
+                         math_expr_graph_set_formula(graph, "b", "a * 10") != 0 ||
+                         math_expr_graph_set_formula(graph, "c", "y + 100") != 0 ||
+                         math_expr_graph_set_formula(graph, "d", "b + c") != 0
+                     ? -1
+                     : 0;
+    if (status != 0) {
+        fprintf(stdout, "graph: could not build the propagation graph\n");
+        return -1;
+    }
+
+    if (expect_unavailable(graph, "d") != 0 || expect_recalculate(graph, pool, 1, 4U) != 0 ||
+        expect_value(graph, "d", 122.0) != 0 || expect_recalculate(graph, pool, 1, 0U) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_value(graph, "x", 3.0) != 0 || expect_unavailable(graph, "a") != 0 ||
+        expect_unavailable(graph, "d") != 0 || expect_value(graph, "c", 102.0) != 0 ||
+        expect_recalculate(graph, pool, 1, 3U) != 0 || expect_value(graph, "b", 40.0) != 0 ||
+        expect_value(graph, "d", 142.0) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_value(graph, "y", 5.0) != 0 || expect_value(graph, "b", 40.0) != 0 ||
+        expect_recalculate(graph, pool, 1, 2U) != 0 || expect_value(graph, "c", 105.0) != 0 ||
+        expect_value(graph, "d", 145.0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Replacing a formula drops its old inputs but keeps those it still uses,
+ * and replacing it with a value removes them altogether; a formula that
+ * fails to compile changes nothing.
+ */
+static int check_redefinition(math_expr_graph *graph, math_expr_thread_pool *pool)
+{
+    if (math_expr_graph_set_value(graph, "x", 1.0) != 0 || math_expr_graph_set_value(graph, "y", 2.0) != 0 ||
+        math_expr_graph_set_formula(graph, "a", "x + 1") != 0 || math_expr_graph_set_formula(graph, "b", "a + 1") != 0 ||
+        expect_recalculate(graph, pool, 1, 2U) != 0 || expect_value(graph, "b", 3.0) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_formula(graph, "a", "y * 3") != 0 || expect_recalculate(graph, pool, 1, 2U) != 0 ||
+        expect_value(graph, "a", 6.0) != 0 || expect_value(graph, "b", 7.0) != 0) {
+        return -1;
+    }
+    if (math_expr_graph_set_value(graph, "x", 10.0) != 0 || expect_recalculate(graph, pool, 1, 0U) != 0 ||
+        math_expr_graph_set_value(graph, "y", 1.0) != 0 || expect_recalculate(graph, pool, 1, 2U) != 0 ||
+        expect_value(graph, "b", 4.0) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_formula(graph, "a", "1 +") == 0) {
+        fprintf(stdout, "graph: an invalid formula was accepted\n");
+        return -1;
+    }
+    if (expect_recalculate(graph, pool, 1, 0U) != 0 || expect_value(graph, "a", 3.0) != 0) {
+        return -1;
+    }
+
+    /* An input of both the old and the new formula keeps its edge. */
+    if (math_expr_graph_set_formula(graph, "a", "y + x") != 0 || expect_recalculate(graph, pool, 1, 2U) != 0 ||
+        expect_value(graph, "b", 12.0) != 0 || math_expr_graph_set_value(graph, "y", 2.0) != 0 ||
+        expect_recalculate(graph, pool, 1, 2U) != 0 || expect_value(graph, "b", 13.0) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_value(graph, "a", 7.0) != 0 || expect_recalculate(graph, pool, 1, 1U) != 0 ||
+        expect_value(graph, "b", 8.0) != 0 || math_expr_graph_set_value(graph, "y", 9.0) != 0 ||
+        expect_recalculate(graph, pool, 1, 0U) != 0 || expect_value(graph, "a", 7.0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * A three-node cycle and a formula referencing itself are both reported,
+ * and recalculation succeeds again once each is broken.
+ */
+static int check_cycles(math_expr_graph *graph, math_expr_thread_pool *pool)
+{
+    if (math_expr_graph_set_value(graph, "x", 1.0) != 0 || math_expr_graph_set_formula(graph, "a", "b + 1") != 0 ||
+        math_expr_graph_set_formula(graph, "b", "c + 1") != 0 || math_expr_graph_set_formula(graph, "c", "a + x") != 0 ||
+        expect_recalculate(graph, pool, 0, 0U) != 0 || expect_unavailable(graph, "a") != 0 ||
+        expect_recalculate(graph, pool, 0, 0U) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_formula(graph, "c", "x * 2") != 0 || expect_recalculate(graph, pool, 1, 3U) != 0 ||
+        expect_value(graph, "c", 2.0) != 0 || expect_value(graph, "a", 4.0) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_formula(graph, "s", "s + a") != 0 || expect_recalculate(graph, pool, 0, 0U) != 0 ||
+        expect_value(graph, "a", 4.0) != 0) {
+        return -1;
+    }
+    if (math_expr_graph_set_value(graph, "s", 5.0) != 0 || expect_recalculate(graph, pool, 1, 0U) != 0 ||
+        expect_value(graph, "s", 5.0) != 0 || math_expr_graph_set_value(graph, "x", 2.0) != 0 ||
+        expect_recalculate(graph, pool, 1, 3U) != 0 || expect_value(graph, "a", 6.0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * A formula over a name nothing defines fails, as does everything
+ * downstream of it, while unrelated formulas still evaluate.
+ */
+static int check_undefined(math_expr_graph *graph, math_expr_thread_pool *pool)
+{
+    if (math_expr_graph_set_value(graph, "x", 1.0) != 0 || math_expr_graph_set_formula(graph, "a", "missing * 2") != 0 ||
+        math_expr_graph_set_formula(graph, "b", "a + 1") != 0 || math_expr_graph_set_formula(graph, "c", "x + 1") != 0 ||
+        expect_recalculate(graph, pool, 0, 3U) != 0 || expect_unavailable(graph, "a") != 0 ||
+        expect_unavailable(graph, "b") != 0 || expect_unavailable(graph, "missing") != 0 ||
+        expect_unavailable(graph, "nothing") != 0 || expect_value(graph, "c", 2.0) != 0) {
+        return -1;
+    }
+
+    if (math_expr_graph_set_value(graph, "missing", 4.0) != 0 || expect_recalculate(graph, pool, 1, 2U) != 0 ||
+        expect_value(graph, "a", 8.0) != 0 || expect_value(graph, "b", 9.0) != 0) {
+        return -1;
+    }
+
+    /* A formula that fails at evaluation time behaves the same way. */
+    if (math_expr_graph_set_formula(graph, "a", "1 / (missing - 4)") != 0 ||
+        expect_recalculate(graph, pool, 0, 2U) != 0 || expect_unavailable(graph, "b") != 0 ||
+        math_expr_graph_set_value(graph, "missing", 5.0) != 0 || expect_recalculate(graph, pool, 1, 2U) != 0 ||
+        expect_value(graph, "b", 2.0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* x feeds WIDE_FORMULAS independent formulas on one level, and total sums them. */
+static int build_wide(math_expr_graph *graph)
+{
+    size_t capacity = WIDE_FORMULAS * NAME_BUFFER;
+    char *total = (char *)malloc(capacity);
+    if (!total) {
+        return -1;
+    }
+
+    int status = math_expr_graph_set_value(graph, "x", 0.5);
+    size_t used = 0U;
+    for (size_t i = 0; i < WIDE_FORMULAS && status == 0; ++i) {
+        char name[NAME_BUFFER];
+        char expression[64];
+        snprintf(name, sizeof(name), "f%zu", i);
+        snprintf(expression, sizeof(expression), "sin(x * %zu) + sqrt(x + %zu)", i, i);
+        status = math_expr_graph_set_formula(graph, name, expression);
+        used += (size_t)snprintf(total + used, capacity - used, "%s%s", i == 0U ? "" : " + ", name);
+    }
+    if (status == 0) {
+        status = math_expr_graph_set_formula(graph, "total", total);
+    }
+
+    free(total);
+    return status;
+}
+
+static int compare_wide(const math_expr_graph *serial, const math_expr_graph *pooled)
+{
+    for (size_t i = 0; i <= WIDE_FORMULAS; ++i) {
+        char name[NAME_BUFFER];
+        if (i < WIDE_FORMULAS) {
+            snprintf(name, sizeof(name), "f%zu", i);
+        } else {
+            snprintf(name, sizeof(name), "total");
+        }
+
+        double expected = 0.0;
+        double value = 0.0;
+        if (math_expr_graph_get_value(serial, name, &expected) != 0 ||
+            math_expr_graph_get_value(pooled, name, &value) != 0 || memcmp(&expected, &value, sizeof(value)) != 0) {
+            fprintf(stdout, "graph: pooled '%s' is %.17g, serial %.17g\n", name, value, expected);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int check_wide(math_expr_thread_pool *pool)
+{
+    math_expr_graph *serial = math_expr_graph_create();
+    math_expr_graph *pooled = math_expr_graph_create();
+    int status = serial && pooled && build_wide(serial) == 0 && build_wide(pooled) == 0 ? 0 : -1;
+    if (status != 0) {
+        fprintf(stdout, "graph: could not build the wide graph\n");
+    }
+
+    for (int round = 0; round < 3 && status == 0; ++round) {
+        if (round > 0) {
+            status = math_expr_graph_set_value(serial, "x", 0.25 * round) != 0 ||
+                             math_expr_graph_set_value(pooled, "x", 0.25 * round) != 0
+                         ? -1
+                         : 0;
+        }
+        if (status == 0) {
+            status = expect_recalculate(serial, NULL, 1, WIDE_FORMULAS + 1U);
+        }
+        if (status == 0) {
+            status = expect_recalculate(pooled, pool, 1, WIDE_FORMULAS + 1U);
+        }
+        if (status == 0) {
+            status = compare_wide(serial, pooled);
+        }
+    }
+
+    math_expr_graph_destroy(pooled);
+    math_expr_graph_destroy(serial);
+    return status;
+}
+
+typedef struct scenario {
+    const char *name;
+    int (*run)(math_expr_graph *graph, math_expr_thread_pool *pool);
+} scenario;
+
+static int run_scenarios(math_expr_thread_pool *pool)
+{
+    static const scenario kScenarios[] = {
+        {"propagation", check_propagation},
+        {"redefinition", check_redefinition},
+        {"cycles", check_cycles},
+        {"undefined", check_undefined},
+    };
+
+    for (size_t i = 0; i < sizeof(kScenarios) / sizeof(kScenarios[0]); ++i) {
+        math_expr_graph *graph = math_expr_graph_create();
+        int status = graph ? kScenarios[i].run(graph, pool) : -1;
+        math_expr_graph_destroy(graph);
+        if (status != 0) {
+            fprintf(stdout, "graph: %s scenario failed %s\n", kScenarios[i].name, pool ? "on the pool" : "serially");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t threads = 4U;
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = (size_t)strtoull(argv[i] + 10, NULL, 10);
+        } else {
+            fprintf(stdout, "graph: unknown option '%s'\n", argv[i]);
+            return 2;
+        }
+    }
+
+    /* Cycles and failed formulas are reported on stderr; only the checks matter here. */
+    if (!freopen("/dev/null", "w", stderr)) {
+        perror("graph: freopen");
+    }
+
+    math_expr_thread_pool *pool = math_expr_thread_pool_create(threads);
+    if (!pool) {
+        fprintf(stdout, "graph: could not create a pool of %zu threads\n", threads);
+        return 1;
+    }
+
+    int status = run_scenarios(NULL);
+    if (status == 0) {
+        status = run_scenarios(pool);
+    }
+    if (status == 0) {
+        status = check_wide(pool);
+    }
+    if (status == 0) {
+        fprintf(stdout, "graph: scenarios agree serially and on %zu threads\n", math_expr_thread_pool_size(pool));
+    }
+
+    math_expr_thread_pool_destroy(pool);
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,415 @@
+/*
+ * Model test and benchmark for math_expr_map.
+ *
+ * Random inserts, lookups and removals on integer-key, string-key and
+ * case-insensitive maps are mirrored in a plain array; every lookup and the
+ * size must agree with it, and integer keys that differ only in their high
+ * 32 bits must stay distinct. With --perf, a benchmark then times insert,
+ * lookup and delete of the same integer keys in the map and in the legacy
+ * chained table, and fails if map lookups are less than --min-speedup times
+ * faster.
+ *
+ * Usage: math_expr_hash_map [--seed=S] [--operations=N] [--perf] [--keys=K] [--min-speedup=X]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/hash_map.h"
+
+#include "legacy_hash_table.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MODEL_KEYS 4096U
+#define KEY_BUFFER 32U
+
+typedef struct harness_options {
+    uint64_t seed;
+    size_t operations;
+    int perf;
+    size_t keys;
+    double min_speedup;
+} harness_options;
+
+typedef struct model_entry {
+    int present;
+    uint64_t value;
+} model_entry;
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* String form of model key k; long keys exercise the word loop of the hash. */
+static size_t format_key(char *buffer, size_t k, int shout)
+{
+    int length = k % 3U == 0U ? snprintf(buffer, KEY_BUFFER, "k%zu", k)
+                              : snprintf(buffer, KEY_BUFFER, "variable_name_%zu_Long", k);
+    if (shout) {
+        for (int i = 0; i < length; ++i) {
+            if (buffer[i] >= 'a' && buffer[i] <= 'z') {
+                buffer[i] = (char)(buffer[i] - 'a' + 'A');
+            }
+        }
+    }
+    return (size_t)length;
+}
+
+static math_expr_map_value *model_find(math_expr_map *map, size_t k, int shout)
+{
+    if (map->flags & MATH_EXPR_MAP_INTEGER_KEYS) {
+        /* Spread keys over the whole 64-bit range, including "negative" ones. */
+        return math_expr_map_find_int(map, (uint64_t)k * 0x9E3779B97F4A7C15ULL);
+    }
+
+    char key[KEY_BUFFER];
+    size_t length = format_key(key, k, shout);
+    return math_expr_map_find(map, key, length);
+}
+
+static math_expr_map_value *model_insert(math_expr_map *map, size_t k, int *out_inserted)
+{
+    if (map->flags & MATH_EXPR_MAP_INTEGER_KEYS) {
+        return math_expr_map_insert_int(map, (uint64_t)k * 0x9E3779B97F4A7C15ULL, out_inserted);
+    }
+
+    char key[KEY_BUFFER];
+    size_t length = format_key(key, k, 0);
+    return math_expr_map_insert(map, key, length, out_inserted);
+}
+
+static int model_remove(math_expr_map *map, size_t k, int shout)
+{
+    if (map->flags & MATH_EXPR_MAP_INTEGER_KEYS) {
+        return math_expr_map_remove_int(map, (uint64_t)k * 0x9E3779B97F4A7C15ULL);
+    }
+
+    char key[KEY_BUFFER];
+    size_t length = format_key(key, k, shout);
+    return math_expr_map_remove(map, key, length);
+}
+
+static int run_model(const harness_options *options, unsigned int flags, const char *label)
+{
+    model_entry *model = (model_entry *)calloc(MODEL_KEYS, sizeof(*model));
+    if (!model) {
+        perror("hash_map: calloc");
+        return -1;
+    }
+
+    math_expr_map map;
+    math_expr_map_init(&map, flags);
+    int shout_allowed = (flags & MATH_EXPR_MAP_IGNORE_CASE) != 0U;
+    uint64_t state = options->seed;
+    size_t live = 0U;
+    int status = 0;
+
+    for (size_t n = 0; n < options->operations && status == 0; ++n) {
+        uint64_t r = next_random(&state);
+        /* A narrow key range early on keeps the table dense; it widens later. */
+        size_t range = n < options->operations / 2U ? 256U : MODEL_KEYS;
+        size_t k = (size_t)((r >> 8) % range);
+        int shout = shout_allowed && ((r >> 4) & 1U);
+
+        switch (r % 8U) {
+        case 0:
+        case 1:
+        case 2: {
+            int inserted = 0;
+            math_expr_map_value *value = model_insert(&map, k, &inserted);
+            if (!value || inserted == model[k].present || (!inserted && value->integer != model[k].value)) {
+                status = -1;
+                break;
+            }
+            value->integer = r;
+            model[k].value = r;
+            if (inserted) {
+                model[k].present = 1;
+                ++live;
+            }
+            break;
+        }
+        case 3:
+        case 4: {
+            int removed = model_remove(&map, k, shout) == 0;
+            if (removed != model[k].present) {
+                status = -1;
+                break;
+            }
+            if (removed) {
+                model[k].present = 0;
+                --live;
+            }
+            break;
+        }
+        case 5:
+            if (r % 4096U == 5U) {
+                math_expr_map_clear(&map);
+                memset(model, 0, MODEL_KEYS * sizeof(*model));
+                live = 0U;
+            } else if (r % 1024U == 13U && math_expr_map_reserve(&map, MODEL_KEYS) != 0) {
+                status = -1;
+            }
+            break;
+        default: {
+            const math_expr_map_value *value = model_find(&map, k, shout);
+            if ((value != NULL) != model[k].present || (value && value->integer != model[k].value)) {
+                status = -1;
+            }
+            break;
+        }
+        }
+
+        if (status == 0 && math_expr_map_size(&map) != live) {
+            status = -1;
+        }
+        if (status != 0) {
+            fprintf(stdout, "hash_map: %s map disagrees with the model at operation %zu (key %zu)\n", label, n, k);
+        }
+    }
+
+    for (size_t k = 0; k < MODEL_KEYS && status == 0; ++k) {
+        const math_expr_map_value *value = model_find(&map, k, 0);
+        if ((value != NULL) != model[k].present) {
+            fprintf(stdout, "hash_map: %s map disagrees with the model on key %zu\n", label, k);
+            status = -1;
+        }
+    }
+
+    math_expr_map_deinit(&map);
+    free(model);
+    return status;
+}
+
+/* Integer keys that differ only above bit 31 must stay distinct on every target. */
+static int check_wide_integer_keys(void)
+{
+    static const uint64_t kKeys[] = {
+        1U, 1U + (1ULL << 32), 1U + (1ULL << 63), UINT64_MAX, UINT64_MAX - (1ULL << 32), 0U, 1ULL << 32,
+    };
+    size_t count = sizeof(kKeys) / sizeof(kKeys[0]);
+    math_expr_map map;
+    math_expr_map_init(&map, MATH_EXPR_MAP_INTEGER_KEYS);
+    int status = 0;
+
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        int inserted = 0;
+        math_expr_map_value *value = math_expr_map_insert_int(&map, kKeys[i], &inserted);
+        if (!value || !inserted) {
+            status = -1;
+            break;
+        }
+        value->index = i;
+    }
+    for (size_t i = 0; i < count && status == 0; ++i) {
+        const math_expr_map_value *value = math_expr_map_find_int(&map, kKeys[i]);
+        if (!value || value->index != i) {
+            status = -1;
+        }
+    }
+    if (status == 0 && (math_expr_map_remove_int(&map, kKeys[1]) != 0 || !math_expr_map_find_int(&map, kKeys[0]) ||
+                        math_expr_map_find_int(&map, kKeys[1]) || math_expr_map_size(&map) != count - 1U)) {
+        status = -1;
+    }
+    if (status != 0) {
+        fprintf(stdout, "hash_map: integer keys differing above bit 31 collide\n");
+    }
+
+    math_expr_map_deinit(&map);
+    return status;
+}
+
+typedef struct timings {
+    double insert;
+    double lookup;
+    double remove;
+} timings;
+
+static int bench_map(const int *keys, size_t count, timings *out, uint64_t *checksum)
+{
+    math_expr_map map;
+    math_expr_map_init(&map, MATH_EXPR_MAP_INTEGER_KEYS);
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        math_expr_map_value *value = math_expr_map_insert_int(&map, (uint64_t)keys[i], NULL);
+        if (!value) {
+            math_expr_map_deinit(&map);
+            return -1;
+        }
+        value->index = i;
+    }
+    double inserted = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        const math_expr_map_value *value = math_expr_map_find_int(&map, (uint64_t)keys[count - 1U - i]);
+        *checksum += value ? value->index : 1U;
+    }
+    double found = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        *checksum += (uint64_t)math_expr_map_remove_int(&map, (uint64_t)keys[i]);
+    }
+    double removed = now_seconds();
+
+    out->insert = inserted - start;
+    out->lookup = found - inserted;
+    out->remove = removed - found;
+    math_expr_map_deinit(&map);
+    return 0;
+}
+
+static int bench_legacy(const int *keys, size_t count, timings *out, uint64_t *checksum)
+{
+    HashTable *table = createHashTable();
+    if (!table) {
+        return -1;
+    }
+
+    char value[] = "0";
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        if (table->insert(table, keys[i], value) != INSERT_SUCCESS) {
+            freeHashTable(table);
+            return -1;
+        }
+    }
+    double inserted = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        const Node *node = table->search(table, keys[count - 1U - i]);
+        *checksum += node ? (uint64_t)node->value[0] : 1U;
+    }
+    double found = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        *checksum += (uint64_t)table->delete(table, keys[i]);
+    }
+    double removed = now_seconds();
+
+    out->insert = inserted - start;
+    out->lookup = found - inserted;
+    out->remove = removed - found;
+    freeHashTable(table);
+    return 0;
+}
+
+static int run_benchmark(const harness_options *options)
+{
+    int *keys = (int *)malloc(options->keys * sizeof(*keys));
+    if (!keys) {
+        perror("hash_map: malloc");
+        return -1;
+    }
+
+    /* Distinct non-negative keys in random order; the legacy hash misbehaves on negative ones. */
+    uint64_t state = options->seed;
+    for (size_t i = 0; i < options->keys; ++i) {
+        keys[i] = (int)i;
+    }
+    for (size_t i = options->keys; i > 1U; --i) {
+        size_t j = (size_t)(next_random(&state) % i);
+        int tmp = keys[i - 1U];
+        keys[i - 1U] = keys[j];
+        keys[j] = tmp;
+    }
+
+    timings map_time;
+    timings legacy_time;
+    uint64_t checksum = 0U;
+    int status = bench_map(keys, options->keys, &map_time, &checksum);
+    if (status == 0) {
+        status = bench_legacy(keys, options->keys, &legacy_time, &checksum);
+    }
+    free(keys);
+    if (status != 0) {
+        fprintf(stdout, "hash_map: benchmark insert failed\n");
+        return -1;
+    }
+
+    double ns = 1e9 / (double)options->keys;
+    fprintf(stdout, "hash_map: %zu keys, ns/op     insert  lookup  delete\n", options->keys);
+    fprintf(stdout, "hash_map:   math_expr_map  %7.1f %7.1f %7.1f\n",
+            map_time.insert * ns, map_time.lookup * ns, map_time.remove * ns);
+    fprintf(stdout, "hash_map:   legacy table   %7.1f %7.1f %7.1f  (checksum %llu)\n",
+            legacy_time.insert * ns, legacy_time.lookup * ns, legacy_time.remove * ns,
+            (unsigned long long)checksum);
+
+    if (map_time.lookup * options->min_speedup > legacy_time.lookup) {
+        fprintf(stdout, "hash_map: lookups below %.2fx the legacy table\n", options->min_speedup);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_options(int argc, char **argv, harness_options *options)
+{
+    options->seed = 0x2545F4914F6CDD1DULL;
+    options->operations = 400000U;
+    options->perf = 0;
+    options->keys = 50000U;
+    options->min_speedup = 2.0;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--seed=", 7) == 0) {
+            options->seed = strtoull(arg + 7, NULL, 10) * 2U + 1U;
+        } else if (strncmp(arg, "--operations=", 13) == 0) {
+            options->operations = (size_t)strtoull(arg + 13, NULL, 10);
+        } else if (strcmp(arg, "--perf") == 0) {
+            options->perf = 1;
+        } else if (strncmp(arg, "--keys=", 7) == 0) {
+            options->keys = (size_t)strtoull(arg + 7, NULL, 10);
+        } else if (strncmp(arg, "--min-speedup=", 14) == 0) {
+            options->min_speedup = strtod(arg + 14, NULL);
+        } else {
+            fprintf(stdout, "hash_map: unknown option '%s'\n", arg);
+            return -1;
+        }
+    }
+
+    if (options->keys == 0U || options->keys > (size_t)INT32_MAX) {
+        fprintf(stdout, "hash_map: --keys must be between 1 and %d\n", INT32_MAX);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    harness_options options;
+    if (parse_options(argc, argv, &options) != 0) {
+        return 2;
+    }
+
+    int status = check_wide_integer_keys();
+    if (status == 0) {
+        status = run_model(&options, MATH_EXPR_MAP_INTEGER_KEYS, "integer-key");
+    }
+    if (status == 0) {
+        status = run_model(&options, 0U, "string-key");
+    }
+    if (status == 0) {
+        status = run_model(&options, MATH_EXPR_MAP_IGNORE_CASE, "case-insensitive");
+    }
+    if (status == 0) {
+        fprintf(stdout, "hash_map: %zu operations x 3 maps agree with the model\n", options.operations);
+    }
+    if (status == 0 && options.perf) {
+        status = run_benchmark(&options);
+    }
+
+    return status == 0 ? 0 : 1;
+}
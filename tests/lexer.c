@@ -0,0 +1,207 @@
+/*
+ * Test of token array sizing, linked against a build of the library with
+ * the ENABLE_STATS counters compiled in so that allocations can be counted.
+ *
+ * Lexing a large expression into a fresh array must allocate the token and
+ * lexeme buffers once each, sized for every token up front. An array
+ * reserved in advance must not allocate tokens again, and one array reused
+ * across expressions of different sizes must never shrink while producing
+ * the same tokens and lexemes as a fresh array.
+ *
+ * Usage: math_expr_lexer_test
+ */
+
+#include "math_expr/lexer.h"
+#include "math_expr/stats.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every token type, hexadecimal and leading-dot numbers and two-character operators. */
+static const char kPiece[] = "sin(x1) + 2.5*y_2 - 0x1F / .5e3 >= max(a, b) && z != 7 ";
+
+#define LARGE_REPEATS 2000U
+
+static char *repeat_piece(size_t count)
+{
+    size_t length = strlen(kPiece);
+    char *source = (char *)malloc(count * length + 1U);
+    if (!source) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(source + i * length, kPiece, length);
+    }
+    source[count * length] = '\0';
+    return source;
+}
+
+static uint64_t allocations(void)
+{
+    math_expr_stats stats;
+    math_expr_stats_get(&stats);
+    return stats.allocations;
+}
+
+/* Tokens, numbers and lexemes of two arrays must agree one for one. */
+static int same_tokens(const char *what, const math_expr_token_array *actual, const math_expr_token_array *expected)
+{
+    if (actual->size != expected->size) {
+        fprintf(stdout, "lexer: %s: %zu tokens, expected %zu\n", what, actual->size, expected->size);
+        return -1;
+    }
+    for (size_t i = 0; i < actual->size; ++i) {
+        const math_expr_token *a = &actual->data[i];
+        const math_expr_token *e = &expected->data[i];
+        if (a->type != e->type || strcmp(a->lexeme, e->lexeme) != 0 ||
+            (a->type == MATH_EXPR_TOKEN_NUMBER && a->number != e->number)) {
+            fprintf(stdout, "lexer: %s: token %zu is %s '%s', expected %s '%s'\n", what, i,
+                    math_expr_token_type_to_string(a->type), a->lexeme, math_expr_token_type_to_string(e->type),
+                    e->lexeme);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* A fresh array takes one allocation for its tokens and one for their lexemes. */
+static int check_large(unsigned int flags)
+{
+    char *source = repeat_piece(LARGE_REPEATS);
+    if (!source) {
+        perror("lexer: malloc");
+        return -1;
+    }
+
+    math_expr_token_array tokens;
+    math_expr_token_array_init(&tokens);
+    math_expr_stats_reset();
+    int status = math_expr_lex_expression_ex(source, &tokens, flags);
+    uint64_t count = allocations();
+
+    const char *what = (flags & MATH_EXPR_LEX_SKIP_SPACE) ? "large input without spaces" : "large input";
+    if (status != 0) {
+        fprintf(stdout, "lexer: %s: lexing failed\n", what);
+    } else if (tokens.size < LARGE_REPEATS * 20U || tokens.capacity < tokens.size) {
+        fprintf(stdout, "lexer: %s: %zu tokens in a capacity of %zu\n", what, tokens.size, tokens.capacity);
+        status = -1;
+    } else if (count != 2U) {
+        fprintf(stdout, "lexer: %s: %llu allocations, expected one for tokens and one for lexemes\n", what,
+                (unsigned long long)count);
+        status = -1;
+    }
+
+    math_expr_token_array_deinit(&tokens);
+    free(source);
+    return status;
+}
+
+/* Lexing into reserved room leaves the token buffer where it is. */
+static int check_reserve(void)
+{
+    char *source = repeat_piece(LARGE_REPEATS / 4U);
+    if (!source) {
+        perror("lexer: malloc");
+        return -1;
+    }
+
+    math_expr_token_array tokens;
+    math_expr_token_array_init(&tokens);
+    int status = math_expr_token_array_reserve(&tokens, LARGE_REPEATS * 32U);
+    const math_expr_token *data = tokens.data;
+    size_t capacity = tokens.capacity;
+    if (status != 0 || capacity < LARGE_REPEATS * 32U) {
+        fprintf(stdout, "lexer: reserving %u tokens gave a capacity of %zu\n", LARGE_REPEATS * 32U, capacity);
+        status = -1;
+    }
+
+    math_expr_stats_reset();
+    if (status == 0 && math_expr_lex_expression(source, &tokens) != 0) {
+        fprintf(stdout, "lexer: lexing into a reserved array failed\n");
+        status = -1;
+    }
+    uint64_t count = allocations();
+    if (status == 0 && (tokens.data != data || tokens.capacity != capacity || count != 1U)) {
+        fprintf(stdout, "lexer: a reserved array was regrown to %zu tokens with %llu allocations\n",
+                tokens.capacity, (unsigned long long)count);
+        status = -1;
+    }
+
+    /* Reserving less than the capacity changes nothing. */
+    if (status == 0 && (math_expr_token_array_reserve(&tokens, 1U) != 0 || tokens.capacity != capacity)) {
+        fprintf(stdout, "lexer: a smaller reservation shrank the array\n");
+        status = -1;
+    }
+
+    math_expr_token_array_deinit(&tokens);
+    free(source);
+    return status;
+}
+
+/* One array lexed into again and again keeps its largest buffers. */
+static int check_reuse(void)
+{
+    static const size_t kRepeats[] = {200U, 3U, 50U, 0U, 400U, 1U, 120U};
+
+    math_expr_token_array reused;
+    math_expr_token_array_init(&reused);
+    int status = 0;
+    for (size_t i = 0; i < sizeof(kRepeats) / sizeof(kRepeats[0]) && status == 0; ++i) {
+        char *source = repeat_piece(kRepeats[i]);
+        if (!source) {
+            perror("lexer: malloc");
+            status = -1;
+            break;
+        }
+
+        unsigned int flags = (i % 2U) ? MATH_EXPR_LEX_SKIP_SPACE : 0U;
+        size_t capacity = reused.capacity;
+        size_t text_capacity = reused.text_capacity;
+        math_expr_token_array fresh;
+        math_expr_token_array_init(&fresh);
+        if (math_expr_lex_expression_ex(source, &reused, flags) != 0 ||
+            math_expr_lex_expression_ex(source, &fresh, flags) != 0) {
+            fprintf(stdout, "lexer: lexing %zu repeats failed\n", kRepeats[i]);
+            status = -1;
+        } else if (reused.capacity < capacity || reused.text_capacity < text_capacity) {
+            fprintf(stdout, "lexer: a reused array shrank from %zu to %zu tokens\n", capacity, reused.capacity);
+            status = -1;
+        } else {
+            char what[64];
+            snprintf(what, sizeof(what), "%zu repeats in a reused array", kRepeats[i]);
+            status = same_tokens(what, &reused, &fresh);
+        }
+
+        math_expr_token_array_deinit(&fresh);
+        free(source);
+    }
+
+    math_expr_token_array_deinit(&reused);
+    return status;
+}
+
+int main(void)
+{
+    if (!math_expr_stats_enabled()) {
+        fprintf(stdout, "lexer: the library was built without ENABLE_STATS\n");
+        return 1;
+    }
+
+    int status = check_large(0U);
+    if (status == 0) {
+        status = check_large(MATH_EXPR_LEX_SKIP_SPACE);
+    }
+    if (status == 0) {
+        status = check_reserve();
+    }
+    if (status == 0) {
+        status = check_reuse();
+    }
+
+    if (status == 0) {
+        fprintf(stdout, "lexer: token arrays are sized up front and reused\n");
+    }
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+/*
+ * End-to-end test of the command-line server.
+ *
+ * In stdio mode, scripted requests are piped through "math_expr_lexer
+ * --serve" and its output must match the expected responses line for line:
+ * assignment and rebinding, == against =, unbound variables, assignment to
+ * a builtin, invalid expressions, a line over the length limit and a final
+ * line without a newline. In socket mode the server is started on a UNIX
+ * socket and two connections in turn must share its bindings.
+ *
+ * Usage: math_expr_server <path to math_expr_lexer> stdio|socket
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* One over the server's line limit, so the whole line is skipped. */
+#define LONG_LINE (1024U * 1024U + 1U)
+#define MAX_OUTPUT 4096U
+
+static const char kScript[] =
+    "x = 2\n"
+    "x * 3\n"
+    "x = x + 1\n"
+    "\n"
+    "x\n"
+    "x == 3\n"
+    "x==4\n"
+    "x\n"
+    "y + 1\n"
+    "pi = 4\n"
+    "pi\n"
+    "1 +\n"
+    "z = 1 +\n"
+    "z\n"
+    "1/0\n";
+
+static const char kAfterLongLine[] = "x + 1";
+
+static const char kExpected[] =
+    "2\n"
+    "6\n"
+    "3\n"
+    "3\n"
+    "1\n"
+    "0\n"
+    "3\n"
+    "error: unbound variable 'y'\n"
+    "error: cannot assign to a builtin name\n"
+    "3.1415926535897931\n"
+    "error: invalid expression\n"
+    "error: invalid expression\n"
+    "error: unbound variable 'z'\n"
+    "error: evaluation failed\n"
+    "error: line too long\n"
+    "4\n";
+
+static int write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0U) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            perror("server: write");
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Everything until end of input, or -1 if it does not fit. */
+static ssize_t read_all(int fd, char *buffer, size_t capacity)
+{
+    size_t size = 0U;
+    for (;;) {
+        ssize_t result = read(fd, buffer + size, capacity - 1U - size);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0) {
+            perror("server: read");
+            return -1;
+        }
+        if (result == 0) {
+            break;
+        }
+        size += (size_t)result;
+        if (size == capacity - 1U) {
+            return -1;
+        }
+    }
+    buffer[size] = '\0';
+    return (ssize_t)size;
+}
+
+static int expect_output(const char *what, const char *output, const char *expected)
+{
+    if (strcmp(output, expected) == 0) {
+        return 0;
+    }
+    fprintf(stdout, "server: %s output differs\n--- expected\n%s--- actual\n%s---\n", what, expected, output);
+    return -1;
+}
+
+/* Start the server with the given mode argument; stdin_fd and stdout_fd of -1 are inherited. */
+static pid_t start_server(const char *program, const char *mode, int stdin_fd, int stdout_fd)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("server: fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if ((stdin_fd >= 0 && dup2(stdin_fd, STDIN_FILENO) < 0) ||
+            (stdout_fd >= 0 && dup2(stdout_fd, STDOUT_FILENO) < 0)) {
+            _exit(127);
+        }
+        /* Rejected requests are also reported on stderr; only responses matter here. */
+        if (!freopen("/dev/null", "w", stderr)) {
+            _exit(127);
+        }
+        execl(program, program, mode, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int check_stdio(const char *program)
+{
+    int to_server[2];
+    int from_server[2];
+    if (pipe(to_server) != 0 || pipe(from_server) != 0) {
+        perror("server: pipe");
+        return -1;
+    }
+    /* The server must not inherit the test's ends, or its input would never end. */
+    for (int i = 0; i < 2; ++i) {
+        fcntl(to_server[i], F_SETFD, FD_CLOEXEC);
+        fcntl(from_server[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    pid_t pid = start_server(program, "--serve", to_server[0], from_server[1]);
+    close(to_server[0]);
+    close(from_server[1]);
+    if (pid < 0) {
+        return -1;
+    }
+
+    /* Responses are short, so the whole script can be written before reading any. */
+    char *long_line = (char *)malloc(LONG_LINE + 1U);
+    int status = long_line ? 0 : -1;
+    if (long_line) {
+        for (size_t i = 0; i < LONG_LINE; ++i) {
+            long_line[i] = i % 2U == 0U ? '1' : '+';
+        }
+        long_line[LONG_LINE] = '\n';
+        status = write_all(to_server[1], kScript, sizeof(kScript) - 1U);
+        if (status == 0) {
+            status = write_all(to_server[1], long_line, LONG_LINE + 1U);
+        }
+        if (status == 0) {
+            status = write_all(to_server[1], kAfterLongLine, sizeof(kAfterLongLine) - 1U);
+        }
+    }
+    close(to_server[1]);
+    free(long_line);
+
+    char output[MAX_OUTPUT];
+    if (read_all(from_server[0], output, sizeof(output)) < 0) {
+        fprintf(stdout, "server: could not read the responses\n");
+        status = -1;
+    }
+    close(from_server[0]);
+
+    int exit_status = 0;
+    if (waitpid(pid, &exit_status, 0) != pid || !WIFEXITED(exit_status) || WEXITSTATUS(exit_status) != 0) {
+        fprintf(stdout, "server: --serve did not exit cleanly\n");
+        status = -1;
+    }
+
+    if (status == 0) {
+        status = expect_output("--serve", output, kExpected);
+    }
+    return status;
+}
+
+/* Connect, retrying while the server starts up. */
+static int connect_server(const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, strlen(path) + 1U);
+
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("server: socket");
+            return -1;
+        }
+        if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+
+        struct timespec delay = {0, 10 * 1000 * 1000};
+        nanosleep(&delay, NULL);
+    }
+
+    fprintf(stdout, "server: could not connect to %s\n", path);
+    return -1;
+}
+
+/* Send requests on a new connection, close the sending side and compare the responses. */
+static int round_trip(const char *path, const char *requests, const char *expected)
+{
+    int fd = connect_server(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char output[MAX_OUTPUT];
+    int status = write_all(fd, requests, strlen(requests));
+    if (status == 0 && shutdown(fd, SHUT_WR) != 0) {
+        perror("server: shutdown");
+        status = -1;
+    }
+    if (status == 0 && read_all(fd, output, sizeof(output)) < 0) {
+        fprintf(stdout, "server: could not read the responses\n");
+        status = -1;
+    }
+    close(fd);
+
+    if (status == 0) {
+        status = expect_output("--serve=PATH", output, expected);
+    }
+    return status;
+}
+
+static int check_socket(const char *program)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/math_expr_server_%ld.sock", (long)getpid());
+    char mode[80];
+    snprintf(mode, sizeof(mode), "--serve=%s", path);
+
+    pid_t pid = start_server(program, mode, -1, -1);
+    if (pid < 0) {
+        return -1;
+    }
+
+    int status = round_trip(path, "rate = 0.5\nrate * 4\nbad +\n", "0.5\n2\nerror: invalid expression\n");
+    if (status == 0) {
+        status = round_trip(path, "rate + 1", "1.5\n");
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(path);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 || (strcmp(argv[2], "stdio") != 0 && strcmp(argv[2], "socket") != 0)) {
+        fprintf(stdout, "usage: math_expr_server <path to math_expr_lexer> stdio|socket\n");
+        return 2;
+    }
+
+    /* A server that dies early must fail the test, not kill it. */
+    signal(SIGPIPE, SIG_IGN);
+
+    int status = strcmp(argv[2], "stdio") == 0 ? check_stdio(argv[1]) : check_socket(argv[1]);
+    if (status == 0) {
+        fprintf(stdout, "server: %s responses match\n", argv[2]);
+    }
+    return status == 0 ? 0 : 1;
+}
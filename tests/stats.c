@@ -0,0 +1,359 @@
+/*
+ * Test of the ENABLE_STATS instrumentation, linked against a build of the
+ * library with the counters compiled in.
+ *
+ * Known expressions are lexed, evaluated and compiled, and the calling
+ * thread's counters must show exactly their tokens per type, builtin calls,
+ * phases and errors. A phase hook must see every phase begin and end in
+ * matched pairs with the user pointer it was registered with, and a second
+ * thread's work must not show up in the first thread's counters.
+ *
+ * Usage: math_expr_stats
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "math_expr/compiler.h"
+#include "math_expr/evaluator.h"
+#include "math_expr/lexer.h"
+#include "math_expr/stats.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREAD_EVALUATIONS 5U
+
+typedef struct expected_counts {
+    uint64_t tokens[MATH_EXPR_STATS_TOKEN_TYPES];
+    uint64_t phase_calls[MATH_EXPR_PHASE_COUNT];
+    uint64_t errors;
+} expected_counts;
+
+typedef struct hook_record {
+    uint64_t open[MATH_EXPR_PHASE_COUNT];
+    uint64_t ends[MATH_EXPR_PHASE_COUNT];
+    int mismatched;
+} hook_record;
+
+typedef struct thread_result {
+    math_expr_stats stats;
+    int status;
+} thread_result;
+
+static const char *const kPhaseNames[MATH_EXPR_PHASE_COUNT] = {"lex", "parse", "eval"};
+static const char *const kTokenNames[MATH_EXPR_STATS_TOKEN_TYPES] = {"identifier", "operator", "number", "space"};
+
+static hook_record g_record;
+
+static size_t builtin_slot(const char *name)
+{
+    for (size_t i = 0; i < MATH_EXPR_STATS_BUILTIN_SLOTS; ++i) {
+        const char *slot_name = math_expr_stats_builtin_name(i);
+        if (slot_name && strcmp(slot_name, name) == 0) {
+            return i;
+        }
+    }
+    return MATH_EXPR_STATS_BUILTIN_SLOTS;
+}
+
+static uint64_t builtin_calls(const math_expr_stats *stats, const char *name)
+{
+    size_t slot = builtin_slot(name);
+    return slot < MATH_EXPR_STATS_BUILTIN_SLOTS ? stats->builtin_calls[slot] : UINT64_MAX;
+}
+
+/* Compare the calling thread's counters with the expected ones. */
+static int expect_counts(const char *what, const expected_counts *expected)
+{
+    math_expr_stats stats;
+    if (math_expr_stats_get(&stats) != 0) {
+        fprintf(stdout, "stats: %s: counters unavailable\n", what);
+        return -1;
+    }
+
+    int status = 0;
+    for (size_t type = 0; type < MATH_EXPR_STATS_TOKEN_TYPES; ++type) {
+        if (stats.tokens[type] != expected->tokens[type]) {
+            fprintf(stdout, "stats: %s: %llu %s tokens, expected %llu\n", what, (unsigned long long)stats.tokens[type],
+                    kTokenNames[type], (unsigned long long)expected->tokens[type]);
+            status = -1;
+        }
+    }
+    for (size_t phase = 0; phase < MATH_EXPR_PHASE_COUNT; ++phase) {
+        if (stats.phase_calls[phase] != expected->phase_calls[phase]) {
+            fprintf(stdout, "stats: %s: %llu %s phases, expected %llu\n", what,
+                    (unsigned long long)stats.phase_calls[phase], kPhaseNames[phase],
+                    (unsigned long long)expected->phase_calls[phase]);
+            status = -1;
+        }
+    }
+    if (stats.errors != expected->errors) {
+        fprintf(stdout, "stats: %s: %llu errors, expected %llu\n", what, (unsigned long long)stats.errors,
+                (unsigned long long)expected->errors);
+        status = -1;
+    }
+    return status;
+}
+
+static int expect_builtin(const char *what, const char *name, uint64_t expected)
+{
+    math_expr_stats stats;
+    math_expr_stats_get(&stats);
+    uint64_t calls = builtin_calls(&stats, name);
+    if (calls != expected) {
+        fprintf(stdout, "stats: %s: %llu calls to %s, expected %llu\n", what, (unsigned long long)calls, name,
+                (unsigned long long)expected);
+        return -1;
+    }
+    return 0;
+}
+
+/* "sin(x) + 2.5*y" with its spaces: sin x y, ( ) + *, 2.5 and two spaces. */
+static int check_lex(void)
+{
+    static const expected_counts kExpected = {{3U, 4U, 1U, 2U}, {1U, 0U, 0U}, 0U};
+
+    math_expr_token_array tokens;
+    math_expr_token_array_init(&tokens);
+    math_expr_stats_reset();
+    int status = math_expr_lex_expression("sin(x) + 2.5*y", &tokens);
+    math_expr_token_array_deinit(&tokens);
+    if (status != 0) {
+        fprintf(stdout, "stats: lexing failed\n");
+        return -1;
+    }
+    return expect_counts("lex", &kExpected);
+}
+
+/*
+ * The evaluator lexes without spaces and calls each builtin it reaches;
+ * max with two scalar arguments is the builtin, and the branch if() does
+ * not take calls nothing.
+ */
+static int check_evaluate(void)
+{
+    static const char kSource[] = "sin(30) + cos(60) + sin(90) + max(1, 2) + if(0, sqrt(4), 1)";
+    static const expected_counts kExpected = {{6U, 19U, 8U, 0U}, {1U, 0U, 1U}, 0U};
+
+    double value = 0.0;
+    math_expr_stats_reset();
+    if (math_expr_evaluate(kSource, &value) != 0 || value != 5.0) {
+        fprintf(stdout, "stats: evaluation gave %.17g, expected 5\n", value);
+        return -1;
+    }
+
+    int status = expect_counts("evaluate", &kExpected);
+    status |= expect_builtin("evaluate", "sin", 2U);
+    status |= expect_builtin("evaluate", "cos", 1U);
+    status |= expect_builtin("evaluate", "max", 1U);
+    status |= expect_builtin("evaluate", "sqrt", 0U);
+    return status;
+}
+
+/* One lex and one parse to compile, then every evaluation calls both builtins once. */
+static int check_compile(void)
+{
+    static const expected_counts kExpected = {{4U, 6U, 1U, 0U}, {1U, 1U, 3U}, 0U};
+
+    math_expr_program program;
+    math_expr_program_init(&program);
+    math_expr_stats_reset();
+    if (math_expr_compile("sin(x) * 2 + cos(y)", &program) != 0) {
+        fprintf(stdout, "stats: compilation failed\n");
+        return -1;
+    }
+
+    int status = 0;
+    double variables[2] = {30.0, 60.0};
+    for (int i = 0; i < 3 && status == 0; ++i) {
+        double value = 0.0;
+        if (math_expr_program_evaluate(&program, variables, &value) != 0 || value != 1.5) {
+            fprintf(stdout, "stats: compiled evaluation gave %.17g, expected 1.5\n", value);
+            status = -1;
+        }
+    }
+    math_expr_program_deinit(&program);
+
+    if (status == 0) {
+        status = expect_counts("compile", &kExpected);
+        status |= expect_builtin("compile", "sin", 3U);
+        status |= expect_builtin("compile", "cos", 3U);
+    }
+    return status;
+}
+
+/*
+ * Each failed call counts one error: an unrecognised character, which the
+ * lexer skips so the evaluator then rejects "1 2", a parse error in the
+ * evaluator and in the compiler, and a division by zero in a compiled
+ * program.
+ */
+static int check_errors(void)
+{
+    static const expected_counts kExpected = {{1U, 3U, 5U, 0U}, {4U, 2U, 3U}, 4U};
+
+    double value = 0.0;
+    math_expr_program program;
+    math_expr_program_init(&program);
+    math_expr_stats_reset();
+
+    int status = 0;
+    if (math_expr_evaluate("1 $ 2", &value) == 0 || math_expr_evaluate("1 +", &value) == 0 ||
+        math_expr_compile("2 *", &program) == 0) {
+        fprintf(stdout, "stats: an invalid expression was accepted\n");
+        status = -1;
+    }
+
+    double zero = 0.0;
+    if (status == 0 && (math_expr_compile("1 / x", &program) != 0 ||
+                        math_expr_program_evaluate(&program, &zero, &value) == 0)) {
+        fprintf(stdout, "stats: division by zero did not fail\n");
+        status = -1;
+    }
+    math_expr_program_deinit(&program);
+
+    return status == 0 ? expect_counts("errors", &kExpected) : status;
+}
+
+static void record_phase(void *user, math_expr_phase phase, int end, uint64_t elapsed_ns)
+{
+    hook_record *record = (hook_record *)user;
+    if (record != &g_record || (unsigned)phase >= MATH_EXPR_PHASE_COUNT) {
+        g_record.mismatched = 1;
+        return;
+    }
+
+    if (!end) {
+        record->mismatched |= elapsed_ns != 0U;
+        ++record->open[phase];
+    } else if (record->open[phase] == 0U) {
+        record->mismatched = 1;
+    } else {
+        --record->open[phase];
+        ++record->ends[phase];
+    }
+}
+
+/* The hook must pair every begin with an end, once per counted phase. */
+static int check_hook(void)
+{
+    memset(&g_record, 0, sizeof(g_record));
+    if (math_expr_stats_set_hook(record_phase, &g_record) != 0) {
+        fprintf(stdout, "stats: could not install the hook\n");
+        return -1;
+    }
+
+    int status = check_evaluate() | check_compile() | check_errors();
+    math_expr_stats_set_hook(NULL, NULL);
+
+    /* Each check resets the counters, so sum what the three reported. */
+    static const uint64_t kPhases[MATH_EXPR_PHASE_COUNT] = {1U + 1U + 4U, 0U + 1U + 2U, 1U + 3U + 3U};
+    for (size_t phase = 0; phase < MATH_EXPR_PHASE_COUNT && status == 0; ++phase) {
+        if (g_record.open[phase] != 0U || g_record.ends[phase] != kPhases[phase]) {
+            fprintf(stdout, "stats: hook saw %llu %s phases with %llu left open, expected %llu\n",
+                    (unsigned long long)g_record.ends[phase], kPhaseNames[phase],
+                    (unsigned long long)g_record.open[phase], (unsigned long long)kPhases[phase]);
+            status = -1;
+        }
+    }
+    if (status == 0 && g_record.mismatched) {
+        fprintf(stdout, "stats: hook calls were unpaired or carried the wrong user pointer\n");
+        status = -1;
+    }
+
+    /* Removed hooks are not called again. */
+    uint64_t ends = g_record.ends[MATH_EXPR_PHASE_EVAL];
+    double value = 0.0;
+    math_expr_evaluate("1 + 1", &value);
+    if (status == 0 && g_record.ends[MATH_EXPR_PHASE_EVAL] != ends) {
+        fprintf(stdout, "stats: a removed hook was still called\n");
+        status = -1;
+    }
+    return status;
+}
+
+static void *evaluate_on_thread(void *arg)
+{
+    thread_result *result = (thread_result *)arg;
+    math_expr_stats_reset();
+    for (unsigned i = 0; i < THREAD_EVALUATIONS && result->status == 0; ++i) {
+        double value = 0.0;
+        if (math_expr_evaluate("sqrt(16) + 1", &value) != 0 || value != 5.0) {
+            result->status = -1;
+        }
+    }
+    math_expr_stats_get(&result->stats);
+    return NULL;
+}
+
+/* Work on another thread lands in that thread's counters only. */
+static int check_threads(void)
+{
+    thread_result result;
+    memset(&result, 0, sizeof(result));
+
+    math_expr_stats_reset();
+    double value = 0.0;
+    if (math_expr_evaluate("sqrt(9)", &value) != 0) {
+        fprintf(stdout, "stats: evaluation failed\n");
+        return -1;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, evaluate_on_thread, &result) != 0) {
+        fprintf(stdout, "stats: could not start a thread\n");
+        return -1;
+    }
+    pthread_join(thread, NULL);
+
+    math_expr_stats stats;
+    math_expr_stats_get(&stats);
+    if (result.status != 0 || builtin_calls(&result.stats, "sqrt") != THREAD_EVALUATIONS ||
+        result.stats.phase_calls[MATH_EXPR_PHASE_EVAL] != THREAD_EVALUATIONS) {
+        fprintf(stdout, "stats: the second thread's counters are wrong\n");
+        return -1;
+    }
+    if (builtin_calls(&stats, "sqrt") != 1U || stats.phase_calls[MATH_EXPR_PHASE_EVAL] != 1U ||
+        stats.tokens[MATH_EXPR_TOKEN_NUMBER] != 1U) {
+        fprintf(stdout, "stats: another thread's work showed up in this thread's counters\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    if (!math_expr_stats_enabled()) {
+        fprintf(stdout, "stats: the library was built without ENABLE_STATS\n");
+        return 1;
+    }
+
+    /* Rejected expressions are reported on stderr; only the counters matter here. */
+    if (!freopen("/dev/null", "w", stderr)) {
+        perror("stats: freopen");
+    }
+
+    int status = check_lex();
+    if (status == 0) {
+        status = check_evaluate();
+    }
+    if (status == 0) {
+        status = check_compile();
+    }
+    if (status == 0) {
+        status = check_errors();
+    }
+    if (status == 0) {
+        status = check_hook();
+    }
+    if (status == 0) {
+        status = check_threads();
+    }
+
+    if (status == 0) {
+        fprintf(stdout, "stats: counters and hooks match\n");
+    }
+    return status == 0 ? 0 : 1;
+}